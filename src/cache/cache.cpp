@@ -11,6 +11,8 @@
 #include "bfu/dialog.h"
 #include "cache/cache.h"
 #include "cache/dialogs.h"
+#include "cache/disk.h"
+#include "cache/policy.h"
 #include "config/options.h"
 #include "main/main.h"
 #include "main/object.h"
@@ -22,6 +24,7 @@
 # include "scripting/smjs/smjs.h"
 #endif
 #include "util/error.h"
+#include "util/math.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "util/time.h"
@@ -32,6 +35,30 @@ static INIT_LIST_OF(struct cache_entry, cache_entries);
 static unsigned longlong cache_size;
 static int id_counter = 1;
 
+/* Hash indexes of the cache entries keyed by the URI_BASE components of
+ * their @uri and @proxy_uri. The cache_entries list is only used for keeping
+ * the LRU order. */
+struct cache_index {
+	LIST_OF(struct cache_index_link) *buckets;
+	unsigned int width;	/* The bucket array is 2^width long */
+	int entries;
+};
+
+/* Initial width of the indexes. They are doubled each time the number of
+ * entries exceeds the number of buckets. */
+#define CACHE_INDEX_WIDTH 8
+
+static struct cache_index uri_index;
+static struct cache_index proxy_index;
+
+/* The GDSF clock of garbage_collection(). It is raised to the priority of
+ * the evicted entries so that entries which are not used anymore age. */
+static double gc_clock;
+
+/* Statistics of find_in_cache() for the resource info dialog. */
+static long cache_lookups;
+static long cache_hits;
+
 static void truncate_entry(struct cache_entry *cached, off_t offset, int final);
 
 /* Change 0 to 1 to enable cache debugging features (redirect stderr to a file). */
@@ -73,7 +100,7 @@ get_cache_size(void)
 int
 get_cache_entry_count(void)
 {
-	return list_size(&cache_entries);
+	return uri_index.entries;
 }
 
 int
@@ -100,22 +127,152 @@ get_cache_entry_loading_count(void)
 	return i;
 }
 
+long
+get_cache_lookup_count(void)
+{
+	return cache_lookups;
+}
+
+long
+get_cache_hit_count(void)
+{
+	return cache_hits;
+}
+
+
+static inline unsigned long
+hash_uri_component(unsigned long hash, const char *component, int length)
+{
+	if (!component) return hash;
+
+	hash = (hash << 5) - hash + length;
+	for (; length > 0; length--, component++)
+		hash = (hash << 5) - hash + (unsigned char) *component;
+
+	return hash;
+}
+
+/* Hashes exactly the components compared by compare_uri() for URI_BASE so
+ * that URIs that compare equal always land in the same bucket. */
+static unsigned long
+hash_cache_uri(const struct uri *uri)
+{
+	unsigned long hash = uri->protocol;
+
+	hash = (hash << 5) - hash + uri->ip_family;
+	hash = hash_uri_component(hash, uri->user, uri->userlen);
+	hash = hash_uri_component(hash, uri->password, uri->passwordlen);
+	hash = hash_uri_component(hash, uri->host, uri->hostlen);
+	hash = hash_uri_component(hash, uri->port, uri->portlen);
+	hash = hash_uri_component(hash, uri->data, uri->datalen);
+	if (uri->post)
+		hash = hash_uri_component(hash, uri->post, strlen(uri->post));
+
+	return hash;
+}
+
+#define cache_index_bucket(table, hash) \
+	((table)->buckets[(hash) & ((1U << (table)->width) - 1)])
+
+static int
+resize_cache_index(struct cache_index *table, unsigned int width)
+{
+	LIST_OF(struct cache_index_link) *buckets;
+	unsigned int i;
+
+	buckets = (LIST_OF(struct cache_index_link) *)mem_alloc((1U << width) * sizeof(*buckets));
+	if (!buckets) return 0;
+
+	for (i = 0; i < (1U << width); i++)
+		init_list(buckets[i]);
+
+	if (table->buckets) {
+		for (i = 0; i < (1U << table->width); i++) {
+			while (!list_empty(table->buckets[i])) {
+				struct cache_index_link *link;
+
+				link = (struct cache_index_link *)table->buckets[i].next;
+				del_from_list(link);
+				add_to_list(buckets[link->hash & ((1U << width) - 1)], link);
+			}
+		}
+		mem_free(table->buckets);
+	}
+
+	table->buckets = buckets;
+	table->width = width;
+
+	return 1;
+}
+
+static int
+add_to_cache_index(struct cache_index *table, struct cache_index_link *link,
+		   struct cache_entry *cached, struct uri *uri)
+{
+	if (!table->buckets
+	    && !resize_cache_index(table, CACHE_INDEX_WIDTH))
+		return 0;
+
+	/* Failing to grow the index only makes the chains longer. */
+	if (table->entries >= (1 << table->width))
+		resize_cache_index(table, table->width + 1);
+
+	link->cached = cached;
+	link->hash = hash_cache_uri(uri);
+	add_to_list(cache_index_bucket(table, link->hash), link);
+	table->entries++;
+
+	return 1;
+}
+
+static void
+del_from_cache_index(struct cache_index *table, struct cache_index_link *link)
+{
+	if (!link->cached) return;
+
+	del_from_list(link);
+	link->cached = NULL;
+	table->entries--;
+}
+
+static void
+done_cache_index(struct cache_index *table)
+{
+	assert(!table->entries);
+
+	mem_free_set(&table->buckets, NULL);
+	table->width = 0;
+}
+
 struct cache_entry *
 find_in_cache(struct uri *uri)
 {
-	struct cache_entry *cached;
-	int proxy = (uri->protocol == PROTOCOL_PROXY);
+	struct cache_index *table;
+	struct cache_index_link *link;
+	unsigned long hash;
 
-	foreach (cached, cache_entries) {
+	cache_lookups++;
+
+	table = (uri->protocol == PROTOCOL_PROXY) ? &proxy_index : &uri_index;
+	if (!table->buckets) return NULL;
+
+	hash = hash_cache_uri(uri);
+
+	foreach (link, cache_index_bucket(table, hash)) {
+		struct cache_entry *cached = link->cached;
 		struct uri *c_uri;
 
-		if (!cached->valid) continue;
+		if (link->hash != hash || !cached->valid) continue;
 
-		c_uri = proxy ? cached->proxy_uri : cached->uri;
+		c_uri = (table == &proxy_index) ? cached->proxy_uri : cached->uri;
 		if (!compare_uri(c_uri, uri, URI_BASE))
 			continue;
 
+		move_to_top_of_list(cache_index_bucket(table, hash), link);
 		move_to_top_of_list(cache_entries, cached);
+		cached->hits++;
+		cached->gc_clock = gc_clock;
+		cache_hits++;
 
 		return cached;
 	}
@@ -149,11 +306,23 @@ get_cache_entry(struct uri *uri)
 		mem_free(cached);
 		return NULL;
 	}
+
+	if (!add_to_cache_index(&uri_index, &cached->uri_link, cached, cached->uri)
+	    || !add_to_cache_index(&proxy_index, &cached->proxy_link, cached, cached->proxy_uri)) {
+		del_from_cache_index(&uri_index, &cached->uri_link);
+		done_uri(cached->proxy_uri);
+		done_uri(cached->uri);
+		mem_free(cached);
+		return NULL;
+	}
 	cached->incomplete = 1;
 	cached->valid = 1;
+	cached->hits = 1;
+	cached->gc_clock = gc_clock;
 
 	init_list(cached->frag);
 	cached->cache_id = id_counter++;
+	cached->data_id = cached->cache_id;
 	object_nolock(cached, "cache_entry"); /* Debugging purpose. */
 
 	cached->box_item = add_listbox_leaf(&cache_browser, NULL, cached);
@@ -184,6 +353,7 @@ get_validated_cache_entry(struct uri *uri, cache_mode_T cache_mode)
 
 	/* We only consider complete entries */
 	cached = find_in_cache(uri);
+	if (!cached) cached = get_disk_cache_entry(uri);
 	if (!cached || cached->incomplete)
 		return NULL;
 
@@ -317,6 +487,38 @@ frag_free(struct fragment *f)
 	mem_mmap_free(f, FRAGSIZE(f->real_length));
 }
 
+/* The biggest step by which the last fragment grows when data is appended
+ * to it. */
+#define FRAG_GROWTH_MAX (32 * 1024 * 1024)
+
+/* Grows the last fragment of @cached so that it can hold data up to
+ * @end_offset. Sequential downloads thus keep all the data in one extent and
+ * never need to be defragmented. The size is doubled (up to FRAG_GROWTH_MAX
+ * at a time) so that appending stays cheap even without mremap(). */
+static struct fragment *
+grow_last_fragment(struct cache_entry *cached, struct fragment *f,
+		   off_t end_offset)
+{
+	off_t size = end_offset - f->offset;
+	off_t growth = MIN(f->real_length, FRAG_GROWTH_MAX);
+	struct fragment *nf;
+
+	assert(!list_has_next(cached->frag, f));
+
+	if (size < f->real_length + growth)
+		size = f->real_length + growth;
+	size = CACHE_PAD(size);
+
+	nf = frag_realloc(f, size);
+	if (!nf) return NULL;
+
+	nf->prev->next = nf;
+	nf->next->prev = nf;
+	nf->real_length = size;
+
+	return nf;
+}
+
 
 /* Concatenate overlapping fragments. */
 static void
@@ -399,9 +601,21 @@ add_fragment(struct cache_entry *cached, off_t offset,
 		if (f->offset > offset) break;
 		if (f_end_offset < offset) continue;
 
+		/* Overwriting what we already have? */
+		if (offset < f_end_offset)
+			cached->data_id = cached->cache_id;
+
 		if (end_offset > f_end_offset) {
 			/* Overlap - we end further than original fragment. */
 
+			if (end_offset - f->offset > f->real_length
+			    && !list_has_next(cached->frag, f)) {
+				/* We are appending to the last fragment, so
+				 * try to make it bigger. */
+				nf = grow_last_fragment(cached, f, end_offset);
+				if (nf) f = nf;
+			}
+
 			if (end_offset - f->offset <= f->real_length) {
 				/* We fit here, so let's enlarge it by delta of
 				 * old and new end.. */
@@ -458,13 +672,60 @@ add_fragment(struct cache_entry *cached, off_t offset,
 	enlarge_entry(cached, length);
 
 	remove_overlaps(cached, nf, &trunc);
-	if (trunc) truncate_entry(cached, end_offset, 0);
+	if (trunc) {
+		cached->data_id = cached->cache_id;
+		truncate_entry(cached, end_offset, 0);
+	}
 
 	dump_frags(cached, "add_fragment");
 
 	return 1;
 }
 
+char *
+get_fragment_tail(struct cache_entry *cached, off_t offset, ssize_t *length)
+{
+	struct fragment *f;
+
+	/* The first fragment is left to add_fragment(). */
+	if (list_empty(cached->frag) || offset != cached->length)
+		return NULL;
+
+	f = (struct fragment *)cached->frag.prev;
+	if (f->offset + f->length != offset)
+		return NULL;
+
+	if (f->real_length - f->length < *length) {
+		f = grow_last_fragment(cached, f, offset + *length);
+		if (!f) return NULL;
+	}
+
+	*length = f->real_length - f->length;
+	return f->data + f->length;
+}
+
+int
+commit_fragment_tail(struct cache_entry *cached, off_t offset, ssize_t length)
+{
+	struct fragment *f = (struct fragment *)cached->frag.prev;
+
+	assertm(!list_empty(cached->frag) && f->offset + f->length == offset
+		&& f->length + length <= f->real_length,
+		"committing data outside of the fragment tail");
+	if_assert_failed return -1;
+
+	if (!length) return 0;
+
+	f->length += length;
+	cached->length = offset + length;
+	cached->cache_id = id_counter++;
+	enlarge_entry(cached, length);
+
+	dump_frags(cached, "commit_fragment_tail");
+
+	return 1;
+}
+
 /* Try to defragment the cache entry. Defragmentation will not be possible
  * if there is a gap in the fragments; if we have bytes 1-100 in one fragment
  * and bytes 201-300 in the second, we must leave those two fragments separate
@@ -581,6 +842,8 @@ truncate_entry(struct cache_entry *cached, off_t offset, int final)
 
 		if (size >= f->length) continue;
 
+		cached->data_id = id_counter++;
+
 		if (size > 0) {
 			enlarge_entry(cached, -(f->length - size));
 			f->length = size;
@@ -616,6 +879,7 @@ free_entry_to(struct cache_entry *cached, off_t offset)
 		if (f->offset + f->length <= offset) {
 			struct fragment *tmp = f;
 
+			cached->data_id = id_counter++;
 			enlarge_entry(cached, -f->length);
 			f = f->prev;
 			del_from_list(tmp);
@@ -623,6 +887,7 @@ free_entry_to(struct cache_entry *cached, off_t offset)
 		} else if (f->offset < offset) {
 			off_t size = offset - f->offset;
 
+			cached->data_id = id_counter++;
 			enlarge_entry(cached, -size);
 			f->length -= size;
 			memmove(f->data, f->data + size, f->length);
@@ -643,6 +908,7 @@ delete_entry_content(struct cache_entry *cached)
 		frag_free(f);
 	}
 	cached->cache_id = id_counter++;
+	cached->data_id = cached->cache_id;
 	cached->length = 0;
 	cached->incomplete = 1;
 
@@ -681,6 +947,8 @@ void
 delete_cache_entry(struct cache_entry *cached)
 {
 	del_from_list(cached);
+	del_from_cache_index(&uri_index, &cached->uri_link);
+	del_from_cache_index(&proxy_index, &cached->proxy_link);
 
 	done_cache_entry(cached);
 }
@@ -774,6 +1042,9 @@ void
 garbage_collection(int whole)
 {
 	struct cache_entry *cached;
+	struct cache_gc_candidate *candidates;
+	int candidates_count = 0, targets = 0, i;
+	int policy = get_opt_int("document.cache.memory.policy", NULL);
 	/* We recompute cache_size when scanning cache entries, to ensure
 	 * consistency. */
 	unsigned longlong old_cache_size = 0;
@@ -811,9 +1082,16 @@ garbage_collection(int whole)
 
 	foreach (cached, cache_entries) {
 		old_cache_size += cached->data_size;
+		cached->gc_target = 0;
 
-		if (!is_object_used(cached) && !is_entry_used(cached))
+		if (!is_object_used(cached) && !is_entry_used(cached)) {
+			candidates_count++;
 			continue;
+		}
+
+#ifdef DEBUG_CACHE
+		obstacle_entry = 1;
+#endif
 
 		assertm(new_cache_size >= cached->data_size,
 			"cache_size (%ld) underflow: subtracting %ld from %ld",
@@ -830,29 +1108,50 @@ garbage_collection(int whole)
 	if_assert_failed { cache_size = old_cache_size; }
 
 	if (!whole && new_cache_size <= opt_cache_size) return;
+	if (!candidates_count) return;
 
 
 	/* Scanning cache, pass #2:
-	 * Mark potential targets for destruction, from the oldest to the
-	 * newest. */
+	 * Collect the unused entries, from the oldest to the newest, and let
+	 * the eviction policy order them. If there is no memory for that we
+	 * are better off dropping all of them. */
+
+	candidates = (struct cache_gc_candidate *)mem_calloc(candidates_count, sizeof(*candidates));
+	if (!candidates) {
+		foreach (cached, cache_entries)
+			cached->gc_target = !is_object_used(cached)
+					    && !is_entry_used(cached);
+		goto destroy;
+	}
 
+	i = 0;
 	foreachback (cached, cache_entries) {
-		/* We would have shrinked enough already? */
-		if (!whole && new_cache_size <= gc_cache_size)
-			goto shrinked_enough;
+		struct cache_gc_candidate *candidate;
 
-		/* Skip used cache entries. */
-		if (is_object_used(cached) || is_entry_used(cached)) {
-#ifdef DEBUG_CACHE
-			obstacle_entry = 1;
-#endif
-			cached->gc_target = 0;
+		if (is_object_used(cached) || is_entry_used(cached))
 			continue;
-		}
 
-		/* FIXME: Optionally take cached->max_age into consideration,
-		 * but that will probably complicate things too much. We'd have
-		 * to sort entries so prioritize removing the oldest entries. */
+		candidate = &candidates[i];
+		candidate->data = cached;
+		candidate->size = cached->data_size;
+		candidate->hits = cached->hits;
+		candidate->clock = cached->gc_clock;
+		candidate->age = i++;
+		candidate->expired = cached->expire && cache_entry_has_expired(cached);
+	}
+
+	sort_cache_gc_candidates(candidates, candidates_count, policy);
+
+
+	/* Scanning cache, pass #3:
+	 * Mark targets for destruction in the order given by the policy. */
+
+	for (; targets < candidates_count; targets++) {
+		/* We would have shrinked enough already? */
+		if (!whole && new_cache_size <= gc_cache_size)
+			break;
+
+		cached = (struct cache_entry *)candidates[targets].data;
 
 		assertm(new_cache_size >= cached->data_size,
 			"cache_size (%ld) underflow: subtracting %ld from %ld",
@@ -865,55 +1164,61 @@ garbage_collection(int whole)
 		if_assert_failed { new_cache_size = 0; }
 	}
 
-	/* If we'd free the whole cache... */
-	assertm(new_cache_size == 0,
-		"cache_size (%ld) overflow: %ld",
-		cache_size, new_cache_size);
-	if_assert_failed { new_cache_size = 0; }
-
-shrinked_enough:
-
-
-	/* Now turn around and start walking in the opposite direction. */
-	cached = cached->next;
-
-	/* Something is strange when we decided all is ok before dropping any
-	 * cache entry. */
-	if ((void *) cached == &cache_entries) return;
-
-
 	if (!whole) {
-		struct cache_entry *entry;
+		/* Scanning cache, pass #4:
+		 * Walk back through the targets and unmark the cache entries
+		 * which could still fit into the cache. */
 
-		/* Scanning cache, pass #3:
-		 * Walk back in the cache and unmark the cache entries which
-		 * could still fit into the cache. */
+		/* This makes sense when the last target is HUGE and before
+		 * it, there's just plenty of tiny entries. By this point, all
+		 * the tiny entries would be marked for deletion even though
+		 * it'd be enough to free the huge entry. This actually fixes
+		 * that situation. */
 
-		/* This makes sense when the newest entry is HUGE and after it,
-		 * there's just plenty of tiny entries. By this point, all the
-		 * tiny entries would be marked for deletion even though it'd
-		 * be enough to free the huge entry. This actually fixes that
-		 * situation. */
+		for (i = targets - 1; i >= 0; i--) {
+			unsigned longlong newer_cache_size;
 
-		for (entry = cached; (void *) entry != &cache_entries; entry = entry->next) {
-			unsigned longlong newer_cache_size = new_cache_size + entry->data_size;
+			cached = (struct cache_entry *)candidates[i].data;
+			newer_cache_size = new_cache_size + cached->data_size;
 
 			if (newer_cache_size > gc_cache_size)
 				continue;
 
 			new_cache_size = newer_cache_size;
-			entry->gc_target = 0;
+			cached->gc_target = 0;
 		}
 	}
 
+	if (policy == CACHE_GC_GDSF) {
+		/* Raise the clock to the priority of the evicted entries so
+		 * that the entries which are not used anymore age. */
+		for (i = 0; i < targets; i++) {
+			cached = (struct cache_entry *)candidates[i].data;
 
-	/* Scanning cache, pass #4:
+			if (cached->gc_target)
+				gc_clock = MAX(gc_clock, candidates[i].priority);
+		}
+	}
+
+	mem_free(candidates);
+
+destroy:
+
+	/* Scanning cache, pass #5:
 	 * Destroy the marked entries. So sad, but that's life, bro'. */
 
-	for (; (void *) cached != &cache_entries; ) {
+	for (cached = (struct cache_entry *)cache_entries.next;
+	     (void *) cached != &cache_entries; ) {
 		cached = cached->next;
-		if (cached->prev->gc_target)
+		if (cached->prev->gc_target) {
+			store_disk_cache_entry(cached->prev);
 			delete_cache_entry(cached->prev);
+		}
+	}
+
+	if (list_empty(cache_entries)) {
+		done_cache_index(&uri_index);
+		done_cache_index(&proxy_index);
 	}
 
 
@@ -29,6 +29,15 @@ enum cache_mode {
 
 typedef int cache_mode_T;
 
+/* Chains a cache entry into one of the URI lookup indexes used by
+ * find_in_cache(). */
+struct cache_index_link {
+	LIST_HEAD(struct cache_index_link);
+
+	struct cache_entry *cached;
+	unsigned long hash;		/* Hash of the URI_BASE components */
+};
+
 struct cache_entry {
 	OBJECT_HEAD(struct cache_entry);
 
@@ -41,6 +50,9 @@ struct cache_entry {
 	struct uri *proxy_uri;		/* Proxy identifier or same as @uri */
 	struct uri *redirect;		/* Location we were redirected to */
 
+	struct cache_index_link uri_link;	/* Indexed by @uri */
+	struct cache_index_link proxy_link;	/* Indexed by @proxy_uri */
+
 	char *head;		/* The protocol header */
 	char *content_type;	/* MIME type: <type> "/" <subtype> */
 	char *last_modified;	/* Latest modification date */
@@ -49,6 +61,9 @@ struct cache_entry {
 	char *encoding_info;	/* Encoding used during transfer */
 
 	unsigned int cache_id;		/* Change each time entry is modified. */
+	unsigned int data_id;		/* Change each time stored data is
+					 * modified or removed, but not when
+					 * data is only appended. */
 
 	time_t seconds;			/* Access time. Used by 'If-Modified-Since' */
 
@@ -62,6 +77,10 @@ struct cache_entry {
 
 	timeval_T max_age;		/* Expiration time */
 
+	/* Data for the eviction policy of garbage_collection() */
+	unsigned long hits;		/* Number of lookups of the entry */
+	double gc_clock;		/* GDSF clock at the last lookup */
+
 	unsigned int expire:1;		/* Whether to honour max_age */
 	unsigned int preformatted:1;	/* Has content been preformatted? */
 	unsigned int redirect_get:1;	/* Follow redirect using get method? */
@@ -118,6 +137,19 @@ struct cache_entry *get_redirected_cache_entry(struct uri *uri);
 int add_fragment(struct cache_entry *cached, off_t offset,
 		 const char *data, ssize_t length);
 
+/* Returns room for appending @length bytes at @offset in place, at the end of
+ * the last fragment of @cached, and stores the size of the room to @length.
+ * Returns NULL if the data does not go to the end of the last fragment or it
+ * cannot grow. Data written to the room has to be committed with
+ * commit_fragment_tail() before the entry is changed in any other way. */
+char *get_fragment_tail(struct cache_entry *cached, off_t offset,
+			ssize_t *length);
+
+/* Adds the @length bytes written to the room from get_fragment_tail() to the
+ * entry. Returns the same as add_fragment(). */
+int commit_fragment_tail(struct cache_entry *cached, off_t offset,
+			 ssize_t length);
+
 /* Defragments the cache entry and returns the resulting fragment containing the
  * complete source of all currently downloaded fragments. Returns NULL if
  * validation of the fragments fails. */
@@ -154,6 +186,8 @@ unsigned longlong get_cache_size(void);
 int get_cache_entry_count(void);
 int get_cache_entry_used_count(void);
 int get_cache_entry_loading_count(void);
+long get_cache_lookup_count(void);
+long get_cache_hit_count(void);
 
 #ifdef __cplusplus
 }
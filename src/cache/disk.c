@@ -0,0 +1,976 @@
+/* On-disk second-level cache */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "elinks.h"
+
+#include "cache/cache.h"
+#include "cache/disk.h"
+#include "config/home.h"
+#include "config/options.h"
+#include "protocol/protocol.h"
+#include "protocol/proxy.h"
+#include "protocol/uri.h"
+#include "util/error.h"
+#include "util/file.h"
+#include "util/hash.h"
+#include "util/math.h"
+#include "util/memory.h"
+#include "util/string.h"
+#include "util/time.h"
+
+/* The disk cache lives in the cache/ subdirectory of the home directory and
+ * consists of numbered segment files and one index file:
+ *
+ * - Segments are append-only. Each record is a struct disk_cache_header
+ *   followed by the URI, protocol header, ETag, Last-Modified and
+ *   Content-Type strings (each NUL terminated) and the body. The header and
+ *   the body both start on DISK_CACHE_ALIGN() boundaries so that records can
+ *   be used directly from a mapping of the segment.
+ *
+ * - The index is an append-only list of struct disk_cache_index_entry
+ *   pointing at the records. A newer record for the same URI supersedes the
+ *   older ones.
+ *
+ * A record is always written before its index entry, so after a crash
+ * records found behind the last indexed one of a segment are checked and
+ * added to the index when the cache is opened again. An index which does
+ * not match the segments is rebuilt by scanning all segments.
+ *
+ * When the segments grow bigger than document.cache.disk.size the oldest
+ * ones are deleted and the index is rewritten. */
+
+#define DISK_CACHE_RECORD_MAGIC	0x52434c45	/* "ELCR" */
+#define DISK_CACHE_INDEX_MAGIC	0x49434c45	/* "ELCI" */
+#define DISK_CACHE_VERSION	1
+
+/* The size limit is split among roughly this many segments. */
+#define DISK_CACHE_SEGMENTS	8
+
+#define DISK_CACHE_ALIGN(x)	(((off_t) (x) + 7) & ~((off_t) 7))
+
+#define DISK_CACHE_CHECKSUM_INIT	2166136261U
+
+struct disk_cache_header {
+	uint32_t magic;
+	uint32_t checksum;	/* Of the strings and the body */
+	uint32_t urilen;
+	uint32_t headlen;
+	uint32_t etaglen;
+	uint32_t last_modified_len;
+	uint32_t content_type_len;
+	uint32_t expire;	/* cache_entry.expire */
+	int64_t length;		/* Length of the body */
+	int64_t seconds;	/* cache_entry.seconds */
+	int64_t max_age;	/* cache_entry.max_age */
+	int64_t cache_mode;	/* cache_entry.cache_mode */
+};
+
+struct disk_cache_index_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct disk_cache_index_entry {
+	uint32_t magic;
+	uint32_t segment;
+	int64_t offset;
+	int64_t size;
+};
+
+struct disk_cache_segment {
+	LIST_HEAD(struct disk_cache_segment);
+
+	unsigned int id;
+	int fd;
+	off_t size;
+	off_t indexed;		/* End of the last indexed record */
+};
+
+struct disk_cache_record {
+	char *uri;		/* URI_BASE string used as the hash key */
+	struct disk_cache_segment *segment;
+	off_t offset;
+	off_t size;		/* Size of the whole record */
+
+	/* The memory cache entry the record was last loaded into or stored
+	 * from, so unchanged entries are not written again. */
+	unsigned int cache_id;
+};
+
+static INIT_LIST_OF(struct disk_cache_segment, segments);
+static struct hash *records;
+static char *cache_dir;
+static int index_fd = -1;
+
+static int records_count;
+static off_t disk_cache_size;
+static long disk_cache_hits;
+
+/* Set when opening the disk cache failed so it is not retried. */
+static int disk_cache_broken;
+
+
+int
+get_disk_cache_entry_count(void)
+{
+	return records_count;
+}
+
+long
+get_disk_cache_hit_count(void)
+{
+	return disk_cache_hits;
+}
+
+
+/* FNV-1a, good enough to catch torn writes. */
+static uint32_t
+checksum_data(uint32_t sum, const unsigned char *data, size_t length)
+{
+	for (; length; length--, data++) {
+		sum ^= *data;
+		sum *= 16777619U;
+	}
+
+	return sum;
+}
+
+static off_t
+get_strings_size(struct disk_cache_header *header)
+{
+	return (off_t) header->urilen + header->headlen + header->etaglen
+		+ header->last_modified_len + header->content_type_len + 5;
+}
+
+static off_t
+get_body_offset(struct disk_cache_header *header)
+{
+	return DISK_CACHE_ALIGN(sizeof(*header) + get_strings_size(header));
+}
+
+static off_t
+get_record_size(struct disk_cache_header *header)
+{
+	return get_body_offset(header) + DISK_CACHE_ALIGN(header->length);
+}
+
+static int
+read_at(int fd, off_t offset, void *data, size_t length)
+{
+	unsigned char *pos = (unsigned char *) data;
+
+	if (lseek(fd, offset, SEEK_SET) != offset)
+		return -1;
+
+	while (length) {
+		ssize_t rd = read(fd, pos, length);
+
+		if (rd < 0 && errno == EINTR) continue;
+		if (rd <= 0) return -1;
+
+		pos += rd;
+		length -= rd;
+	}
+
+	return 0;
+}
+
+static int
+write_all(int fd, const void *data, size_t length)
+{
+	const unsigned char *pos = (const unsigned char *) data;
+
+	while (length) {
+		ssize_t wr = write(fd, pos, length);
+
+		if (wr < 0 && errno == EINTR) continue;
+		if (wr <= 0) return -1;
+
+		pos += wr;
+		length -= wr;
+	}
+
+	return 0;
+}
+
+
+static struct disk_cache_segment *
+open_disk_cache_segment(unsigned int id, int create)
+{
+	struct disk_cache_segment *segment, *pos;
+	char name[16];
+	char *filename;
+	struct stat st;
+	int fd;
+
+	snprintf(name, sizeof(name), "%08x.seg", id);
+	filename = straconcat(cache_dir, name, (char *) NULL);
+	if (!filename) return NULL;
+
+	fd = open(filename, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600);
+	mem_free(filename);
+	if (fd < 0) return NULL;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	segment = (struct disk_cache_segment *)mem_calloc(1, sizeof(*segment));
+	if (!segment) {
+		close(fd);
+		return NULL;
+	}
+
+	segment->id = id;
+	segment->fd = fd;
+	segment->size = st.st_size;
+	disk_cache_size += segment->size;
+
+	/* Keep the segments sorted from the oldest to the newest. */
+	foreachback (pos, segments)
+		if (pos->id < id) break;
+	add_at_pos(pos, segment);
+
+	return segment;
+}
+
+static struct disk_cache_segment *
+find_disk_cache_segment(unsigned int id)
+{
+	struct disk_cache_segment *segment;
+
+	foreach (segment, segments)
+		if (segment->id == id)
+			return segment;
+
+	return NULL;
+}
+
+static void
+open_disk_cache_segments(void)
+{
+#ifdef HAVE_DIRENT_H
+	DIR *dir = opendir(cache_dir);
+	struct dirent *entry;
+
+	if (!dir) return;
+
+	while ((entry = readdir(dir))) {
+		unsigned int id;
+		char tail;
+
+		if (sscanf(entry->d_name, "%8x.se%c", &id, &tail) != 2
+		    || tail != 'g' || strlen(entry->d_name) != 12)
+			continue;
+
+		open_disk_cache_segment(id, 0);
+	}
+
+	closedir(dir);
+#endif
+}
+
+static void
+close_disk_cache_segment(struct disk_cache_segment *segment, int unlink_it)
+{
+	if (unlink_it) {
+		char name[16];
+		char *filename;
+
+		snprintf(name, sizeof(name), "%08x.seg", segment->id);
+		filename = straconcat(cache_dir, name, (char *) NULL);
+		if (filename) {
+			unlink(filename);
+			mem_free(filename);
+		}
+	}
+
+	disk_cache_size -= segment->size;
+	close(segment->fd);
+	del_from_list(segment);
+	mem_free(segment);
+}
+
+
+/* Adds a record taking over the @uri string. A record for the same URI is
+ * replaced since the new one is assumed to be newer. */
+static struct disk_cache_record *
+add_disk_cache_record(char *uri, struct disk_cache_segment *segment,
+		      off_t offset, off_t size)
+{
+	struct hash_item *item = get_hash_item(records, uri, strlen(uri));
+	struct disk_cache_record *record;
+
+	if (item) {
+		record = (struct disk_cache_record *)item->value;
+		mem_free(uri);
+
+	} else {
+		record = (struct disk_cache_record *)mem_calloc(1, sizeof(*record));
+		if (!record) {
+			mem_free(uri);
+			return NULL;
+		}
+
+		record->uri = uri;
+		if (!add_hash_item(records, uri, strlen(uri), record)) {
+			mem_free(uri);
+			mem_free(record);
+			return NULL;
+		}
+		records_count++;
+	}
+
+	record->segment = segment;
+	record->offset = offset;
+	record->size = size;
+	record->cache_id = 0;
+
+	return record;
+}
+
+/* Deletes all records of @segment or all records if it is NULL. */
+static void
+del_disk_cache_records(struct disk_cache_segment *segment)
+{
+	int i;
+
+	for (i = 0; i < (1 << records->width); i++) {
+		struct hash_item *item = (struct hash_item *)records->hash[i].next;
+
+		while ((void *) item != &records->hash[i]) {
+			struct disk_cache_record *record = (struct disk_cache_record *)item->value;
+			struct hash_item *next = item->next;
+
+			if (!segment || record->segment == segment) {
+				del_hash_item(records, item);
+				mem_free(record->uri);
+				mem_free(record);
+				records_count--;
+			}
+
+			item = next;
+		}
+	}
+}
+
+
+static int
+write_index_header(void)
+{
+	struct disk_cache_index_header header;
+
+	header.magic = DISK_CACHE_INDEX_MAGIC;
+	header.version = DISK_CACHE_VERSION;
+
+	if (ftruncate(index_fd, 0)
+	    || lseek(index_fd, 0, SEEK_SET) != 0)
+		return -1;
+
+	return write_all(index_fd, &header, sizeof(header));
+}
+
+static int
+write_index_entry(struct disk_cache_record *record)
+{
+	struct disk_cache_index_entry entry;
+
+	entry.magic = DISK_CACHE_RECORD_MAGIC;
+	entry.segment = record->segment->id;
+	entry.offset = record->offset;
+	entry.size = record->size;
+
+	record->segment->indexed = MAX(record->segment->indexed,
+					   record->offset + record->size);
+
+	if (lseek(index_fd, 0, SEEK_END) < 0)
+		return -1;
+
+	return write_all(index_fd, &entry, sizeof(entry));
+}
+
+/* Writes a fresh index containing only the live records. */
+static void
+rewrite_index(void)
+{
+	struct hash_item *item;
+	int i;
+
+	if (write_index_header())
+		return;
+
+	foreach_hash_item (item, *records, i)
+		if (write_index_entry((struct disk_cache_record *)item->value))
+			return;
+}
+
+
+/* Reads and checks the header of the record at @offset and returns its URI
+ * string. The checksum is verified only if @verify is set. */
+static char *
+read_disk_cache_record(struct disk_cache_segment *segment, off_t offset,
+		       struct disk_cache_header *header, int verify)
+{
+	char *uri;
+
+	if (offset + (off_t) sizeof(*header) > segment->size
+	    || read_at(segment->fd, offset, header, sizeof(*header))
+	    || header->magic != DISK_CACHE_RECORD_MAGIC
+	    || !header->urilen
+	    || header->length < 0
+	    || offset + get_record_size(header) > segment->size)
+		return NULL;
+
+	if (verify) {
+		uint32_t sum = DISK_CACHE_CHECKSUM_INIT;
+		unsigned char buffer[4096];
+		off_t start = offset + sizeof(*header);
+		off_t length = get_strings_size(header);
+		int pass;
+
+		for (pass = 0; pass < 2; pass++) {
+			while (length > 0) {
+				size_t chunk = MIN(length, (off_t) sizeof(buffer));
+
+				if (read_at(segment->fd, start, buffer, chunk))
+					return NULL;
+
+				sum = checksum_data(sum, buffer, chunk);
+				start += chunk;
+				length -= chunk;
+			}
+
+			start = offset + get_body_offset(header);
+			length = header->length;
+		}
+
+		if (sum != header->checksum)
+			return NULL;
+	}
+
+	uri = (char *)mem_alloc(header->urilen + 1);
+	if (!uri) return NULL;
+
+	if (read_at(segment->fd, offset + sizeof(*header), uri, header->urilen + 1)
+	    || uri[header->urilen]) {
+		mem_free(uri);
+		return NULL;
+	}
+
+	return uri;
+}
+
+/* Adds the records of @segment which are not in the index yet. This happens
+ * when ELinks was killed between writing a record and its index entry. A
+ * broken record and everything after it is truncated. */
+static void
+recover_disk_cache_segment(struct disk_cache_segment *segment)
+{
+	off_t offset = segment->indexed;
+
+	while (offset < segment->size) {
+		struct disk_cache_header header;
+		struct disk_cache_record *record;
+		char *uri = read_disk_cache_record(segment, offset, &header, 1);
+
+		if (!uri) {
+			if (!ftruncate(segment->fd, offset)) {
+				disk_cache_size -= segment->size - offset;
+				segment->size = offset;
+			}
+			break;
+		}
+
+		record = add_disk_cache_record(uri, segment, offset,
+					       get_record_size(&header));
+		if (record) write_index_entry(record);
+
+		offset += get_record_size(&header);
+	}
+}
+
+/* Returns zero if the index does not match the segments. */
+static int
+load_index(void)
+{
+	struct disk_cache_index_header header;
+	struct disk_cache_index_entry entry;
+	off_t offset = sizeof(header);
+
+	if (read_at(index_fd, 0, &header, sizeof(header))
+	    || header.magic != DISK_CACHE_INDEX_MAGIC
+	    || header.version != DISK_CACHE_VERSION)
+		return 0;
+
+	while (!read_at(index_fd, offset, &entry, sizeof(entry))) {
+		struct disk_cache_segment *segment;
+		struct disk_cache_header record;
+		char *uri;
+
+		if (entry.magic != DISK_CACHE_RECORD_MAGIC)
+			return 0;
+
+		offset += sizeof(entry);
+
+		/* Entries of deleted segments are only left behind when
+		 * rewriting the index failed. */
+		segment = find_disk_cache_segment(entry.segment);
+		if (!segment) continue;
+
+		uri = read_disk_cache_record(segment, entry.offset, &record, 0);
+		if (!uri) return 0;
+
+		if (get_record_size(&record) != entry.size) {
+			mem_free(uri);
+			return 0;
+		}
+
+		if (!add_disk_cache_record(uri, segment, entry.offset, entry.size))
+			return 0;
+
+		segment->indexed = MAX(segment->indexed,
+					   entry.offset + entry.size);
+	}
+
+	/* Drop a partially written entry. */
+	return !ftruncate(index_fd, offset);
+}
+
+static void
+rebuild_index(void)
+{
+	struct disk_cache_segment *segment;
+
+	del_disk_cache_records(NULL);
+	write_index_header();
+
+	foreach (segment, segments)
+		segment->indexed = 0;
+}
+
+static off_t
+get_disk_cache_size_limit(void)
+{
+	return get_opt_long("document.cache.disk.size", NULL);
+}
+
+/* Deletes the oldest segments until the cache fits in the size limit. The
+ * newest segment is never deleted. */
+static void
+shrink_disk_cache(void)
+{
+	off_t limit = get_disk_cache_size_limit();
+	int dropped = 0;
+
+	while (disk_cache_size > limit && !list_is_singleton(segments)
+	       && !list_empty(segments)) {
+		struct disk_cache_segment *segment = (struct disk_cache_segment *)segments.next;
+
+		del_disk_cache_records(segment);
+		close_disk_cache_segment(segment, 1);
+		dropped = 1;
+	}
+
+	if (dropped) rewrite_index();
+}
+
+static int
+init_disk_cache(void)
+{
+	struct disk_cache_segment *segment;
+	char *filename;
+
+	if (records) return 1;
+	if (disk_cache_broken || !elinks_home) return 0;
+
+	/* Until proven otherwise. */
+	disk_cache_broken = 1;
+
+	cache_dir = straconcat(elinks_home, "cache/", (char *) NULL);
+	if (!cache_dir) return 0;
+
+	mkalldirs(cache_dir);
+
+	filename = straconcat(cache_dir, "index", (char *) NULL);
+	if (!filename) return 0;
+
+	index_fd = open(filename, O_RDWR | O_CREAT, 0600);
+	mem_free(filename);
+	if (index_fd < 0) return 0;
+
+#ifdef F_SETLK
+	{
+		/* Only one ELinks instance may append to the cache. */
+		struct flock lock;
+
+		memset(&lock, 0, sizeof(lock));
+		lock.l_type = F_WRLCK;
+		lock.l_whence = SEEK_SET;
+
+		if (fcntl(index_fd, F_SETLK, &lock) < 0) {
+			close(index_fd);
+			index_fd = -1;
+			return 0;
+		}
+	}
+#endif
+
+	records = init_hash8();
+	if (!records) {
+		close(index_fd);
+		index_fd = -1;
+		return 0;
+	}
+
+	open_disk_cache_segments();
+
+	if (!load_index())
+		rebuild_index();
+
+	foreach (segment, segments)
+		recover_disk_cache_segment(segment);
+
+	disk_cache_broken = 0;
+
+	shrink_disk_cache();
+
+	return 1;
+}
+
+void
+done_disk_cache(void)
+{
+	if (records) {
+		del_disk_cache_records(NULL);
+		free_hash(&records);
+	}
+
+	while (!list_empty(segments))
+		close_disk_cache_segment((struct disk_cache_segment *)segments.next, 0);
+
+	if (index_fd >= 0) {
+		close(index_fd);
+		index_fd = -1;
+	}
+
+	mem_free_set(&cache_dir, NULL);
+}
+
+
+static int
+disk_cache_entry_is_storable(struct cache_entry *cached)
+{
+	if (!cached->valid || cached->incomplete || cached->redirect
+	    || cached->cgi || cached->uri->post
+	    || cached->cache_mode >= CACHE_MODE_NEVER
+	    || cached->length <= 0)
+		return 0;
+
+	return cached->uri->protocol == PROTOCOL_HTTP
+		|| cached->uri->protocol == PROTOCOL_HTTPS;
+}
+
+static struct disk_cache_segment *
+get_writable_segment(off_t size)
+{
+	off_t segment_limit = get_disk_cache_size_limit() / DISK_CACHE_SEGMENTS;
+	struct disk_cache_segment *segment = NULL;
+
+	if (!list_empty(segments)) {
+		segment = (struct disk_cache_segment *)segments.prev;
+		if (segment->size && segment->size + size > segment_limit)
+			segment = open_disk_cache_segment(segment->id + 1, 1);
+	} else {
+		segment = open_disk_cache_segment(0, 1);
+	}
+
+	return segment;
+}
+
+static void
+add_disk_cache_string(struct string *strings, const char *str, uint32_t *length)
+{
+	*length = str ? strlen(str) : 0;
+	if (str) add_bytes_to_string(strings, str, *length);
+	add_bytes_to_string(strings, "", 1);
+}
+
+void
+store_disk_cache_entry(struct cache_entry *cached)
+{
+	static const char padding[8];
+	struct disk_cache_header header;
+	struct disk_cache_segment *segment;
+	struct disk_cache_record *record;
+	struct hash_item *item;
+	struct fragment *fragment;
+	struct string strings;
+	off_t offset, size;
+	char *uri;
+
+	if (!get_opt_bool("document.cache.disk.enable", NULL)
+	    || !disk_cache_entry_is_storable(cached)
+	    || !init_disk_cache())
+		return;
+
+	fragment = get_cache_fragment(cached);
+	if (!fragment || fragment->length != cached->length)
+		return;
+
+	uri = get_uri_string(cached->uri, URI_BASE);
+	if (!uri) return;
+
+	item = get_hash_item(records, uri, strlen(uri));
+	if (item && ((struct disk_cache_record *)item->value)->cache_id == cached->cache_id) {
+		mem_free(uri);
+		return;
+	}
+
+	if (!init_string(&strings)) {
+		mem_free(uri);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = DISK_CACHE_RECORD_MAGIC;
+	add_disk_cache_string(&strings, uri, &header.urilen);
+	add_disk_cache_string(&strings, cached->head, &header.headlen);
+	add_disk_cache_string(&strings, cached->etag, &header.etaglen);
+	add_disk_cache_string(&strings, cached->last_modified, &header.last_modified_len);
+	add_disk_cache_string(&strings, cached->content_type, &header.content_type_len);
+	header.expire = cached->expire;
+	header.length = fragment->length;
+	header.seconds = cached->seconds;
+	header.max_age = cached->max_age.sec;
+	header.cache_mode = cached->cache_mode;
+	header.checksum = checksum_data(DISK_CACHE_CHECKSUM_INIT,
+					(unsigned char *) strings.source,
+					strings.length);
+	header.checksum = checksum_data(header.checksum,
+					(unsigned char *) fragment->data,
+					fragment->length);
+
+	size = get_record_size(&header);
+
+	/* Do not let one document flush the whole cache. */
+	if (size > get_disk_cache_size_limit() / 2
+	    || !(segment = get_writable_segment(size))) {
+		done_string(&strings);
+		mem_free(uri);
+		return;
+	}
+
+	offset = segment->size;
+
+	if (lseek(segment->fd, offset, SEEK_SET) != offset
+	    || write_all(segment->fd, &header, sizeof(header))
+	    || write_all(segment->fd, strings.source, strings.length)
+	    || write_all(segment->fd, padding,
+			 get_body_offset(&header) - sizeof(header) - strings.length)
+	    || write_all(segment->fd, fragment->data, fragment->length)
+	    || write_all(segment->fd, padding,
+			 DISK_CACHE_ALIGN(fragment->length) - fragment->length)) {
+		/* Leave no garbage for the recovery to chew on. */
+		if (ftruncate(segment->fd, offset)) {
+			/* The recovery will deal with it. */
+		}
+		done_string(&strings);
+		mem_free(uri);
+		return;
+	}
+
+	done_string(&strings);
+
+	segment->size += size;
+	disk_cache_size += size;
+
+	record = add_disk_cache_record(uri, segment, offset, size);
+	if (record) {
+		write_index_entry(record);
+		record->cache_id = cached->cache_id;
+	}
+
+	shrink_disk_cache();
+}
+
+
+/* A view of a whole record, either mapped or read into memory. */
+struct disk_cache_view {
+	void *base;
+	size_t size;
+	unsigned char *data;
+	unsigned int mapped:1;
+};
+
+static int
+open_disk_cache_view(struct disk_cache_view *view,
+		     struct disk_cache_record *record)
+{
+#ifdef HAVE_MMAP
+	off_t page_size = 4096;
+	off_t start;
+
+#ifdef HAVE_SC_PAGE_SIZE
+	page_size = sysconf(_SC_PAGE_SIZE);
+	if (page_size <= 0) page_size = 4096;
+#endif
+	start = record->offset - record->offset % page_size;
+	view->size = record->offset + record->size - start;
+	view->base = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE,
+			  record->segment->fd, start);
+	if (view->base != MAP_FAILED) {
+		view->data = (unsigned char *) view->base + (record->offset - start);
+		view->mapped = 1;
+		return 1;
+	}
+#endif
+
+	view->size = record->size;
+	view->base = mem_mmap_alloc(view->size);
+	if (!view->base) return 0;
+
+	if (read_at(record->segment->fd, record->offset, view->base, view->size)) {
+		mem_mmap_free(view->base, view->size);
+		return 0;
+	}
+
+	view->data = (unsigned char *) view->base;
+	view->mapped = 0;
+	return 1;
+}
+
+static void
+close_disk_cache_view(struct disk_cache_view *view)
+{
+#ifdef HAVE_MMAP
+	if (view->mapped) {
+		munmap(view->base, view->size);
+		return;
+	}
+#endif
+	mem_mmap_free(view->base, view->size);
+}
+
+static char *
+get_view_string(unsigned char **pos, uint32_t length)
+{
+	char *str = length ? memacpy((char *) *pos, length) : NULL;
+
+	*pos += length + 1;
+	return str;
+}
+
+struct cache_entry *
+get_disk_cache_entry(struct uri *uri)
+{
+	struct disk_cache_header header;
+	struct disk_cache_record *record;
+	struct disk_cache_view view;
+	struct cache_entry *cached;
+	struct hash_item *item;
+	struct uri *real_uri;
+	unsigned char *pos;
+	char *key;
+
+	if (!get_opt_bool("document.cache.disk.enable", NULL)
+	    || !init_disk_cache())
+		return NULL;
+
+	real_uri = get_proxied_uri(uri);
+	if (!real_uri) return NULL;
+
+	key = get_uri_string(real_uri, URI_BASE);
+	done_uri(real_uri);
+	if (!key) return NULL;
+
+	item = get_hash_item(records, key, strlen(key));
+	if (!item) {
+		mem_free(key);
+		return NULL;
+	}
+
+	record = (struct disk_cache_record *)item->value;
+	if (!open_disk_cache_view(&view, record)) {
+		mem_free(key);
+		return NULL;
+	}
+
+	memcpy(&header, view.data, sizeof(header));
+	pos = view.data + sizeof(header);
+
+	if (header.magic != DISK_CACHE_RECORD_MAGIC
+	    || get_record_size(&header) != record->size
+	    || checksum_data(checksum_data(DISK_CACHE_CHECKSUM_INIT, pos,
+					   get_strings_size(&header)),
+			     view.data + get_body_offset(&header),
+			     header.length) != header.checksum) {
+		close_disk_cache_view(&view);
+		mem_free(key);
+		return NULL;
+	}
+
+	/* Note that get_cache_entry() may trigger the garbage collection
+	 * which can store entries and delete old segments, so @record must
+	 * not be used after this. The view stays usable even if its segment
+	 * is deleted. */
+	cached = get_cache_entry(uri);
+	if (!cached) {
+		close_disk_cache_view(&view);
+		mem_free(key);
+		return NULL;
+	}
+
+	pos += header.urilen + 1;
+	mem_free_set(&cached->head, get_view_string(&pos, header.headlen));
+	mem_free_set(&cached->etag, get_view_string(&pos, header.etaglen));
+	mem_free_set(&cached->last_modified, get_view_string(&pos, header.last_modified_len));
+	mem_free_set(&cached->content_type, get_view_string(&pos, header.content_type_len));
+
+	if (add_fragment(cached, 0, (char *) view.data + get_body_offset(&header),
+			 header.length) < 0) {
+		close_disk_cache_view(&view);
+		mem_free(key);
+		delete_cache_entry(cached);
+		return NULL;
+	}
+
+	close_disk_cache_view(&view);
+
+	normalize_cache_entry(cached, header.length);
+	cached->seconds = header.seconds;
+	cached->max_age.sec = header.max_age;
+	cached->max_age.usec = 0;
+	cached->expire = !!header.expire;
+	cached->cache_mode = header.cache_mode;
+
+	item = get_hash_item(records, key, strlen(key));
+	if (item) ((struct disk_cache_record *)item->value)->cache_id = cached->cache_id;
+	mem_free(key);
+
+	disk_cache_hits++;
+
+	return cached;
+}
@@ -0,0 +1,36 @@
+#ifndef EL__CACHE_DISK_H
+#define EL__CACHE_DISK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cache_entry;
+struct uri;
+
+/* The disk cache is a second level below the memory cache. Complete cache
+ * entries evicted by garbage_collection() are appended to segment files in
+ * the cache/ subdirectory of the ELinks home directory and can be brought
+ * back to the memory cache later, possibly by another ELinks process. */
+
+/* Saves the contents of @cached to the disk cache if it is enabled and the
+ * entry is worth keeping. */
+void store_disk_cache_entry(struct cache_entry *cached);
+
+/* Looks up @uri in the disk cache and if found adds a new memory cache entry
+ * with the stored contents. Returns NULL if nothing usable was found. */
+struct cache_entry *get_disk_cache_entry(struct uri *uri);
+
+/* Closes all disk cache files. It is safe to call it even when the disk
+ * cache was never used. */
+void done_disk_cache(void);
+
+/* Used by the resource info dialog. */
+int get_disk_cache_entry_count(void);
+long get_disk_cache_hit_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+/* Cache eviction policies */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "elinks.h"
+
+#include "cache/policy.h"
+
+
+static int
+compare_lru(const void *v1, const void *v2)
+{
+	const struct cache_gc_candidate *c1 = (const struct cache_gc_candidate *)v1;
+	const struct cache_gc_candidate *c2 = (const struct cache_gc_candidate *)v2;
+
+	return (c1->age > c2->age) - (c1->age < c2->age);
+}
+
+static int
+compare_expired_first(const void *v1, const void *v2)
+{
+	const struct cache_gc_candidate *c1 = (const struct cache_gc_candidate *)v1;
+	const struct cache_gc_candidate *c2 = (const struct cache_gc_candidate *)v2;
+
+	if (c1->expired != c2->expired)
+		return c1->expired ? -1 : 1;
+
+	return compare_lru(v1, v2);
+}
+
+static int
+compare_gdsf(const void *v1, const void *v2)
+{
+	const struct cache_gc_candidate *c1 = (const struct cache_gc_candidate *)v1;
+	const struct cache_gc_candidate *c2 = (const struct cache_gc_candidate *)v2;
+
+	if (c1->priority != c2->priority)
+		return c1->priority < c2->priority ? -1 : 1;
+
+	return compare_lru(v1, v2);
+}
+
+void
+sort_cache_gc_candidates(struct cache_gc_candidate *candidates, int count,
+			 int policy)
+{
+	int (*compare)(const void *, const void *);
+	int i;
+
+	switch (policy) {
+	case CACHE_GC_EXPIRED_FIRST:
+		compare = compare_expired_first;
+		break;
+
+	case CACHE_GC_GDSF:
+		/* The priority is the number of uses times the refetch cost
+		 * per byte, so many small entries used once are not able to
+		 * push out a big one which is often revisited. The refetch
+		 * cost is estimated as the number of packets needed, which
+		 * also accounts for the connection setup. The clock ages
+		 * entries which are not used anymore. Expired entries have
+		 * to be refetched anyway so they go first. */
+		for (i = 0; i < count; i++) {
+			struct cache_gc_candidate *c = &candidates[i];
+			double size = c->size > 0 ? (double) c->size : 1.0;
+			double cost = 2.0 + size / 536.0;
+
+			c->priority = c->expired ? 0.0
+				    : c->clock + c->hits * cost / size;
+		}
+		compare = compare_gdsf;
+		break;
+
+	case CACHE_GC_LRU:
+	default:
+		compare = compare_lru;
+	}
+
+	qsort(candidates, count, sizeof(*candidates), compare);
+}
+
+const char *
+get_cache_gc_policy_name(int policy)
+{
+	switch (policy) {
+	case CACHE_GC_EXPIRED_FIRST:	return "expired-first";
+	case CACHE_GC_GDSF:		return "gdsf";
+	case CACHE_GC_LRU:
+	default:			return "lru";
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef EL__CACHE_POLICY_H
+#define EL__CACHE_POLICY_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Eviction policies of the memory cache garbage collector. The values are
+ * those of the document.cache.memory.policy option. */
+enum cache_gc_policy {
+	CACHE_GC_LRU,		/* Least recently used first */
+	CACHE_GC_EXPIRED_FIRST,	/* Expired entries first, then LRU */
+	CACHE_GC_GDSF,		/* Greedy Dual Size Frequency */
+
+	CACHE_GC_POLICIES,	/* Must be last */
+};
+
+/* The data garbage_collection() bases its decisions on. It is kept apart
+ * from struct cache_entry so the policies can also be replayed outside of
+ * the cache. */
+struct cache_gc_candidate {
+	void *data;		/* The entry the candidate stands for */
+	off_t size;		/* Bytes freed by evicting the entry */
+	unsigned long hits;	/* Number of times the entry was used */
+	double clock;		/* GDSF clock when the entry was last used */
+	long age;		/* LRU position, 0 being the least recent */
+	unsigned int expired:1;	/* Has the entry expired? */
+
+	double priority;	/* Set by sort_cache_gc_candidates() */
+};
+
+/* Sorts the @candidates so that those which should be evicted first come
+ * first. For CACHE_GC_GDSF the priority member of the candidates is updated
+ * and the clock should be raised to the priority of each evicted one. */
+void sort_cache_gc_candidates(struct cache_gc_candidate *candidates,
+			      int count, int policy);
+
+const char *get_cache_gc_policy_name(int policy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
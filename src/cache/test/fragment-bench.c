@@ -0,0 +1,347 @@
+/* Stream a big body into a cache entry the way the protocol handlers do */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "bfu/hierbox.h"
+#include "cache/cache.h"
+#include "cache/dialogs.h"
+#include "cache/disk.h"
+#include "config/options.h"
+#include "main/main.h"
+#include "network/connection.h"
+#include "protocol/proxy.h"
+#include "protocol/uri.h"
+#include "util/memory.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+struct option *config_options = NULL;
+
+#ifdef CONFIG_DEBUG
+union option_value *
+get_opt_(char *file, int line, enum option_type option_type,
+	 struct option *tree, const char *name, struct session *ses)
+#else
+union option_value *
+get_opt_(struct option *tree, const char *name, struct session *ses)
+#endif
+{
+	static union option_value value;
+
+	return &value;
+}
+
+/* The entry is made up here, so the rest of the cache is never asked for. */
+
+struct hierbox_browser cache_browser;
+
+struct listbox_item *
+add_listbox_item(struct hierbox_browser *browser, struct listbox_item *root,
+		 enum listbox_item_type type, void *data, int add_position)
+{
+	return NULL;
+}
+
+void
+done_listbox_item(struct hierbox_browser *browser, struct listbox_item *item)
+{
+}
+
+struct uri *
+get_uri(char *string, uri_component_T components)
+{
+	return NULL;
+}
+
+void
+done_uri(struct uri *uri)
+{
+}
+
+int
+compare_uri(const struct uri *a, const struct uri *b,
+	    uri_component_T components)
+{
+	return a == b;
+}
+
+char *
+get_uri_string(const struct uri *uri, uri_component_T components)
+{
+	return NULL;
+}
+
+char *
+join_urls(struct uri *base, const char *relative)
+{
+	return NULL;
+}
+
+struct uri *
+get_proxied_uri(struct uri *uri)
+{
+	return uri;
+}
+
+struct uri *
+get_proxy_uri(struct uri *uri, struct connection_state *connection_state)
+{
+	return uri;
+}
+
+int
+is_entry_used(struct cache_entry *cached)
+{
+	return 0;
+}
+
+void
+shrink_memory(int whole)
+{
+}
+
+struct cache_entry *
+get_disk_cache_entry(struct uri *uri)
+{
+	return NULL;
+}
+
+void
+store_disk_cache_entry(struct cache_entry *cached)
+{
+}
+
+/* The body repeats this many bytes, which is prime so that no chunk size
+ * lines up with it, and a misplaced chunk is seen. */
+#define PATTERN 251
+
+static char pattern[PATTERN];
+
+/* Where the data comes from: @offset of the body in a buffer which holds
+ * a chunk from any offset. */
+static const char *
+body_data(const char *buffer, off_t offset)
+{
+	return buffer + offset % PATTERN;
+}
+
+/* Appends the body with add_fragment() the way read_http_data() did, and
+ * asks for the defragmented data every @read bytes the way the renderer
+ * does while the document is loading. */
+static void
+stream_add_fragment(struct cache_entry *cached, const char *buffer,
+		    off_t size, ssize_t chunk, off_t read, int *fragments)
+{
+	off_t offset, next_read = read;
+
+	for (offset = 0; offset < size; offset += chunk) {
+		ssize_t length = MIN(chunk, size - offset);
+
+		if (add_fragment(cached, offset, body_data(buffer, offset), length) < 0)
+			die("out of memory at %ld", (long) offset);
+
+		if (offset + length >= next_read) {
+			if (!get_cache_fragment(cached))
+				die("no data at %ld", (long) offset);
+			next_read += read;
+		}
+	}
+
+	*fragments = list_size(&cached->frag);
+}
+
+/* Appends the body straight into the last fragment with get_fragment_tail()
+ * the way read_http_data() does now. */
+static void
+stream_fragment_tail(struct cache_entry *cached, const char *buffer,
+		     off_t size, ssize_t chunk, off_t read, int *fragments)
+{
+	off_t offset = 0, next_read = read;
+
+	/* The first fragment is left to add_fragment(). */
+	if (add_fragment(cached, 0, body_data(buffer, 0), MIN(chunk, size)) < 0)
+		die("out of memory");
+	offset = MIN(chunk, size);
+
+	while (offset < size) {
+		ssize_t length = MIN(chunk, size - offset);
+		ssize_t room = length;
+		char *tail = get_fragment_tail(cached, offset, &room);
+
+		if (!tail)
+			die("no tail at %ld", (long) offset);
+
+		memcpy(tail, body_data(buffer, offset), length);
+		commit_fragment_tail(cached, offset, length);
+		offset += length;
+
+		if (offset >= next_read) {
+			if (!get_cache_fragment(cached))
+				die("no data at %ld", (long) offset);
+			next_read += read;
+		}
+	}
+
+	*fragments = list_size(&cached->frag);
+}
+
+static void
+check_body(struct cache_entry *cached, off_t size)
+{
+	struct fragment *f = get_cache_fragment(cached);
+	off_t offset;
+
+	if (!f || f->offset || f->length != size)
+		die("the body is not in one fragment of %ld bytes", (long) size);
+
+	for (offset = 0; offset < size; offset += PATTERN) {
+		ssize_t length = MIN(PATTERN, size - offset);
+
+		if (memcmp(f->data + offset, pattern, length))
+			die("the body differs at %ld", (long) offset);
+	}
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+static long
+mb_per_s(off_t size, milliseconds_T ms)
+{
+	return ms ? (long) (size / 1024 / 1024 * 1000 / ms) : 0;
+}
+
+typedef void (*stream_T)(struct cache_entry *, const char *, off_t, ssize_t,
+			 off_t, int *);
+
+static void
+run(const char *name, stream_T stream, const char *buffer, off_t size,
+    ssize_t chunk, off_t read)
+{
+	struct cache_entry cached;
+	milliseconds_T time;
+	timeval_T start;
+	int fragments;
+
+	memset(&cached, 0, sizeof(cached));
+	init_list(cached.frag);
+
+	timeval_now(&start);
+	stream(&cached, buffer, size, chunk, read, &fragments);
+	time = elapsed_ms(&start);
+
+	check_body(&cached, size);
+	delete_entry_content(&cached);
+
+	printf(", %s %ld ms (%ld MB/s, %d fragment%s)", name, time,
+	       mb_per_s(size, time), fragments, fragments == 1 ? "" : "s");
+}
+
+int
+main(int argc, char *argv[])
+{
+	off_t size = 2048;
+	ssize_t chunk = 16384;
+	off_t read = 1;
+	char *buffer, *copy;
+	milliseconds_T time;
+	timeval_T start;
+	off_t offset;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "size", &i, argc, argv, "a number")) {
+			size = atol(arg);
+
+		} else if (get_test_opt(&arg, "chunk", &i, argc, argv, "a number")) {
+			chunk = atol(arg);
+
+		} else if (get_test_opt(&arg, "read", &i, argc, argv, "a number")) {
+			read = atol(arg);
+
+		} else {
+			die("usage: %s [--size <MB>] [--chunk <bytes>] [--read <MB>]",
+			    argv[0]);
+		}
+	}
+
+	if (size <= 0 || chunk <= 0 || read <= 0)
+		die("--size, --chunk and --read must be positive");
+
+	size *= 1024 * 1024;
+	read *= 1024 * 1024;
+
+	for (i = 0; i < PATTERN; i++)
+		pattern[i] = 'a' + i % 26 + i / 26;
+
+	buffer = (char *)mem_alloc(chunk + PATTERN);
+	if (!buffer) die("out of memory");
+	for (i = 0; i < chunk + PATTERN; i++)
+		buffer[i] = pattern[i % PATTERN];
+
+	/* For comparison, copy the body into one mapping which is big enough
+	 * from the start. */
+	copy = (char *)mem_mmap_alloc(size);
+	if (!copy) die("out of memory");
+
+	timeval_now(&start);
+	for (offset = 0; offset < size; offset += chunk)
+		memcpy(copy + offset, body_data(buffer, offset),
+		       MIN(chunk, size - offset));
+	time = elapsed_ms(&start);
+	mem_mmap_free(copy, size);
+
+	printf("%ld MB in %ld byte chunks: copy %ld ms (%ld MB/s)",
+	       (long) (size / 1024 / 1024), (long) chunk, time,
+	       mb_per_s(size, time));
+
+	run("add_fragment", stream_add_fragment, buffer, size, chunk, read);
+	run("tail", stream_fragment_tail, buffer, size, chunk, read);
+	printf("\n");
+
+	mem_free(buffer);
+
+	return 0;
+}
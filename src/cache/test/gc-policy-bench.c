@@ -0,0 +1,324 @@
+/* Replay a URL trace against the cache eviction policies */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "cache/policy.h"
+#include "util/hash.h"
+#include "util/memory.h"
+#include "util/string.h"
+#include "util/test.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+/* Same as MEMORY_CACHE_GC_PERCENT */
+#define GC_PERCENT 90
+
+struct object {
+	off_t size;
+	long ttl;		/* In requests, 0 means it never expires */
+
+	/* Simulated cache state */
+	unsigned int cached:1;
+	unsigned long hits;
+	double clock;
+	long last_use;
+	long expires;
+};
+
+struct trace {
+	struct object *objects;
+	int objects_count;
+	int *requests;
+	long requests_count;
+};
+
+static int
+add_object(struct trace *trace, off_t size, long ttl)
+{
+	struct object *objects;
+
+	objects = (struct object *)mem_realloc(trace->objects,
+		(trace->objects_count + 1) * sizeof(*objects));
+	if (!objects) die("out of memory");
+
+	trace->objects = objects;
+	memset(&objects[trace->objects_count], 0, sizeof(*objects));
+	objects[trace->objects_count].size = size;
+	objects[trace->objects_count].ttl = ttl;
+
+	return trace->objects_count++;
+}
+
+static void
+add_request(struct trace *trace, int object)
+{
+	if (!(trace->requests_count & 1023)) {
+		int *requests = (int *)mem_realloc(trace->requests,
+			(trace->requests_count + 1024) * sizeof(*requests));
+
+		if (!requests) die("out of memory");
+		trace->requests = requests;
+	}
+
+	trace->requests[trace->requests_count++] = object;
+}
+
+/* Reads a trace with one "<url> <size> [<ttl>]" line per request. The size
+ * and expiry time of the first request of an URL are used. */
+static void
+read_trace(struct trace *trace, const char *filename)
+{
+	struct hash *urls = init_hash8();
+	FILE *file = fopen(filename, "r");
+	char line[4096];
+
+	if (!urls) die("out of memory");
+	if (!file) die("cannot open %s", filename);
+
+	while (fgets(line, sizeof(line), file)) {
+		char url[4096];
+		long long size;
+		long ttl = 0;
+		struct hash_item *item;
+		int object;
+
+		if (sscanf(line, "%4095s %lld %ld", url, &size, &ttl) < 2)
+			continue;
+
+		item = get_hash_item(urls, url, strlen(url));
+		if (item) {
+			object = (int) (long) item->value;
+		} else {
+			char *key = stracpy(url);
+
+			if (!key) die("out of memory");
+			object = add_object(trace, size, ttl);
+			if (!add_hash_item(urls, key, strlen(key), (void *) (long) object))
+				die("out of memory");
+		}
+
+		add_request(trace, object);
+	}
+
+	fclose(file);
+}
+
+static unsigned long random_state = 42;
+
+static unsigned long
+next_random(void)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) & 0x7fff;
+}
+
+/* Generates a workload of a few big pages which are revisited all the time
+ * and plenty of small images and stylesheets, some of them short-lived, which
+ * are mostly used once. */
+static void
+generate_trace(struct trace *trace, long requests)
+{
+	int pages = 50, small = 20000;
+	int i;
+
+	for (i = 0; i < pages; i++)
+		add_object(trace, 50000 + next_random() * 5, 0);
+
+	for (i = 0; i < small; i++)
+		add_object(trace, 500 + next_random() % 8000,
+			   (i % 4) ? 0 : 1000 + next_random() % 5000);
+
+	for (i = 0; i < requests; i++) {
+		if (next_random() % 3 == 0) {
+			/* Popular pages are revisited more often. */
+			int page = (next_random() % pages) * (next_random() % pages) / pages;
+
+			add_request(trace, page);
+		} else {
+			add_request(trace, pages + (next_random() * 32768 + next_random()) % small);
+		}
+	}
+}
+
+static int
+is_expired(struct object *object, long now)
+{
+	return object->ttl && now >= object->expires;
+}
+
+static void
+collect_garbage(struct trace *trace, struct cache_gc_candidate *candidates,
+		int policy, int current, off_t limit, off_t *cache_size,
+		double *clock, long now)
+{
+	off_t gc_size = limit * GC_PERCENT / 100;
+	int count = 0, targets, i;
+
+	for (i = 0; i < trace->objects_count; i++) {
+		struct object *object = &trace->objects[i];
+		struct cache_gc_candidate *candidate;
+
+		/* The document being loaded is in use. */
+		if (!object->cached || i == current) continue;
+
+		candidate = &candidates[count++];
+		candidate->data = object;
+		candidate->size = object->size;
+		candidate->hits = object->hits;
+		candidate->clock = object->clock;
+		candidate->age = object->last_use;
+		candidate->expired = is_expired(object, now);
+	}
+
+	sort_cache_gc_candidates(candidates, count, policy);
+
+	for (targets = 0; targets < count && *cache_size > gc_size; targets++) {
+		struct object *object = (struct object *)candidates[targets].data;
+
+		object->cached = 0;
+		*cache_size -= object->size;
+	}
+
+	/* Keep what still fits, like garbage_collection() does. */
+	for (i = targets - 1; i >= 0; i--) {
+		struct object *object = (struct object *)candidates[i].data;
+
+		if (*cache_size + object->size > gc_size)
+			continue;
+
+		object->cached = 1;
+		*cache_size += object->size;
+	}
+
+	for (i = 0; i < targets; i++) {
+		struct object *object = (struct object *)candidates[i].data;
+
+		if (!object->cached && policy == CACHE_GC_GDSF && candidates[i].priority > *clock)
+			*clock = candidates[i].priority;
+	}
+}
+
+static void
+replay_trace(struct trace *trace, int policy, off_t limit)
+{
+	struct cache_gc_candidate *candidates;
+	off_t cache_size = 0;
+	unsigned longlong refetched = 0;
+	double clock = 0;
+	long hits = 0, now;
+	int i;
+
+	candidates = (struct cache_gc_candidate *)mem_calloc(trace->objects_count, sizeof(*candidates));
+	if (!candidates) die("out of memory");
+
+	for (i = 0; i < trace->objects_count; i++)
+		trace->objects[i].cached = 0;
+
+	for (now = 0; now < trace->requests_count; now++) {
+		int current = trace->requests[now];
+		struct object *object = &trace->objects[current];
+
+		if (object->cached && !is_expired(object, now)) {
+			hits++;
+			object->hits++;
+
+		} else {
+			refetched += object->size;
+			if (!object->cached) cache_size += object->size;
+			object->cached = 1;
+			object->hits = 1;
+			object->expires = now + object->ttl;
+		}
+
+		object->clock = clock;
+		object->last_use = now;
+
+		if (cache_size > limit)
+			collect_garbage(trace, candidates, policy, current,
+					limit, &cache_size, &clock, now);
+	}
+
+	printf("%-15s %9.2f%% %18llu\n", get_cache_gc_policy_name(policy),
+	       trace->requests_count ? hits * 100.0 / trace->requests_count : 0.0,
+	       refetched);
+
+	mem_free(candidates);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct trace trace;
+	const char *filename = NULL;
+	long requests = 200000;
+	off_t limit = 1048576;
+	int policy;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "trace", &i, argc, argv, "a filename")) {
+			filename = arg;
+
+		} else if (get_test_opt(&arg, "requests", &i, argc, argv, "a number")) {
+			requests = atol(arg);
+
+		} else if (get_test_opt(&arg, "size", &i, argc, argv, "a number")) {
+			limit = atol(arg);
+
+		} else {
+			die("usage: %s [--trace <file>] [--requests <n>] [--size <bytes>]", argv[0]);
+		}
+	}
+
+	memset(&trace, 0, sizeof(trace));
+
+	if (filename)
+		read_trace(&trace, filename);
+	else
+		generate_trace(&trace, requests);
+
+	printf("%ld requests of %d URLs, cache size %lld bytes\n",
+	       trace.requests_count, trace.objects_count, (long long) limit);
+	printf("%-15s %10s %18s\n", "policy", "hit ratio", "bytes refetched");
+
+	for (policy = 0; policy < CACHE_GC_POLICIES; policy++)
+		replay_trace(&trace, policy, limit);
+
+	mem_free_if(trace.objects);
+	mem_free_if(trace.requests);
+
+	return 0;
+}
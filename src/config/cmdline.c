@@ -931,6 +931,11 @@ union option_info cmdline_options_info[] = {
 		"no-libevent", OPT_ZERO, 0,
 		N_("Disables libevent.")),
 
+	INIT_OPT_BOOL("", N_("Disable epoll"),
+		"no-epoll", OPT_ZERO, 0,
+		N_("Disables the use of epoll in the main loop, select() is "
+		"used instead.")),
+
 	INIT_OPT_CMDALIAS("", N_("Disable link numbering in dump output"),
 		"no-numbering", OPT_ALIAS_NEGATE, "document.dump.numbering",
 		N_("Prevents printing of link number in dump output.\n"
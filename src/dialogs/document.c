@@ -18,6 +18,7 @@
 #include "document/view.h"
 #include "globhist/globhist.h"
 #include "intl/libintl.h"
+#include "network/ssl/session.h"
 #include "protocol/header.h"
 #include "protocol/uri.h"
 #include "session/location.h"
@@ -43,6 +44,27 @@ nowhere_box(struct terminal *term, char *title)
 		 N_("You are nowhere!"));
 }
 
+#ifdef CONFIG_SSL
+/* The handshakes of all the SSL connections so far, to see how much the
+ * session cache saves. The times are averages. */
+static void
+add_ssl_handshake_info_to_string(struct string *msg, struct terminal *term)
+{
+	long full = get_ssl_full_handshake_count();
+	long resumed = get_ssl_resumed_handshake_count();
+	long sessions = get_ssl_session_count();
+
+	add_format_to_string(msg, "\n%s: ", _("SSL handshakes", term));
+	add_format_to_string(msg, n_("%ld full", "%ld full", full, term), full);
+	add_format_to_string(msg, " (%ld ms), ", get_ssl_full_handshake_time());
+	add_format_to_string(msg, n_("%ld resumed", "%ld resumed", resumed, term),
+			     resumed);
+	add_format_to_string(msg, " (%ld ms), ", get_ssl_resumed_handshake_time());
+	add_format_to_string(msg, n_("%ld cached session", "%ld cached sessions",
+				     sessions, term), sessions);
+}
+#endif
+
 static void
 add_link_info_to_string(struct string *msg, struct session *ses)
 {
@@ -201,6 +223,9 @@ document_info_dialog(struct session *ses)
 			add_format_to_string(&msg, "\n%s: %s",
 					     _("SSL Cipher", term),
 					     cached->ssl_info);
+#ifdef CONFIG_SSL
+			add_ssl_handshake_info_to_string(&msg, term);
+#endif
 		}
 		if (cached->encoding_info) {
 			add_format_to_string(&msg, "\n%s: %s",
@@ -19,9 +19,13 @@
 
 #include "bfu/dialog.h"
 #include "cache/cache.h"
+#include "cache/disk.h"
 #include "config/kbdbind.h"
 #include "config/options.h"
 #include "dialogs/info.h"
+#ifdef CONFIG_CSS
+#include "document/css/apply.h"
+#endif
 #include "document/renderer.h"
 #include "ecmascript/ecmascript.h"
 #include "intl/libintl.h"
@@ -29,6 +33,9 @@
 #include "main/timer.h"
 #include "main/version.h"
 #include "network/connection.h"
+#include "network/dns.h"
+#include "network/prefetch.h"
+#include "protocol/http/http2.h"
 #include "session/session.h"
 #include "terminal/terminal.h"
 #include "util/conv.h"
@@ -199,8 +206,62 @@ get_resource_info(struct terminal *term, void *data)
 
 	val = get_keepalive_connections_count();
 	val_add(n_("%ld keepalive", "%ld keepalive", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_http2_session_count();
+	val_add(n_("%ld HTTP/2 session", "%ld HTTP/2 sessions", val, term));
 	add_to_string(&info, ".\n");
 
+	add_to_string(&info, _("DNS", term));
+	add_to_string(&info, ": ");
+
+	val = get_dns_cache_entry_count();
+	val_add(n_("%ld cached", "%ld cached", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_helpers_count();
+	val_add(n_("%ld helper", "%ld helpers", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_lookup_count();
+	val_add(n_("%ld lookup", "%ld lookups", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_hit_count();
+	val_add(n_("%ld hit", "%ld hits", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_coalesced_count();
+	val_add(n_("%ld shared", "%ld shared", val, term));
+	add_to_string(&info, ".\n");
+
+	add_to_string(&info, _("Prefetch", term));
+	add_to_string(&info, ": ");
+
+	val = get_dns_prefetch_count();
+	val_add(n_("%ld lookup", "%ld lookups", val, term));
+	add_to_string(&info, " (");
+
+	val = get_dns_prefetch_hit_count();
+	val_add(n_("%ld used", "%ld used", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_prefetch_waste_count();
+	val_add(n_("%ld wasted", "%ld wasted", val, term));
+	add_to_string(&info, "), ");
+
+	val = get_preconnect_count();
+	val_add(n_("%ld connection", "%ld connections", val, term));
+	add_to_string(&info, " (");
+
+	val = get_preconnect_hit_count();
+	val_add(n_("%ld used", "%ld used", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_preconnect_waste_count();
+	val_add(n_("%ld wasted", "%ld wasted", val, term));
+	add_to_string(&info, ").\n");
+
 	add_to_string(&info, _("Memory cache", term));
 	add_to_string(&info, ": ");
 
@@ -219,8 +280,29 @@ get_resource_info(struct terminal *term, void *data)
 
 	val = get_cache_entry_loading_count();
 	val_add(n_("%ld loading", "%ld loading", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_cache_lookup_count();
+	val_add(n_("%ld lookup", "%ld lookups", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_cache_hit_count();
+	val_add(n_("%ld hit", "%ld hits", val, term));
 	add_to_string(&info, ".\n");
 
+	if (get_opt_bool("document.cache.disk.enable", NULL)) {
+		add_to_string(&info, _("Disk cache", term));
+		add_to_string(&info, ": ");
+
+		val = get_disk_cache_entry_count();
+		val_add(n_("%ld file", "%ld files", val, term));
+		add_to_string(&info, ", ");
+
+		val = get_disk_cache_hit_count();
+		val_add(n_("%ld hit", "%ld hits", val, term));
+		add_to_string(&info, ".\n");
+	}
+
 	add_to_string(&info, _("Document cache", term));
 	add_to_string(&info, ": ");
 
@@ -236,6 +318,19 @@ get_resource_info(struct terminal *term, void *data)
 	val_add(n_("%ld refreshing", "%ld refreshing", val, term));
 	add_to_string(&info, ".\n");
 
+#ifdef CONFIG_CSS
+	add_to_string(&info, _("CSS", term));
+	add_to_string(&info, ": ");
+
+	val = get_css_ancestor_walk_count();
+	val_add(n_("%ld ancestor walk", "%ld ancestor walks", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_css_ancestor_skip_count();
+	val_add(n_("%ld skipped", "%ld skipped", val, term));
+	add_to_string(&info, ".\n");
+#endif
+
 #ifdef CONFIG_ECMASCRIPT_SMJS
 	add_to_string(&info, _("ECMAScript", term));
 	add_to_string(&info, ": ");
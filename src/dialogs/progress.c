@@ -60,6 +60,14 @@ get_progress_msg_2(struct progress *progress, struct terminal *term,
 		add_xnum_to_string(&msg, progress->current_speed);
 		add_to_string(&msg, "/s");
 
+		if (progress->limit) {
+			add_to_string(&msg, ", ");
+			add_to_string(&msg, _("limit", term));
+			add_char_to_string(&msg, ' ');
+			add_xnum_to_string(&msg, progress->limit);
+			add_to_string(&msg, "/s");
+		}
+
 		add_to_string(&msg, separator);
 
 		add_to_string(&msg, _(full ? (newlines ? N_("Elapsed time")
@@ -76,6 +84,12 @@ get_progress_msg_2(struct progress *progress, struct terminal *term,
 		add_char_to_string(&msg, ' ');
 		add_xnum_to_string(&msg, progress->average_speed);
 		add_to_string(&msg, "/s");
+
+		if (progress->limit) {
+			add_to_string(&msg, " / ");
+			add_xnum_to_string(&msg, progress->limit);
+			add_to_string(&msg, "/s");
+		}
 	}
 
 	if (progress->size >= 0 && progress->loaded > 0) {
@@ -23,6 +23,7 @@
 #include "document/css/stylesheet.h"
 #include "document/format.h"
 #include "document/html/parser/parse.h"
+#include "document/html/parser/stack.h"
 #include "document/options.h"
 #include "util/align.h"
 #include "util/color.h"
@@ -155,6 +156,46 @@ static const css_applier_T css_appliers[CSS_PT_LAST] = {
 	/* CSS_PT_WHITE_SPACE */	css_apply_font_attribute,
 };
 
+/* Statistics for the resource info dialog. */
+static long ancestor_walk_count;
+static long ancestor_skip_count;
+
+long
+get_css_ancestor_walk_count(void)
+{
+	return ancestor_walk_count;
+}
+
+long
+get_css_ancestor_skip_count(void)
+{
+	return ancestor_skip_count;
+}
+
+/** Returns whether any CSR_ANCESTOR selector in @a leaves may match an
+ * ancestor of @a element, according to its ancestor filter. */
+static int
+may_match_ancestor(struct css_selector_set *leaves,
+		   struct html_element *element)
+{
+	struct css_selector *leaf;
+
+	foreach_css_selector (leaf, leaves) {
+		if (leaf->relation != CSR_ANCESTOR)
+			continue;
+
+		/* Neither the pseudo-classes nor "*" are in the filter. */
+		if (leaf->type == CST_PSEUDO || !leaf->name
+		    || (leaf->type == CST_ELEMENT && !strcmp(leaf->name, "*")))
+			return 1;
+
+		if (may_have_html_ancestor(element, leaf->type, leaf->name, -1))
+			return 1;
+	}
+
+	return 0;
+}
+
 /** This looks for a match in list of selectors. */
 static void
 examine_element(struct html_context *html_context, struct css_selector *base,
@@ -192,15 +233,21 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 			 * first over sel->leaves and then over the HTML stack,
 			 * which shines in the most common case where there are
 			 * no CSR_ANCESTOR selector leaves. However we would
-			 * have to duplicate the whole examine_element(), so if
-			 * profiles won't show it really costs... */ \
-			for (ancestor = element->next; \
-			     (LIST_OF(struct html_element) *) ancestor	\
-			      != &html_context->stack;\
-			     ancestor = ancestor->next) \
-				examine_element(html_context, base, \
-						CST_ELEMENT, CSR_ANCESTOR, \
-						&sel->leaves, ancestor); \
+			 * have to duplicate the whole examine_element(), so the
+			 * ancestor filter at least skips the walks which
+			 * cannot find anything. */ \
+			if (may_match_ancestor(&sel->leaves, element)) { \
+				ancestor_walk_count++; \
+				for (ancestor = element->next; \
+				     (LIST_OF(struct html_element) *) ancestor \
+				      != &html_context->stack;\
+				     ancestor = ancestor->next) \
+					examine_element(html_context, base, \
+							CST_ELEMENT, CSR_ANCESTOR, \
+							&sel->leaves, ancestor); \
+			} else { \
+				ancestor_skip_count++; \
+			} \
 			examine_element(html_context, base, \
 			                CST_ELEMENT, CSR_PARENT, \
 			                &sel->leaves, element->next); \
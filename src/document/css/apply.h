@@ -37,6 +37,12 @@ css_apply(struct html_context *html_context, struct html_element *element,
 	  struct css_stylesheet *css,
 	  LIST_OF(struct html_element) *html_stack);
 
+/** Statistics for the resource info dialog: how many times the ancestors
+ * of an element were walked for the descendant selectors, and how many
+ * times the walk was skipped because none of them could match. */
+long get_css_ancestor_walk_count(void);
+long get_css_ancestor_skip_count(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,7 +22,9 @@
 #include "protocol/uri.h"
 #include "session/session.h"
 #include "util/error.h"
+#include "util/lists.h"
 #include "util/memory.h"
+#include "util/string.h"
 #include "viewer/text/draw.h"
 
 
@@ -127,11 +129,103 @@ supports_css_media_type(const char *optstr,
 	return 0;
 }
 
+/* How many parsed stylesheets are kept for the next documents. */
+#define PARSED_CSS_CACHE_SIZE	16
+
+/* A stylesheet parsed from a cache entry.  The next documents importing the
+ * same version of the entry get copies of its selectors instead of parsing
+ * it again, so it is never changed. */
+struct parsed_css {
+	LIST_HEAD(struct parsed_css);
+
+	/* The cache_entry.cache_id and cache_entry.data_id of the parsed
+	 * version of the entry. */
+	unsigned int cache_id;
+	unsigned int data_id;
+
+	struct css_stylesheet css;
+
+	/* The @import URLs of the stylesheet, which are resolved and imported
+	 * for each document. */
+	LIST_OF(struct string_list_item) imports;
+};
+
+static INIT_LIST_OF(struct parsed_css, parsed_css_cache);
+
+static void
+done_parsed_css(struct parsed_css *parsed)
+{
+	del_from_list(parsed);
+	done_css_stylesheet(&parsed->css);
+	free_string_list(&parsed->imports);
+	mem_free(parsed);
+}
+
+static void
+done_parsed_css_cache(void)
+{
+	while (!list_empty(parsed_css_cache))
+		done_parsed_css((struct parsed_css *)parsed_css_cache.next);
+}
+
+static void
+record_css_import(struct css_stylesheet *css, struct uri *base_uri,
+		  const char *url, int urllen)
+{
+	struct parsed_css *parsed = (struct parsed_css *)css->import_data;
+
+	add_to_string_list(&parsed->imports, url, urllen);
+}
+
+/* Returns the parsed stylesheet of @cached, parsing it first if it is not in
+ * the cache yet, or NULL if it cannot be kept. */
+static struct parsed_css *
+get_parsed_css(struct cache_entry *cached, struct uri *uri)
+{
+	struct parsed_css *parsed;
+	struct fragment *fragment;
+
+	foreach (parsed, parsed_css_cache) {
+		if (parsed->cache_id != cached->cache_id
+		    || parsed->data_id != cached->data_id)
+			continue;
+
+		move_to_top_of_list(parsed_css_cache, parsed);
+		return parsed;
+	}
+
+	/* The entry will change when the rest comes in. */
+	if (cached->incomplete)
+		return NULL;
+
+	fragment = get_cache_fragment(cached);
+	if (!fragment) return NULL;
+
+	parsed = (struct parsed_css *)mem_calloc(1, sizeof(*parsed));
+	if (!parsed) return NULL;
+
+	parsed->cache_id = cached->cache_id;
+	parsed->data_id = cached->data_id;
+	parsed->css.import = record_css_import;
+	parsed->css.import_data = parsed;
+	init_css_selector_set(&parsed->css.selectors);
+	init_list(parsed->imports);
+
+	css_parse_stylesheet(&parsed->css, uri, fragment->data,
+			     fragment->data + fragment->length);
+
+	add_to_list(parsed_css_cache, parsed);
+	if (list_size(&parsed_css_cache) > PARSED_CSS_CACHE_SIZE)
+		done_parsed_css((struct parsed_css *)parsed_css_cache.prev);
+
+	return parsed;
+}
+
 void
 import_css(struct css_stylesheet *css, struct uri *uri)
 {
-	/* Do we have it in the cache? (TODO: CSS cache) */
 	struct cache_entry *cached;
+	struct parsed_css *parsed;
 	struct fragment *fragment;
 
 	if (!uri || css->import_level >= MAX_REDIRECTS)
@@ -140,6 +234,22 @@ import_css(struct css_stylesheet *css, struct uri *uri)
 	cached = get_redirected_cache_entry(uri);
 	if (!cached) return;
 
+	parsed = get_parsed_css(cached, uri);
+	if (parsed) {
+		struct string_list_item *item;
+
+		/* CSS puts the @import rules before all the others, so
+		 * importing them first keeps the order of the cascade. */
+		css->import_level++;
+		foreach (item, parsed->imports) {
+			css->import(css, uri, item->string.source,
+				    item->string.length);
+		}
+		merge_css_stylesheets(css, &parsed->css);
+		css->import_level--;
+		return;
+	}
+
 	fragment = get_cache_fragment(cached);
 	if (fragment) {
 		char *end = fragment->data + fragment->length;
@@ -150,7 +260,6 @@ import_css(struct css_stylesheet *css, struct uri *uri)
 	}
 }
 
-
 static void
 import_css_file(struct css_stylesheet *css, struct uri *base_uri,
 		const char *url, int urllen)
@@ -206,8 +315,12 @@ change_hook_css(struct session *ses, struct option *current, struct option *chan
 		import_default_css();
 	}
 
-	if (!strcmp(changed->name, "media"))
+	if (!strcmp(changed->name, "media")) {
+		/* The parsed stylesheets left out the rules for other
+		 * media. */
+		done_parsed_css_cache();
 		reload_css = 1;
+	}
 
 	/* Instead of using the value of the @ses parameter, iterate
 	 * through the @sessions list.  The parameter may be NULL and
@@ -232,6 +345,7 @@ init_css(struct module *module)
 void
 done_css(struct module *module)
 {
+	done_parsed_css_cache();
 	done_css_stylesheet(&default_stylesheet);
 }
 
@@ -12,7 +12,9 @@
 
 #include "document/css/property.h"
 #include "document/css/stylesheet.h"
+#include "util/conv.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/lists.h"
 #include "util/memory.h"
 #include "util/string.h"
@@ -25,6 +27,107 @@
  * will find them useful at some time, so... Dunno. --pasky */
 
 
+/* Selectors with longer names are left out of css_selector_set.index. */
+#define CSS_SELECTOR_KEY_MAX 128
+
+/* Writes the key of css_selector_set.index for @type, @rel and @name to
+ * @key and returns its length, or zero if @name is too long. */
+static int
+make_css_selector_key(char key[CSS_SELECTOR_KEY_MAX],
+		      css_selector_type_T type, enum css_selector_relation rel,
+		      const char *name, int namelen)
+{
+	int i;
+
+	if (namelen < 0)
+		namelen = strlen(name);
+	if (namelen > CSS_SELECTOR_KEY_MAX - 2)
+		return 0;
+
+	key[0] = type;
+	key[1] = rel;
+	for (i = 0; i < namelen; i++)
+		key[i + 2] = c_tolower(name[i]);
+
+	return namelen + 2;
+}
+
+/* Returns zero if @selector should be in @index but could not be put
+ * there. */
+static int
+add_css_selector_to_index(struct css_selector *selector, struct hash *index)
+{
+	char key[CSS_SELECTOR_KEY_MAX];
+	char *copy;
+	int keylen;
+
+	if (!selector->name)
+		return 1;
+
+	keylen = make_css_selector_key(key, selector->type, selector->relation,
+				       selector->name, -1);
+	if (!keylen)
+		return 1;
+
+	copy = memacpy(key, keylen);
+	if (!copy)
+		return 0;
+
+	selector->index_item = add_hash_item(index, copy, keylen, selector);
+	if (!selector->index_item) {
+		mem_free(copy);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void
+del_css_selector_from_index(struct css_selector *selector)
+{
+	struct hash_item *item = selector->index_item;
+
+	if (!item)
+		return;
+
+	mem_free((void *) item->key);
+	del_hash_item(selector->set->index, item);
+	selector->index_item = NULL;
+}
+
+static void
+done_css_selector_index(struct css_selector_set *set)
+{
+	struct css_selector *selector;
+
+	foreach_css_selector (selector, set) {
+		del_css_selector_from_index(selector);
+	}
+
+	free_hash(&set->index);
+}
+
+/* Without the index of a set, its selectors are only found by going
+ * through them all, which is then done instead. */
+static void
+index_css_selector_set(struct css_selector_set *set)
+{
+	struct css_selector *selector;
+
+	set->index = init_hash8();
+	if (!set->index)
+		return;
+
+	/* The latest selectors come first in the list and so they must in
+	 * the hash buckets, for the same name can be there twice. */
+	foreachback (selector, set->list) {
+		if (!add_css_selector_to_index(selector, set->index)) {
+			done_css_selector_index(set);
+			return;
+		}
+	}
+}
+
 struct css_selector *
 find_css_selector(struct css_selector_set *sels,
                   css_selector_type_T type,
@@ -35,6 +138,20 @@ find_css_selector(struct css_selector_set *sels,
 
 	assert(sels && name);
 
+	if (sels->index) {
+		char key[CSS_SELECTOR_KEY_MAX];
+		int keylen = make_css_selector_key(key, type, rel, name, namelen);
+
+		/* A longer name is not in the index but may be in the
+		 * list. */
+		if (keylen) {
+			struct hash_item *item = get_hash_item(sels->index,
+							       key, keylen);
+
+			return item ? (struct css_selector *) item->value : NULL;
+		}
+	}
+
 	foreach_css_selector (selector, sels) {
 		if (type != selector->type || rel != selector->relation)
 			continue;
@@ -198,12 +315,17 @@ void
 init_css_selector_set(struct css_selector_set *set)
 {
 	set->may_contain_rel_ancestor_or_parent = 0;
+	set->count = 0;
+	set->index = NULL;
 	init_list(set->list);
 }
 
 void
 done_css_selector_set(struct css_selector_set *set)
 {
+	if (set->index)
+		done_css_selector_index(set);
+
 	while (!css_selector_set_empty(set)) {
 		done_css_selector(css_selector_set_front(set));
 	}
@@ -216,14 +338,27 @@ add_css_selector_to_set(struct css_selector *selector,
 	assert(!css_selector_is_in_set(selector));
 
 	add_to_list(set->list, selector);
+	selector->set = set;
+	set->count++;
 	if (selector->relation == CSR_ANCESTOR
 	    || selector->relation == CSR_PARENT)
 		set->may_contain_rel_ancestor_or_parent = 1;
+
+	if (set->index) {
+		if (!add_css_selector_to_index(selector, set->index))
+			done_css_selector_index(set);
+	} else if (set->count >= CSS_SELECTOR_INDEX_MIN) {
+		index_css_selector_set(set);
+	}
 }
 
 void
 del_css_selector_from_set(struct css_selector *selector)
 {
+	del_css_selector_from_index(selector);
+	selector->set->count--;
+	selector->set = NULL;
+
 	del_from_list(selector);
 	selector->next = NULL;
 	selector->prev = NULL;
@@ -296,32 +431,44 @@ clone_css_stylesheet(struct css_stylesheet *orig)
 	mirror_css_stylesheet(orig, copy);
 	return copy;
 }
+#endif
 
-void
-merge_css_stylesheets(struct css_stylesheet *css1,
-		      struct css_stylesheet *css2)
+/* Adds copies of the selectors of @sels2, with their leaves and
+ * properties, to @sels1 the way parsing them there would have. */
+static void
+merge_css_selector_sets(struct css_selector_set *sels1,
+			struct css_selector_set *sels2)
 {
 	struct css_selector *selector;
 
-	assert(css1 && css2);
-
-	/* This is 100% evil. And gonna be a huge bottleneck. Essentially
-	 * O(N^2) where we could be much smarter (ie. sort it once and then
-	 * always be O(N)). */
+	/* Going backwards adds the selectors and properties to the heads of
+	 * the lists of @sels1 in the order the parser added them. */
+	foreachback (selector, sels2->list) {
+		struct css_selector *copy;
+		struct css_property *prop;
 
-	foreach_css_selector (selector, &css2->selectors) {
-		struct css_selector *origsel;
+		copy = get_css_selector(sels1, selector->type,
+					selector->relation, selector->name,
+					selector->name ? -1 : 0);
+		if (!copy)
+			continue;
 
-		origsel = find_css_selector(&css1->selectors, selector->name,
-					    strlen(selector->name));
-		if (!origsel) {
-			clone_css_selector(css1, selector);
-		} else {
-			merge_css_selectors(origsel, selector);
+		foreachback (prop, selector->properties) {
+			add_selector_property(copy, prop);
 		}
+
+		merge_css_selector_sets(&copy->leaves, &selector->leaves);
 	}
 }
-#endif
+
+void
+merge_css_stylesheets(struct css_stylesheet *css1,
+		      struct css_stylesheet *css2)
+{
+	assert(css1 && css2);
+
+	merge_css_selector_sets(&css1->selectors, &css2->selectors);
+}
 
 void
 done_css_stylesheet(struct css_stylesheet *css)
@@ -3,6 +3,7 @@
 #define EL__DOCUMENT_CSS_STYLESHEET_H
 
 #include "protocol/uri.h"
+#include "util/hash.h"
 #include "util/lists.h"
 
 #ifdef __cplusplus
@@ -52,21 +53,32 @@ extern "C" {
 struct css_selector_set {
 	unsigned char may_contain_rel_ancestor_or_parent;
 
-	/** The list of selectors in this set.
+	/** The number of selectors in #list. */
+	int count;
+
+	/** The selectors of a big set by their type, relation and
+	 * lowercased name, or NULL.
 	 *
-	 * Sets are currently represented as lists that
-	 * find_css_selector() then has to search linearly.
-	 * Hashing was also tested but did not help in practice:
-	 * each find_css_selector() call runs approximately one
-	 * strcasecmp(), and a hash function is unlikely to be
-	 * faster than that.  See ELinks bug 789 for details.
+	 * Hashing does not help with the small sets, where each
+	 * find_css_selector() call runs approximately one strcasecmp(),
+	 * and a hash function is unlikely to be faster than that.  See
+	 * ELinks bug 789 for details.  The top level set of a stylesheet
+	 * with thousands of rules is another matter, so the sets get
+	 * the index when they grow to #CSS_SELECTOR_INDEX_MIN selectors.  */
+	struct hash *index;
+
+	/** The list of selectors in this set.
 	 *
 	 * Keep this away from the beginning of the structure,
 	 * so that nobody can cast the struct css_selector_set *
 	 * to LIST_OF(struct css_selector) * and get away with it.  */
 	LIST_OF(struct css_selector) list;
 };
-#define INIT_CSS_SELECTOR_SET(set) { 0, { D_LIST_HEAD(set.list) } }
+#define INIT_CSS_SELECTOR_SET(set) { 0, 0, NULL, { D_LIST_HEAD(set.list) } }
+
+/** How many selectors a set has before it gets
+ * css_selector_set.index.  */
+#define CSS_SELECTOR_INDEX_MIN 16
 
 enum css_selector_relation {
 	CSR_ROOT, /**< First class stylesheet member. */
@@ -100,6 +112,12 @@ struct css_selector {
 	css_selector_type_T type;
 	char *name;
 
+	/** The set the selector is in and its entry in the index of the
+	 * set, if the set has one.  The key of the entry is the type,
+	 * the relation and the lowercased name.  */
+	struct css_selector_set *set;
+	struct hash_item *index_item;
+
 	LIST_OF(struct css_property) properties;
 };
 
@@ -140,6 +158,12 @@ struct css_stylesheet *init_css_stylesheet(css_stylesheet_importer_T importer,
 void mirror_css_stylesheet(struct css_stylesheet *css1,
 			   struct css_stylesheet *css2);
 
+/** Add copies of all the selectors of @a css2, with their leaves and
+ * properties, to @a css1 as if the source of @a css2 had been parsed
+ * into @a css1.  @a css2 is not changed. */
+void merge_css_stylesheets(struct css_stylesheet *css1,
+			   struct css_stylesheet *css2);
+
 /** Releases all the content of the stylesheet (but not the stylesheet
  * itself). */
 void done_css_stylesheet(struct css_stylesheet *css);
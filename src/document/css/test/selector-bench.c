@@ -0,0 +1,263 @@
+/* Compare finding the selectors of elements in the index with the list,
+ * and copying a parsed stylesheet with parsing it */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "document/css/css.h"
+#include "document/css/parser.h"
+#include "document/css/stylesheet.h"
+#include "util/memory.h"
+#include "util/string.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+struct option *config_options = NULL;
+
+#ifdef CONFIG_DEBUG
+union option_value *
+get_opt_(char *file, int line, enum option_type option_type,
+	 struct option *tree, const char *name, struct session *ses)
+#else
+union option_value *
+get_opt_(struct option *tree, const char *name, struct session *ses)
+#endif
+{
+	static union option_value value;
+
+	return &value;
+}
+
+int
+supports_css_media_type(const char *optstr,
+			const char *token, size_t token_length)
+{
+	return 1;
+}
+
+static const char *const tags[] = {
+	"a", "div", "span", "p", "li", "ul", "td", "tr", "table", "img",
+	"h1", "h2", "h3", "form", "input", "button", "section", "nav",
+};
+
+#define TAGS (sizeof(tags) / sizeof(*tags))
+
+static unsigned long random_state = 42;
+
+static int
+random_below(int n)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) % n;
+}
+
+/* Something like the stylesheet of a big site: mostly classes, some of
+ * them narrowed down by the element or an ancestor, and a few IDs. */
+static void
+make_stylesheet(struct string *css, int rules)
+{
+	int i;
+
+	for (i = 0; i < rules; i++) {
+		switch (random_below(8)) {
+		case 0:
+			add_format_to_string(css, "#id%d", i);
+			break;
+		case 1:
+			add_format_to_string(css, "%s.c%d",
+					     tags[random_below(TAGS)], i);
+			break;
+		case 2:
+			add_format_to_string(css, ".c%d %s",
+					     random_below(rules),
+					     tags[random_below(TAGS)]);
+			break;
+		case 3:
+			add_format_to_string(css, "%s", tags[random_below(TAGS)]);
+			break;
+		default:
+			add_format_to_string(css, ".C%d", i);
+		}
+		add_to_string(css, " { color: #123456; font-weight: bold }\n");
+	}
+}
+
+/* What find_css_selector() did before there was the index. */
+static struct css_selector *
+find_css_selector_in_list(struct css_selector_set *sels,
+			  css_selector_type_T type,
+			  enum css_selector_relation rel,
+			  const char *name, int namelen)
+{
+	struct css_selector *selector;
+
+	foreach_css_selector (selector, sels) {
+		if (type != selector->type || rel != selector->relation)
+			continue;
+		if (c_strlcasecmp(name, namelen, selector->name, -1))
+			continue;
+		return selector;
+	}
+
+	return NULL;
+}
+
+typedef struct css_selector *(*find_T)(struct css_selector_set *,
+				       css_selector_type_T,
+				       enum css_selector_relation,
+				       const char *, int);
+
+/* Looks the elements up like examine_element() does at the top of the
+ * stylesheet, and returns how many selectors were found. */
+static long
+find_selectors(struct css_stylesheet *css, find_T find, int elements,
+	       int rules, unsigned long *checksum)
+{
+	long found = 0;
+	int i;
+
+	random_state = 4711;
+	for (i = 0; i < elements; i++) {
+		const char *tag = tags[random_below(TAGS)];
+		char name[32];
+		struct css_selector *selector;
+		int j;
+
+		selector = find(&css->selectors, CST_ELEMENT, CSR_ROOT, "*", 1);
+		if (selector) found++, *checksum += (unsigned long) selector;
+
+		selector = find(&css->selectors, CST_ELEMENT, CSR_ROOT,
+				tag, strlen(tag));
+		if (selector) found++, *checksum += (unsigned long) selector;
+
+		for (j = 0; j < 2; j++) {
+			snprintf(name, sizeof(name), "c%d", random_below(rules));
+			selector = find(&css->selectors, CST_CLASS, CSR_ROOT,
+					name, strlen(name));
+			if (selector) found++, *checksum += (unsigned long) selector;
+		}
+
+		snprintf(name, sizeof(name), "id%d", random_below(rules));
+		selector = find(&css->selectors, CST_ID, CSR_ROOT,
+				name, strlen(name));
+		if (selector) found++, *checksum += (unsigned long) selector;
+	}
+
+	return found;
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct css_stylesheet css = INIT_CSS_STYLESHEET(css, NULL);
+	struct css_stylesheet copy = INIT_CSS_STYLESHEET(copy, NULL);
+	int rules = 5000;
+	int elements = 20000;
+	unsigned long index_sum = 0, list_sum = 0;
+	long index_found, list_found;
+	milliseconds_T parse, merge, index, list;
+	struct string source;
+	timeval_T start;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "rules", &i, argc, argv, "a number")) {
+			rules = atoi(arg);
+
+		} else if (get_test_opt(&arg, "elements", &i, argc, argv, "a number")) {
+			elements = atoi(arg);
+
+		} else {
+			die("usage: %s [--rules <n>] [--elements <n>]", argv[0]);
+		}
+	}
+
+	if (rules <= 0 || elements <= 0)
+		die("--rules and --elements must be positive");
+
+	if (!init_string(&source))
+		die("out of memory");
+	make_stylesheet(&source, rules);
+
+	timeval_now(&start);
+	css_parse_stylesheet(&css, NULL, source.source,
+			     source.source + source.length);
+	parse = elapsed_ms(&start);
+
+	timeval_now(&start);
+	merge_css_stylesheets(&copy, &css);
+	merge = elapsed_ms(&start);
+
+	if (copy.selectors.count != css.selectors.count)
+		die("the copy has %d top selectors, the stylesheet %d",
+		    copy.selectors.count, css.selectors.count);
+
+	timeval_now(&start);
+	index_found = find_selectors(&css, find_css_selector, elements, rules,
+				     &index_sum);
+	index = elapsed_ms(&start);
+
+	timeval_now(&start);
+	list_found = find_selectors(&css, find_css_selector_in_list, elements,
+				    rules, &list_sum);
+	list = elapsed_ms(&start);
+
+	if (index_found != list_found || index_sum != list_sum)
+		die("the index found %ld selectors, the list %ld",
+		    index_found, list_found);
+
+	printf("%d rules, %d top selectors: parsing %ld ms, copying %ld ms, "
+	       "%d elements with %ld selectors: index %ld ms, list %ld ms\n",
+	       rules, css.selectors.count, parse, merge, elements, index_found,
+	       index, list);
+
+	done_css_stylesheet(&copy);
+	done_css_stylesheet(&css);
+	done_string(&source);
+
+	return 0;
+}
@@ -82,6 +82,17 @@
 
 static INIT_LIST_OF(struct document, format_cache);
 
+/* The format cache is also hashed on the URI and the digest of the document
+ * options so get_cached_document() doesn't have to compare the options of
+ * every cached document. The list above is only used for LRU order. */
+#define FORMAT_CACHE_HASH_WIDTH 8
+
+static LIST_OF(struct format_cache_link) format_cache_hash[1 << FORMAT_CACHE_HASH_WIDTH];
+
+#define format_cache_bucket(uri, digest) \
+	(format_cache_hash[(((unsigned long) (uri) >> 4) ^ (digest)) \
+			   & ((1 << FORMAT_CACHE_HASH_WIDTH) - 1)])
+
 const char *script_event_hook_name[] = {
 	"click",
 	"dblclick",
@@ -169,6 +180,11 @@ init_document(struct cache_entry *cached, struct document_options *options)
 
 	add_to_list(format_cache, document);
 
+	document->options_digest = digest_opt(&document->options);
+	document->hash_link.document = document;
+	add_to_list(format_cache_bucket(document->uri, document->options_digest),
+		    &document->hash_link);
+
 	return document;
 }
 
@@ -307,6 +323,8 @@ reset_document(struct document *document)
 	mem_free_set(&document->slines1, NULL);
 	mem_free_set(&document->slines2, NULL);
 	mem_free_set(&document->search_points, NULL);
+	done_plain_checkpoint(document);
+	done_html_checkpoint(document);
 
 #ifdef CONFIG_COMBINE
 	discard_comb_x_y(document);
@@ -387,7 +405,10 @@ done_document(struct document *document)
 	mem_free_if(document->slines1);
 	mem_free_if(document->slines2);
 	mem_free_if(document->search_points);
+	done_plain_checkpoint(document);
+	done_html_checkpoint(document);
 
+	del_from_list(&document->hash_link);
 	del_from_list(document);
 	mem_free(document);
 }
@@ -475,20 +496,60 @@ update_cached_document_options(struct session *ses)
 	}
 }
 
+void
+done_plain_checkpoint(struct document *document)
+{
+	struct plain_checkpoint *checkpoint = document->plain_checkpoint;
+
+	if (!checkpoint) return;
+
+	mem_free_if(checkpoint->head);
+	mem_free(checkpoint);
+	document->plain_checkpoint = NULL;
+}
+
+/* Whether rendering of the out-of-date @document can continue where the
+ * previous rendering stopped. */
+static int
+is_resumable_document(struct document *document)
+{
+	struct plain_checkpoint *plain = document->plain_checkpoint;
+	struct html_checkpoint *html = document->html_checkpoint;
+	struct cache_entry *cached = document->cached;
+	char *head = empty_string_or_(cached->head);
+
+	if (plain)
+		return plain->data_id == cached->data_id
+			&& !strcmp(plain->head, head);
+
+	/* The lines rendered before the checkpoint were styled with the
+	 * stylesheets imported by then. */
+	return html
+		&& html->data_id == cached->data_id
+		&& !strcmp(html->head, head)
+		&& check_document_css_magic(document);
+}
+
 struct document *
 get_cached_document(struct cache_entry *cached, struct document_options *options)
 {
-	struct document *document, *next;
+	struct format_cache_link *link, *next;
+	unsigned long digest = digest_opt(options);
+
+	foreachsafe (link, next, format_cache_bucket(cached->uri, digest)) {
+		struct document *document = link->document;
 
-	foreachsafe (document, next, format_cache) {
 		if (!compare_uri(document->uri, cached->uri, 0)
+		    || document->options_digest != digest
 		    || compare_opt(&document->options, options))
 			continue;
 
 		if (options->no_cache
 		    || cached->cache_id != document->cache_id
 		    || !check_document_css_magic(document)) {
-			if (!is_object_used(document)) {
+			if (!is_object_used(document)
+			    && (options->no_cache
+				|| !is_resumable_document(document))) {
 				done_document(document);
 			}
 			continue;
@@ -505,6 +566,57 @@ get_cached_document(struct cache_entry *cached, struct document_options *options
 	return NULL;
 }
 
+struct document *
+get_resumable_document(struct cache_entry *cached, struct document_options *options)
+{
+	struct format_cache_link *link;
+	unsigned long digest = digest_opt(options);
+
+	if (options->no_cache) return NULL;
+
+	foreach (link, format_cache_bucket(cached->uri, digest)) {
+		struct document *document = link->document;
+
+		if (document->cached != cached
+		    || is_object_used(document)
+		    || !is_resumable_document(document)
+		    || !compare_uri(document->uri, cached->uri, 0)
+		    || document->options_digest != digest
+		    || compare_opt(&document->options, options))
+			continue;
+
+		move_to_top_of_list(format_cache, document);
+
+		object_lock(document);
+		document->cache_id = cached->cache_id;
+
+		return document;
+	}
+
+	return NULL;
+}
+
+void
+drop_superseded_documents(struct document *document)
+{
+	struct format_cache_link *link, *next;
+
+	foreachsafe (link, next, format_cache_bucket(document->uri,
+						      document->options_digest)) {
+		struct document *old = link->document;
+
+		if (old == document
+		    || old->cached != document->cached
+		    || is_object_used(old)
+		    || !is_resumable_document(old)
+		    || old->options_digest != document->options_digest
+		    || compare_opt(&old->options, &document->options))
+			continue;
+
+		done_document(old);
+	}
+}
+
 void
 shrink_format_cache(int whole)
 {
@@ -518,8 +630,9 @@ shrink_format_cache(int whole)
 		format_cache_entries++;
 
 		/* Destroy obsolete renderer documents which are already
-		 * out-of-sync. */
-		if (document->cached->cache_id == document->cache_id)
+		 * out-of-sync and can not be brought up to date. */
+		if (document->cached->cache_id == document->cache_id
+		    || is_resumable_document(document))
 			continue;
 
 		done_document(document);
@@ -578,6 +691,11 @@ get_format_cache_refresh_count(void)
 static void
 init_documents(struct module *module)
 {
+	int i;
+
+	for (i = 0; i < (1 << FORMAT_CACHE_HASH_WIDTH); i++)
+		init_list(format_cache_hash[i]);
+
 	init_tags_lookup();
 }
 
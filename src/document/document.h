@@ -6,6 +6,7 @@
 #include "main/object.h"
 #include "main/timer.h"
 #include "protocol/uri.h"
+#include "terminal/draw.h"
 #include "util/color.h"
 #include "util/lists.h"
 #include "util/box.h"
@@ -21,6 +22,7 @@ struct ecmascript_timeout;
 struct el_form_control;
 struct frame_desc;
 struct frameset_desc;
+struct html_checkpoint;
 struct module;
 struct screen_char;
 
@@ -33,6 +35,26 @@ struct node {
 };
 
 
+/** Where the plain text renderer can continue rendering a document that was
+ * rendered from an incomplete cache entry when more data has been appended
+ * to the entry. Everything before @offset in the source is rendered in the
+ * first @lineno lines and can not be changed by data that comes later. */
+struct plain_checkpoint {
+	unsigned int data_id;	/**< cache_entry.data_id of the source */
+	char *head;		/**< Copy of the protocol header */
+	off_t offset;		/**< Source bytes rendered in stable lines */
+	int cp;			/**< Charset the source was decoded from */
+
+	/** Renderer state at @offset */
+	struct screen_char template_;
+	int lineno;
+	unsigned int was_empty_line:1;
+	unsigned int was_wrapped:1;
+
+	/** Document state at @offset */
+	int width, height, nlinks;
+};
+
 /** The document line consisting of the chars ready to be copied to
  * the terminal screen. */
 struct line {
@@ -196,10 +218,21 @@ struct search {
 };
 #endif
 
+/** Chains a document into the format cache hash used by
+ * get_cached_document(). */
+struct format_cache_link {
+	LIST_HEAD(struct format_cache_link);
+
+	struct document *document;
+};
+
 struct document {
 	OBJECT_HEAD(struct document);
 
 	struct document_options options;
+	/** digest_opt() of #options when the document was created. */
+	unsigned long options_digest;
+	struct format_cache_link hash_link;
 
 	LIST_OF(struct form) forms;
 	LIST_OF(struct tag) tags;
@@ -259,6 +292,12 @@ struct document {
 	struct link **lines2; /**< The last link on the line. */
 	/** @} */
 
+	/** Set when the plain renderer can continue rendering the
+	 * document after more data was loaded. */
+	struct plain_checkpoint *plain_checkpoint;
+	/** The same for the HTML renderer. */
+	struct html_checkpoint *html_checkpoint;
+
 	struct search *search;
 	struct search **slines1;
 	struct search **slines2;
@@ -319,6 +358,17 @@ void update_cached_document_options(struct session *ses);
 
 struct document *get_cached_document(struct cache_entry *cached, struct document_options *options);
 
+/** Returns a document formatted from older contents of @cached, which can be
+ * brought up to date by only rendering the data appended since. */
+struct document *get_resumable_document(struct cache_entry *cached, struct document_options *options);
+
+/** Frees the out-of-date documents formatted from the same cache entry with
+ * the same options as @document, which could have been resumed but which
+ * @document now replaces. */
+void drop_superseded_documents(struct document *document);
+
+void done_plain_checkpoint(struct document *document);
+
 /** Release a reference to the document.
  * @relates document */
 void release_document(struct document *document);
@@ -135,6 +135,11 @@ struct html_context {
 	 * html/parser/parse.c
 	 * html/parser.c */
 	void *(*special_f)(struct html_context *, html_special_type_T, ...);
+
+	/* For parser/parse.c: called at the top level, between the elements
+	 * and text, so that the renderer can save the state of the parsing
+	 * and continue from there when more of the document is loaded. */
+	void (*checkpoint_f)(struct html_context *, char *);
 };
 
 #define html_top	((struct html_element *) html_context->stack.next)
@@ -142,6 +142,18 @@ enum html_element_pseudo_class {
 
 typedef unsigned char html_element_pseudo_class_T;
 
+#ifdef CONFIG_CSS
+/* How many bits the ancestor filter of an element has. */
+#define HTML_ANCESTOR_FILTER_BITS 512
+
+/* A Bloom filter of the element names, IDs and classes of the ancestors
+ * of an element, so that the CSS engine can tell without walking the
+ * stack that none of them has a name.  html_stack_dup() sets it up. */
+struct html_ancestor_filter {
+	unsigned char bits[HTML_ANCESTOR_FILTER_BITS / 8];
+};
+#endif
+
 struct html_element {
 	LIST_HEAD(struct html_element);
 
@@ -170,6 +182,10 @@ struct html_element {
 
 	/* For the needs of CSS engine. A wannabe bitmask. */
 	html_element_pseudo_class_T pseudo_class;
+
+#ifdef CONFIG_CSS
+	struct html_ancestor_filter ancestors;
+#endif
 };
 
 #define is_inline_element(e) ((e)->linebreak == 0)
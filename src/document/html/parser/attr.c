@@ -0,0 +1,295 @@
+/* HTML element attributes */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "document/html/parser/attr.h"
+#include "intl/charsets.h"
+#include "util/conv.h"
+#include "util/memdebug.h"
+#include "util/memory.h"
+#include "util/string.h"
+
+
+/* How many attributes of an element a table has room for.  The rest of
+ * them are found by scanning the source again. */
+#define ATTR_TABLE_SIZE	32
+
+/* For how many elements the tables are kept.  The element handlers ask
+ * about the element they handle and sometimes about the few following
+ * ones, like the table cells or the select options. */
+#define ATTR_TABLES	4
+
+/* An attribute as it is in the source.  Its value is copied and the
+ * entities in it decoded only when the value is asked for. */
+struct attr_value {
+	char *name;
+	int namelen;
+	unsigned int hash;
+
+	/* Where the value starts, at its quote if it has one, or NULL if
+	 * the attribute has no value. */
+	char *value;
+};
+
+/* The attributes of the element whose attributes start at @attr. */
+struct attr_value_table {
+	char *attr;
+	int count;
+
+	/* The element has more attributes than the table has room for. */
+	unsigned int overflow:1;
+
+	struct attr_value values[ATTR_TABLE_SIZE];
+};
+
+static struct attr_value_table attr_value_tables[ATTR_TABLES];
+static int next_attr_value_table;
+
+
+static inline unsigned int
+hash_attr_name(const char *name, int namelen)
+{
+	unsigned int hash = 0;
+	int i;
+
+	for (i = 0; i < namelen; i++)
+		hash = hash * 31 + c_toupper(name[i]);
+
+	return hash;
+}
+
+/* Splits the attributes at @e up into @table, stopping where a bad
+ * attribute or value would make get_attr_value() give up. */
+static void
+init_attr_value_table(struct attr_value_table *table, char *e)
+{
+	table->attr = e;
+	table->count = 0;
+	table->overflow = 0;
+
+	for (;;) {
+		struct attr_value *value;
+
+		skip_space(e);
+		if (end_of_tag(*e) || !atchr(*e)) return;
+
+		if (table->count == ATTR_TABLE_SIZE) {
+			table->overflow = 1;
+			return;
+		}
+
+		value = &table->values[table->count++];
+		value->name = e;
+		while (atchr(*e)) e++;
+		value->namelen = e - value->name;
+		value->hash = hash_attr_name(value->name, value->namelen);
+		value->value = NULL;
+
+		skip_space(e);
+		if (*e != '=') continue;
+		e++;
+		skip_space(e);
+		value->value = e;
+
+		/* The value is checked again when it is copied. */
+		if (!isquote(*e)) {
+			while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
+				if (!*e) return;
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+
+			while (*(++e) != quote)
+				if (!*e) return;
+			e++;
+		}
+	}
+}
+
+static struct attr_value_table *
+get_attr_value_table(char *e)
+{
+	struct attr_value_table *table;
+	int i;
+
+	for (i = 0; i < ATTR_TABLES; i++)
+		if (attr_value_tables[i].attr == e)
+			return &attr_value_tables[i];
+
+	table = &attr_value_tables[next_attr_value_table];
+	next_attr_value_table = (next_attr_value_table + 1) % ATTR_TABLES;
+	init_attr_value_table(table, e);
+
+	return table;
+}
+
+void
+forget_attr_value_table(char *e)
+{
+	int i;
+
+	for (i = 0; i < ATTR_TABLES; i++)
+		if (attr_value_tables[i].attr == e)
+			attr_value_tables[i].attr = NULL;
+}
+
+
+#define realloc_chrs(x, l) mem_align_alloc(x, l, (l) + 1, 0xFF)
+
+#define add_chr(s, l, c)						\
+	do {								\
+		if (!realloc_chrs(&(s), l)) return NULL;		\
+		(s)[(l)++] = (c);					\
+	} while (0)
+
+/* Copies the value starting at @e, which is NULL for an attribute without
+ * any value. */
+static char *
+copy_attr_value(char *e, const char *name, int cp, enum html_attr_flags flags)
+{
+	char *attr = NULL;
+	int attrlen = 0;
+
+	if (!e) {
+		/* An empty string, then. */
+	} else if (!isquote(*e)) {
+		while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
+			if (!*e) goto parse_error;
+			add_chr(attr, attrlen, *e);
+			e++;
+		}
+	} else {
+		unsigned char quote = *e;
+
+/* parse_quoted_value: */
+		while (*(++e) != quote) {
+			if (!*e) goto parse_error;
+			if (flags & HTML_ATTR_LITERAL_NL)
+				add_chr(attr, attrlen, *e);
+			else if (*e == ASCII_CR) continue;
+			else if (*e != ASCII_TAB && *e != ASCII_LF)
+				add_chr(attr, attrlen, *e);
+			else if (!(flags & HTML_ATTR_EAT_NL))
+				add_chr(attr, attrlen, ' ');
+		}
+		e++;
+		/* The following apparently handles the case of <foo
+		 * id="a""b">, however that is very rare and probably
+		 * not conforming. More frequent (and mishandling it
+		 * more fatal) is probably the typo of <foo id="a""> -
+		 * we can handle it as long as this is commented out.
+		 * --pasky */
+#if 0
+		if (*e == quote) {
+			add_chr(attr, attrlen, *e);
+			goto parse_quoted_value;
+		}
+#endif
+	}
+
+	add_chr(attr, attrlen, '\0');
+	attrlen--;
+
+	if (/* Unused: !(flags & HTML_ATTR_NO_CONV) && */
+	    memchr(attr, '&', attrlen)) {
+		char *saved_attr = attr;
+
+		attr = convert_string(NULL, saved_attr, attrlen, cp,
+		                      CSM_QUERY, NULL, NULL, NULL);
+		mem_free(saved_attr);
+	}
+
+	set_mem_comment(attr, name, strlen(name));
+	return attr;
+
+parse_error:
+	mem_free_if(attr);
+	return NULL;
+}
+
+#undef add_chr
+
+/* Finds the attribute @name by scanning all the attributes at @e, for
+ * the elements with more of them than a table has room for. */
+static char *
+scan_attr_value(char *e, const char *name, int cp, enum html_attr_flags flags)
+{
+	const char *n;
+	char *name_start;
+	int found;
+
+next_attr:
+	skip_space(e);
+	if (end_of_tag(*e) || !atchr(*e)) return NULL;
+	n = name;
+	name_start = e;
+
+	while (atchr(*n) && atchr(*e) && c_toupper(*e) == c_toupper(*n)) e++, n++;
+	found = !*n && !atchr(*e);
+
+	if (found && (flags & HTML_ATTR_TEST)) return name_start;
+
+	while (atchr(*e)) e++;
+	skip_space(e);
+	if (*e != '=') {
+		if (found) return copy_attr_value(NULL, name, cp, flags);
+		goto next_attr;
+	}
+	e++;
+	skip_space(e);
+
+	if (found) return copy_attr_value(e, name, cp, flags);
+
+	if (!isquote(*e)) {
+		while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
+			if (!*e) return NULL;
+			e++;
+		}
+	} else {
+		unsigned char quote = *e;
+
+		do {
+			while (*(++e) != quote)
+				if (!*e) return NULL;
+			e++;
+		} while (/* See above. *e == quote */ 0);
+	}
+
+	goto next_attr;
+}
+
+char *
+get_attr_value(char *e, const char *name,
+	       int cp, enum html_attr_flags flags)
+{
+	struct attr_value_table *table = get_attr_value_table(e);
+	int namelen = strlen(name);
+	unsigned int hash = hash_attr_name(name, namelen);
+	int i;
+
+	for (i = 0; i < table->count; i++) {
+		struct attr_value *value = &table->values[i];
+
+		if (value->hash != hash
+		    || value->namelen != namelen
+		    || c_strncasecmp(value->name, name, namelen))
+			continue;
+
+		if (flags & HTML_ATTR_TEST) return value->name;
+
+		return copy_attr_value(value->value, name, cp, flags);
+	}
+
+	if (table->overflow)
+		return scan_attr_value(e, name, cp, flags);
+
+	return NULL;
+}
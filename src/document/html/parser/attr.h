@@ -0,0 +1,65 @@
+#ifndef EL__DOCUMENT_HTML_PARSER_ATTR_H
+#define EL__DOCUMENT_HTML_PARSER_ATTR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define end_of_tag(c) ((c) == '>' || (c) == '<')
+
+static inline int
+atchr(unsigned char c)
+{
+	return (c < 127 && (c > '>' || (c > ' ' && c != '=' && !end_of_tag(c))));
+}
+
+/* Flags for get_attr_value(). */
+enum html_attr_flags {
+	HTML_ATTR_NONE = 0,
+
+	/* If HTML_ATTR_TEST is set then we only test for existence of
+	 * an attribute of that @name. In that mode it returns NULL if
+	 * attribute was not found, and a pointer to start of the attribute
+	 * if it was found. */
+	HTML_ATTR_TEST = 1,
+
+	/* If HTML_ATTR_EAT_NL is not set, newline and tabs chars are
+	 * replaced by spaces in returned value, else these chars are
+	 * skipped. */
+	HTML_ATTR_EAT_NL = 2,
+
+	/* If HTML_ATTR_NO_CONV is set, then convert_string() is not called
+	 * on value. Unused for now. */
+	/* HTML_ATTR_NO_CONV = 4, */
+
+	/* If HTML_ATTR_LITERAL_NL is set, carriage return, newline and tab
+	 * characters are returned literally. */
+	HTML_ATTR_LITERAL_NL = 8,
+};
+
+/* Parses html element attributes.
+ * - e is attr pointer previously get from parse_element,
+ * DON'T PASS HERE ANY OTHER VALUE!!!
+ * - name is searched attribute
+ *
+ * The attributes of the last few elements asked about are split up only
+ * once, the values are copied and decoded on each call.
+ *
+ * Returns allocated string containing the attribute, or NULL on unsuccess. */
+char *get_attr_value(char *e, const char *name, int cp, enum html_attr_flags flags);
+
+/* Wrappers for get_attr_value(). */
+#define get_attr_val(e, name, cp) get_attr_value(e, name, cp, HTML_ATTR_NONE)
+#define get_lit_attr_val(e, name, cp) get_attr_value(e, name, cp, HTML_ATTR_LITERAL_NL)
+#define get_url_val(e, name, cp) get_attr_value(e, name, cp, HTML_ATTR_EAT_NL)
+#define has_attr(e, name, cp) (!!get_attr_value(e, name, cp, HTML_ATTR_TEST))
+
+/* Drops what get_attr_value() has kept about the attributes at @e, which
+ * parse_element() has just found there and may be new. */
+void forget_attr_value_table(char *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
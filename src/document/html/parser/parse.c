@@ -16,6 +16,7 @@
 #include "document/css/apply.h"
 #include "document/css/css.h"
 #include "document/css/parser.h"
+#include "document/html/parser/attr.h"
 #include "document/html/parser/forms.h"
 #include "document/html/parser/general.h"
 #include "document/html/parser/link.h"
@@ -30,20 +31,13 @@
 #include "util/fastfind.h"
 #include "util/memdebug.h"
 #include "util/memory.h"
+#include "util/memscan.h"
 #include "util/string.h"
 
 /* Unsafe macros */
 #include "document/html/internal.h"
 
 
-#define end_of_tag(c) ((c) == '>' || (c) == '<')
-
-static inline int
-atchr(unsigned char c)
-{
-	return (c < 127 && (c > '>' || (c > ' ' && c != '=' && !end_of_tag(c))));
-}
-
 /* This function eats one html element. */
 /* - e is pointer to the begining of the element (*e must be '<')
  * - eof is pointer to the end of scanned area
@@ -80,7 +74,10 @@ parse_element(char *e, char *eof,
 	/* Skip bad attribute */
 	while (!atchr(*e) && !end_of_tag(*e) && !isspace((unsigned char)*e)) next_char();
 
-	if (attr) *attr = e;
+	if (attr) {
+		*attr = e;
+		forget_attr_value_table(e);
+	}
 
 next_attr:
 	while (isspace((unsigned char)*e)) next_char();
@@ -129,123 +126,6 @@ end:
 }
 
 
-#define realloc_chrs(x, l) mem_align_alloc(x, l, (l) + 1, 0xFF)
-
-#define add_chr(s, l, c)						\
-	do {								\
-		if (!realloc_chrs(&(s), l)) return NULL;		\
-		(s)[(l)++] = (c);					\
-	} while (0)
-
-char *
-get_attr_value(char *e, const char *name,
-	       int cp, enum html_attr_flags flags)
-{
-	char *n;
-	char *name_start;
-	char *attr = NULL;
-	int attrlen = 0;
-	int found;
-
-next_attr:
-	skip_space(e);
-	if (end_of_tag(*e) || !atchr(*e)) goto parse_error;
-	n = (char *)name;
-	name_start = e;
-
-	while (atchr(*n) && atchr(*e) && c_toupper(*e) == c_toupper(*n)) e++, n++;
-	found = !*n && !atchr(*e);
-
-	if (found && (flags & HTML_ATTR_TEST)) return name_start;
-
-	while (atchr(*e)) e++;
-	skip_space(e);
-	if (*e != '=') {
-		if (found) goto found_endattr;
-		goto next_attr;
-	}
-	e++;
-	skip_space(e);
-
-	if (found) {
-		if (!isquote(*e)) {
-			while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
-				if (!*e) goto parse_error;
-				add_chr(attr, attrlen, *e);
-				e++;
-			}
-		} else {
-			unsigned char quote = *e;
-
-/* parse_quoted_value: */
-			while (*(++e) != quote) {
-				if (!*e) goto parse_error;
-				if (flags & HTML_ATTR_LITERAL_NL)
-					add_chr(attr, attrlen, *e);
-				else if (*e == ASCII_CR) continue;
-				else if (*e != ASCII_TAB && *e != ASCII_LF)
-					add_chr(attr, attrlen, *e);
-				else if (!(flags & HTML_ATTR_EAT_NL))
-					add_chr(attr, attrlen, ' ');
-			}
-			e++;
-			/* The following apparently handles the case of <foo
-			 * id="a""b">, however that is very rare and probably
-			 * not conforming. More frequent (and mishandling it
-			 * more fatal) is probably the typo of <foo id="a""> -
-			 * we can handle it as long as this is commented out.
-			 * --pasky */
-#if 0
-			if (*e == quote) {
-				add_chr(attr, attrlen, *e);
-				goto parse_quoted_value;
-			}
-#endif
-		}
-
-found_endattr:
-		add_chr(attr, attrlen, '\0');
-		attrlen--;
-
-		if (/* Unused: !(flags & HTML_ATTR_NO_CONV) && */
-		    memchr(attr, '&', attrlen)) {
-			char *saved_attr = attr;
-
-			attr = convert_string(NULL, saved_attr, attrlen, cp,
-			                      CSM_QUERY, NULL, NULL, NULL);
-			mem_free(saved_attr);
-		}
-
-		set_mem_comment(attr, name, strlen(name));
-		return attr;
-
-	} else {
-		if (!isquote(*e)) {
-			while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
-				if (!*e) goto parse_error;
-				e++;
-			}
-		} else {
-			unsigned char quote = *e;
-
-			do {
-				while (*(++e) != quote)
-					if (!*e) goto parse_error;
-				e++;
-			} while (/* See above. *e == quote */ 0);
-		}
-	}
-
-	goto next_attr;
-
-parse_error:
-	mem_free_if(attr);
-	return NULL;
-}
-
-#undef add_chr
-
-
 /* Extract numerical value of attribute @name.
  * It will return a positive integer value on success,
  * or -1 on error. */
@@ -390,11 +270,11 @@ skip_comment(char *html, char *eof)
 {
 	if (html + 4 <= eof && html[2] == '-' && html[3] == '-') {
 		html += 4;
-		while (html < eof) {
-			if (html + 2 <= eof && html[0] == '-' && html[1] == '-') {
+		while ((html = (char *)memchr(html, '-', eof - html))) {
+			if (html + 2 <= eof && html[1] == '-') {
 				html += 2;
 				while (html < eof && *html == '-') html++;
-				while (html < eof && isspace((unsigned char)*html)) html++;
+				html = (char *) memscan_spaces(html, eof);
 				if (html >= eof) return eof;
 				if (*html == '>') return html + 1;
 				continue;
@@ -403,11 +283,8 @@ skip_comment(char *html, char *eof)
 		}
 
 	} else {
-		html += 2;
-		while (html < eof) {
-			if (html[0] == '>') return html + 1;
-			html++;
-		}
+		html = (char *)memchr(html + 2, '>', eof - html - 2);
+		if (html) return html + 1;
 	}
 
 	return eof;
@@ -665,9 +542,6 @@ parse_html(char *html, char *eof,
 	   struct part *part, char *head,
 	   struct html_context *html_context)
 {
-	char *base_pos = html;
-	int noupdate = 0;
-
 	html_context->putsp = HTML_SPACE_SUPPRESS;
 	html_context->line_breax = html_context->table_level ? 2 : 1;
 	html_context->position = 0;
@@ -679,6 +553,18 @@ parse_html(char *html, char *eof,
 	html_context->eoff = eof;
 	if (head) process_head(html_context, head);
 
+	continue_parse_html(html, eof, part, html_context);
+}
+
+/* Parses from @html on with the state that @html_context has, either from
+ * parse_html() or restored from an earlier parsing of the same source. */
+void
+continue_parse_html(char *html, char *eof, struct part *part,
+		    struct html_context *html_context)
+{
+	char *base_pos = html;
+	int noupdate = 0;
+
 main_loop:
 	while (html < eof) {
 		char *name, *attr, *end;
@@ -689,6 +575,10 @@ main_loop:
 			html_context->part = part;
 			html_context->eoff = eof;
 			base_pos = html;
+
+			/* Everything before @html has been put out. */
+			if (html_context->checkpoint_f && !html_context->table_level)
+				html_context->checkpoint_f(html_context, html);
 		} else {
 			noupdate = 0;
 		}
@@ -696,8 +586,7 @@ main_loop:
 		if (isspace((unsigned char)*html) && !html_is_preformatted()) {
 			char *h = html;
 
-			while (h < eof && isspace((unsigned char)*h))
-				h++;
+			h = (char *) memscan_spaces(h, eof);
 			if (h + 1 < eof && h[0] == '<' && h[1] == '/') {
 				if (!parse_element(h, eof, &name, &namelen, &attr, &end)) {
 					put_chrs(html_context, base_pos, html - base_pos);
@@ -722,8 +611,7 @@ main_loop:
 			}
 
 skip_w:
-			while (html < eof && isspace((unsigned char)*html))
-				html++;
+			html = (char *) memscan_spaces(html, eof);
 			continue;
 		}
 
@@ -798,7 +686,9 @@ next_break:
 		}
 
 		if (*html != '<' || parse_element(html, eof, &name, &namelen, &attr, &end)) {
-			html++;
+			/* The ordinary characters up to the next one which
+			 * could start anything else stay in the text. */
+			html = (char *) memscan_text(html + 1, eof, '<', '&');
 			noupdate = 1;
 			continue;
 		}
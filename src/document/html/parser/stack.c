@@ -147,6 +147,88 @@ kill_html_stack_item(struct html_context *html_context, struct html_element *e)
 }
 
 
+#ifdef CONFIG_CSS
+static unsigned int
+hash_ancestor_name(css_selector_type_T type, const char *name, int namelen)
+{
+	/* FNV-1a of the type and the lowercased name, which the selectors
+	 * match case-insensitively. */
+	unsigned int hash = (2166136261U ^ type) * 16777619U;
+	int i;
+
+	for (i = 0; i < namelen; i++)
+		hash = (hash ^ (unsigned char) c_tolower(name[i])) * 16777619U;
+
+	return hash;
+}
+
+#define ancestor_filter_bit(hash, n) \
+	(((hash) >> ((n) * 16)) % HTML_ANCESTOR_FILTER_BITS)
+
+static void
+add_to_ancestor_filter(struct html_ancestor_filter *filter,
+		       css_selector_type_T type, const char *name, int namelen)
+{
+	unsigned int hash = hash_ancestor_name(type, name, namelen);
+	int n;
+
+	for (n = 0; n < 2; n++) {
+		unsigned int bit = ancestor_filter_bit(hash, n);
+
+		filter->bits[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+int
+may_have_html_ancestor(struct html_element *element, css_selector_type_T type,
+		       const char *name, int namelen)
+{
+	unsigned int hash;
+	int n;
+
+	if (namelen < 0)
+		namelen = strlen(name);
+	hash = hash_ancestor_name(type, name, namelen);
+
+	for (n = 0; n < 2; n++) {
+		unsigned int bit = ancestor_filter_bit(hash, n);
+
+		if (!(element->ancestors.bits[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Adds what the CSS selectors can match of @element to @filter, the same
+ * names examine_element() looks up. */
+static void
+add_element_to_ancestor_filter(struct html_ancestor_filter *filter,
+			       struct html_element *element)
+{
+	const char *class_ = element->attr.class_;
+
+	if (element->namelen)
+		add_to_ancestor_filter(filter, CST_ELEMENT,
+				       element->name, element->namelen);
+
+	if (element->attr.id)
+		add_to_ancestor_filter(filter, CST_ID, element->attr.id,
+				       strlen(element->attr.id));
+
+	while (class_) {
+		const char *begin;
+
+		while (*class_ == ' ') ++class_;
+		if (*class_ == '\0') break;
+		begin = class_;
+		while (*class_ != ' ' && *class_ != '\0') ++class_;
+
+		add_to_ancestor_filter(filter, CST_CLASS, begin, class_ - begin);
+	}
+}
+#endif
+
 void
 html_stack_dup(struct html_context *html_context, enum html_element_mortality_type type)
 {
@@ -161,6 +243,13 @@ html_stack_dup(struct html_context *html_context, enum html_element_mortality_ty
 
 	copy_struct(e, ep);
 
+#ifdef CONFIG_CSS
+	/* The element on the top is done with its name, ID and classes by
+	 * the time elements are put inside it, and the filter it has got
+	 * from its parent already covers the rest of the stack. */
+	add_element_to_ancestor_filter(&e->ancestors, ep);
+#endif
+
 	if (ep->attr.link) e->attr.link = stracpy(ep->attr.link);
 	if (ep->attr.target) e->attr.target = stracpy(ep->attr.target);
 	if (ep->attr.image) e->attr.image = stracpy(ep->attr.image);
@@ -2,6 +2,9 @@
 #ifndef EL__DOCUMENT_HTML_PARSER_STACK_H
 #define EL__DOCUMENT_HTML_PARSER_STACK_H
 
+#ifdef CONFIG_CSS
+#include "document/css/stylesheet.h" /* css_selector_type_T */
+#endif
 #include "document/html/parser.h"
 
 #ifdef __cplusplus
@@ -16,6 +19,14 @@ struct html_element *search_html_stack(struct html_context *html_context,
 void html_stack_dup(struct html_context *html_context,
                     enum html_element_mortality_type type);
 
+#ifdef CONFIG_CSS
+/* Returns zero if no ancestor of @element has the element name, ID or
+ * class (depending on @type) @name, and nonzero if one may have it. */
+int may_have_html_ancestor(struct html_element *element,
+                           css_selector_type_T type,
+                           const char *name, int namelen);
+#endif
+
 void kill_html_stack_item(struct html_context *html_context,
                           struct html_element *e);
 #define pop_html_element(html_context) \
@@ -35,6 +35,7 @@
 #include "document/html/iframes.h"
 #include "document/html/parser.h"
 #include "document/html/parser/parse.h"
+#include "document/html/parser/stack.h"
 #include "document/html/renderer.h"
 #include "document/html/tables.h"
 #include "document/options.h"
@@ -52,6 +53,7 @@
 #include "util/hash.h"
 #include "util/lists.h"
 #include "util/memory.h"
+#include "util/memscan.h"
 #include "util/string.h"
 #include "util/time.h"
 #include "viewer/text/form.h"
@@ -99,6 +101,7 @@ struct renderer_context renderer_context;
 
 /* Prototypes */
 static void put_chars(struct html_context *, const char *, int);
+static void drop_html_checkpoint(struct html_context *, struct document *);
 
 #define X(x_)	(part->box.x + (x_))
 #define Y(y_)	(part->box.y + (y_))
@@ -1854,13 +1857,7 @@ get_link_state(struct html_context *html_context)
 static inline int
 html_has_non_space_chars(const char *chars, int charslen)
 {
-	int pos = 0;
-
-	while (pos < charslen)
-		if (!isspace((unsigned char)chars[pos++]))
-			return 1;
-
-	return 0;
+	return memscan_spaces(chars, chars + charslen) < chars + charslen;
 }
 
 static void
@@ -2333,6 +2330,7 @@ html_special(struct html_context *html_context, html_special_type_T c, ...)
 			struct frameset_param *fsp = va_arg(l, struct frameset_param *);
 			struct frameset_desc *frameset_desc;
 
+			drop_html_checkpoint(html_context, document);
 			if (!fsp->parent && document->frame_desc)
 				break;
 
@@ -2361,6 +2359,7 @@ html_special(struct html_context *html_context, html_special_type_T c, ...)
 			char *t = va_arg(l, char *);
 
 			if (document) {
+				drop_html_checkpoint(html_context, document);
 				if (document->refresh)
 					done_document_refresh(document->refresh);
 				document->refresh = init_document_refresh(t, seconds);
@@ -2368,8 +2367,10 @@ html_special(struct html_context *html_context, html_special_type_T c, ...)
 			break;
 		}
 		case SP_COLOR_LINK_LINES:
-			if (document && use_document_bg_colors(&document->options))
+			if (document && use_document_bg_colors(&document->options)) {
+				drop_html_checkpoint(html_context, document);
 				color_link_lines(html_context);
+			}
 			break;
 		case SP_STYLESHEET:
 #ifdef CONFIG_CSS
@@ -2399,6 +2400,7 @@ html_special(struct html_context *html_context, html_special_type_T c, ...)
 				int width = va_arg(l, int);
 				int height = va_arg(l, int);
 
+				drop_html_checkpoint(html_context, document);
 				add_iframeset_entry(&document->iframe_desc, url, name, y, width, height);
 			}
 			break;
@@ -2575,17 +2577,491 @@ ret:
 	return part;
 }
 
+/* How many bytes of the source must follow a point before it can be
+ * a checkpoint, for the look at the next characters the parser takes
+ * before it is done with the text and tags. */
+#define HTML_CHECKPOINT_MARGIN	8
+
+static struct html_element *
+copy_html_element(struct html_element *e)
+{
+	struct html_element *copy = (struct html_element *)mem_alloc(sizeof(*copy));
+
+	if (!copy) return NULL;
+
+	copy_struct(copy, e);
+	copy->attr.link = null_or_stracpy(e->attr.link);
+	copy->attr.target = null_or_stracpy(e->attr.target);
+	copy->attr.image = null_or_stracpy(e->attr.image);
+	copy->attr.title = null_or_stracpy(e->attr.title);
+	copy->attr.select = null_or_stracpy(e->attr.select);
+#ifdef CONFIG_CSS
+	copy->attr.id = null_or_stracpy(e->attr.id);
+	copy->attr.class_ = null_or_stracpy(e->attr.class_);
+#endif
+	copy->attr.onclick = null_or_stracpy(e->attr.onclick);
+	copy->attr.ondblclick = null_or_stracpy(e->attr.ondblclick);
+	copy->attr.onmouseover = null_or_stracpy(e->attr.onmouseover);
+	copy->attr.onhover = null_or_stracpy(e->attr.onhover);
+	copy->attr.onfocus = null_or_stracpy(e->attr.onfocus);
+	copy->attr.onmouseout = null_or_stracpy(e->attr.onmouseout);
+	copy->attr.onblur = null_or_stracpy(e->attr.onblur);
+	copy->attr.onkeydown = null_or_stracpy(e->attr.onkeydown);
+	copy->attr.onkeyup = null_or_stracpy(e->attr.onkeyup);
+
+	return copy;
+}
+
+static void
+done_html_element_copies(LIST_OF(struct html_element) *stack)
+{
+	while (!list_empty(*stack)) {
+		struct html_element *e = (struct html_element *)stack->next;
+
+		mem_free_if(e->attr.link);
+		mem_free_if(e->attr.target);
+		mem_free_if(e->attr.image);
+		mem_free_if(e->attr.title);
+		mem_free_if(e->attr.select);
+#ifdef CONFIG_CSS
+		mem_free_if(e->attr.id);
+		mem_free_if(e->attr.class_);
+#endif
+		mem_free_if(e->attr.onclick);
+		mem_free_if(e->attr.ondblclick);
+		mem_free_if(e->attr.onmouseover);
+		mem_free_if(e->attr.onhover);
+		mem_free_if(e->attr.onfocus);
+		mem_free_if(e->attr.onmouseout);
+		mem_free_if(e->attr.onblur);
+		mem_free_if(e->attr.onkeydown);
+		mem_free_if(e->attr.onkeyup);
+
+		del_from_list(e);
+		mem_free(e);
+	}
+}
+
+/* Copies the elements on the stack of @from to the empty @stack. */
+static int
+copy_html_stack(LIST_OF(struct html_element) *stack,
+		struct html_context *from)
+{
+	struct html_element *e;
+
+	foreachback (e, from->stack) {
+		struct html_element *copy = copy_html_element(e);
+
+		if (!copy) {
+			done_html_element_copies(stack);
+			return 0;
+		}
+
+		add_to_list(*stack, copy);
+	}
+
+	return 1;
+}
+
+static void
+done_html_context_copy(struct html_context *copy)
+{
+	if (!copy) return;
+
+#ifdef CONFIG_CSS
+	done_css_stylesheet(&copy->css_styles);
+#endif
+	done_html_element_copies(&copy->stack);
+	mem_free_if(copy->base_target);
+	if (copy->base_href) done_uri(copy->base_href);
+	mem_free(copy);
+}
+
+/* Copies the state that the parser keeps in @html_context from one
+ * element to the next. */
+static struct html_context *
+copy_html_context(struct html_context *html_context)
+{
+	struct html_context *copy = (struct html_context *)mem_alloc(sizeof(*copy));
+
+	if (!copy) return NULL;
+
+	copy_struct(copy, html_context);
+	init_list(copy->stack);
+#ifdef CONFIG_CSS
+	init_css_selector_set(&copy->css_styles.selectors);
+	merge_css_stylesheets(&copy->css_styles, &html_context->css_styles);
+#endif
+	copy->base_href = get_uri_reference(html_context->base_href);
+	copy->base_target = null_or_stracpy(html_context->base_target);
+
+	if (!copy_html_stack(&copy->stack, html_context)) {
+		done_html_context_copy(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+void
+done_html_checkpoint(struct document *document)
+{
+	struct html_checkpoint *checkpoint = document->html_checkpoint;
+
+	if (!checkpoint) return;
+
+	done_html_context_copy(checkpoint->html_context);
+	mem_free_if(checkpoint->head);
+	mem_free_if(checkpoint->http_equiv);
+	mem_free_if(checkpoint->title);
+	mem_free(checkpoint);
+	document->html_checkpoint = NULL;
+}
+
+/* For the things whose output the earlier lines can not be told apart from
+ * anymore. */
+static void
+drop_html_checkpoint(struct html_context *html_context,
+		     struct document *document)
+{
+	html_context->checkpoint_f = NULL;
+	done_html_checkpoint(document);
+}
+
+/* Whether nothing that was rendered from the source before @html can change
+ * when more of the source comes after it. */
+static int
+is_stable_html_point(struct html_context *html_context, char *html)
+{
+	struct part *part = html_context->part;
+	struct document *document = part->document;
+	char *eof = html_context->eoff;
+	int y;
+
+	/* A line is aligned and its links and tags are moved about until
+	 * the next one is started. */
+	if (part->cx != -1
+	    || renderer_context.last_tag_for_newline != (struct tag *) &document->tags
+	    || renderer_context.link_state_info.link
+	    || renderer_context.link_state_info.target
+	    || renderer_context.link_state_info.image
+	    || renderer_context.link_state_info.form)
+		return 0;
+
+#ifdef CONFIG_UTF8
+	if (document->buf_length) return 0;
+#endif
+#ifdef CONFIG_COMBINE
+	/* A combining character can still change the last character that
+	 * was put out, even on an earlier line. */
+	if (document->comb_x != -1) return 0;
+#endif
+
+	/* The elements which take their content from the source by
+	 * themselves and the preformatted text do not wait for the whole
+	 * of it. */
+	if (html_top->invisible || html_is_preformatted()
+	    || html_context->was_xmp || html_context->was_style
+	    || elformat.select || elformat.form)
+		return 0;
+
+	for (y = part->cy; y < document->height; y++)
+		if (document->data[y].length)
+			return 0;
+
+	for (y = 0; y < part->spaces_len; y++)
+		if (part->spaces[y])
+			return 0;
+
+	/* Following the elements, the parser looks past the spaces and
+	 * tags that come next. */
+	while (1) {
+		html = (char *) memscan_spaces(html, eof);
+		if (eof - html < HTML_CHECKPOINT_MARGIN)
+			return 0;
+		if (*html != '<')
+			return 1;
+		if (parse_element(html, eof, NULL, NULL, NULL, &html))
+			return 0;
+	}
+}
+
+/* Saves the state of the rendering of the top level part at @html, about
+ * each time the rendered source doubles so that the last checkpoint is not
+ * far from the end. */
+static void
+save_html_checkpoint(struct html_context *html_context, char *html)
+{
+	struct part *part = html_context->part;
+	struct document *document = part->document;
+	struct html_checkpoint *checkpoint = document->html_checkpoint;
+	char *start = html_context->startf;
+	struct html_context *copy;
+	struct form *form;
+
+	if (html - start - checkpoint->offset < html_context->eoff - html
+	    || list_empty(document->nodes)
+	    || !is_stable_html_point(html_context, html))
+		return;
+
+	copy = copy_html_context(html_context);
+	if (!copy) return;
+
+	done_html_context_copy(checkpoint->html_context);
+	checkpoint->html_context = copy;
+	checkpoint->source = start;
+	checkpoint->offset = html - start;
+
+	copy_struct(&checkpoint->renderer_context, &renderer_context);
+	copy_struct(&checkpoint->part, part);
+	checkpoint->part.spaces = NULL;
+	checkpoint->part.spaces_len = 0;
+#ifdef CONFIG_UTF8
+	checkpoint->part.char_width = NULL;
+#endif
+
+	checkpoint->height = document->height;
+	checkpoint->node = (struct node *)document->nodes.next;
+	checkpoint->node_height = checkpoint->node->box.height;
+	checkpoint->tag = (struct tag *)document->tags.next;
+	checkpoint->form = (struct form *)document->forms.next;
+	checkpoint->last_form = NULL;
+	foreach (form, document->forms)
+		if (form->form_end == INT_MAX)
+			checkpoint->last_form = form;
+#ifdef CONFIG_CSS
+	checkpoint->css_imports = document->css_imports.size;
+#endif
+}
+
+/* Throws away everything rendered after the @checkpoint. */
+static void
+rewind_html_document(struct document *document,
+		     struct html_checkpoint *checkpoint)
+{
+	int cy = checkpoint->part.cy;
+	int nlinks = 0;
+	struct form *form;
+	int i;
+
+	/* The line at @cy may not have been allocated yet. */
+	for (i = int_min(cy, checkpoint->height); i < document->height; i++) {
+		mem_free_if(document->data[i].chars);
+		memset(&document->data[i], 0, sizeof(*document->data));
+	}
+	document->height = checkpoint->height;
+
+	/* The links are sorted by now, the ones that were there before
+	 * start above @cy. */
+	for (i = 0; i < document->nlinks; i++) {
+		struct link *link = &document->links[i];
+
+		if (!link->npoints || link->points[0].y >= cy) {
+			done_link_members(link);
+			continue;
+		}
+
+		if (i != nlinks)
+			copy_struct(&document->links[nlinks], link);
+		nlinks++;
+	}
+	for (i = nlinks; i < document->nlinks; i++)
+		memset(&document->links[i], 0, sizeof(*document->links));
+	document->nlinks = nlinks;
+	document->links_sorted = 0;
+	mem_free_set(&document->lines1, NULL);
+	mem_free_set(&document->lines2, NULL);
+
+	while (!list_empty(document->tags)
+	       && document->tags.next != checkpoint->tag) {
+		struct tag *tag = (struct tag *)document->tags.next;
+
+		del_from_list(tag);
+		mem_free(tag);
+	}
+
+	while (!list_empty(document->nodes)
+	       && document->nodes.next != checkpoint->node) {
+		struct node *node = (struct node *)document->nodes.next;
+
+		del_from_list(node);
+		mem_free(node);
+	}
+	if (!list_empty(document->nodes))
+		checkpoint->node->box.height = checkpoint->node_height;
+
+	foreach (form, document->forms) {
+		struct el_form_control *fc, *next;
+
+		foreachsafe (fc, next, form->items) {
+			if (fc->g_ctrl_num < checkpoint->renderer_context.g_ctrl_num)
+				continue;
+
+			del_from_list(fc);
+			done_form_control(fc);
+			mem_free(fc);
+		}
+	}
+	while (!list_empty(document->forms)
+	       && document->forms.next != checkpoint->form)
+		done_form((struct form *)document->forms.next);
+	if (checkpoint->last_form)
+		checkpoint->last_form->form_end = INT_MAX;
+
+#ifdef CONFIG_CSS
+	while (document->css_imports.size > checkpoint->css_imports) {
+		struct uri *uri = document->css_imports.uris[--document->css_imports.size];
+
+		if (uri) done_uri(uri);
+	}
+#endif
+
+	mem_free_set(&document->search, NULL);
+	mem_free_set(&document->slines1, NULL);
+	mem_free_set(&document->slines2, NULL);
+	mem_free_set(&document->search_points, NULL);
+	document->nsearch = 0;
+	document->number_of_search_points = 0;
+}
+
+/* Throws away everything rendered, for rendering the document anew. */
+static void
+reset_html_document(struct document *document)
+{
+	struct html_checkpoint start;
+
+	memset(&start, 0, sizeof(start));
+	start.node = (struct node *)&document->nodes;
+	start.tag = (struct tag *)&document->tags;
+	start.form = (struct form *)&document->forms;
+	rewind_html_document(document, &start);
+
+	mem_free_set(&document->title, NULL);
+}
+
+/* Puts the parser state of the @checkpoint into @html_context, made for
+ * the source at @start. */
+static int
+restore_html_context(struct html_context *html_context,
+		     struct html_checkpoint *checkpoint, char *start)
+{
+	struct html_context *saved = checkpoint->html_context;
+	INIT_LIST_OF(struct html_element, stack);
+	struct html_element *e;
+
+	if (!copy_html_stack(&stack, saved))
+		return 0;
+
+	kill_html_stack_item(html_context, html_top);
+	while (!list_empty(stack)) {
+		e = (struct html_element *)stack.prev;
+		del_from_list(e);
+
+		if (e->name)
+			e->name = start + (e->name - checkpoint->source);
+		if (e->options) {
+			e->options = start + (e->options - checkpoint->source);
+			forget_attr_value_table(e->options);
+		}
+
+		add_to_list(html_context->stack, e);
+	}
+
+#ifdef CONFIG_CSS
+	if (html_context->options->css_enable) {
+		done_css_stylesheet(&html_context->css_styles);
+		init_css_selector_set(&html_context->css_styles.selectors);
+		merge_css_stylesheets(&html_context->css_styles,
+				      &saved->css_styles);
+	}
+#endif
+
+	done_uri(html_context->base_href);
+	html_context->base_href = get_uri_reference(saved->base_href);
+	mem_free_set(&html_context->base_target,
+		     null_or_stracpy(saved->base_target));
+
+	html_context->line_breax = saved->line_breax;
+	html_context->position = saved->position;
+	html_context->putsp = saved->putsp;
+	html_context->was_li = saved->was_li;
+	html_context->quote_level = saved->quote_level;
+	html_context->was_br = saved->was_br;
+	html_context->has_link_lines = saved->has_link_lines;
+	html_context->was_body = saved->was_body;
+	html_context->was_body_background = saved->was_body_background;
+	html_context->margin = saved->margin;
+	html_context->ff = saved->ff;
+
+	return 1;
+}
+
+/* Like format_html_part() for the whole document, but continuing at the
+ * @checkpoint of an earlier rendering of the same @document. */
+static struct part *
+resume_html_part(struct html_context *html_context, char *start, char *end,
+		 struct document *document, struct html_checkpoint *checkpoint)
+{
+	struct conv_table *convert_table = renderer_context.convert_table;
+	struct cache_entry *cached = renderer_context.cached;
+	struct part *part;
+	struct node *node;
+	void *html_state;
+
+	part = (struct part *)mem_alloc(sizeof(*part));
+	if (!part) return NULL;
+
+	if (!restore_html_context(html_context, checkpoint, start)) {
+		mem_free(part);
+		return NULL;
+	}
+
+	rewind_html_document(document, checkpoint);
+
+	copy_struct(&renderer_context, &checkpoint->renderer_context);
+	renderer_context.convert_table = convert_table;
+	renderer_context.cached = cached;
+	renderer_context.last_link_to_move = document->nlinks;
+	copy_struct(part, &checkpoint->part);
+
+	/* The element that format_html_part() put below the ones of the
+	 * document. */
+	html_state = html_bottom->prev;
+
+	continue_parse_html(start + checkpoint->offset, end, part, html_context);
+
+	done_html_parser_state(html_context, html_state);
+
+	int_lower_bound(&part->max_width, part->box.width);
+
+	renderer_context.nobreak = 0;
+
+	done_link_state_info();
+	mem_free_if(part->spaces);
+#ifdef CONFIG_UTF8
+	mem_free_if(part->char_width);
+#endif
+
+	node = (struct node *)document->nodes.next;
+	node->box.height = part->box.height - node->box.y;
+
+	return part;
+}
+
 void
 render_html_document(struct cache_entry *cached, struct document *document,
 		     struct string *buffer)
 {
 	struct html_context *html_context;
-	struct part *part;
+	struct html_checkpoint *checkpoint = document->html_checkpoint;
+	struct fragment *fragment = get_cache_fragment(cached);
+	struct part *part = NULL;
 	char *start;
 	char *end;
 	struct string title;
 	struct string head;
 	int xml2;
+	int incremental;
 
 	assert(cached && document);
 	if_assert_failed return;
@@ -2620,25 +3096,92 @@ render_html_document(struct cache_entry *cached, struct document *document,
 #endif /* CONFIG_UTF8 */
 	html_context->doc_cp = document->cp;
 
-	if (title.length) {
-		/* CSM_DEFAULT because init_html_parser() did not
-		 * decode entities in the title.  */
-		document->title = convert_string(renderer_context.convert_table,
-						 title.source, title.length,
-						 document->options.cp,
-						 CSM_DEFAULT, NULL, NULL, NULL);
+	/* Only sources that are the raw cache data can be assumed to grow
+	 * by appending, decoded content is regenerated each time. */
+	incremental = fragment && buffer->source == fragment->data;
+
+	if (checkpoint) {
+		/* The document was rendered before from a shorter version
+		 * of the source. Continue where the rendered lines could not
+		 * change anymore, if what was read ahead from the whole
+		 * source is still the same. */
+		if (!incremental
+		    || checkpoint->offset > buffer->length
+		    || checkpoint->cp != document->cp
+		    || strcmp(checkpoint->http_equiv, head.source)
+		    || strlcmp(checkpoint->title, -1, title.source, title.length)) {
+			reset_html_document(document);
+			done_html_checkpoint(document);
+			checkpoint = NULL;
+		}
+	}
+
+#ifdef CONFIG_ECMASCRIPT
+	/* The scripts refer to the text of the whole document. */
+	incremental = 0;
+#endif
+
+	if (incremental && cached->incomplete
+	    && document->options.html_incremental) {
+		if (!checkpoint) {
+			struct html_checkpoint *next;
+
+			next = (struct html_checkpoint *)mem_calloc(1, sizeof(*next));
+			if (next) {
+				document->html_checkpoint = next;
+				next->data_id = cached->data_id;
+				next->cp = document->cp;
+				next->head = stracpy(empty_string_or_(cached->head));
+				next->http_equiv = stracpy(head.source);
+				next->title = memacpy(title.source, title.length);
+				if (!next->head || !next->http_equiv || !next->title)
+					done_html_checkpoint(document);
+			}
+		}
+
+		if (document->html_checkpoint)
+			html_context->checkpoint_f = save_html_checkpoint;
+	}
+
+	if (checkpoint) {
+		part = resume_html_part(html_context, start, end, document,
+					checkpoint);
+		if (!part) {
+			reset_html_document(document);
+			drop_html_checkpoint(html_context, document);
+		}
+	}
+
+	if (!part) {
+		if (title.length) {
+			/* CSM_DEFAULT because init_html_parser() did not
+			 * decode entities in the title.  */
+			document->title = convert_string(renderer_context.convert_table,
+							 title.source, title.length,
+							 document->options.cp,
+							 CSM_DEFAULT, NULL, NULL, NULL);
+		}
+
+		part = format_html_part(html_context, start, end, par_elformat.align,
+				        par_elformat.leftmargin + par_elformat.blockquote_level * (html_context->table_level == 0),
+					document->options.document_width, document,
+				        0, 0, head.source, 1);
 	}
 	done_string(&title);
 
-	part = format_html_part(html_context, start, end, par_elformat.align,
-			        par_elformat.leftmargin + par_elformat.blockquote_level * (html_context->table_level == 0),
-				document->options.document_width, document,
-			        0, 0, head.source, 1);
+	/* A checkpoint is of no more use when the whole document has been
+	 * rendered. */
+	if (document->html_checkpoint
+	    && (!html_context->checkpoint_f
+		|| !document->html_checkpoint->html_context))
+		done_html_checkpoint(document);
 
 	/* Drop empty allocated lines at end of document if any
 	 * and adjust document height. */
-	while (document->height && !document->data[document->height - 1].length)
-		mem_free_if(document->data[--document->height].chars);
+	while (document->height && !document->data[document->height - 1].length) {
+		document->height--;
+		mem_free_set(&document->data[document->height].chars, NULL);
+	}
 
 	/* Calculate document width. */
 	{
@@ -2664,8 +3207,9 @@ render_html_document(struct cache_entry *cached, struct document *document,
 	done_html_parser(html_context);
 
 	/* Drop forms which has been serving as a placeholder for form items
-	 * added in the wrong order due to the ordering of table rendering. */
-	{
+	 * added in the wrong order due to the ordering of table rendering.
+	 * The form of the checkpoint is kept for when rendering continues. */
+	if (!document->html_checkpoint) {
 		struct form *form;
 
 		foreach (form, document->forms) {
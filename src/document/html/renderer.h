@@ -10,6 +10,7 @@ extern "C" {
 
 struct el_box;
 struct cache_entry;
+struct form;
 struct html_context;
 struct string;
 
@@ -103,6 +104,42 @@ struct renderer_context {
 
 extern struct renderer_context renderer_context;
 
+/* Where render_html_document() can continue rendering a document that was
+ * rendered from an incomplete cache entry, like struct plain_checkpoint.
+ * Everything before @offset in the source went to the lines above
+ * @part.cy and can not be changed by data that comes later. */
+struct html_checkpoint {
+	unsigned int data_id;	/* cache_entry.data_id of the source */
+	char *head;		/* Copy of the protocol header */
+	off_t offset;		/* Source bytes rendered in stable lines */
+	int cp;			/* Charset the source was decoded from */
+
+	/* What init_html_parser() found in the source that was rendered
+	 * ahead of the elements. */
+	char *http_equiv;
+	char *title;
+
+	/* Parser state at @offset. The element names and attributes on its
+	 * stack point into @source. */
+	struct html_context *html_context;
+	char *source;
+
+	/* Renderer state at @offset */
+	struct renderer_context renderer_context;
+	struct part part;
+
+	/* Document state at @offset */
+	int height;
+	struct node *node;
+	int node_height;
+	struct tag *tag;
+	struct form *form;
+	struct form *last_form;
+	int css_imports;
+};
+
+void done_html_checkpoint(struct document *document);
+
 void expand_lines(struct html_context *html_context, struct part *part,
                   int x, int y, int lines, color_T bgcolor);
 void check_html_form_hierarchy(struct part *part);
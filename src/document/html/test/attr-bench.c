@@ -0,0 +1,360 @@
+/* Compare getting the attributes of elements from the tables with scanning
+ * them for each attribute */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "document/html/parser/attr.h"
+#include "intl/charsets.h"
+#include "util/conv.h"
+#include "util/memory.h"
+#include "util/string.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+/* What the element handlers ask about most of the elements: the
+ * start_element() and CSS ones first, then those of the common
+ * elements. */
+static const char *const names[] = {
+	"onClick", "id", "class", "style", "href", "target", "title", "name",
+	"src", "alt", "width", "height", "align", "onLoad",
+};
+
+#define NAMES (sizeof(names) / sizeof(*names))
+
+static unsigned long random_state = 42;
+
+static int
+random_below(int n)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) % n;
+}
+
+/* Something like the source of a big page full of links and tables. */
+static void
+make_page(struct string *html, int elements)
+{
+	int i;
+
+	add_to_string(html, "<html><body><table>\n");
+	for (i = 0; i < elements; i++) {
+		switch (random_below(5)) {
+		case 0:
+			add_format_to_string(html, "<a href=\"/item?id=%d&amp;page=%d\" "
+					     "class=\"link c%d\" title=\"Item %d\" "
+					     "target=_blank rel=nofollow>item</a>\n",
+					     i, random_below(50), random_below(20), i);
+			break;
+		case 1:
+			add_format_to_string(html, "<img src=\"/img/%d.png\" alt='Image "
+					     "%d' width=%d height=%d class=thumb>\n",
+					     i, i, random_below(400), random_below(300));
+			break;
+		case 2:
+			add_format_to_string(html, "<td align=left valign=top width=\"%d%%\" "
+					     "class=\"cell\" colspan=%d>\n",
+					     random_below(100), random_below(3) + 1);
+			break;
+		case 3:
+			add_format_to_string(html, "<div id=\"d%d\" class=\"box c%d\" "
+					     "style=\"color: red;\n margin: 0\" "
+					     "data-x=\"%d\" hidden>\n",
+					     i, random_below(20), i);
+			break;
+		default:
+			add_format_to_string(html, "<input type=text name=\"q%d\" "
+					     "value=\"&lt;%d&gt;\" size=%d "
+					     "onClick=\"go(%d)\">\n",
+					     i, i, random_below(80), i);
+		}
+	}
+	add_to_string(html, "</table></body></html>\n");
+}
+
+/* Finds the attributes of the elements in @html the way parse_element()
+ * does and returns how many were found. */
+static int
+find_elements(struct string *html, char ***attrs)
+{
+	char *e = html->source;
+	char *eof = html->source + html->length;
+	int count = 0, size = 0;
+
+	while ((e = (char *)memchr(e, '<', eof - e))) {
+		e++;
+		if (e == eof || !isident(*e)) continue;
+
+		while (e < eof && isident(*e)) e++;
+		while (e < eof && (isspace((unsigned char)*e) || *e == '/' || *e == ':')) e++;
+		while (e < eof && !atchr(*e) && !end_of_tag(*e) && !isspace((unsigned char)*e)) e++;
+		if (e == eof) break;
+
+		if (count == size) {
+			size = size ? size * 2 : 1024;
+			*attrs = (char **)mem_realloc(*attrs, size * sizeof(**attrs));
+			if (!*attrs) die("out of memory");
+		}
+		(*attrs)[count++] = e;
+	}
+
+	return count;
+}
+
+#define realloc_chrs(x, l) mem_align_alloc(x, l, (l) + 1, 0xFF)
+
+#define add_chr(s, l, c)						\
+	do {								\
+		if (!realloc_chrs(&(s), l)) return NULL;		\
+		(s)[(l)++] = (c);					\
+	} while (0)
+
+/* What get_attr_value() did before there were the tables. */
+static char *
+scan_attr_value(char *e, const char *name,
+		int cp, enum html_attr_flags flags)
+{
+	const char *n;
+	char *name_start;
+	char *attr = NULL;
+	int attrlen = 0;
+	int found;
+
+next_attr:
+	skip_space(e);
+	if (end_of_tag(*e) || !atchr(*e)) goto parse_error;
+	n = name;
+	name_start = e;
+
+	while (atchr(*n) && atchr(*e) && c_toupper(*e) == c_toupper(*n)) e++, n++;
+	found = !*n && !atchr(*e);
+
+	if (found && (flags & HTML_ATTR_TEST)) return name_start;
+
+	while (atchr(*e)) e++;
+	skip_space(e);
+	if (*e != '=') {
+		if (found) goto found_endattr;
+		goto next_attr;
+	}
+	e++;
+	skip_space(e);
+
+	if (found) {
+		if (!isquote(*e)) {
+			while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
+				if (!*e) goto parse_error;
+				add_chr(attr, attrlen, *e);
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+
+			while (*(++e) != quote) {
+				if (!*e) goto parse_error;
+				if (flags & HTML_ATTR_LITERAL_NL)
+					add_chr(attr, attrlen, *e);
+				else if (*e == ASCII_CR) continue;
+				else if (*e != ASCII_TAB && *e != ASCII_LF)
+					add_chr(attr, attrlen, *e);
+				else if (!(flags & HTML_ATTR_EAT_NL))
+					add_chr(attr, attrlen, ' ');
+			}
+			e++;
+		}
+
+found_endattr:
+		add_chr(attr, attrlen, '\0');
+		attrlen--;
+
+		if (memchr(attr, '&', attrlen)) {
+			char *saved_attr = attr;
+
+			attr = convert_string(NULL, saved_attr, attrlen, cp,
+			                      CSM_QUERY, NULL, NULL, NULL);
+			mem_free(saved_attr);
+		}
+
+		return attr;
+
+	} else {
+		if (!isquote(*e)) {
+			while (!isspace((unsigned char)*e) && !end_of_tag(*e)) {
+				if (!*e) goto parse_error;
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+
+			while (*(++e) != quote)
+				if (!*e) goto parse_error;
+			e++;
+		}
+	}
+
+	goto next_attr;
+
+parse_error:
+	mem_free_if(attr);
+	return NULL;
+}
+
+#undef add_chr
+
+typedef char *(*get_T)(char *, const char *, int, enum html_attr_flags);
+
+/* Asks about the attributes of each element like the element handlers do,
+ * the first one only whether it is there, and hashes the values into
+ * @checksum. */
+static long
+get_attrs(char **attrs, int count, get_T get, int cp, unsigned long *checksum)
+{
+	long values = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		int j;
+
+		if (get(attrs[i], names[0], cp, HTML_ATTR_TEST))
+			values++, *checksum += i;
+
+		for (j = 1; j < NAMES; j++) {
+			char *value = get(attrs[i], names[j], cp,
+					  j == 4 || j == 8 ? HTML_ATTR_EAT_NL
+					  : HTML_ATTR_NONE);
+			char *pos;
+
+			if (!value) continue;
+			values++;
+			for (pos = value; *pos; pos++)
+				*checksum = *checksum * 31 + (unsigned char) *pos;
+			mem_free(value);
+		}
+	}
+
+	return values;
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int elements = 50000;
+	int rounds = 5;
+	unsigned long table_sum = 0, scan_sum = 0;
+	long table_values = 0, scan_values = 0;
+	milliseconds_T table, scan;
+	struct string html;
+	char **attrs = NULL;
+	timeval_T start;
+	int cp, count, round;
+	int i;
+
+	if (!init_string(&html))
+		die("out of memory");
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "elements", &i, argc, argv, "a number")) {
+			elements = atoi(arg);
+
+		} else if (get_test_opt(&arg, "rounds", &i, argc, argv, "a number")) {
+			rounds = atoi(arg);
+
+		} else {
+			die("usage: %s [--elements <n>] [--rounds <n>] [<file>...]",
+			    argv[0]);
+		}
+	}
+
+	if (elements <= 0 || rounds <= 0)
+		die("--elements and --rounds must be positive");
+
+	/* The corpus is the given pages, or a made up one. */
+	if (i == argc)
+		make_page(&html, elements);
+
+	for (; i < argc; i++) {
+		FILE *file = fopen(argv[i], "rb");
+		char buffer[4096];
+		size_t len;
+
+		if (!file)
+			die("cannot open %s", argv[i]);
+		while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			add_bytes_to_string(&html, buffer, len);
+		fclose(file);
+	}
+
+	count = find_elements(&html, &attrs);
+
+	init_charsets_lookup();
+	cp = get_cp_index("utf-8");
+
+	timeval_now(&start);
+	for (round = 0; round < rounds; round++)
+		table_values += get_attrs(attrs, count, get_attr_value, cp,
+					  &table_sum);
+	table = elapsed_ms(&start);
+
+	timeval_now(&start);
+	for (round = 0; round < rounds; round++)
+		scan_values += get_attrs(attrs, count, scan_attr_value, cp,
+					 &scan_sum);
+	scan = elapsed_ms(&start);
+
+	if (table_values != scan_values || table_sum != scan_sum)
+		die("the tables found %ld values, the scanning %ld",
+		    table_values, scan_values);
+
+	printf("%d elements, %ld values in %d rounds: tables %ld ms, "
+	       "scanning %ld ms\n", count, table_values, rounds, table, scan);
+
+	free_charsets_lookup();
+	mem_free_if(attrs);
+	done_string(&html);
+
+	return 0;
+}
@@ -0,0 +1,244 @@
+/* Compare scanning the text of a page with the vector instructions with
+ * scanning it byte by byte */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "util/memory.h"
+#include "util/memscan.h"
+#include "util/string.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+static const char *const words[] = {
+	"the", "document", "is", "rendered", "into", "a", "grid", "of",
+	"characters", "and", "links", "naïve", "façade", "čeština", "日本語",
+	"https://example.org/a/long/path?with=query", "1234567890",
+};
+
+#define WORDS (sizeof(words) / sizeof(*words))
+
+static unsigned long random_state = 42;
+
+static int
+random_below(int n)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) % n;
+}
+
+/* Something like the source of a page with much text: paragraphs of
+ * words, indented markup and a few entities. */
+static void
+make_page(struct string *html, int size)
+{
+	while (html->length < size) {
+		int i, n = random_below(60) + 1;
+
+		add_to_string(html, "\n    <p class=\"text\">");
+		for (i = 0; i < n; i++) {
+			switch (random_below(20)) {
+			case 0:
+				add_to_string(html, "&amp; ");
+				break;
+			case 1:
+				add_to_string(html, "<b>bold</b> ");
+				break;
+			case 2:
+				add_to_string(html, "\n\t\t");
+				break;
+			default:
+				add_to_string(html, words[random_below(WORDS)]);
+				add_char_to_string(html, ' ');
+			}
+		}
+		add_to_string(html, "</p>");
+	}
+}
+
+/* What the parser and the renderers did before there were the vector
+ * scans. */
+
+static const char *
+byte_text(const char *s, const char *end, int c1, int c2)
+{
+	while (s < end && (unsigned char) *s > ' ' && *s != c1 && *s != c2
+	       && !isspace((unsigned char) *s))
+		s++;
+
+	return s;
+}
+
+static const char *
+byte_ascii_text(const char *s, const char *end)
+{
+	while (s < end && (unsigned char) *s > ' ' && (unsigned char) *s < 0x7F)
+		s++;
+
+	return s;
+}
+
+static const char *
+byte_spaces(const char *s, const char *end)
+{
+	while (s < end && isspace((unsigned char) *s))
+		s++;
+
+	return s;
+}
+
+struct scans {
+	const char *(*text)(const char *s, const char *end, int c1, int c2);
+	const char *(*ascii_text)(const char *s, const char *end);
+	const char *(*spaces)(const char *s, const char *end);
+};
+
+static const struct scans byte_scans = {
+	byte_text, byte_ascii_text, byte_spaces,
+};
+
+static const struct scans vector_scans = {
+	memscan_text, memscan_ascii_text, memscan_spaces,
+};
+
+/* Walks the page like parse_html() and then like the plain text
+ * renderer does, and hashes where the scans stopped into @checksum.
+ * Returns how many times they stopped. */
+static long
+walk_page(struct string *html, const struct scans *scans,
+	  unsigned long *checksum)
+{
+	const char *eof = html->source + html->length;
+	const char *s;
+	long stops = 0;
+
+	for (s = html->source; s < eof; stops++) {
+		s = scans->text(s, eof, '<', '&');
+		*checksum = *checksum * 31 + (s - html->source);
+		if (s < eof && isspace((unsigned char) *s))
+			s = scans->spaces(s, eof);
+		else
+			s++;
+	}
+
+	for (s = html->source; s < eof; stops++) {
+		s = scans->ascii_text(s, eof);
+		*checksum = *checksum * 31 + (s - html->source);
+		s++;
+	}
+
+	return stops;
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *const isa_names[] = { "scalar", "SSE2", "AVX2" };
+	int size = 8192;
+	int rounds = 5;
+	unsigned long byte_sum = 0;
+	long byte_stops = 0;
+	milliseconds_T bytes;
+	struct string html;
+	timeval_T start;
+	int isa, round;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "size", &i, argc, argv, "a number")) {
+			size = atoi(arg);
+
+		} else if (get_test_opt(&arg, "rounds", &i, argc, argv, "a number")) {
+			rounds = atoi(arg);
+
+		} else {
+			die("usage: %s [--size <kB>] [--rounds <n>]", argv[0]);
+		}
+	}
+
+	if (size <= 0 || rounds <= 0)
+		die("--size and --rounds must be positive");
+
+	if (!init_string(&html))
+		die("out of memory");
+	make_page(&html, size * 1024);
+
+	timeval_now(&start);
+	for (round = 0; round < rounds; round++)
+		byte_stops += walk_page(&html, &byte_scans, &byte_sum);
+	bytes = elapsed_ms(&start);
+
+	printf("%d kB, %ld stops in %d rounds: bytes %ld ms", html.length / 1024,
+	       byte_stops, rounds, bytes);
+
+	for (isa = MEMSCAN_SCALAR; isa <= MEMSCAN_AVX2; isa++) {
+		unsigned long vector_sum = 0;
+		long vector_stops = 0;
+		milliseconds_T vector;
+
+		if (use_memscan_isa((enum memscan_isa) isa) != isa)
+			continue;
+
+		timeval_now(&start);
+		for (round = 0; round < rounds; round++)
+			vector_stops += walk_page(&html, &vector_scans, &vector_sum);
+		vector = elapsed_ms(&start);
+
+		if (vector_stops != byte_stops || vector_sum != byte_sum)
+			die("\n%s stopped %ld times, the bytes %ld",
+			    isa_names[isa], vector_stops, byte_stops);
+
+		printf(", %s %ld ms", isa_names[isa], vector);
+	}
+
+	printf("\n");
+
+	done_string(&html);
+
+	return 0;
+}
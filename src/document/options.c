@@ -17,6 +17,7 @@
 #include "session/session.h"
 #include "terminal/window.h"
 #include "util/color.h"
+#include "util/conv.h"
 #include "util/string.h"
 #include "viewer/text/draw.h"
 
@@ -83,8 +84,10 @@ init_document_options(struct session *ses, struct document_options *doo)
 	doo->plain_display_links = get_opt_bool("document.plain.display_links", ses);
 	doo->plain_compress_empty_lines = get_opt_bool("document.plain.compress_empty_lines", ses);
 	doo->plain_fixup_tables = get_opt_bool("document.plain.fixup_tables", ses);
+	doo->plain_incremental = get_opt_bool("document.plain.incremental", ses);
 	doo->underline_links = get_opt_bool("document.html.underline_links", ses);
 	doo->wrap_nbsp = get_opt_bool("document.html.wrap_nbsp", ses);
+	doo->html_incremental = get_opt_bool("document.html.incremental", ses);
 	doo->use_tabindex = get_opt_bool("document.browse.links.use_tabindex", ses);
 	doo->links_numbering = get_opt_bool("document.browse.links.numbering", ses);
 	doo->links_show_goto = get_opt_bool("document.browse.links.show_goto", ses);
@@ -126,6 +129,28 @@ compare_opt(struct document_options *o1, struct document_options *o2)
 		    && o1->box.width != o2->box.width);
 }
 
+unsigned long
+digest_opt(struct document_options *o)
+{
+	const unsigned char *pos = (const unsigned char *) o;
+	const unsigned char *end = pos + offsetof(struct document_options, framename);
+	unsigned long digest = 0;
+	const char *name;
+
+	/* Padding bytes are included in the same way memcmp() includes them
+	 * in compare_opt(); the structure is always cleared before use. */
+	for (; pos < end; pos++)
+		digest = (digest << 5) - digest + *pos;
+
+	for (name = o->framename; name && *name; name++)
+		digest = (digest << 5) - digest + c_tolower(*name);
+
+	digest = (digest << 5) - digest + o->box.x;
+	digest = (digest << 5) - digest + o->box.y;
+
+	return digest;
+}
+
 NONSTATIC_INLINE void
 copy_opt(struct document_options *o1, struct document_options *o2)
 {
@@ -97,6 +97,7 @@ struct document_options {
 	unsigned int underline_links:1;
 
 	unsigned int wrap_nbsp:1;
+	unsigned int html_incremental:1;
 	/** @} */
 
 	/** @name Plain rendering stuff
@@ -104,6 +105,7 @@ struct document_options {
 	unsigned int plain_display_links:1;
 	unsigned int plain_compress_empty_lines:1;
 	unsigned int plain_fixup_tables:1;
+	unsigned int plain_incremental:1;
 	/** @} */
 
 	/** @name Link navigation
@@ -182,6 +184,11 @@ void copy_opt(struct document_options *to, struct document_options *from);
  * @relates document_options */
 int compare_opt(struct document_options *o1, struct document_options *o2);
 
+/** Hashes the values compared by compare_opt() except the window size, so
+ * that options which compare equal always have the same digest.
+ * @relates document_options */
+unsigned long digest_opt(struct document_options *o);
+
 #define use_document_fg_colors(o) \
 	((o)->color_mode != COLOR_MODE_MONO && (o)->use_document_colors >= 1)
 
@@ -28,6 +28,7 @@
 #include "util/color.h"
 #include "util/error.h"
 #include "util/memory.h"
+#include "util/memscan.h"
 #include "util/string.h"
 
 
@@ -54,6 +55,14 @@ struct plain_renderer {
 
 	/* Are we doing line compression */
 	unsigned int compress:1;
+
+	/* Was the previous line empty or wrapped */
+	unsigned int was_empty_line:1;
+	unsigned int was_wrapped:1;
+
+	/* Where to save the state after each line that more data can not
+	 * change, or NULL if the source is complete */
+	struct plain_checkpoint *checkpoint;
 };
 
 #define realloc_document_links(doc, size) \
@@ -734,12 +743,64 @@ add_node(struct plain_renderer *renderer, int x, int width, int height)
 }
 
 static void
-add_document_lines(struct plain_renderer *renderer)
+save_checkpoint(struct plain_renderer *renderer, char *source)
+{
+	struct plain_checkpoint *checkpoint = renderer->checkpoint;
+	struct document *document = renderer->document;
+
+	checkpoint->offset = source - renderer->source;
+	copy_struct(&checkpoint->template_, &renderer->template_);
+	checkpoint->lineno = renderer->lineno;
+	checkpoint->was_empty_line = renderer->was_empty_line;
+	checkpoint->was_wrapped = renderer->was_wrapped;
+	checkpoint->width = document->width;
+	checkpoint->height = document->height;
+	checkpoint->nlinks = document->nlinks;
+}
+
+/* Throws away everything rendered after the @checkpoint. */
+static void
+rewind_document(struct document *document, struct plain_checkpoint *checkpoint)
+{
+	struct node *node, *next;
+	int i;
+
+	for (i = checkpoint->height; i < document->height; i++) {
+		mem_free_if(document->data[i].chars);
+		memset(&document->data[i], 0, sizeof(*document->data));
+	}
+	document->height = checkpoint->height;
+	document->width = checkpoint->width;
+
+	for (i = checkpoint->nlinks; i < document->nlinks; i++) {
+		done_link_members(&document->links[i]);
+		memset(&document->links[i], 0, sizeof(*document->links));
+	}
+	document->nlinks = checkpoint->nlinks;
+	document->links_sorted = 0;
+	mem_free_set(&document->lines1, NULL);
+	mem_free_set(&document->lines2, NULL);
+
+	foreachsafe (node, next, document->nodes) {
+		if (node->box.y < checkpoint->lineno) continue;
+
+		del_from_list(node);
+		mem_free(node);
+	}
+
+	mem_free_set(&document->search, NULL);
+	mem_free_set(&document->slines1, NULL);
+	mem_free_set(&document->slines2, NULL);
+	mem_free_set(&document->search_points, NULL);
+	document->nsearch = 0;
+	document->number_of_search_points = 0;
+}
+
+static void
+add_document_lines(struct plain_renderer *renderer, off_t offset)
 {
-	char *source = renderer->source;
-	int length = renderer->length;
-	int was_empty_line = 0;
-	int was_wrapped = 0;
+	char *source = renderer->source + offset;
+	int length = renderer->length - offset;
 #ifdef CONFIG_UTF8
 	int utf8 = is_cp_utf8(renderer->document->cp);
 #endif
@@ -751,6 +812,11 @@ add_document_lines(struct plain_renderer *renderer)
 		int step = 0;
  		int cells = 0;
 
+		/* The previous line did not end at the end of the source,
+		 * so it will stay the same when more data is appended. */
+		if (renderer->checkpoint)
+			save_checkpoint(renderer, source);
+
 		/* End of line detection: We handle \r, \r\n and \n types. */
  		for (width = 0; (width < length) &&
  				(cells < renderer->max_width);) {
@@ -760,6 +826,30 @@ add_document_lines(struct plain_renderer *renderer)
 				step++;
 			if (step) break;
 
+			if ((unsigned char) source[width] > ' ') {
+				/* The ordinary characters are a cell each, up
+				 * to the end of the line. */
+				char *text = &source[width];
+				char *end = &source[int_min(length, width + renderer->max_width - cells)];
+				int run;
+
+#ifdef CONFIG_UTF8
+				if (utf8)
+					end = (char *) memscan_ascii_text(text, end);
+				else
+#endif /* CONFIG_UTF8 */
+					end = (char *) memscan_text(text, end, 0, 0);
+
+				run = end - text;
+				if (run) {
+					only_spaces = 0;
+					was_spaces = 0;
+					cells += run;
+					width += run;
+					continue;
+				}
+			}
+
 			if (isspace((unsigned char)source[width])) {
 				last_space = width;
 				if (only_spaces)
@@ -791,7 +881,8 @@ add_document_lines(struct plain_renderer *renderer)
 		}
 
 		if (only_spaces && step) {
-			if (was_wrapped || (renderer->compress && was_empty_line)) {
+			if (renderer->was_wrapped
+			    || (renderer->compress && renderer->was_empty_line)) {
 				/* Successive empty lines will appear as one. */
 				length -= step + spaces;
 				source += step + spaces;
@@ -799,7 +890,7 @@ add_document_lines(struct plain_renderer *renderer)
 				assert(renderer->lineno >= 0);
 				continue;
 			}
-			was_empty_line = 1;
+			renderer->was_empty_line = 1;
 
 			/* No need to keep whitespaces on an empty line. */
 			source += spaces;
@@ -807,8 +898,8 @@ add_document_lines(struct plain_renderer *renderer)
 			width -= spaces;
 
 		} else {
-			was_empty_line = 0;
-			was_wrapped = !step;
+			renderer->was_empty_line = 0;
+			renderer->was_wrapped = !step;
 
 			if (was_spaces && step) {
 				/* Drop trailing whitespaces. */
@@ -959,6 +1050,9 @@ render_plain_document(struct cache_entry *cached, struct document *document,
 	struct conv_table *convert_table;
 	char *head = empty_string_or_(cached->head);
 	struct plain_renderer renderer;
+	struct plain_checkpoint *checkpoint = document->plain_checkpoint;
+	struct fragment *fragment = get_cache_fragment(cached);
+	off_t offset = 0;
 
 	convert_table = get_convert_table(head, document->options.cp,
 					  document->options.assume_cp,
@@ -973,6 +1067,9 @@ render_plain_document(struct cache_entry *cached, struct document *document,
 	renderer.lineno = 0;
 	renderer.convert_table = convert_table;
 	renderer.compress = document->options.plain_compress_empty_lines;
+	renderer.was_empty_line = 0;
+	renderer.was_wrapped = 0;
+	renderer.checkpoint = NULL;
 	renderer.max_width = document->options.wrap ? document->options.document_width
 						    : INT_MAX;
 
@@ -985,7 +1082,50 @@ render_plain_document(struct cache_entry *cached, struct document *document,
 	/* Setup the style */
 	init_template(&renderer.template_, &document->options);
 
-	add_document_lines(&renderer);
+	if (checkpoint) {
+		/* The document was rendered before from a shorter version
+		 * of the source. Continue after the last line known to be
+		 * complete, if the source is still the same. */
+		if (fragment && buffer->source == fragment->data
+		    && checkpoint->offset <= buffer->length
+		    && checkpoint->cp == document->cp) {
+			offset = checkpoint->offset;
+			renderer.lineno = checkpoint->lineno;
+			renderer.was_empty_line = checkpoint->was_empty_line;
+			renderer.was_wrapped = checkpoint->was_wrapped;
+			copy_struct(&renderer.template_, &checkpoint->template_);
+			rewind_document(document, checkpoint);
+		} else {
+			struct plain_checkpoint start;
+
+			memset(&start, 0, sizeof(start));
+			rewind_document(document, &start);
+		}
+
+		done_plain_checkpoint(document);
+	}
+
+	/* Only sources that are the raw cache data can be assumed to grow
+	 * by appending, decoded content is regenerated each time. */
+	if (cached->incomplete
+	    && document->options.plain_incremental
+	    && !document->options.plain_fixup_tables
+	    && fragment && buffer->source == fragment->data) {
+		checkpoint = (struct plain_checkpoint *)mem_calloc(1, sizeof(*checkpoint));
+		if (checkpoint) {
+			checkpoint->head = stracpy(head);
+			if (checkpoint->head) {
+				checkpoint->data_id = cached->data_id;
+				checkpoint->cp = document->cp;
+				document->plain_checkpoint = checkpoint;
+				renderer.checkpoint = checkpoint;
+			} else {
+				mem_free(checkpoint);
+			}
+		}
+	}
+
+	add_document_lines(&renderer, offset);
 
 	if (document->options.plain_fixup_tables) {
 		fixup_tables(&renderer);
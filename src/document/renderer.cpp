@@ -366,7 +366,9 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 	if (document) {
 		doc_view->document = document;
 	} else {
-		document = init_document(cached, options);
+		document = get_resumable_document(cached, options);
+		if (!document)
+			document = init_document(cached, options);
 		if (!document) return;
 		doc_view->document = document;
 
@@ -403,6 +405,9 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 		document->css_magic = get_document_css_magic(document);
 #endif
 	}
+
+	drop_superseded_documents(document);
+
 #if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 	if (!vs->ecmascript_fragile)
 		assert(vs->ecmascript);
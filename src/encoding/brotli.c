@@ -168,6 +168,46 @@ brotli_decode_buffer(struct stream_encoded *st, char *datac, int len, int *new_l
 	return NULL;
 }
 
+static int
+brotli_decode_stream(struct stream_encoded *st, char *datac, int len,
+		     struct decoded_sink *sink)
+{
+	struct br_enc_data *enc_data = (struct br_enc_data *)st->data;
+	BrotliDecoderResult error;
+	int decoded = 0;
+
+	if (enc_data->after_end) return 0;
+
+	enc_data->next_in = (const uint8_t *)datac;
+	enc_data->avail_in = len;
+
+	do {
+		int size;
+		char *window = get_decoding_window(st, sink, &size);
+
+		if (!window) return -1;
+
+		enc_data->next_out  = (uint8_t *)window;
+		enc_data->avail_out = size;
+
+		error = BrotliDecoderDecompressStream(enc_data->state,
+			&enc_data->avail_in, &enc_data->next_in,
+			&enc_data->avail_out, &enc_data->next_out, NULL);
+
+		size -= enc_data->avail_out;
+		if (!put_decoded_data(st, sink, size)) return -1;
+		decoded += size;
+	} while (error == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+	if (error == BROTLI_DECODER_RESULT_ERROR)
+		return -1;
+
+	if (error == BROTLI_DECODER_RESULT_SUCCESS)
+		enc_data->after_end = 1;
+
+	return decoded;
+}
+
 static void
 brotli_close(struct stream_encoded *stream)
 {
@@ -208,5 +248,6 @@ const struct decoding_backend brotli_decoding_backend = {
 	brotli_open,
 	brotli_read,
 	brotli_decode_buffer,
+	brotli_decode_stream,
 	brotli_close,
 };
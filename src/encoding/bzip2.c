@@ -195,6 +195,45 @@ bzip2_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len
 	}
 }
 
+static int
+bzip2_decode_stream(struct stream_encoded *st, char *data, int len,
+		    struct decoded_sink *sink)
+{
+	struct bz2_enc_data *enc_data = (struct bz2_enc_data *)st->data;
+	bz_stream *stream = &enc_data->fbz_stream;
+	int decoded = 0;
+	int error;
+
+	if (enc_data->after_end) return 0;
+
+	stream->next_in = data;
+	stream->avail_in = len;
+
+	do {
+		int size;
+		char *window = get_decoding_window(st, sink, &size);
+
+		if (!window) return -1;
+
+		stream->next_out  = window;
+		stream->avail_out = size;
+
+		error = BZ2_bzDecompress(stream);
+
+		size -= stream->avail_out;
+		if (!put_decoded_data(st, sink, size)) return -1;
+		decoded += size;
+	} while (error == BZ_OK && (stream->avail_in > 0 || !stream->avail_out));
+
+	if (error == BZ_STREAM_END) {
+		BZ2_bzDecompressEnd(stream);
+		enc_data->after_end = 1;
+		error = BZ_OK;
+	}
+
+	return error == BZ_OK ? decoded : -1;
+}
+
 static void
 bzip2_close(struct stream_encoded *stream)
 {
@@ -236,5 +275,6 @@ const struct decoding_backend bzip2_decoding_backend = {
 	bzip2_open,
 	bzip2_read,
 	bzip2_decode_buffer,
+	bzip2_decode_stream,
 	bzip2_close,
 };
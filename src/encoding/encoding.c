@@ -62,6 +62,13 @@ dummy_decode_buffer(struct stream_encoded *stream, char *data, int len, int *new
 	return buffer;
 }
 
+static int
+dummy_decode_stream(struct stream_encoded *stream, char *data, int len,
+		    struct decoded_sink *sink)
+{
+	return sink->append(sink, data, len) ? len : -1;
+}
+
 static void
 dummy_close(struct stream_encoded *stream)
 {
@@ -77,6 +84,7 @@ static const struct decoding_backend dummy_decoding_backend = {
 	dummy_open,
 	dummy_read,
 	dummy_decode_buffer,
+	dummy_decode_stream,
 	dummy_close,
 };
 
@@ -114,6 +122,8 @@ open_encoded(int fd, stream_encoding_T encoding)
 	if (!stream) return NULL;
 
 	stream->encoding = encoding;
+	stream->window = NULL;
+	stream->in_place = 0;
 	if (decoding_backends[stream->encoding]->eopen(stream, fd) >= 0)
 		return stream;
 
@@ -140,12 +150,64 @@ decode_encoded_buffer(struct stream_encoded *stream, stream_encoding_T encoding,
 	return decoding_backends[encoding]->decode_buffer(stream, data, len, new_len);
 }
 
+/* Decode the next @len bytes of @data read from the stream and pass the
+ * result to @sink as it comes out of the decoder. Unlike
+ * decode_encoded_buffer(), this needs no output buffer of its own, which
+ * suits decoding straight to the end of a cache entry. Returns the number
+ * of bytes decoded or -1 on error. */
+int
+decode_encoded_stream(struct stream_encoded *stream, char *data, int len,
+		      struct decoded_sink *sink)
+{
+	if (!len) return 0;
+
+	return decoding_backends[stream->encoding]->decode_stream(stream, data, len, sink);
+}
+
+/* Returns the window for the backend to decode the next piece of output
+ * into, of *@size bytes. It is room at the end of the sink's output if the
+ * sink has some, else the scratch window of @stream. */
+char *
+get_decoding_window(struct stream_encoded *stream, struct decoded_sink *sink,
+		    int *size)
+{
+	char *window;
+
+	*size = DECODING_WINDOW_SIZE;
+	window = sink->room ? sink->room(sink, size) : NULL;
+	if (window && *size > 0) {
+		stream->in_place = 1;
+		return window;
+	}
+
+	if (!stream->window) {
+		stream->window = (char *)mem_alloc(DECODING_WINDOW_SIZE);
+		if (!stream->window) return NULL;
+	}
+
+	stream->in_place = 0;
+	*size = DECODING_WINDOW_SIZE;
+	return stream->window;
+}
+
+/* Passes the first @len bytes of the last window to the sink. Returns zero
+ * on failure. */
+int
+put_decoded_data(struct stream_encoded *stream, struct decoded_sink *sink,
+		 int len)
+{
+	if (!len) return 1;
+
+	return sink->append(sink, stream->in_place ? NULL : stream->window, len);
+}
+
 /* Closes encoded stream. Note that fd associated with the stream will be
  * closed here. */
 void
 close_encoded(struct stream_encoded *stream)
 {
 	decoding_backends[stream->encoding]->eclose(stream);
+	mem_free_if(stream->window);
 	mem_free(stream);
 }
 
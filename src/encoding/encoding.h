@@ -25,6 +25,28 @@ typedef unsigned char stream_encoding_T;
 struct stream_encoded {
 	stream_encoding_T encoding;
 	void *data;
+
+	/* The scratch window data is decoded into when the sink has no room
+	 * for decoding in place. It is kept for the life of the stream. */
+	char *window;
+
+	/* Whether the last window came from the sink. */
+	unsigned int in_place:1;
+};
+
+/* The size of the scratch window of a stream. */
+#define DECODING_WINDOW_SIZE (64 * 1024)
+
+/* Where decode_encoded_stream() puts the decoded data. */
+struct decoded_sink {
+	/* Returns room at the end of the output for decoding in place and
+	 * stores its size to @size, which holds the size wanted on entry.
+	 * Returns NULL if the data cannot be decoded in place. */
+	char *(*room)(struct decoded_sink *sink, int *size);
+
+	/* Appends @len decoded bytes from @data, or from the start of the
+	 * last room if @data is NULL. Returns zero on failure. */
+	int (*append)(struct decoded_sink *sink, const char *data, int len);
 };
 
 struct decoding_backend {
@@ -33,14 +55,21 @@ struct decoding_backend {
 	int (*eopen)(struct stream_encoded *stream, int fd);
 	int (*eread)(struct stream_encoded *stream, char *data, int len);
 	char *(*decode_buffer)(struct stream_encoded *stream, char *data, int len, int *new_len);
+	int (*decode_stream)(struct stream_encoded *stream, char *data, int len, struct decoded_sink *sink);
 	void (*eclose)(struct stream_encoded *stream);
 };
 
 struct stream_encoded *open_encoded(int, stream_encoding_T);
 int read_encoded(struct stream_encoded *, char *, int);
 char *decode_encoded_buffer(struct stream_encoded *stream, stream_encoding_T encoding, char *data, int len, int *new_len);
+int decode_encoded_stream(struct stream_encoded *stream, char *data, int len, struct decoded_sink *sink);
 void close_encoded(struct stream_encoded *);
 
+/* For the backends: the window to decode the next output into and passing
+ * the @len bytes decoded there to the sink. */
+char *get_decoding_window(struct stream_encoded *stream, struct decoded_sink *sink, int *size);
+int put_decoded_data(struct stream_encoded *stream, struct decoded_sink *sink, int len);
+
 const char *const *listext_encoded(stream_encoding_T);
 stream_encoding_T guess_encoding(char *filename);
 const char *get_encoding_name(stream_encoding_T encoding);
@@ -211,6 +211,64 @@ deflate_gzip_decode_buffer(struct stream_encoded *st, char *data, int len, int *
 	return deflate_decode_buffer(st, MAX_WBITS + 32, data, len, new_len);
 }
 
+static int
+deflate_decode_stream(struct stream_encoded *st, char *datac, int len,
+		      struct decoded_sink *sink)
+{
+	struct deflate_enc_data *enc_data = (struct deflate_enc_data *) st->data;
+	z_stream *stream = &enc_data->deflate_stream;
+	int decoded = 0;
+	int error;
+
+	if (enc_data->after_end) return 0;
+
+	stream->next_in = (unsigned char *)datac;
+	stream->avail_in = len;
+
+	do {
+		int size;
+		char *window = get_decoding_window(st, sink, &size);
+
+		if (!window) return -1;
+
+restart:
+		stream->next_out  = (unsigned char *)window;
+		stream->avail_out = size;
+
+		error = inflate(stream, Z_SYNC_FLUSH);
+		if (error == Z_DATA_ERROR && !enc_data->after_first_read
+		    && !stream->total_out) {
+			/* Some servers send raw deflate data. */
+			(void)inflateEnd(stream);
+			error = inflateInit2(stream, -MAX_WBITS);
+			if (error != Z_OK) return -1;
+
+			enc_data->after_first_read = 1;
+			stream->next_in = (unsigned char *)datac;
+			stream->avail_in = len;
+			goto restart;
+		}
+
+		size -= stream->avail_out;
+		if (!put_decoded_data(st, sink, size)) return -1;
+		decoded += size;
+
+		/* No progress possible until more data comes. */
+		if (error == Z_BUF_ERROR) {
+			error = Z_OK;
+			break;
+		}
+	} while (error == Z_OK && (stream->avail_in > 0 || !stream->avail_out));
+
+	if (error == Z_STREAM_END) {
+		inflateEnd(stream);
+		enc_data->after_end = 1;
+		error = Z_OK;
+	}
+
+	return error == Z_OK ? decoded : -1;
+}
+
 static void
 deflate_close(struct stream_encoded *stream)
 {
@@ -242,5 +300,6 @@ const struct decoding_backend gzip_decoding_backend = {
 	deflate_gzip_open,
 	deflate_read,
 	deflate_gzip_decode_buffer,
+	deflate_decode_stream,
 	deflate_close,
 };
@@ -159,6 +159,45 @@ lzma_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len)
 	}
 }
 
+static int
+lzma_decode_stream(struct stream_encoded *st, char *data, int len,
+		   struct decoded_sink *sink)
+{
+	struct lzma_enc_data *enc_data = (struct lzma_enc_data *) st->data;
+	lzma_stream *stream = &enc_data->flzma_stream;
+	int decoded = 0;
+	lzma_ret error;
+
+	if (enc_data->after_end) return 0;
+
+	stream->next_in = (unsigned char *)data;
+	stream->avail_in = len;
+
+	do {
+		int size;
+		char *window = get_decoding_window(st, sink, &size);
+
+		if (!window) return -1;
+
+		stream->next_out  = (unsigned char *)window;
+		stream->avail_out = size;
+
+		error = lzma_code(stream, LZMA_RUN);
+
+		size -= stream->avail_out;
+		if (!put_decoded_data(st, sink, size)) return -1;
+		decoded += size;
+	} while (error == LZMA_OK && (stream->avail_in > 0 || !stream->avail_out));
+
+	if (error == LZMA_STREAM_END) {
+		lzma_end(stream);
+		enc_data->after_end = 1;
+		error = LZMA_OK;
+	}
+
+	return error == LZMA_OK || error == LZMA_BUF_ERROR ? decoded : -1;
+}
+
 static void
 lzma_close(struct stream_encoded *stream)
 {
@@ -190,5 +229,6 @@ const struct decoding_backend lzma_decoding_backend = {
 	lzma_open,
 	lzma_read,
 	lzma_decode_buffer,
+	lzma_decode_stream,
 	lzma_close,
 };
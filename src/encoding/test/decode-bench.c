@@ -0,0 +1,417 @@
+/* Compare decoding to a new buffer per read with decoding to the sink */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CONFIG_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef CONFIG_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef CONFIG_LZMA
+#include <lzma.h>
+#endif
+#ifdef CONFIG_GZIP
+#include <zlib.h>
+#endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "encoding/encoding.h"
+#include "util/math.h"
+#include "util/memory.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* How much compressed data each call gets, as from one read of the socket. */
+#define READ_SIZE 16384
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+void
+set_bin(int fd)
+{
+}
+
+struct option *config_options = NULL;
+
+#ifdef CONFIG_DEBUG
+union option_value *
+get_opt_(char *file, int line, enum option_type option_type,
+	 struct option *tree, const char *name, struct session *ses)
+#else
+union option_value *
+get_opt_(struct option *tree, const char *name, struct session *ses)
+#endif
+{
+	static union option_value value;
+
+	return &value;
+}
+
+/* Grows like the last fragment of a cache entry. */
+struct test_sink {
+	struct decoded_sink sink;
+	char *data;
+	int length;
+	int size;
+};
+
+static void
+reserve_test_sink(struct test_sink *sink, int size)
+{
+	if (sink->size - sink->length >= size) return;
+
+	sink->size = MAX(sink->size * 2, sink->length + size);
+	sink->data = (char *)mem_realloc(sink->data, sink->size);
+	if (!sink->data) die("out of memory");
+}
+
+static char *
+get_test_sink_room(struct decoded_sink *sink, int *size)
+{
+	struct test_sink *test_sink = (struct test_sink *) sink;
+
+	reserve_test_sink(test_sink, *size);
+	*size = test_sink->size - test_sink->length;
+
+	return test_sink->data + test_sink->length;
+}
+
+static int
+append_to_test_sink(struct decoded_sink *sink, const char *data, int len)
+{
+	struct test_sink *test_sink = (struct test_sink *) sink;
+
+	if (data) {
+		reserve_test_sink(test_sink, len);
+		memcpy(test_sink->data + test_sink->length, data, len);
+	}
+	test_sink->length += len;
+
+	return 1;
+}
+
+static void
+init_test_sink(struct test_sink *sink)
+{
+	memset(sink, 0, sizeof(*sink));
+	sink->sink.room = get_test_sink_room;
+	sink->sink.append = append_to_test_sink;
+}
+
+#ifdef CONFIG_BROTLI
+static int
+compress_brotli(const char *data, int len, char *out, size_t *out_len)
+{
+	return BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW,
+				     BROTLI_MODE_TEXT, len,
+				     (const uint8_t *) data, out_len,
+				     (uint8_t *) out);
+}
+#endif
+
+#ifdef CONFIG_BZIP2
+static int
+compress_bzip2(const char *data, int len, char *out, size_t *out_len)
+{
+	unsigned int length = *out_len;
+	int error = BZ2_bzBuffToBuffCompress(out, &length, (char *) data,
+					     len, 9, 0, 0);
+
+	*out_len = length;
+	return error == BZ_OK;
+}
+#endif
+
+#ifdef CONFIG_GZIP
+static int
+compress_gzip(const char *data, int len, char *out, size_t *out_len)
+{
+	static const z_stream null_z_stream = {0};
+	z_stream stream = null_z_stream;
+	int error;
+
+	/* Ask for the gzip header, as servers send. */
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			 MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+
+	stream.next_in = (unsigned char *) data;
+	stream.avail_in = len;
+	stream.next_out = (unsigned char *) out;
+	stream.avail_out = *out_len;
+
+	error = deflate(&stream, Z_FINISH);
+	*out_len = stream.total_out;
+	deflateEnd(&stream);
+
+	return error == Z_STREAM_END;
+}
+#endif
+
+#ifdef CONFIG_LZMA
+static int
+compress_lzma(const char *data, int len, char *out, size_t *out_len)
+{
+	size_t pos = 0;
+
+	if (lzma_easy_buffer_encode(1, LZMA_CHECK_CRC32, NULL,
+				    (const uint8_t *) data, len,
+				    (uint8_t *) out, &pos, *out_len) != LZMA_OK)
+		return 0;
+
+	*out_len = pos;
+	return 1;
+}
+#endif
+
+#ifdef CONFIG_ZSTD
+static int
+compress_zstd(const char *data, int len, char *out, size_t *out_len)
+{
+	size_t length = ZSTD_compress(out, *out_len, data, len, 3);
+
+	if (ZSTD_isError(length)) return 0;
+
+	*out_len = length;
+	return 1;
+}
+#endif
+
+struct codec {
+	stream_encoding_T encoding;
+	int (*compress)(const char *data, int len, char *out, size_t *out_len);
+};
+
+static const struct codec codecs[] = {
+#ifdef CONFIG_GZIP
+	{ ENCODING_GZIP, compress_gzip },
+#endif
+#ifdef CONFIG_BZIP2
+	{ ENCODING_BZIP2, compress_bzip2 },
+#endif
+#ifdef CONFIG_LZMA
+	{ ENCODING_LZMA, compress_lzma },
+#endif
+#ifdef CONFIG_BROTLI
+	{ ENCODING_BROTLI, compress_brotli },
+#endif
+#ifdef CONFIG_ZSTD
+	{ ENCODING_ZSTD, compress_zstd },
+#endif
+	{ ENCODING_NONE, NULL },
+};
+
+/* Something like the text of a web page, which compresses about as well. */
+static char *
+make_body(int size)
+{
+	static const char *const words[] = {
+		"<p>", "</p>\n", "<a href=\"/", "\">", "</a>", "the", "of",
+		"connection", "cache", "document", "browser", "elinks", "and",
+		"<div class=\"item\">", "</div>\n", "download", "to", "in",
+	};
+	char *body = (char *)mem_alloc(size);
+	unsigned long random_state = 42;
+	int pos = 0;
+
+	if (!body) die("out of memory");
+
+	while (pos < size) {
+		const char *word;
+		int len;
+
+		random_state = random_state * 1103515245 + 12345;
+		word = words[(random_state >> 16) % (sizeof(words) / sizeof(*words))];
+		len = MIN((int) strlen(word), size - pos);
+		memcpy(body + pos, word, len);
+		pos += len;
+
+		if (pos < size && !((random_state >> 24) % 3)) {
+			pos += snprintf(body + pos, size - pos, "%lu ",
+					(random_state >> 8) % 10000);
+			if (pos > size) pos = size;
+		}
+	}
+
+	return body;
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+/* Decoding the old way: each read gets a buffer from the decoder, which is
+ * then copied to the output. */
+static void
+decode_to_buffers(const struct codec *codec, char *data, int len,
+		  struct test_sink *sink)
+{
+	struct stream_encoded *stream = open_encoded(-1, codec->encoding);
+	int pos;
+
+	if (!stream) die("cannot open the %s stream", get_encoding_name(codec->encoding));
+
+	for (pos = 0; pos < len; pos += READ_SIZE) {
+		int new_len;
+		char *decoded = decode_encoded_buffer(stream, codec->encoding,
+						      data + pos,
+						      MIN(READ_SIZE, len - pos),
+						      &new_len);
+
+		if (decoded) {
+			append_to_test_sink(&sink->sink, decoded, new_len);
+			mem_free(decoded);
+		}
+	}
+
+	close_encoded(stream);
+}
+
+static void
+decode_to_sink(const struct codec *codec, char *data, int len,
+	       struct test_sink *sink)
+{
+	struct stream_encoded *stream = open_encoded(-1, codec->encoding);
+	int pos;
+
+	if (!stream) die("cannot open the %s stream", get_encoding_name(codec->encoding));
+
+	for (pos = 0; pos < len; pos += READ_SIZE) {
+		if (decode_encoded_stream(stream, data + pos,
+					  MIN(READ_SIZE, len - pos),
+					  &sink->sink) < 0)
+			die("%s stream decoding failed", get_encoding_name(codec->encoding));
+	}
+
+	close_encoded(stream);
+}
+
+/* Returns -1 if the output is not @body. */
+static milliseconds_T
+time_decoding(const struct codec *codec, char *data, int len,
+	      const char *body, int size,
+	      void (*decode)(const struct codec *, char *, int, struct test_sink *))
+{
+	struct test_sink sink;
+	timeval_T start;
+	milliseconds_T ms;
+
+	init_test_sink(&sink);
+
+	timeval_now(&start);
+	decode(codec, data, len, &sink);
+	ms = elapsed_ms(&start);
+
+	if (sink.length != size || memcmp(sink.data, body, size))
+		ms = -1;
+
+	mem_free_if(sink.data);
+	return ms;
+}
+
+static double
+megabytes_per_second(int size, milliseconds_T ms)
+{
+	return (double) size / (1024 * 1024) * 1000 / MAX(ms, 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int size = 8 * 1024 * 1024;
+	const struct codec *codec;
+	char *body, *data;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "size", &i, argc, argv, "a number")) {
+			size = atoi(arg) * 1024 * 1024;
+
+		} else {
+			die("usage: %s [--size <MiB>]", argv[0]);
+		}
+	}
+
+	if (size <= 0)
+		die("--size must be positive");
+
+	body = make_body(size);
+	data = (char *)mem_alloc(size + size / 2 + 4096);
+	if (!data) die("out of memory");
+
+	for (codec = codecs; codec->compress; codec++) {
+		const char *name = get_encoding_name(codec->encoding);
+		size_t len = size + size / 2 + 4096;
+		milliseconds_T buffers, stream;
+
+		if (!codec->compress(body, size, data, &len))
+			die("%s compression failed", name);
+
+		stream = time_decoding(codec, data, len, body, size,
+				       decode_to_sink);
+		if (stream < 0)
+			die("%s stream decoded wrong data", name);
+
+		printf("%s: %d KiB from %d KiB, stream %ld ms (%.0f MiB/s), ",
+		       name, size / 1024, (int) (len / 1024),
+		       stream, megabytes_per_second(size, stream));
+
+		/* Some decode_buffer() handlers cannot take the data in
+		 * parts. */
+		buffers = time_decoding(codec, data, len, body, size,
+					decode_to_buffers);
+		if (buffers < 0)
+			printf("buffers decoded wrong data\n");
+		else
+			printf("buffers %ld ms (%.0f MiB/s)\n",
+			       buffers, megabytes_per_second(size, buffers));
+	}
+
+	mem_free(data);
+	mem_free(body);
+
+	return 0;
+}
@@ -98,6 +98,42 @@ zstd_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len)
 	return (char *)enc_data->output.dst;
 }
 
+static int
+zstd_decode_stream(struct stream_encoded *st, char *data, int len,
+		   struct decoded_sink *sink)
+{
+	struct zstd_enc_data *enc_data = (struct zstd_enc_data *)st->data;
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	int decoded = 0;
+
+	input.src = data;
+	input.pos = 0;
+	input.size = len;
+
+	do {
+		int size;
+		char *window = get_decoding_window(st, sink, &size);
+		size_t error;
+
+		if (!window) return -1;
+
+		output.dst = window;
+		output.pos = 0;
+		output.size = size;
+
+		error = ZSTD_decompressStream(enc_data->zstd_stream, &output, &input);
+		if (ZSTD_isError(error)) return -1;
+
+		if (!put_decoded_data(st, sink, output.pos)) return -1;
+		decoded += output.pos;
+
+		/* A full window may leave more output in the decoder. */
+	} while (input.pos < input.size || output.pos == output.size);
+
+	return decoded;
+}
+
 static int
 zstd_read(struct stream_encoded *stream, char *buf, int len)
 {
@@ -184,5 +220,6 @@ const struct decoding_backend zstd_decoding_backend = {
 	zstd_open,
 	zstd_read,
 	zstd_decode_buffer,
+	zstd_decode_stream,
 	zstd_close,
 };
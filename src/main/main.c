@@ -23,6 +23,7 @@
 
 #include "bfu/dialog.h"
 #include "cache/cache.h"
+#include "cache/disk.h"
 #include "config/cmdline.h"
 #include "config/conf.h"
 #include "config/home.h"
@@ -39,6 +40,7 @@
 #include "main/version.h"
 #include "network/connection.h"
 #include "network/dns.h"
+#include "network/prefetch.h"
 #include "network/state.h"
 #include "osdep/osdep.h"
 #include "osdep/signals.h"
@@ -293,6 +295,7 @@ terminate_all_subsystems(void)
 	 * It forces a some what unclean connection tear-down since at most the
 	 * shutdown routine will be able to send one command. But else it would
 	 * take too long time to terminate. */
+	abort_preconnects();
 	abort_all_connections();
 	check_bottom_halves();
 	abort_all_connections();
@@ -307,6 +310,7 @@ terminate_all_subsystems(void)
 	}
 
 	shrink_memory(1);
+	done_disk_cache();
 	free_charsets_lookup();
 	free_colors_lookup();
 	done_modules(main_modules);
@@ -5,6 +5,7 @@
 #endif
 
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <string.h> /* FreeBSD FD_ZERO() macro calls bzero() */
 #ifdef __GNU__ /* For GNU Hurd bug workaround in set_handlers() */
@@ -50,6 +51,11 @@
 #include <sys/select.h>
 #endif
 
+#if defined(CONFIG_EPOLL) && defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
+
 #define EINTRLOOPX(ret_, call_, x_)			\
 do {							\
 	(ret_) = (call_);				\
@@ -59,6 +65,7 @@ do {							\
 
 #include "elinks.h"
 
+#include "config/options.h"
 #include "intl/libintl.h"
 #include "main/main.h"
 #include "main/select.h"
@@ -104,6 +111,12 @@ struct thread {
 	struct event *read_event;
 	struct event *write_event;
 #endif
+#ifdef USE_EPOLL
+	/* The handle is in the epoll set. */
+	unsigned int epoll_added:1;
+	/* epoll refuses regular files, which are always ready anyway. */
+	unsigned int epoll_always_ready:1;
+#endif
 };
 
 #ifdef CONFIG_OS_WIN32
@@ -124,17 +137,13 @@ static fd_set x_error;
 
 static int w_max;
 
+/* The number of handles with at least one handler set. */
+static int w_count;
+
 int
 get_file_handles_count(void)
 {
-	int i = 0, j;
-
-	for (j = 0; j < w_max; j++)
-		if (threads[j].read_func
-		    || threads[j].write_func
-		    || threads[j].error_func)
-			i++;
-	return i;
+	return w_count;
 }
 
 struct bottom_half {
@@ -366,6 +375,251 @@ do_event_loop(int flags)
 }
 #endif
 
+#ifdef USE_EPOLL
+
+/* The size of the buffer for events returned by one epoll_wait(). Handles
+ * which did not fit are reported again by the next call. */
+#define EPOLL_MAX_EVENTS 256
+
+int epoll_enabled = 0;
+
+static int epoll_fd = -1;
+
+/* The number of handles with the epoll_always_ready flag set. */
+static int epoll_always_ready_count;
+
+static uint32_t
+get_epoll_events(int h)
+{
+	uint32_t events = 0;
+
+	/* The same conditions select() reports in readfds, writefds and
+	 * exceptfds. EPOLLHUP and EPOLLERR are always reported. */
+	if (threads[h].read_func) events |= EPOLLIN;
+	if (threads[h].write_func) events |= EPOLLOUT;
+	if (threads[h].error_func) events |= EPOLLPRI;
+
+	return events;
+}
+
+static void
+set_epoll_for_handle(int h)
+{
+	uint32_t events = get_epoll_events(h);
+	struct epoll_event ev;
+	int rs;
+
+	if (threads[h].epoll_always_ready) {
+		if (events) return;
+		threads[h].epoll_always_ready = 0;
+		epoll_always_ready_count--;
+		return;
+	}
+
+	if (!events) {
+		if (threads[h].epoll_added) {
+			/* Fails if the handle was already closed, which
+			 * removed it from the epoll set anyway. */
+			EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_DEL, h, NULL));
+			threads[h].epoll_added = 0;
+		}
+		return;
+	}
+
+	/* Even if the events are the same as before, the handle may be a new
+	 * one which got the number of a closed one, so epoll is always
+	 * told. set_handlers() comes here only when the handlers change. */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = h;
+
+	EINTRLOOP(rs, epoll_ctl(epoll_fd, threads[h].epoll_added
+				? EPOLL_CTL_MOD : EPOLL_CTL_ADD, h, &ev));
+	/* The handle may have been closed and reopened behind our back
+	 * without clearing its handlers first. */
+	if (rs == -1 && errno == ENOENT)
+		EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_ADD, h, &ev));
+	else if (rs == -1 && errno == EEXIST)
+		EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_MOD, h, &ev));
+
+	if (rs == -1) {
+		if (errno == EPERM) {
+			threads[h].epoll_added = 0;
+			threads[h].epoll_always_ready = 1;
+			epoll_always_ready_count++;
+			return;
+		}
+		elinks_internal("ERROR: epoll_ctl failed: %s, handle %d", strerror(errno), h);
+	}
+
+	threads[h].epoll_added = 1;
+}
+
+/* Stops watching @h until its handlers change. Used for hangups nobody
+ * listens to, which epoll would otherwise report over and over. */
+static void
+park_epoll_handle(int h)
+{
+	int rs;
+
+	EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_DEL, h, NULL));
+	if (h < n_threads)
+		threads[h].epoll_added = 0;
+}
+
+static void
+enable_epoll(void)
+{
+	int i;
+
+	if (get_cmd_opt_bool("no-epoll"))
+		return;
+
+	/* Not before init(), which may fork, and the children would share
+	 * the epoll set with us. */
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+		return;
+
+	epoll_enabled = 1;
+
+	for (i = 0; i < w_max; i++)
+		set_epoll_for_handle(i);
+}
+
+static void
+terminate_epoll(void)
+{
+	if (epoll_enabled) {
+		close(epoll_fd);
+		epoll_fd = -1;
+		epoll_enabled = 0;
+	}
+}
+
+static void
+dispatch_epoll_event(int h, uint32_t events)
+{
+	int handled = 0;
+
+	if (h >= n_threads || !(threads[h].read_func
+				|| threads[h].write_func
+				|| threads[h].error_func)) {
+		park_epoll_handle(h);
+		return;
+	}
+
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	    && threads[h].read_func) {
+		threads[h].read_func(threads[h].data);
+		check_bottom_halves();
+		handled = 1;
+	}
+
+	if ((events & (EPOLLOUT | EPOLLERR)) && threads[h].write_func) {
+		threads[h].write_func(threads[h].data);
+		check_bottom_halves();
+		handled = 1;
+	}
+
+	if ((events & EPOLLPRI) && threads[h].error_func) {
+		threads[h].error_func(threads[h].data);
+		check_bottom_halves();
+		handled = 1;
+	}
+
+	/* select() would not report a hangup to a handle watched only for
+	 * exceptions. */
+	if (!handled && (events & (EPOLLHUP | EPOLLERR)))
+		park_epoll_handle(h);
+}
+
+static void
+epoll_loop(timeval_T *last_time)
+{
+	static struct epoll_event events[EPOLL_MAX_EVENTS];
+	int epoll_errors = 0;
+
+	while (!program.terminate) {
+		int n, i, has_timer;
+		int timeout = -1;
+		timeval_T t;
+
+		check_signals();
+		check_timers(last_time);
+		redraw_all_terminals();
+
+		if (program.terminate) break;
+
+		has_timer = get_next_timer_time(&t);
+		if (!w_count && !has_timer) break;
+		critical_section = 1;
+
+		if (check_signals()) {
+			critical_section = 0;
+			continue;
+		}
+
+		if (epoll_always_ready_count) {
+			timeout = 0;
+		} else if (has_timer) {
+			milliseconds_T ms;
+
+			/* Be sure timeout is not negative. */
+			timeval_limit_to_zero_or_one(&t);
+			/* Round up, waking up before the timer is due
+			 * would only spin. */
+			ms = timeval_to_milliseconds(&t);
+			if (t.usec % 1000) ms++;
+			timeout = (int) ms_min(ms, INT_MAX);
+		}
+
+		n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, timeout);
+		if (n < 0) {
+			/* The following calls (especially gettext)
+			 * might change errno.  */
+			const int errno_from_epoll = errno;
+
+			critical_section = 0;
+			uninstall_alarm();
+			if (errno_from_epoll != EINTR) {
+				ERROR(gettext("The call to %s failed: %d (%s)"),
+				      "epoll_wait()", errno_from_epoll, (char *) strerror(errno_from_epoll));
+				if (++epoll_errors > 10) /* Infinite loop prevention. */
+					INTERNAL(gettext("%d select() failures."),
+						 epoll_errors);
+			}
+			continue;
+		}
+
+		epoll_errors = 0;
+		critical_section = 0;
+		uninstall_alarm();
+		check_signals();
+		check_timers(last_time);
+
+		for (i = 0; i < n; i++)
+			dispatch_epoll_event(events[i].data.fd, events[i].events);
+
+		if (!epoll_always_ready_count) continue;
+
+		for (i = 0; i < w_max; i++) {
+			if (!threads[i].epoll_always_ready) continue;
+
+			if (threads[i].read_func) {
+				threads[i].read_func(threads[i].data);
+				check_bottom_halves();
+			}
+			if (threads[i].write_func) {
+				threads[i].write_func(threads[i].data);
+				check_bottom_halves();
+			}
+		}
+	}
+}
+
+#endif
+
 
 select_handler_T
 get_handler(int fd, enum select_handler_type tp)
@@ -399,9 +653,16 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 	     select_handler_T error_func, void *data)
 {
 #ifndef CONFIG_OS_WIN32
+#ifdef USE_EPOLL
+	/* epoll has no limit on handle numbers. */
+	assertm(fd >= 0 && (fd < FD_SETSIZE || epoll_enabled),
+		"set_handlers: handle %d >= FD_SETSIZE %d",
+		fd, FD_SETSIZE);
+#else
 	assertm(fd >= 0 && fd < FD_SETSIZE,
 		"set_handlers: handle %d >= FD_SETSIZE %d",
 		fd, FD_SETSIZE);
+#endif
 	if_assert_failed return;
 #endif
 #ifdef __GNU__
@@ -422,6 +683,9 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 
 #if defined(USE_POLL) && defined(USE_LIBEVENT)
 	if (!event_enabled)
+#endif
+#ifdef USE_EPOLL
+	if (!epoll_enabled)
 #endif
 		if (fd >= (int)FD_SETSIZE) {
 			elinks_internal("too big handle %d", fd);
@@ -444,6 +708,11 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 		return;
 	}
 
+	if (threads[fd].read_func || threads[fd].write_func || threads[fd].error_func)
+		w_count--;
+	if (read_func || write_func || error_func)
+		w_count++;
+
 	threads[fd].read_func = read_func;
 	threads[fd].write_func = write_func;
 	threads[fd].error_func = error_func;
@@ -466,6 +735,12 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 		set_events_for_handle(fd);
 		return;
 	}
+#endif
+#ifdef USE_EPOLL
+	if (epoll_enabled) {
+		set_epoll_for_handle(fd);
+		return;
+	}
 #endif
 	if (read_func) {
 		FD_SET(fd, &w_read);
@@ -527,6 +802,12 @@ select_loop(void (*init)(void))
 		}
 	} else
 #endif
+#ifdef USE_EPOLL
+	enable_epoll();
+	if (epoll_enabled) {
+		epoll_loop(&last_time);
+	} else
+#endif
 
 	while (!program.terminate) {
 		struct timeval *timeout = NULL;
@@ -685,6 +966,9 @@ terminate_select(void)
 {
 #ifdef USE_LIBEVENT
 	terminate_libevent();
+#endif
+#ifdef USE_EPOLL
+	terminate_epoll();
 #endif
 	mem_free_if(threads);
 }
@@ -0,0 +1,174 @@
+/* Measure the overhead of one select_loop() iteration with many idle handles */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+#include <sys/socket.h>
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "elinks.h"
+
+#include "main/main.h"
+#include "main/select.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* In stub.c */
+extern int test_no_epoll;
+
+static int idle_count = 1000;
+static long iterations = 100000;
+
+static int active[2];
+static long iteration;
+static timeval_T start;
+
+static void
+idle_handler(void *data)
+{
+	die("idle handle %d reported ready", (int) (intptr_t) data);
+}
+
+/* The active handle has unread data and so is ready in every iteration. */
+static void
+active_handler(void *data)
+{
+	if (!iteration++)
+		timeval_now(&start);
+
+	if (iteration > iterations)
+		program.terminate = 1;
+}
+
+static void
+init_bench(void)
+{
+	int i;
+
+	for (i = 0; i < idle_count; i += 2) {
+		int fds[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+			die("socketpair: %s", strerror(errno));
+
+		set_handlers(fds[0], idle_handler, NULL, idle_handler,
+			     (void *) (intptr_t) fds[0]);
+		set_handlers(fds[1], idle_handler, NULL, idle_handler,
+			     (void *) (intptr_t) fds[1]);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, active)
+	    || write(active[0], "x", 1) != 1)
+		die("socketpair: %s", strerror(errno));
+
+	set_handlers(active[1], active_handler, NULL, NULL, NULL);
+
+	if (get_file_handles_count() != i + 1)
+		die("%d handles counted, %d expected",
+		    get_file_handles_count(), i + 1);
+}
+
+static void
+run_bench(const char *backend, int use_epoll)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid < 0) die("fork: %s", strerror(errno));
+
+	if (!pid) {
+		timeval_T now, duration;
+
+		test_no_epoll = !use_epoll;
+		select_loop(init_bench);
+
+		if (iteration <= iterations)
+			die("%s loop ended after %ld iterations", backend, iteration);
+
+		timeval_now(&now);
+		timeval_sub(&duration, &start, &now);
+		printf("%-8s %12.0f\n", backend,
+		       (duration.sec * 1000000.0 + duration.usec) * 1000.0 / iterations);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (waitpid(pid, &status, 0) != pid
+	    || !WIFEXITED(status) || WEXITSTATUS(status))
+		die("%s benchmark failed", backend);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "idle", &i, argc, argv, "a number")) {
+			idle_count = atoi(arg);
+
+		} else if (get_test_opt(&arg, "iterations", &i, argc, argv, "a number")) {
+			iterations = atol(arg);
+
+		} else {
+			die("usage: %s [--idle <handles>] [--iterations <n>]", argv[0]);
+		}
+	}
+
+	if (iterations <= 0)
+		die("--iterations must be positive");
+
+#if defined(HAVE_SYS_RESOURCE_H) && defined(RLIMIT_NOFILE)
+	{
+		struct rlimit limit;
+
+		if (!getrlimit(RLIMIT_NOFILE, &limit)
+		    && limit.rlim_cur < (rlim_t) idle_count + 16) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+	}
+#endif
+
+	printf("%ld iterations with %d idle handles\n", iterations, idle_count);
+	printf("%-8s %12s\n", "backend", "ns/iteration");
+
+	/* Leave room for stdio and the active pair. */
+	if (idle_count + 8 < FD_SETSIZE)
+		run_bench("select", 0);
+	else
+		printf("%-8s %12s\n", "select", "too many handles");
+
+#if defined(CONFIG_EPOLL) && defined(HAVE_SYS_EPOLL_H)
+	run_bench("epoll", 1);
+#endif
+
+	return 0;
+}
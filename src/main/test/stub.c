@@ -0,0 +1,81 @@
+/* What the main loop needs from the rest of ELinks. The tests have no
+ * signals, terminals or options, only handles and timers. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "main/main.h"
+#include "osdep/signals.h"
+#include "terminal/terminal.h"
+#include "util/time.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+struct program program;
+volatile int critical_section = 0;
+struct option *cmdline_options = NULL;
+
+/* The value of the -no-epoll switch. */
+int test_no_epoll = 0;
+
+#ifdef CONFIG_DEBUG
+union option_value *
+get_opt_(char *file, int line, enum option_type option_type,
+	 struct option *tree, const char *name, struct session *ses)
+#else
+union option_value *
+get_opt_(struct option *tree, const char *name, struct session *ses)
+#endif
+{
+	static union option_value value;
+
+	/* Only the main loop switches are asked for. */
+	value.number = !strcmp(name, "no-libevent")
+		       || (!strcmp(name, "no-epoll") && test_no_epoll);
+	return &value;
+}
+
+int
+check_signals(void)
+{
+	return 0;
+}
+
+void
+clear_signal_mask_and_handlers(void)
+{
+}
+
+void
+uninstall_alarm(void)
+{
+}
+
+void
+redraw_all_terminals(void)
+{
+}
@@ -0,0 +1,213 @@
+/* Install and kill lots of timers and check they expire in order */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "main/timer.h"
+#include "util/memory.h"
+#include "util/test.h"
+#include "util/time.h"
+
+/* How much the clock check_timers() advances may run ahead of the simulated
+ * one, because real time passes as well. */
+#define CLOCK_SLACK 2
+
+struct entry {
+	timer_id_T id;
+	milliseconds_T due;
+	unsigned int killed:1;
+	unsigned int fired:1;
+};
+
+static struct entry *entries;
+static int entries_count;
+
+static milliseconds_T now;
+static int last_fired = -1;
+static long fired_count, extra_installed, extra_fired;
+
+static unsigned long random_state = 42;
+
+static int
+next_random(void)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) & 0x7fff;
+}
+
+static int
+random_entry(void)
+{
+	return (next_random() * 32768 + next_random()) % entries_count;
+}
+
+static void
+extra_timer(void *data)
+{
+	extra_fired++;
+}
+
+static void
+entry_timer(void *data)
+{
+	int index = (int) (intptr_t) data;
+	struct entry *entry = &entries[index];
+
+	if (entry->killed || entry->fired)
+		die("timer %d called after being %s", index,
+		    entry->killed ? "killed" : "called");
+
+	if (entry->due > now + CLOCK_SLACK)
+		die("timer %d due at %ld called at %ld", index, entry->due, now);
+
+	/* All entries were installed at once, so they have to be called in
+	 * the order of their expiration and then of their installation. */
+	if (last_fired >= 0
+	    && (entries[last_fired].due > entry->due
+		|| (entries[last_fired].due == entry->due && last_fired > index)))
+		die("timer %d called after timer %d", index, last_fired);
+
+	entry->id = TIMER_ID_UNDEF;
+	entry->fired = 1;
+	last_fired = index;
+	fired_count++;
+
+	/* Timers may kill and install other timers from their handlers. */
+	if (next_random() % 4 == 0) {
+		struct entry *victim = &entries[random_entry()];
+
+		if (victim->id != TIMER_ID_UNDEF) {
+			kill_timer(&victim->id);
+			victim->killed = 1;
+		}
+	}
+
+	if (next_random() % 8 == 0) {
+		timer_id_T id;
+
+		install_timer(&id, 1 + next_random() % 1000, extra_timer, NULL);
+		if (id == TIMER_ID_UNDEF) die("out of memory");
+		extra_installed++;
+	}
+}
+
+static void
+advance_clock(milliseconds_T step)
+{
+	timeval_T last_time, interval;
+
+	now += step;
+
+	/* check_timers() advances its clock by the time since @last_time. */
+	timeval_now(&last_time);
+	timeval_from_milliseconds(&interval, step);
+	timeval_sub_interval(&last_time, &interval);
+	check_timers(&last_time);
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+int
+main(int argc, char *argv[])
+{
+	milliseconds_T max_delay = 100000;
+	timeval_T start;
+	long live = 0, killed = 0;
+	int i;
+
+	entries_count = 100000;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "timers", &i, argc, argv, "a number")) {
+			entries_count = atoi(arg);
+
+		} else {
+			die("usage: %s [--timers <n>]", argv[0]);
+		}
+	}
+
+	if (entries_count <= 0)
+		die("--timers must be positive");
+
+	entries = (struct entry *)mem_calloc(entries_count, sizeof(*entries));
+	if (!entries) die("out of memory");
+
+	timeval_now(&start);
+	for (i = 0; i < entries_count; i++) {
+		entries[i].due = 1 + (next_random() * 32768 + next_random()) % max_delay;
+		install_timer(&entries[i].id, entries[i].due, entry_timer,
+			      (void *) (intptr_t) i);
+		if (entries[i].id == TIMER_ID_UNDEF) die("out of memory");
+	}
+	printf("installed %d timers in %ld ms\n", entries_count, elapsed_ms(&start));
+
+	if (get_timers_count() != entries_count)
+		die("%d timers counted, %d expected", get_timers_count(), entries_count);
+
+	timeval_now(&start);
+	for (i = 0; i < entries_count / 2; i++) {
+		struct entry *entry = &entries[random_entry()];
+
+		if (entry->id == TIMER_ID_UNDEF) continue;
+		kill_timer(&entry->id);
+		if (entry->id != TIMER_ID_UNDEF) die("kill_timer() did not clear the ID");
+		entry->killed = 1;
+		killed++;
+	}
+	printf("killed %ld timers in %ld ms\n", killed, elapsed_ms(&start));
+
+	timeval_now(&start);
+	while (now <= max_delay + CLOCK_SLACK) {
+		timeval_T next;
+
+		advance_clock(1 + next_random() % 50);
+
+		/* Everything already due has to have been called. */
+		if (get_next_timer_time(&next) && !timeval_is_positive(&next))
+			die("timers due at %ld not called", now);
+	}
+
+	/* Let the timers installed by the handlers expire too. */
+	while (get_timers_count() && now < 2 * max_delay)
+		advance_clock(1000);
+	printf("expired %ld timers in %ld ms\n", fired_count + extra_fired,
+	       elapsed_ms(&start));
+
+	for (i = 0; i < entries_count; i++)
+		if (!entries[i].killed) live++;
+
+	if (fired_count != live)
+		die("%ld timers called, %ld expected", fired_count, live);
+	if (extra_fired != extra_installed)
+		die("%ld timers installed by handlers, %ld called",
+		    extra_installed, extra_fired);
+	if (get_timers_count())
+		die("%d timers left", get_timers_count());
+
+	mem_free(entries);
+
+	return 0;
+}
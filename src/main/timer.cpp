@@ -29,7 +29,6 @@
 #include "main/select.h"
 #include "main/timer.h"
 #include "util/error.h"
-#include "util/lists.h"
 #include "util/memory.h"
 #include "util/time.h"
 
@@ -37,15 +36,112 @@
 #include "ecmascript/timer.h"
 #endif
 
-/* @timers.next points to the timer with the smallest interval,
- * @timers.next->next to the second smallest, and so on.  */
-static INIT_LIST_OF(struct timer, timers);
+/* The timers are kept in a binary min-heap, @timer_heap[0] is the one to
+ * expire first and the children of @timer_heap[i] are at 2 * i + 1 and
+ * 2 * i + 2. Installing and killing a timer is O(log n). */
+static struct timer **timer_heap;
+static int timer_heap_size;
+
+#define realloc_timer_heap(size) \
+	mem_align_alloc(&timer_heap, size, (size) + 1, 0xFF)
+
+/* The clock timers expire on. check_timers() advances it by the time elapsed
+ * since its previous call, but never backwards, so setting the system clock
+ * back does not stall the timers. */
+static timeval_T timer_clock;
+
+static unsigned long timer_sequence;
 
 int
 get_timers_count(void)
 {
-	return list_size(&timers);
+	return timer_heap_size;
+}
+
+static inline int
+timer_expires_before(struct timer *timer1, struct timer *timer2)
+{
+	int cmp = timeval_cmp(&timer1->when, &timer2->when);
+
+	return cmp < 0 || (!cmp && timer1->sequence < timer2->sequence);
+}
 
+static inline void
+set_heap_timer(int index, struct timer *timer)
+{
+	timer_heap[index] = timer;
+	timer->heap_index = index;
+}
+
+static void
+sift_timer_up(int index)
+{
+	struct timer *timer = timer_heap[index];
+
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+
+		if (!timer_expires_before(timer, timer_heap[parent]))
+			break;
+
+		set_heap_timer(index, timer_heap[parent]);
+		index = parent;
+	}
+
+	set_heap_timer(index, timer);
+}
+
+static void
+sift_timer_down(int index)
+{
+	struct timer *timer = timer_heap[index];
+
+	while (1) {
+		int child = 2 * index + 1;
+
+		if (child >= timer_heap_size)
+			break;
+
+		if (child + 1 < timer_heap_size
+		    && timer_expires_before(timer_heap[child + 1], timer_heap[child]))
+			child++;
+
+		if (!timer_expires_before(timer_heap[child], timer))
+			break;
+
+		set_heap_timer(index, timer_heap[child]);
+		index = child;
+	}
+
+	set_heap_timer(index, timer);
+}
+
+static int
+add_to_timer_heap(struct timer *timer)
+{
+	if (!realloc_timer_heap(timer_heap_size))
+		return 0;
+
+	set_heap_timer(timer_heap_size++, timer);
+	sift_timer_up(timer->heap_index);
+
+	return 1;
+}
+
+static void
+del_from_timer_heap(struct timer *timer)
+{
+	int index = timer->heap_index;
+	struct timer *last = timer_heap[--timer_heap_size];
+
+	timer->heap_index = -1;
+	if (last == timer) return;
+
+	set_heap_timer(index, last);
+	if (index > 0 && timer_expires_before(last, timer_heap[(index - 1) / 2]))
+		sift_timer_up(index);
+	else
+		sift_timer_down(index);
 }
 
 #ifdef HAVE_EVENT_BASE_SET
@@ -87,17 +183,16 @@ check_timers(timeval_T *last_time)
 	timeval_now(&now);
 	timeval_sub(&interval, last_time, &now);
 
-	foreach (timer, timers) {
-		timeval_sub_interval(&timer->interval, &interval);
-	}
+	if (timeval_is_positive(&interval))
+		timeval_add_interval(&timer_clock, &interval);
 
-	while (!list_empty(timers)) {
-		timer = (struct timer *)timers.next;
+	while (timer_heap_size) {
+		timer = timer_heap[0];
 
-		if (timeval_is_positive(&timer->interval))
+		if (timeval_cmp(&timer->when, &timer_clock) > 0)
 			break;
 
-		del_from_list(timer);
+		del_from_timer_heap(timer);
 #if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 		del_from_map_timer(timer);
 #endif
@@ -125,15 +220,18 @@ set_event_for_timer(timer_id_T tm)
 {
 	struct timeval tv;
 	struct event *ev = timer_event(tm);
+	timeval_T interval;
 	timeout_set(ev, timer_callback, tm);
 #ifdef HAVE_EVENT_BASE_SET
 	if (event_base_set(event_base, ev) == -1)
 		elinks_internal("ERROR: event_base_set failed: %s", strerror(errno));
 #endif
-	tv.tv_sec = tm->interval.sec;
-	tv.tv_usec = tm->interval.usec;
+	timeval_sub(&interval, &timer_clock, &tm->when);
+	timeval_limit_to_zero_or_one(&interval);
+	tv.tv_sec = interval.sec;
+	tv.tv_usec = interval.usec;
 #if defined(HAVE_LIBEV)
-	if (!tm->interval.usec && ev_version_major() < 4) {
+	if (!interval.usec && ev_version_major() < 4) {
 		/* libev bug */
 		tv.tv_usec = 1;
 	}
@@ -154,7 +252,8 @@ set_event_for_timer(timer_id_T tm)
 void
 install_timer(timer_id_T *id, milliseconds_T delay, void (*func)(void *), void *data)
 {
-	struct timer *new_timer, *timer;
+	struct timer *new_timer;
+	timeval_T interval;
 
 	assert(id && delay > 0);
 
@@ -167,23 +266,37 @@ install_timer(timer_id_T *id, milliseconds_T delay, void (*func)(void *), void *
 	*id = (timer_id_T) new_timer; /* TIMER_ID_UNDEF is NULL */
 	if (!new_timer) return;
 
-	timeval_from_milliseconds(&new_timer->interval, delay);
+	timeval_from_milliseconds(&interval, delay);
+	timeval_add(&new_timer->when, &timer_clock, &interval);
+
+	/* Round up to whole milliseconds, so that timers expiring within
+	 * the same millisecond are all called by one check_timers(). */
+	if (new_timer->when.usec % 1000) {
+		new_timer->when.usec += 1000 - new_timer->when.usec % 1000;
+		if (new_timer->when.usec >= 1000000) {
+			new_timer->when.usec -= 1000000;
+			new_timer->when.sec++;
+		}
+	}
+
 	new_timer->func = func;
 	new_timer->data = data;
+	new_timer->sequence = timer_sequence++;
+
+	if (!add_to_timer_heap(new_timer)) {
 #ifdef USE_LIBEVENT
-	if (event_enabled) {
-		set_event_for_timer(new_timer);
-		add_to_list(timers, new_timer);
-	} else
+		mem_free(timer_event(new_timer));
+#else
+		mem_free(new_timer);
 #endif
-	{
-		foreach (timer, timers) {
-			if (timeval_cmp(&timer->interval, &new_timer->interval) >= 0)
-				break;
-		}
-
-		add_at_pos(timer->prev, new_timer);
+		*id = TIMER_ID_UNDEF;
+		return;
 	}
+
+#ifdef USE_LIBEVENT
+	if (event_enabled)
+		set_event_for_timer(new_timer);
+#endif
 #if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 	add_to_map_timer(new_timer);
 #endif
@@ -197,7 +310,10 @@ kill_timer(timer_id_T *id)
 	assert(id != NULL);
 	if (*id == TIMER_ID_UNDEF) return;
 	timer = *id;
-	del_from_list(timer);
+	assertm(timer->heap_index >= 0, "killing expired timer");
+	if_assert_failed return;
+
+	del_from_timer_heap(timer);
 #if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 	del_from_map_timer(timer);
 #endif
@@ -216,8 +332,8 @@ kill_timer(timer_id_T *id)
 int
 get_next_timer_time(timeval_T *t)
 {
-	if (!list_empty(timers)) {
-		timeval_copy(t, &((struct timer *) &timers)->next->interval);
+	if (timer_heap_size) {
+		timeval_sub(t, &timer_clock, &timer_heap[0]->when);
 		return 1;
 	}
 
@@ -229,9 +345,9 @@ void
 set_events_for_timer(void)
 {
 #ifdef USE_LIBEVENT
-	timer_id_T tm;
+	int i;
 
-	foreach(tm, timers)
-		set_event_for_timer(tm);
+	for (i = 0; i < timer_heap_size; i++)
+		set_event_for_timer(timer_heap[i]);
 #endif
 }
@@ -1,7 +1,6 @@
 #ifndef EL__MAIN_TIMER_H
 #define EL__MAIN_TIMER_H
 
-#include "util/lists.h"
 #include "util/time.h"
 
 #ifdef __cplusplus
@@ -9,11 +8,17 @@ extern "C" {
 #endif
 
 struct timer {
-	LIST_HEAD(struct timer);
-
-	timeval_T interval;
+	/* When the timer expires, measured on the clock advanced by
+	 * check_timers(). */
+	timeval_T when;
 	void (*func)(void *);
 	void *data;
+
+	/* The position in the timer heap, -1 when not in it. */
+	int heap_index;
+	/* Installation order, timers expiring at the same time are called in
+	 * it. */
+	unsigned long sequence;
 };
 
 /* Little hack, timer_id_T is in fact a pointer to the timer, so
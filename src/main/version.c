@@ -47,6 +47,10 @@
 extern int event_enabled;
 #endif 
 
+#if defined(CONFIG_EPOLL) && defined(HAVE_SYS_EPOLL_H)
+extern int epoll_enabled;
+#endif
+
 static void
 add_module_to_string(struct string *string, struct module *module,
 		     struct terminal *term)
@@ -190,6 +194,9 @@ get_dyn_full_version(struct terminal *term, int more)
 #ifdef CONFIG_LIBEVENT
 		comma, (event_enabled ? _("libevent", term) : _("libevent (disabled)", term)), "(", get_libevent_version(), ")",
 #endif
+#if defined(CONFIG_EPOLL) && defined(HAVE_SYS_EPOLL_H)
+		comma, (epoll_enabled ? _("epoll", term) : _("epoll (disabled)", term)),
+#endif
 #ifdef CONFIG_TERMINFO
 		comma, (get_cmd_opt_bool("terminfo") ? _("terminfo", term) : _("terminfo (disabled)", term)),
 #endif
@@ -31,11 +31,15 @@
 #include "network/socket.h"
 #include "network/ssl/ssl.h"
 #include "protocol/http/http.h"
+#include "protocol/http/http2.h"
 #include "protocol/protocol.h"
 #include "protocol/proxy.h"
 #include "protocol/uri.h"
 #include "session/session.h"
+#include "util/conv.h"
 #include "util/error.h"
+#include "util/hash.h"
+#include "util/math.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "util/time.h"
@@ -56,6 +60,8 @@ struct keepalive_connection {
 	timeval_T creation_time;
 
 	unsigned int protocol_family:1; /* see network/socket.h, EL_PF_INET, EL_PF_INET6 */
+	/* Opened ahead of time by the prefetcher, nobody used it yet. */
+	unsigned int preconnected:1;
 	int socket;
 };
 
@@ -68,6 +74,13 @@ static INIT_LIST_OF(struct connection, connection_queue);
 static INIT_LIST_OF(struct host_connection, host_connections);
 static INIT_LIST_OF(struct keepalive_connection, keepalive_connections);
 
+/* Statistics for the resource info dialog. */
+static long preconnect_hit_count;
+static long preconnect_waste_count;
+
+/* All the connections, by their ID. */
+static struct hash *connection_ids;
+
 /* Prototypes */
 static void check_keepalive_connections(void);
 static void notify_connection_callbacks(struct connection *conn);
@@ -87,6 +100,12 @@ get_priority(struct connection *conn)
 	return priority;
 }
 
+connection_priority_T
+get_connection_priority(struct connection *conn)
+{
+	return get_priority(conn);
+}
+
 int
 get_connections_count(void)
 {
@@ -99,6 +118,31 @@ get_keepalive_connections_count(void)
 	return list_size(&keepalive_connections);
 }
 
+int
+get_preconnected_count(void)
+{
+	struct keepalive_connection *keep_conn;
+	int count = 0;
+
+	foreach (keep_conn, keepalive_connections)
+		if (keep_conn->preconnected)
+			count++;
+
+	return count;
+}
+
+long
+get_preconnect_hit_count(void)
+{
+	return preconnect_hit_count;
+}
+
+long
+get_preconnect_waste_count(void)
+{
+	return preconnect_waste_count;
+}
+
 int
 get_connections_connecting_count(void)
 {
@@ -132,22 +176,26 @@ get_connections_transfering_count(void)
 static inline int
 connection_disappeared(struct connection *conn, unsigned int id)
 {
-	struct connection *c;
+	struct hash_item *item;
 
-	foreach (c, connection_queue)
-		if (conn == c && id == c->id)
-			return 0;
+	if (!connection_ids) return 1;
 
-	return 1;
+	item = get_hash_item(connection_ids, (const char *) &id, sizeof(id));
+
+	return !item || item->value != conn;
 }
 
 /* Host connection management: */
 /* Used to keep track on the number of connections to any given host. When
- * trying to setup a new connection the list is searched to see if the maximum
+ * trying to setup a new connection the table is searched to see if the maximum
  * number of connection has been reached. If that is the case we try to suspend
  * an already established connection. */
-/* Some connections (like file://) that do not involve hosts are not maintained
- * in the list. */
+/* The host connection also queues the connections to the host which wait for
+ * their turn, one queue for each priority. check_queue() takes turns among
+ * the hosts, so that lots of downloads from one host do not hold up the others
+ * and it never has to look at more than the first connection of a queue. */
+/* Some connections (like file://) that do not involve hosts are not counted
+ * but they are queued with a host connection of their own. */
 
 struct host_connection {
 	OBJECT_HEAD(struct host_connection);
@@ -155,20 +203,121 @@ struct host_connection {
 	/* XXX: This is just the URI of the connection that registered the
 	 * host connection so only rely on the host part. */
 	struct uri *uri;
+
+	struct hash_item *item;
+
+	LIST_OF(struct connection_slot) queue[PRIORITIES];
+	int queued;
+
+	/* The connection.limit.host limit of the traffic, or the share of
+	 * the host in connection.limit.total if that is lower. */
+	struct rate_limit rate_limit;
+
+	char key[1];	/* See get_host_connection_key(); XXX: Must be last. */
 };
 
+static struct hash *host_connections_hash;
+
+/* No host name is longer, the longer ones are cut. */
+#define HOST_CONNECTION_KEYLEN 256
+
+/* Puts the key of the host of @uri in @key and returns its length. The host
+ * names are in lowercase, compare_uri() does not care about the case either.
+ * The hash takes no empty keys, and no host name has a slash. */
+static int
+get_host_connection_key(struct uri *uri, char key[HOST_CONNECTION_KEYLEN])
+{
+	int keylen;
+
+	if (!uri->host || !uri->hostlen) {
+		key[0] = '/';
+		return 1;
+	}
+
+	keylen = int_min(uri->hostlen, HOST_CONNECTION_KEYLEN);
+	memcpy(key, uri->host, keylen);
+	convert_to_lowercase_locale_indep(key, keylen);
+
+	return keylen;
+}
+
 static struct host_connection *
-get_host_connection(struct connection *conn)
+find_host_connection(struct uri *uri)
 {
-	struct host_connection *host_conn;
+	struct hash_item *item;
+	char key[HOST_CONNECTION_KEYLEN];
+	int keylen;
 
-	if (!conn->uri->host) return NULL;
+	if (!host_connections_hash) return NULL;
 
-	foreach (host_conn, host_connections)
-		if (compare_uri(host_conn->uri, conn->uri, URI_HOST))
-			return host_conn;
+	keylen = get_host_connection_key(uri, key);
+	item = get_hash_item(host_connections_hash, key, keylen);
 
-	return NULL;
+	return item ? (struct host_connection *) item->value : NULL;
+}
+
+static struct host_connection *
+init_host_connection(struct uri *uri)
+{
+	struct host_connection *host_conn = find_host_connection(uri);
+	char key[HOST_CONNECTION_KEYLEN];
+	int keylen;
+	int priority;
+
+	if (host_conn) return host_conn;
+
+	if (!host_connections_hash) {
+		host_connections_hash = init_hash8();
+		if (!host_connections_hash) return NULL;
+	}
+
+	keylen = get_host_connection_key(uri, key);
+
+	/* calloc() sets the NUL char for us. */
+	host_conn = (struct host_connection *)mem_calloc(1, sizeof(*host_conn)
+							 + keylen);
+	if (!host_conn) return NULL;
+
+	host_conn->uri = get_uri_reference(uri);
+	memcpy(host_conn->key, key, keylen);
+	host_conn->item = add_hash_item(host_connections_hash, host_conn->key,
+					keylen, host_conn);
+	if (!host_conn->item) {
+		done_uri(host_conn->uri);
+		mem_free(host_conn);
+		return NULL;
+	}
+
+	for (priority = 0; priority < PRIORITIES; priority++)
+		init_list(host_conn->queue[priority]);
+
+	object_nolock(host_conn, "host_connection");
+	add_to_list_end(host_connections, host_conn);
+
+	return host_conn;
+}
+
+/* Frees the host connection once no connection runs or waits for it. */
+static void
+release_host_connection(struct host_connection *host_conn)
+{
+	if (is_object_used(host_conn) || host_conn->queued) return;
+
+	del_hash_item(host_connections_hash, host_conn->item);
+	del_from_list(host_conn);
+	done_uri(host_conn->uri);
+	mem_free(host_conn);
+
+	if (list_empty(host_connections))
+		free_hash(&host_connections_hash);
+}
+
+static struct host_connection *
+get_host_connection(struct connection *conn)
+{
+	if (!conn->uri->host) return NULL;
+
+	return find_host_connection(conn->uri);
 }
 
 /* Returns if the connection was successfully added. */
@@ -176,17 +325,14 @@ get_host_connection(struct connection *conn)
 static int
 add_host_connection(struct connection *conn)
 {
-	struct host_connection *host_conn = get_host_connection(conn);
+	struct host_connection *host_conn;
 
-	if (!host_conn && conn->uri->host) {
-		host_conn = (struct host_connection *)mem_calloc(1, sizeof(*host_conn));
-		if (!host_conn) return 0;
+	if (!conn->uri->host) return 1;
 
-		host_conn->uri = get_uri_reference(conn->uri);
-		object_nolock(host_conn, "host_connection");
-		add_to_list(host_connections, host_conn);
-	}
-	if (host_conn) object_lock(host_conn);
+	host_conn = init_host_connection(conn->uri);
+	if (!host_conn) return 0;
+
+	object_lock(host_conn);
 
 	return 1;
 }
@@ -200,39 +346,284 @@ done_host_connection(struct connection *conn)
 	if (!host_conn) return;
 
 	object_unlock(host_conn);
-	if (is_object_used(host_conn)) return;
+	release_host_connection(host_conn);
+}
 
-	del_from_list(host_conn);
-	done_uri(host_conn->uri);
-	mem_free(host_conn);
+/* Puts the waiting @conn at the end of the queue of its host. Returns zero if
+ * out of memory. */
+static int
+queue_connection(struct connection *conn)
+{
+	struct host_connection *host_conn = init_host_connection(conn->uri);
+
+	assertm(!conn->running && !conn->slot.host, "connection already queued");
+	if_assert_failed return 1;
+
+	if (!host_conn) return 0;
+
+	conn->slot.conn = conn;
+	conn->slot.host = host_conn;
+	conn->slot.pri = get_priority(conn);
+	add_to_list_end(host_conn->queue[conn->slot.pri], &conn->slot);
+	host_conn->queued++;
+
+	return 1;
+}
+
+static void
+unqueue_connection(struct connection *conn)
+{
+	struct host_connection *host_conn = conn->slot.host;
+
+	if (!host_conn) return;
+
+	del_from_list(&conn->slot);
+	conn->slot.host = NULL;
+	host_conn->queued--;
+	release_host_connection(host_conn);
+}
+
+/* The connections new downloads of their URI are attached to, by the address
+ * of the URI. */
+static struct hash *uri_connections;
+
+static struct hash_item *
+get_uri_connection_item(struct uri *uri)
+{
+	if (!uri_connections) return NULL;
+
+	return get_hash_item(uri_connections, (const char *) &uri, sizeof(uri));
+}
+
+static struct connection *
+find_uri_connection(struct uri *uri)
+{
+	struct hash_item *item = get_uri_connection_item(uri);
+
+	return item ? (struct connection *) item->value : NULL;
+}
+
+/* If out of memory, downloads of the URI will just not share @conn. */
+static void
+add_uri_connection(struct connection *conn)
+{
+	if (!uri_connections) {
+		uri_connections = init_hash8();
+		if (!uri_connections) return;
+	}
+
+	add_hash_item(uri_connections, (const char *) &conn->uri,
+		      sizeof(conn->uri), conn);
+}
+
+static void
+del_uri_connection(struct connection *conn)
+{
+	struct hash_item *item = get_uri_connection_item(conn->uri);
+
+	if (item && item->value == conn)
+		del_hash_item(uri_connections, item);
+}
+
+/* The running connections, sorted by priority. */
+static INIT_LIST_OF(struct connection_slot, running_connections);
+
+static void
+add_running_connection(struct connection *conn)
+{
+	struct connection_slot *slot;
+
+	conn->slot.conn = conn;
+	conn->slot.pri = get_priority(conn);
+
+	foreachback (slot, running_connections)
+		if (slot->pri <= conn->slot.pri)
+			break;
+
+	add_at_pos(slot, &conn->slot);
+}
+
+/* Takes @conn off the queue of its host and counts it as running. */
+static void
+activate_connection(struct connection *conn)
+{
+	unqueue_connection(conn);
+	add_running_connection(conn);
+
+	active_connections++;
+	conn->running = 1;
+}
+
+/* Moves @conn to the place for its priority after the priority changed. */
+static void
+requeue_connection(struct connection *conn)
+{
+	connection_priority_T priority = get_priority(conn);
+
+	if (priority == conn->slot.pri) return;
+
+	if (conn->slot.host) {
+		del_from_list(&conn->slot);
+		conn->slot.pri = priority;
+		add_to_list_end(conn->slot.host->queue[priority], &conn->slot);
+
+	} else if (conn->running) {
+		del_from_list(&conn->slot);
+		add_running_connection(conn);
+	}
+}
+
+
+/* Rate limits: */
+
+/* The connection.limit.total limit of the traffic. */
+static struct rate_limit total_rate_limit;
+
+/* Returns the rate set by the option @name, in bytes per second. */
+#define get_opt_rate(name) (get_opt_int(name, NULL) * 1024)
+
+/* A host has traffic if its limit was asked for more within this time. */
+#define HOST_TRAFFIC_TIME	1000
+/* How often the hosts with traffic are counted. */
+#define HOST_TRAFFIC_COUNT_TIME	100
+
+/* The limit of a host is asked for whenever its sockets are to read or
+ * write, which refills the bucket, so @last_time of the bucket tells when
+ * the host last had traffic. */
+static int
+has_host_traffic(struct host_connection *host_conn, timeval_T *now)
+{
+	timeval_T age;
+
+	if (!host_conn->rate_limit.rate) return 0;
+
+	timeval_sub(&age, &host_conn->rate_limit.last_time, now);
+	return timeval_to_milliseconds(&age) < HOST_TRAFFIC_TIME;
 }
 
+/* Returns how many hosts have had traffic lately, @host_conn counting as
+ * one of them. */
+static int
+get_busy_host_count(struct host_connection *host_conn, timeval_T *now)
+{
+	static int count;
+	static timeval_T count_time;
+	timeval_T age;
+
+	timeval_sub(&age, &count_time, now);
+	if (timeval_to_milliseconds(&age) >= HOST_TRAFFIC_COUNT_TIME) {
+		struct host_connection *host;
+
+		count = 0;
+		foreach (host, host_connections)
+			count += has_host_traffic(host, now);
+		timeval_copy(&count_time, now);
+	}
+
+	return has_host_traffic(host_conn, now) ? int_max(count, 1) : count + 1;
+}
+
+int
+get_host_rate_limits(struct uri *uri, struct rate_limit **limits)
+{
+	struct host_connection *host_conn;
+	int count = 0;
+
+	set_rate_limit(&total_rate_limit, get_opt_rate("connection.limit.total"));
+	if (total_rate_limit.rate)
+		limits[count++] = &total_rate_limit;
+
+	host_conn = uri->host ? find_host_connection(uri) : NULL;
+	if (host_conn) {
+		int rate = get_opt_rate("connection.limit.host");
+
+		/* The hosts with traffic share the total limit equally, so
+		 * that the downloads from one host do not take it all. Only
+		 * the bytes are shared, the connections take turns in
+		 * check_queue(). */
+		if (total_rate_limit.rate) {
+			timeval_T now;
+			int share;
+
+			timeval_now(&now);
+			share = total_rate_limit.rate
+				/ get_busy_host_count(host_conn, &now);
+			if (!rate || share < rate) rate = share;
+		}
+
+		set_rate_limit(&host_conn->rate_limit, rate);
+		if (host_conn->rate_limit.rate)
+			limits[count++] = &host_conn->rate_limit;
+	}
+
+	return count;
+}
+
+static int
+get_connection_rate_limits(struct connection *conn, struct rate_limit **limits)
+{
+	int count = get_host_rate_limits(conn->uri, limits);
 
-static void sort_queue();
+	set_rate_limit(&conn->rate_limit, get_opt_rate("connection.limit.download"));
+	if (conn->rate_limit.rate)
+		limits[count++] = &conn->rate_limit;
+
+	return count;
+}
+
+/* Returns the lowest rate the traffic of @conn is limited to, or zero. */
+static int
+get_connection_rate_limit(struct connection *conn)
+{
+	struct rate_limit *limits[RATE_LIMITS];
+	int count = get_connection_rate_limits(conn, limits);
+	int rate = 0;
+
+	while (count--)
+		if (!rate || limits[count]->rate < rate)
+			rate = limits[count]->rate;
+
+	return rate;
+}
+
+#undef get_opt_rate
+
+
+static void suspend_connection(struct connection *conn);
 
 #ifdef CONFIG_DEBUG
 static void
 check_queue_bugs(void)
 {
 	struct connection *conn;
+	struct connection_slot *slot;
 	connection_priority_T prev_priority = 0;
-	int cc = 0;
+	int cc = 0, rc = 0;
 
 	foreach (conn, connection_queue) {
-		connection_priority_T priority = get_priority(conn);
-
 		cc += conn->running;
 
-		assertm(priority >= prev_priority, "queue is not sorted");
 		assertm(is_in_progress_state(conn->state),
 			"interrupted connection on queue (conn %s, state %d)",
 			struri(conn->uri), conn->state);
-		prev_priority = priority;
+		assertm(conn->running || conn->slot.host,
+			"connection neither running nor queued (conn %s)",
+			struri(conn->uri));
+		assertm(conn->slot.pri == get_priority(conn),
+			"connection queued with old priority (conn %s)",
+			struri(conn->uri));
 	}
 
-	assertm(cc == active_connections,
-		"bad number of active connections (counted %d, stored %d)",
-		cc, active_connections);
+	foreach (slot, running_connections) {
+		rc++;
+
+		assertm(slot->pri >= prev_priority, "queue is not sorted");
+		prev_priority = slot->pri;
+	}
+
+	assertm(cc == active_connections && rc == active_connections,
+		"bad number of active connections (counted %d and %d, stored %d)",
+		cc, rc, active_connections);
 }
 #else
 #define check_queue_bugs()
@@ -259,6 +650,12 @@ retry_connection_socket(struct socket *socket, struct connection_state state)
 	retry_connection((struct connection *)socket->conn, state);
 }
 
+static int
+get_connection_socket_limits(struct socket *socket, struct rate_limit **limits)
+{
+	return get_connection_rate_limits((struct connection *)socket->conn, limits);
+}
+
 static void
 done_connection_socket(struct socket *socket, struct connection_state state)
 {
@@ -276,6 +673,7 @@ init_connection(struct uri *uri, struct uri *proxied_uri, struct uri *referrer,
 		set_connection_socket_timeout,
 		retry_connection_socket,
 		done_connection_socket,
+		get_connection_socket_limits,
 	};
 	struct connection *conn = (struct connection *)mem_calloc(1, sizeof(*conn));
 
@@ -306,15 +704,27 @@ init_connection(struct uri *uri, struct uri *proxied_uri, struct uri *referrer,
 
 	/* load_uri() gets the URI from get_proxy() which grabs a reference for
 	 * us. */
+	conn->id = connection_id++;
+	if (!connection_ids) connection_ids = init_hash8();
+	if (!connection_ids
+	    || !add_hash_item(connection_ids, (const char *) &conn->id,
+			      sizeof(conn->id), conn)) {
+		done_progress(conn->progress);
+		mem_free(conn->data_socket);
+		mem_free(conn->socket);
+		mem_free(conn);
+		return NULL;
+	}
+
 	conn->uri = uri;
 	conn->proxied_uri = proxied_uri;
-	conn->id = connection_id++;
 	conn->pri[priority] = 1;
 	conn->cache_mode = cache_mode;
 
 	conn->content_encoding = ENCODING_NONE;
 	init_list(conn->downloads);
 	conn->est_length = -1;
+	conn->direct_fd = -1;
 	conn->timer = TIMER_ID_UNDEF;
 
 	if (referrer) {
@@ -334,6 +744,7 @@ static void
 update_connection_progress(struct connection *conn)
 {
 	update_progress(conn->progress, conn->received, conn->est_length, conn->from);
+	conn->progress->limit = get_connection_rate_limit(conn);
 }
 
 /** Progress timer callback for @a conn->progress.  */
@@ -356,6 +767,7 @@ upload_stat_timer(struct connection *conn)
 
 	update_progress(conn->http_upload_progress, http->post.uploaded,
 		http->post.total_upload_length, http->post.uploaded);
+	conn->http_upload_progress->limit = get_connection_rate_limit(conn);
 	notify_connection_callbacks(conn);
 }
 
@@ -412,15 +824,36 @@ shutdown_connection_stream(struct connection *conn)
 static void
 free_connection_data(struct connection *conn)
 {
+	/* Requests waiting for their turn on the socket of another
+	 * connection do not count as connections to the host. */
+	int has_host_connection = !is_in_state(conn->state, S_WAIT)
+				  && !conn->pipelined_after;
+
 	assertm(conn->running, "connection already suspended");
 	/* XXX: Recovery path? Originally, there was none. I think we'll get
 	 * at least active_connections underflows along the way. --pasky */
+	if (conn->running) del_from_list(&conn->slot);
 	conn->running = 0;
 
 	active_connections--;
 	assertm(active_connections >= 0, "active connections underflow");
 	if_assert_failed active_connections = 0;
 
+	if (conn->pipelined_after) {
+		conn->pipelined_after->pipelined = NULL;
+		conn->pipelined_after->pipeline_broken = 1;
+		conn->pipelined_after = NULL;
+	}
+
+	if (conn->pipelined) {
+		struct connection *next = conn->pipelined;
+
+		/* The requests pipelined after ours will be sent again. This
+		 * unlinks @next. */
+		suspend_connection(next);
+		register_check_queue();
+	}
+
 #ifdef CONFIG_SSL
 	if (conn->socket->ssl && conn->cached)
 		mem_free_set(&conn->cached->ssl_info, get_ssl_connection_cipher(conn->socket));
@@ -447,8 +880,10 @@ free_connection_data(struct connection *conn)
 
 	kill_timer(&conn->timer);
 
-	if (!is_in_state(conn->state, S_WAIT))
+	if (has_host_connection)
 		done_host_connection(conn);
+
+	conn->pipeline_broken = 0;
 }
 
 static void
@@ -478,6 +913,12 @@ done_connection(struct connection *conn)
 	if (!is_in_result_state(conn->state))
 		set_connection_state(conn, connection_state(S_INTERNAL));
 
+	assertm(!conn->running, "running connection freed");
+	unqueue_connection(conn);
+	del_uri_connection(conn);
+	del_hash_item(connection_ids,
+		      get_hash_item(connection_ids, (const char *) &conn->id,
+				    sizeof(conn->id)));
 	del_from_list(conn);
 	notify_connection_callbacks(conn);
 	if (conn->referrer) done_uri(conn->referrer);
@@ -492,20 +933,6 @@ done_connection(struct connection *conn)
 	check_queue_bugs();
 }
 
-static inline void
-add_to_queue(struct connection *conn)
-{
-	struct connection *c;
-	connection_priority_T priority = get_priority(conn);
-
-	foreach (c, connection_queue)
-		if (get_priority(c) > priority)
-			break;
-
-	add_at_pos(c->prev, conn);
-}
-
-
 /* Returns zero if no callback was done and the keepalive connection should be
  * deleted or non-zero if the keepalive connection should not be deleted. */
 static int
@@ -523,7 +950,8 @@ do_keepalive_connection_callback(struct keepalive_connection *keep_conn)
 		if (conn) {
 			void (*done)(struct connection *) = keep_conn->done;
 
-			add_to_queue(conn);
+			add_to_list_end(connection_queue, conn);
+			activate_connection(conn);
 
 			/* Get the keepalive info and let it clean up */
 			if (!has_keepalive_connection(conn)
@@ -533,8 +961,6 @@ do_keepalive_connection_callback(struct keepalive_connection *keep_conn)
 				return 0;
 			}
 
-			active_connections++;
-			conn->running = 1;
 			done(conn);
 			return 1;
 		}
@@ -553,17 +979,20 @@ done_keepalive_connection(struct keepalive_connection *keep_conn)
 		return;
 
 	del_from_list(keep_conn);
-	if (keep_conn->socket != -1) close(keep_conn->socket);
+	if (keep_conn->socket != -1) {
+		if (keep_conn->preconnected) preconnect_waste_count++;
+		close(keep_conn->socket);
+	}
 	done_uri(keep_conn->uri);
 	mem_free(keep_conn);
 }
 
 static struct keepalive_connection *
-init_keepalive_connection(struct connection *conn, long timeout_in_seconds,
+init_keepalive_connection(struct uri *uri, struct socket *socket,
+			  long timeout_in_seconds,
 			  void (*done)(struct connection *))
 {
 	struct keepalive_connection *keep_conn;
-	struct uri *uri = conn->uri;
 
 	assert(uri->host);
 	if_assert_failed return NULL;
@@ -573,8 +1002,8 @@ init_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 
 	keep_conn->uri = get_uri_reference(uri);
 	keep_conn->done = done;
-	keep_conn->protocol_family = conn->socket->protocol_family;
-	keep_conn->socket = conn->socket->fd;
+	keep_conn->protocol_family = socket->protocol_family;
+	keep_conn->socket = socket->fd;
 	timeval_from_seconds(&keep_conn->timeout, timeout_in_seconds);
 	timeval_now(&keep_conn->creation_time);
 
@@ -582,19 +1011,25 @@ init_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 }
 
 static struct keepalive_connection *
-get_keepalive_connection(struct connection *conn)
+find_keepalive_connection(struct uri *uri)
 {
 	struct keepalive_connection *keep_conn;
 
-	if (!conn->uri->host) return NULL;
+	if (!uri->host) return NULL;
 
 	foreach (keep_conn, keepalive_connections)
-		if (compare_uri(keep_conn->uri, conn->uri, URI_KEEPALIVE))
+		if (compare_uri(keep_conn->uri, uri, URI_KEEPALIVE))
 			return keep_conn;
 
 	return NULL;
 }
 
+static struct keepalive_connection *
+get_keepalive_connection(struct connection *conn)
+{
+	return find_keepalive_connection(conn->uri);
+}
+
 int
 has_keepalive_connection(struct connection *conn)
 {
@@ -604,6 +1039,7 @@ has_keepalive_connection(struct connection *conn)
 
 	conn->socket->fd = keep_conn->socket;
 	conn->socket->protocol_family = keep_conn->protocol_family;
+	if (keep_conn->preconnected) preconnect_hit_count++;
 
 	/* Mark that the socket should not be closed and the callback should be
 	 * ignored. */
@@ -623,7 +1059,10 @@ add_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 	assertm(conn->socket->fd != -1, "keepalive connection not connected");
 	if_assert_failed goto done;
 
-	keep_conn = init_keepalive_connection(conn, timeout_in_seconds, done);
+	if (conn->pipeline_broken) goto done;
+
+	keep_conn = init_keepalive_connection(conn->uri, conn->socket,
+					      timeout_in_seconds, done);
 	if (keep_conn) {
 		/* Make sure that the socket descriptor will not periodically be
 		 * checked or closed by free_connection_data(). */
@@ -643,6 +1082,98 @@ done:
 	register_check_queue();
 }
 
+void
+add_preconnected_socket(struct uri *uri, struct socket *socket,
+			long timeout_in_seconds)
+{
+	struct keepalive_connection *keep_conn;
+
+	keep_conn = init_keepalive_connection(uri, socket, timeout_in_seconds,
+					      NULL);
+	if (!keep_conn) return;
+
+	keep_conn->preconnected = 1;
+
+	/* The keepalive connection owns the descriptor now. */
+	clear_handlers(socket->fd);
+	socket->fd = -1;
+	add_to_list(keepalive_connections, keep_conn);
+
+	check_keepalive_connections();
+}
+
+int
+is_host_connected(struct uri *uri)
+{
+	return find_host_connection(uri) || find_keepalive_connection(uri);
+}
+
+struct connection *
+pipeline_connection(struct connection *conn, int (*accept)(struct connection *))
+{
+	struct connection *last = conn;
+	struct host_connection *host_conn;
+	int priority;
+
+	if (!conn->uri->host || conn->pipeline_broken) return NULL;
+
+	host_conn = get_host_connection(conn);
+	if (!host_conn) return NULL;
+
+	while (last->pipelined) last = last->pipelined;
+
+	for (priority = 0; priority < PRIORITIES; priority++) {
+		struct connection_slot *slot;
+
+		foreach (slot, host_conn->queue[priority]) {
+			struct connection *c = slot->conn;
+
+			if (c->uri->protocol != conn->uri->protocol
+			    || !compare_uri(c->uri, conn->uri, URI_KEEPALIVE)
+			    || !accept(c))
+				continue;
+
+			activate_connection(c);
+
+			last->pipelined = c;
+			c->pipelined_after = last;
+
+			set_connection_state(c, connection_state(S_SENT));
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+struct connection *
+continue_pipelined_connection(struct connection *conn)
+{
+	struct connection *next = conn->pipelined;
+
+	assertm(next && conn->socket->fd != -1, "nothing to continue");
+
+	conn->pipelined = NULL;
+	next->pipelined_after = NULL;
+	/* Cannot fail, @conn holds the host connection. */
+	add_host_connection(next);
+
+	next->socket->fd = conn->socket->fd;
+	next->socket->protocol_family = conn->socket->protocol_family;
+	next->socket->read_buffer = conn->socket->read_buffer;
+
+	/* Make sure free_connection_data() will leave them alone. */
+	clear_handlers(conn->socket->fd);
+	conn->socket->fd = -1;
+	conn->socket->read_buffer = NULL;
+
+	free_connection_data(conn);
+	done_connection(conn);
+	register_check_queue();
+
+	return next;
+}
+
 /* Timer callback for @keepalive_timeout.  As explained in @install_timer,
  * this function must erase the expired timer ID from all variables.  */
 static void
@@ -702,40 +1233,19 @@ abort_all_keepalive_connections(void)
 }
 
 
-static void
-sort_queue(void)
-{
-	while (1) {
-		struct connection *conn;
-		int swp = 0;
-
-		foreach (conn, connection_queue) {
-			if (!list_has_next(connection_queue, conn)) break;
-
-			if (get_priority(conn->next) < get_priority(conn)) {
-				struct connection *c = conn->next;
-
-				del_from_list(conn);
-				add_at_pos(c, conn);
-				swp = 1;
-			}
-		}
-
-		if (!swp) break;
-	};
-}
-
 static void
 interrupt_connection(struct connection *conn)
 {
 	free_connection_data(conn);
 }
 
-static inline void
+static void
 suspend_connection(struct connection *conn)
 {
 	interrupt_connection(conn);
 	set_connection_state(conn, connection_state(S_WAIT));
+	if (!queue_connection(conn))
+		abort_connection(conn, connection_state(S_OUT_OF_MEM));
 }
 
 static void
@@ -754,8 +1264,7 @@ run_connection(struct connection *conn)
 		return;
 	}
 
-	active_connections++;
-	conn->running = 1;
+	activate_connection(conn);
 
 	func(conn);
 }
@@ -794,6 +1303,9 @@ retry_connection(struct connection *conn, struct connection_state state)
 		register_check_queue();
 	} else {
 		conn->prev_error = conn->state;
+		/* The response to the new request goes to the cache entry
+		 * until the download has seen where it starts. */
+		conn->direct_fd = -1;
 		run_connection(conn);
 	}
 }
@@ -802,12 +1314,14 @@ static int
 try_to_suspend_connection(struct connection *conn, struct uri *uri)
 {
 	connection_priority_T priority = get_priority(conn);
-	struct connection *c;
+	struct connection_slot *slot;
+
+	foreachback (slot, running_connections) {
+		struct connection *c = slot->conn;
 
-	foreachback (c, connection_queue) {
-		if (get_priority(c) <= priority) return -1;
+		if (slot->pri <= priority) return -1;
 		if (is_in_state(c->state, S_WAIT)) continue;
-		if (c->uri->post && get_priority(c) < PRI_CANCEL) continue;
+		if (c->uri->post && slot->pri < PRI_CANCEL) continue;
 		if (uri && !compare_uri(uri, c->uri, URI_HOST)) continue;
 		suspend_connection(c);
 		return 0;
@@ -821,6 +1335,13 @@ try_connection(struct connection *conn, int max_conns_to_host, int max_conns)
 {
 	struct host_connection *host_conn = get_host_connection(conn);
 
+	/* The streams of an HTTP/2 session need no sockets of their own and
+	 * the server limits how many of them may run. */
+	if (get_http2_session(conn)) {
+		run_connection(conn);
+		return 1;
+	}
+
 	if (host_conn && get_object_refcount(host_conn) >= max_conns_to_host)
 		return try_to_suspend_connection(conn, host_conn->uri) ? 0 : -1;
 
@@ -834,48 +1355,58 @@ try_connection(struct connection *conn, int max_conns_to_host, int max_conns)
 static void
 check_queue(void)
 {
-	struct connection *conn;
+	struct host_connection *host_conn;
 	int max_conns_to_host = get_opt_int("connection.max_connections_to_host", NULL);
 	int max_conns = get_opt_int("connection.max_connections", NULL);
+	int priority;
 
 again:
-	conn = (struct connection *)connection_queue.next;
 	check_queue_bugs();
 	check_keepalive_connections();
 
-	while (conn != (struct connection *) &connection_queue) {
-		struct connection *c;
-		connection_priority_T pri = get_priority(conn);
+	for (priority = 0; priority < PRIORITIES; priority++) {
+		int keepalive;
 
-		for (c = conn; c != (struct connection *) &connection_queue && get_priority(c) == pri;) {
-			struct connection *cc = c;
+		/* Prefer the hosts there is a keepalive connection to. */
+		for (keepalive = 1; keepalive >= 0; keepalive--) {
+			foreach (host_conn, host_connections) {
+				struct host_connection *prev = host_conn->prev;
+				struct connection_slot *slot;
 
-			c = c->next;
-			if (is_in_state(cc->state, S_WAIT)
-			    && get_keepalive_connection(cc)
-			    && try_connection(cc, max_conns_to_host, max_conns))
-				goto again;
-		}
+				if (list_empty(host_conn->queue[priority]))
+					continue;
 
-		for (c = conn; c != (struct connection *) &connection_queue && get_priority(c) == pri;) {
-			struct connection *cc = c;
+				slot = (struct connection_slot *)host_conn->queue[priority].next;
+				if (keepalive && !get_keepalive_connection(slot->conn))
+					continue;
 
-			c = c->next;
-			if (is_in_state(cc->state, S_WAIT)
-			    && try_connection(cc, max_conns_to_host, max_conns))
-				goto again;
+				/* Let the other hosts have their turn first the
+				 * next time. This has to be done beforehand
+				 * because running the connection may free
+				 * @host_conn. */
+				del_from_list(host_conn);
+				add_to_list_end(host_connections, host_conn);
+
+				if (try_connection(slot->conn, max_conns_to_host, max_conns))
+					goto again;
+
+				del_from_list(host_conn);
+				add_at_pos(prev, host_conn);
+			}
 		}
-		conn = c;
 	}
 
 again2:
-	foreachback (conn, connection_queue) {
-		if (get_priority(conn) < PRI_CANCEL) break;
-		if (is_in_state(conn->state, S_WAIT)) {
-			set_connection_state(conn, connection_state(S_INTERRUPTED));
-			done_connection(conn);
-			goto again2;
-		}
+	foreach (host_conn, host_connections) {
+		struct connection *conn;
+
+		if (list_empty(host_conn->queue[PRI_CANCEL]))
+			continue;
+
+		conn = ((struct connection_slot *)host_conn->queue[PRI_CANCEL].next)->conn;
+		set_connection_state(conn, connection_state(S_INTERRUPTED));
+		done_connection(conn);
+		goto again2;
 	}
 
 	check_queue_bugs();
@@ -964,18 +1495,14 @@ load_uri(struct uri *uri, struct uri *referrer, struct download *download,
 		return -1;
 	}
 
-	foreach (conn, connection_queue) {
-		if (conn->detached
-		    || !compare_uri(conn->uri, proxy_uri, 0))
-			continue;
-
+	conn = find_uri_connection(proxy_uri);
+	if (conn) {
 		done_uri(proxy_uri);
 		done_uri(proxied_uri);
 
 		if (get_priority(conn) > pri) {
-			del_from_list(conn);
 			conn->pri[pri]++;
-			add_to_queue(conn);
+			requeue_connection(conn);
 			register_check_queue();
 		} else {
 			conn->pri[pri]++;
@@ -1029,7 +1556,12 @@ load_uri(struct uri *uri, struct uri *referrer, struct download *download,
 		add_to_list(conn->downloads, download);
 	}
 
-	add_to_queue(conn);
+	add_to_list_end(connection_queue, conn);
+	add_uri_connection(conn);
+	if (!queue_connection(conn)) {
+		abort_connection(conn, connection_state(S_OUT_OF_MEM));
+		return -1;
+	}
 	set_connection_state(conn, connection_state(S_WAIT));
 
 	check_queue_bugs();
@@ -1069,11 +1601,13 @@ cancel_download(struct download *download, int interrupt)
 		/* Necessary because of assertion in get_priority(). */
 		conn->pri[PRI_CANCEL]++;
 
-		if (conn->detached || interrupt)
+		if (conn->detached || interrupt) {
 			abort_connection(conn, connection_state(S_INTERRUPTED));
+			return;
+		}
 	}
 
-	sort_queue();
+	requeue_connection(conn);
 	check_queue_bugs();
 
 	register_check_queue();
@@ -1115,15 +1649,44 @@ move_download(struct download *old, struct download *new_,
 
 	conn->pri[new_->pri]++;
 	add_to_list(conn->downloads, new_);
-	/* In principle, we need to sort_queue() only if conn->pri[new_->pri]
-	 * just changed from 0 to 1.  But the risk of bugs is smaller if we
-	 * sort every time.  */
-	sort_queue();
+	requeue_connection(conn);
 
 	cancel_download(old, 0);
 }
 
 
+/* Gives up the cache entry of @conn to its only download. Returns whether
+ * it could. */
+static int
+detach_cache_entry(struct connection *conn)
+{
+	off_t i, total_pri = 0;
+
+	if (conn->detached) return 1;
+
+	for (i = 0; i < PRI_CANCEL; i++)
+		total_pri += conn->pri[i];
+	assertm(total_pri, "detaching free connection");
+	/* No recovery path should be necessary...? */
+
+	/* Pre-clean cache. */
+	shrink_format_cache(0);
+
+	if (total_pri != 1 || is_object_used(conn->cached)) {
+		/* We're too important, or someone uses our cache
+		 * entry. */
+		return 0;
+	}
+
+	/* DBG("detached"); */
+
+	/* We aren't valid cache entry anymore. */
+	conn->cached->valid = 0;
+	conn->detached = 1;
+	del_uri_connection(conn);
+	return 1;
+}
+
 /* This will remove 'pos' bytes from the start of the cache for the specified
  * connection, if the cached object is already too big. */
 void
@@ -1135,7 +1698,6 @@ detach_connection(struct download *download, off_t pos)
 
 	if (!conn->detached) {
 		off_t total_len;
-		off_t i, total_pri = 0;
 
 		if (!conn->cached)
 			return;
@@ -1151,31 +1713,52 @@ detach_connection(struct download *download, off_t pos)
 			return;
 		}
 
-		for (i = 0; i < PRI_CANCEL; i++)
-			total_pri += conn->pri[i];
-		assertm(total_pri, "detaching free connection");
-		/* No recovery path should be necessary...? */
-
-		/* Pre-clean cache. */
-		shrink_format_cache(0);
-
-		if (total_pri != 1 || is_object_used(conn->cached)) {
-			/* We're too important, or someone uses our cache
-			 * entry. */
+		if (!detach_cache_entry(conn))
 			return;
-		}
-
-		/* DBG("detached"); */
-
-		/* We aren't valid cache entry anymore. */
-		conn->cached->valid = 0;
-		conn->detached = 1;
 	}
 
 	/* Strip the entry. */
 	free_entry_to(conn->cached, pos);
 }
 
+off_t
+direct_connection_to_file(struct download *download, int fd, off_t pos)
+{
+	struct connection *conn = download->conn;
+	long direct_size;
+
+	if (is_in_result_state(download->state)) return pos;
+
+	/* The cache entry may have been loaded without a connection. */
+	if (!conn || !conn->cached) return pos;
+
+	/* The protocol updates @pos through the progress as it writes. */
+	if (conn->direct_fd != -1) return pos;
+
+	direct_size = get_opt_long("document.download.direct_size", NULL);
+	if (!direct_size || conn->est_length == -1
+	    || conn->est_length - conn->from < direct_size)
+		return pos;
+
+	/* The cache entry must hold what has come and the protocol writes
+	 * what it gets, which must then be the body itself. */
+	if (pos != conn->from || conn->content_encoding != ENCODING_NONE)
+		return pos;
+
+	/* Only the HTTP code knows about @conn->direct_fd, proxies
+	 * included. */
+	if (conn->uri->protocol != PROTOCOL_HTTP
+	    && conn->uri->protocol != PROTOCOL_HTTPS
+	    && conn->uri->protocol != PROTOCOL_PROXY)
+		return pos;
+
+	if (!detach_cache_entry(conn))
+		return pos;
+
+	conn->direct_fd = fd;
+	return pos;
+}
+
 /* Timer callback for @conn->timer.  As explained in @install_timer,
  * this function must erase the expired timer ID from all variables.  */
 static void
@@ -1240,6 +1823,9 @@ abort_all_connections(void)
 	}
 
 	abort_all_keepalive_connections();
+
+	if (uri_connections) free_hash(&uri_connections);
+	if (connection_ids) free_hash(&connection_ids);
 }
 
 void
@@ -4,6 +4,7 @@
 #include "cache/cache.h"
 #include "encoding/encoding.h"
 #include "main/timer.h" /* timer_id_T */
+#include "network/limit.h"
 #include "network/state.h"
 #include "util/lists.h"
 #include <stdio.h>
@@ -12,10 +13,26 @@
 extern "C" {
 #endif
 
+struct connection;
 struct download;
+struct host_connection;
 struct socket;
 struct uri;
 
+/* The place of a connection in the scheduler: the queue of its host while it
+ * waits for its turn and the list of running connections while it runs. */
+struct connection_slot {
+	LIST_HEAD(struct connection_slot);
+
+	struct connection *conn;
+
+	/* The host whose queue the connection waits on, NULL if it does not
+	 * wait. */
+	struct host_connection *host;
+
+	/* The priority the connection is queued with. */
+	connection_priority_T pri;
+};
 
 struct connection {
 	LIST_HEAD(struct connection);
@@ -48,6 +65,10 @@ struct connection {
 	stream_encoding_T content_encoding;
 	struct stream_encoded *stream;
 
+	/* If not -1, the protocol writes the body from @from on to this file
+	 * of the only download instead of the cache entry.  Not ours. */
+	int direct_fd;
+
 	/* Called if non NULL when shutting down a connection. */
 	void (*done)(struct connection *);
 
@@ -67,10 +88,19 @@ struct connection {
 	timer_id_T timer;
 	milliseconds_T xhr_timeout;
 
+	/* The connection whose request was sent on our socket after ours. It
+	 * gets the socket when we are done with it. */
+	struct connection *pipelined;
+	/* The connection after whose request ours was sent. */
+	struct connection *pipelined_after;
+
 	unsigned int running:1;
 	unsigned int unrestartable:1;
 	unsigned int detached:1;
 	unsigned int cgi:1;
+	/* A connection pipelined after us was stopped, but the response to
+	 * its request will still come, so the socket cannot be kept alive. */
+	unsigned int pipeline_broken:1;
 
 	/* Each document is downloaded with some priority. When downloading a
 	 * document, the existing connections are checked to see if a
@@ -82,6 +112,11 @@ struct connection {
 	 * @pri is also kinda refcount of the connection. */
 	int pri[PRIORITIES];
 
+	struct connection_slot slot;
+
+	/* The connection.limit.download limit of the traffic. */
+	struct rate_limit rate_limit;
+
 	/* Private protocol specific info. If non-NULL it is free()d when
 	 * stopping the connection. */
 	void *info;
@@ -91,15 +126,49 @@ int register_check_queue(void);
 
 int get_connections_count(void);
 int get_keepalive_connections_count(void);
+int get_preconnected_count(void);
+long get_preconnect_hit_count(void);
+long get_preconnect_waste_count(void);
 int get_connections_connecting_count(void);
 int get_connections_transfering_count(void);
 
+/* Returns the highest priority of the downloads of @conn. */
+connection_priority_T get_connection_priority(struct connection *conn);
+
 void set_connection_state(struct connection *, struct connection_state);
 
 int has_keepalive_connection(struct connection *);
 void add_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 			      void (*done)(struct connection *));
 
+/* Keeps the connected @socket, which was opened ahead of time to the server
+ * of @uri, among the keepalive connections for the next connection to the
+ * server to take. The descriptor is taken from @socket. */
+void add_preconnected_socket(struct uri *uri, struct socket *socket,
+			     long timeout_in_seconds);
+
+/* Whether there is a connection to the server of @uri, running or kept
+ * alive. */
+int is_host_connected(struct uri *uri);
+
+/* Starts the waiting connection with the highest priority, which goes to
+ * the same server as @conn and which @accept returns non-zero for, without
+ * a socket of its own. Its request is to be sent on the socket of @conn
+ * right after the requests of @conn and the connections already pipelined
+ * after it. Returns NULL if there is no such connection. */
+struct connection *pipeline_connection(struct connection *conn,
+				       int (*accept)(struct connection *));
+
+/* Passes the socket of @conn and any data read past its response to the
+ * connection pipelined after it, and frees @conn like
+ * add_keepalive_connection() would. Returns the connection which got the
+ * socket. */
+struct connection *continue_pipelined_connection(struct connection *conn);
+
+/* Fills @limits with the limits of all traffic and of the traffic of the
+ * host of @uri and returns how many there are. */
+int get_host_rate_limits(struct uri *uri, struct rate_limit **limits);
+
 void abort_connection(struct connection *, struct connection_state);
 void retry_connection(struct connection *, struct connection_state);
 
@@ -108,6 +177,12 @@ void move_download(struct download *old, struct download *new_,
 		     connection_priority_T newpri);
 
 void detach_connection(struct download *, off_t);
+
+/* Lets the protocol write the rest of the body for @download to @fd, to
+ * which the first @pos bytes have been written, if there is enough of it
+ * to go. Returns how many bytes of the body are in @fd. */
+off_t direct_connection_to_file(struct download *download, int fd, off_t pos);
+
 void abort_all_connections(void);
 void abort_background_connections(void);
 
@@ -4,6 +4,9 @@
 #include "config.h"
 #endif
 
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -38,54 +41,157 @@
 #include "network/dns.h"
 #include "osdep/osdep.h"
 #include "protocol/uri.h"
+#include "util/conv.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/memory.h"
 #include "util/time.h"
 
-#ifdef WIN32
+#if defined(WIN32) || defined(CONFIG_OS_DOS)
 #define NO_ASYNC_LOOKUP
 #endif
 
+/* The async lookups are done by helpers started with start_thread(). Unless
+ * it really starts a thread, the helper is a forked copy of ELinks. */
+#if !defined(HAVE_BEGINTHREAD) && !defined(CONFIG_OS_BEOS) && !defined(CONFIG_OS_WIN32)
+#define DNS_HELPER_IS_PROCESS
+#endif
+
 
 struct dnsentry {
 	LIST_HEAD(struct dnsentry);
 
+	struct hash_item *item;		/* In @dns_cache_hash. */
 	struct sockaddr_storage *addr;	/* Pointer to array of addresses. */
 	int addrno;			/* Adress array length. */
+	int preferred_family;		/* Which connected first, or zero. */
 	timeval_T creation_time;	/* Creation time; let us do timeouts. */
+	unsigned int prefetched:1;	/* Resolved by prefetch_host(), unused. */
 	char name[1];		/* Associated host; XXX: Must be last. */
 };
 
-struct dnsquery {
-#ifdef THREAD_SAFE_LOOKUP
-	struct dnsquery *next_in_queue;	/* Got queued? */
+/* A host name being resolved. All find_host() calls for the name made while
+ * it is being resolved wait for this one lookup. */
+struct dnslookup {
+	LIST_HEAD(struct dnslookup);
+
+	LIST_OF(struct dnsquery) queries;	/* Waiting for the result. */
+
+	/* Set while the queries are told the result. */
+	unsigned int finished:1;
+	/* Started by prefetch_host() and no query waited for it yet. */
+	unsigned int prefetched:1;
+
+#ifndef NO_ASYNC_LOOKUP
+	struct dnshelper *helper;	/* Resolving it, NULL when queued. */
 #endif
+	char name[1];		/* Associated host; XXX: Must be last. */
+};
+
+struct dnsquery {
+	LIST_HEAD(struct dnsquery);
+
+	struct dnslookup *lookup;	/* The lookup we are waiting for. */
+
 	dns_callback_T done;		/* Used for reporting back DNS result. */
 	void *data;			/* Private callback data. */
 
-	/* The @done callback is called with these members. Thus, when
-	 * free()ing, *always* set pointer to NULL ! */
-	struct sockaddr_storage *addr;	/* Reference to array of addresses. */
-	int addrno;			/* Reference to array len. */
-
-	/* As with the two members above, when stopping a DNS query *always* set
-	 * this pointer to NULL. */
+	/* When stopping a DNS query *always* set this pointer to NULL. */
 	struct dnsquery **queryref;	/* Reference to callers DNS member. */
+};
 
 #ifndef NO_ASYNC_LOOKUP
-	int h;				/* One end of the async thread pipe. */
-#endif
-	char name[1];		/* Associated host; XXX: Must be last. */
+/* A helper resolves one name at a time and then waits for the next one, so
+ * there is no new helper for every lookup. */
+struct dnshelper {
+	LIST_HEAD(struct dnshelper);
+
+	int query_h;			/* We write host names here, */
+	int result_h;			/* and read the addresses here. */
+	struct dnslookup *lookup;	/* Being resolved, NULL when idle. */
 };
 
+static INIT_LIST_OF(struct dnshelper, dns_helpers);
+static int dns_helpers_count;
 
+/* Lookups are not thread safe there, only one may run at a time. */
 #ifdef THREAD_SAFE_LOOKUP
-static struct dnsquery *dns_queue = NULL;
+#define get_dns_helpers_limit()	1
+#else
+#define get_dns_helpers_limit()	get_opt_int("connection.async_dns_helpers", NULL)
+#endif
 #endif
 
+/* Lookups being resolved, or queued while all the helpers are busy. The
+ * queued ones are at the end. */
+static INIT_LIST_OF(struct dnslookup, dns_lookups);
+
 static INIT_LIST_OF(struct dnsentry, dns_cache);
+static struct hash *dns_cache_hash;
+
+/* Statistics for the resource info dialog. */
+static long dns_lookup_count;
+static long dns_hit_count;
+static long dns_coalesced_count;
+static long dns_prefetch_count;
+static long dns_prefetch_hit_count;
+static long dns_prefetch_waste_count;
+
+static void done_dns_lookup(struct dnslookup *lookup, enum dns_result result,
+			    struct sockaddr_storage *addr, int addrno);
 
-static void done_dns_lookup(struct dnsquery *query, enum dns_result res);
+
+long
+get_dns_lookup_count(void)
+{
+	return dns_lookup_count;
+}
+
+long
+get_dns_hit_count(void)
+{
+	return dns_hit_count;
+}
+
+long
+get_dns_coalesced_count(void)
+{
+	return dns_coalesced_count;
+}
+
+long
+get_dns_prefetch_count(void)
+{
+	return dns_prefetch_count;
+}
+
+long
+get_dns_prefetch_hit_count(void)
+{
+	return dns_prefetch_hit_count;
+}
+
+long
+get_dns_prefetch_waste_count(void)
+{
+	return dns_prefetch_waste_count;
+}
+
+int
+get_dns_cache_entry_count(void)
+{
+	return list_size(&dns_cache);
+}
+
+int
+get_dns_helpers_count(void)
+{
+#ifndef NO_ASYNC_LOOKUP
+	return dns_helpers_count;
+#else
+	return 0;
+#endif
+}
 
 
 /* DNS cache management: */
@@ -93,52 +199,113 @@ static void done_dns_lookup(struct dnsquery *query, enum dns_result res);
 static struct dnsentry *
 find_in_dns_cache(char *name)
 {
-	struct dnsentry *dnsentry;
+	struct hash_item *item;
+	char *key = stracpy(name);
 
-	foreach (dnsentry, dns_cache)
-		if (!c_strcasecmp(dnsentry->name, name)) {
-			move_to_top_of_list(dns_cache, dnsentry);
-			return dnsentry;
-		}
+	if (!key) return NULL;
 
-	return NULL;
+	/* The entries are hashed on the lowercased name. */
+	convert_to_lowercase_locale_indep(key, strlen(key));
+	item = dns_cache_hash
+	       ? get_hash_item(dns_cache_hash, key, strlen(key)) : NULL;
+	mem_free(key);
+
+	if (!item) return NULL;
+
+	move_to_top_of_list(dns_cache, (struct dnsentry *) item->value);
+	return (struct dnsentry *) item->value;
+}
+
+static int
+is_dns_cache_entry_expired(struct dnsentry *dnsentry)
+{
+	timeval_T age, now, max_age;
+
+	timeval_from_seconds(&max_age, get_opt_int("connection.dns_cache_ttl", NULL));
+	timeval_now(&now);
+	timeval_sub(&age, &dnsentry->creation_time, &now);
+
+	return timeval_cmp(&age, &max_age) > 0;
 }
 
 static void
+del_dns_cache_entry(struct dnsentry *dnsentry)
+{
+	if (dnsentry->prefetched) dns_prefetch_waste_count++;
+	del_hash_item(dns_cache_hash, dnsentry->item);
+	del_from_list(dnsentry);
+	mem_free_if(dnsentry->addr);
+	mem_free(dnsentry);
+}
+
+static struct dnsentry *
 add_to_dns_cache(char *name, struct sockaddr_storage *addr, int addrno)
 {
 	int namelen = strlen(name);
 	struct dnsentry *dnsentry;
+	int preferred_family = 0;
 	int size;
 
 	assert(addrno > 0);
 
+	if (!dns_cache_hash) {
+		dns_cache_hash = init_hash8();
+		if (!dns_cache_hash) return NULL;
+	}
+
+	/* The route to the host is most likely the same as before. */
+	dnsentry = find_in_dns_cache(name);
+	if (dnsentry) {
+		preferred_family = dnsentry->preferred_family;
+		del_dns_cache_entry(dnsentry);
+	}
+
 	dnsentry = (struct dnsentry *)mem_calloc(1, sizeof(*dnsentry) + namelen);
-	if (!dnsentry) return;
+	if (!dnsentry) return NULL;
 
 	size = addrno * sizeof(*dnsentry->addr);
 	dnsentry->addr = (struct sockaddr_storage *)mem_alloc(size);
 	if (!dnsentry->addr) {
 		mem_free(dnsentry);
-		return;
+		return NULL;
 	}
 
 	/* calloc() sets NUL char for us. */
 	memcpy(dnsentry->name, name, namelen);
-	memcpy(dnsentry->addr, addr, size);;
+	convert_to_lowercase_locale_indep(dnsentry->name, namelen);
+	memcpy(dnsentry->addr, addr, size);
+
+	dnsentry->item = add_hash_item(dns_cache_hash, dnsentry->name,
+				       namelen, dnsentry);
+	if (!dnsentry->item) {
+		mem_free(dnsentry->addr);
+		mem_free(dnsentry);
+		return NULL;
+	}
 
 	dnsentry->addrno = addrno;
+	dnsentry->preferred_family = preferred_family;
 
 	timeval_now(&dnsentry->creation_time);
 	add_to_list(dns_cache, dnsentry);
+
+	return dnsentry;
 }
 
-static void
-del_dns_cache_entry(struct dnsentry *dnsentry)
+int
+get_dns_preferred_family(char *name)
 {
-	del_from_list(dnsentry);
-	mem_free_if(dnsentry->addr);
-	mem_free(dnsentry);
+	struct dnsentry *dnsentry = find_in_dns_cache(name);
+
+	return dnsentry ? dnsentry->preferred_family : 0;
+}
+
+void
+set_dns_preferred_family(char *name, int family)
+{
+	struct dnsentry *dnsentry = find_in_dns_cache(name);
+
+	if (dnsentry) dnsentry->preferred_family = family;
 }
 
 
@@ -271,36 +438,6 @@ write_dns_data(int h, void *data, size_t datalen)
 	return DNS_SUCCESS;
 }
 
-static void
-async_dns_writer(void *data, int h)
-{
-	char *name = (char *) data;
-	struct sockaddr_storage *addrs;
-	int addrno, i;
-
-	if (do_real_lookup(name, &addrs, &addrno, 1) == DNS_ERROR)
-		return;
-
-	/* We will do blocking I/O here, however it's only local communication
-	 * and it's supposed to be just a flash talk, so it shouldn't matter.
-	 * And it would be incredibly more complicated and messy (and mainly
-	 * useless) to do this in non-blocking way. */
-	if (set_blocking_fd(h) < 0) return;
-
-	if (write_dns_data(h, &addrno, sizeof(addrno)) == DNS_ERROR)
-		return;
-
-	for (i = 0; i < addrno; i++) {
-		struct sockaddr_storage *addr = &addrs[i];
-
-		if (write_dns_data(h, addr, sizeof(*addr)) == DNS_ERROR)
-			return;
-	}
-
-	/* We're in thread, thus we must do plain free(). */
-	free(addrs);
-}
-
 static enum dns_result
 read_dns_data(int h, void *data, size_t datalen)
 {
@@ -318,190 +455,382 @@ read_dns_data(int h, void *data, size_t datalen)
 	return DNS_SUCCESS;
 }
 
+#ifdef DNS_HELPER_IS_PROCESS
+/* The helper must not keep the sockets and pipes of ELinks open, or closing
+ * them in ELinks would not close the connections. */
 static void
-async_dns_reader(struct dnsquery *query)
+close_inherited_handles(int keep1, int keep2)
 {
-	enum dns_result result = DNS_ERROR;
-	int i;
+	long max = -1;
+	int h;
+
+#ifdef HAVE_DIRENT_H
+	DIR *dir = opendir("/proc/self/fd");
+
+	if (dir) {
+		struct dirent *entry;
+
+		while ((entry = readdir(dir))) {
+			h = atoi(entry->d_name);
+			if (h > 2 && h != keep1 && h != keep2 && h != dirfd(dir))
+				close(h);
+		}
+		closedir(dir);
+		return;
+	}
+#endif
+
+#ifdef _SC_OPEN_MAX
+	max = sysconf(_SC_OPEN_MAX);
+#endif
+	if (max < 0 || max > 65536) max = 65536;
+
+	for (h = 3; h < max; h++)
+		if (h != keep1 && h != keep2)
+			close(h);
+}
+#endif
+
+/* Runs in the helper: resolves the names written to the @query_h pointed to
+ * by @data and writes the addresses to @h until @query_h is closed. */
+static void
+dns_helper(void *data, int h)
+{
+	int query_h = *(int *) data;
+
+#ifdef DNS_HELPER_IS_PROCESS
+	close_inherited_handles(query_h, h);
+#endif
 
 	/* We will do blocking I/O here, however it's only local communication
 	 * and it's supposed to be just a flash talk, so it shouldn't matter.
 	 * And it would be incredibly more complicated and messy (and mainly
 	 * useless) to do this in non-blocking way. */
-	if (set_blocking_fd(query->h) < 0) goto done;
+	if (set_blocking_fd(h) < 0 || set_blocking_fd(query_h) < 0) {
+		close(query_h);
+		return;
+	}
 
-	if (read_dns_data(query->h, &query->addrno, sizeof(query->addrno)) == DNS_ERROR)
-		goto done;
+	while (1) {
+		struct sockaddr_storage *addrs = NULL;
+		int namelen, addrno = 0;
+		char *name;
 
-	query->addr = (struct sockaddr_storage *)mem_calloc(query->addrno, sizeof(*query->addr));
-	if (!query->addr) goto done;
+		if (read_dns_data(query_h, &namelen, sizeof(namelen)) == DNS_ERROR
+		    || namelen <= 0)
+			break;
 
-	for (i = 0; i < query->addrno; i++) {
-		struct sockaddr_storage *addr = &query->addr[i];
+		/* We're in thread, thus we must do plain malloc(). */
+		name = (char *)calloc(1, namelen + 1);
+		if (!name) break;
 
-		if (read_dns_data(query->h, addr, sizeof(*addr)) == DNS_ERROR)
-			goto done;
-	}
+		if (read_dns_data(query_h, name, namelen) == DNS_ERROR) {
+			free(name);
+			break;
+		}
 
-	result = DNS_SUCCESS;
+		if (do_real_lookup(name, &addrs, &addrno, 1) == DNS_ERROR)
+			addrno = 0;
+		free(name);
 
-done:
-	if (result == DNS_ERROR)
-		mem_free_set(&query->addr, NULL);
+		if (write_dns_data(h, &addrno, sizeof(addrno)) == DNS_ERROR
+		    || (addrno && write_dns_data(h, addrs,
+						 addrno * sizeof(*addrs)) == DNS_ERROR)) {
+			free(addrs);
+			break;
+		}
+
+		free(addrs);
+	}
 
-	done_dns_lookup(query, result);
+	close(query_h);
 }
 
 static void
-async_dns_error(struct dnsquery *query)
+done_dns_helper(struct dnshelper *helper)
 {
-	done_dns_lookup(query, DNS_ERROR);
+	/* The helper quits when it sees the end of its input. */
+	clear_handlers(helper->result_h);
+	close(helper->result_h);
+	close(helper->query_h);
+
+	del_from_list(helper);
+	dns_helpers_count--;
+	mem_free(helper);
 }
 
-static int
-init_async_dns_lookup(struct dnsquery *dnsquery, int force_async)
+static void
+dns_helper_error(struct dnshelper *helper)
 {
-	if (!force_async && !get_opt_bool("connection.async_dns", NULL)) {
-		dnsquery->h = -1;
-		return 0;
-	}
+	struct dnslookup *lookup = helper->lookup;
 
-	dnsquery->h = start_thread(async_dns_writer, dnsquery->name,
-				   strlen(dnsquery->name) + 1);
-	if (dnsquery->h == -1)
-		return 0;
-
-	set_handlers(dnsquery->h, (select_handler_T) async_dns_reader, NULL,
-		     (select_handler_T) async_dns_error, dnsquery);
+	done_dns_helper(helper);
 
-	return 1;
+	if (lookup) {
+		lookup->helper = NULL;
+		done_dns_lookup(lookup, DNS_ERROR, NULL, 0);
+	}
 }
 
 static void
-done_async_dns_lookup(struct dnsquery *dnsquery)
+dns_helper_reader(struct dnshelper *helper)
 {
-	if (dnsquery->h == -1) return;
+	struct dnslookup *lookup = helper->lookup;
+	struct sockaddr_storage *addr = NULL;
+	int addrno;
+
+	if (!lookup
+	    || read_dns_data(helper->result_h, &addrno, sizeof(addrno)) == DNS_ERROR
+	    || addrno < 0) {
+		dns_helper_error(helper);
+		return;
+	}
+
+	if (addrno) {
+		addr = (struct sockaddr_storage *)mem_calloc(addrno, sizeof(*addr));
+		if (!addr
+		    || read_dns_data(helper->result_h, addr,
+				     addrno * sizeof(*addr)) == DNS_ERROR) {
+			mem_free_if(addr);
+			dns_helper_error(helper);
+			return;
+		}
+	}
+
+	helper->lookup = NULL;
+	lookup->helper = NULL;
 
-	clear_handlers(dnsquery->h);
-	close(dnsquery->h);
-	dnsquery->h = -1;
+	done_dns_lookup(lookup, addrno ? DNS_SUCCESS : DNS_ERROR, addr, addrno);
+	mem_free_if(addr);
 }
-#else
-#define init_async_dns_lookup(dnsquery, force)	(0)
-#define done_async_dns_lookup(dnsquery)		/* Nada. */
-#endif /* NO_ASYNC_LOOKUP */
 
+static struct dnshelper *
+init_dns_helper(void)
+{
+	struct dnshelper *helper;
+	int query_pipe[2];
+
+	helper = (struct dnshelper *)mem_calloc(1, sizeof(*helper));
+	if (!helper) return NULL;
 
-static enum dns_result
-do_lookup(struct dnsquery *query, int force_async)
+	if (c_pipe(query_pipe) < 0) {
+		mem_free(helper);
+		return NULL;
+	}
+
+	/* start_thread() makes its own copy of the handle number. */
+	helper->result_h = start_thread(dns_helper, &query_pipe[0],
+					sizeof(query_pipe[0]));
+	if (helper->result_h == -1) {
+		close(query_pipe[0]);
+		close(query_pipe[1]);
+		mem_free(helper);
+		return NULL;
+	}
+
+#ifdef DNS_HELPER_IS_PROCESS
+	close(query_pipe[0]);
+#endif
+	helper->query_h = query_pipe[1];
+
+	if (set_blocking_fd(helper->result_h) < 0) {
+		close(helper->result_h);
+		close(helper->query_h);
+		mem_free(helper);
+		return NULL;
+	}
+
+	set_handlers(helper->result_h, (select_handler_T) dns_helper_reader, NULL,
+		     (select_handler_T) dns_helper_error, helper);
+
+	add_to_list(dns_helpers, helper);
+	dns_helpers_count++;
+
+	return helper;
+}
+
+static struct dnshelper *
+get_idle_dns_helper(void)
 {
-	enum dns_result result;
+	struct dnshelper *helper;
 
-	/* DBG("starting lookup for %s", query->name); */
+	foreach (helper, dns_helpers)
+		if (!helper->lookup)
+			return helper;
 
-	/* Async lookup */
-	if (init_async_dns_lookup(query, force_async))
-		return DNS_ASYNC;
+	if (dns_helpers_count >= get_dns_helpers_limit())
+		return NULL;
 
-	/* Sync lookup */
-	result = do_real_lookup(query->name, &query->addr, &query->addrno, 0);
-	done_dns_lookup(query, result);
+	return init_dns_helper();
+}
 
-	return result;
+/* Returns whether the lookup was handed to a helper. */
+static int
+start_async_dns_lookup(struct dnslookup *lookup, struct dnshelper *helper)
+{
+	int namelen = strlen(lookup->name);
+
+	if (write_dns_data(helper->query_h, &namelen, sizeof(namelen)) == DNS_ERROR
+	    || write_dns_data(helper->query_h, lookup->name, namelen) == DNS_ERROR) {
+		done_dns_helper(helper);
+		return 0;
+	}
+
+	helper->lookup = lookup;
+	lookup->helper = helper;
+
+	return 1;
 }
 
-static enum dns_result
-do_queued_lookup(struct dnsquery *query)
+/* Hands the queued lookups to the idle helpers. */
+static void
+run_queued_dns_lookups(void)
 {
-#ifdef THREAD_SAFE_LOOKUP
-	query->next_in_queue = NULL;
+	struct dnslookup *lookup;
 
-	if (dns_queue) {
-		/* DBG("queuing lookup for %s", q->name); */
-		assertm(!dns_queue->next_in_queue, "DNS queue corrupted");
-		dns_queue->next_in_queue = query;
-		dns_queue = query;
-		return DNS_ERROR;
+	foreach (lookup, dns_lookups) {
+		struct dnshelper *helper;
+
+		if (lookup->helper) continue;
+
+		helper = get_idle_dns_helper();
+		if (!helper) break;
+
+		if (!start_async_dns_lookup(lookup, helper)) {
+			/* Let the helper failure show up in the next
+			 * lookups, do not spin here. */
+			done_dns_lookup(lookup, DNS_ERROR, NULL, 0);
+			break;
+		}
 	}
+}
 
-	dns_queue = query;
-#endif
-	/* DBG("direct lookup"); */
-	return do_lookup(query, 0);
+static void
+done_idle_dns_helpers(void)
+{
+	struct dnshelper *helper, *next;
+
+	foreachsafe (helper, next, dns_helpers)
+		if (!helper->lookup)
+			done_dns_helper(helper);
 }
+#endif /* NO_ASYNC_LOOKUP */
 
 
 static void
-done_dns_lookup(struct dnsquery *query, enum dns_result result)
+done_dns_lookup(struct dnslookup *lookup, enum dns_result result,
+		struct sockaddr_storage *addr, int addrno)
 {
 	struct dnsentry *dnsentry;
 
-	/* DBG("end lookup %s (%d)", query->name, res); */
+	/* DBG("end lookup %s (%d)", lookup->name, result); */
+
+	del_from_list(lookup);
+	lookup->finished = 1;
+
+	/* Cache the result even if nobody waits for it any more. */
+	if (result == DNS_SUCCESS && get_opt_int("connection.dns_cache_ttl", NULL) > 0) {
+		dnsentry = add_to_dns_cache(lookup->name, addr, addrno);
+		if (dnsentry && lookup->prefetched)
+			dnsentry->prefetched = 1;
+
+	} else if (result == DNS_ERROR) {
+		/* If the query failed, use the existing DNS cache entry even
+		 * if it is too old. */
+		dnsentry = find_in_dns_cache(lookup->name);
+		if (dnsentry) {
+			result = DNS_SUCCESS;
+			addr = dnsentry->addr;
+			addrno = dnsentry->addrno;
+		}
+	}
 
-	/* do_lookup() might start a new async thread */
-	done_async_dns_lookup(query);
+	if (result == DNS_ERROR) {
+		addr = NULL;
+		addrno = 0;
+	}
 
-#ifdef THREAD_SAFE_LOOKUP
-	if (query->next_in_queue) {
-		/* DBG("processing next in queue: %s", query->next_in_queue->name); */
-		do_lookup(query->next_in_queue, 1);
-	} else {
-		dns_queue = NULL;
+	/* The callbacks may start or kill other queries, take the waiting
+	 * queries one by one. */
+	while (!list_empty(lookup->queries)) {
+		struct dnsquery *query = (struct dnsquery *)lookup->queries.next;
+
+		del_from_list(query);
+
+		/* Make sure the query is unregister _before_ calling any
+		 * callbacks. */
+		*query->queryref = NULL;
+		query->done(query->data, addr, addrno);
+		mem_free(query);
 	}
-#endif
 
-	/* Make sure the query is unregister _before_ calling any callbacks. */
-	*query->queryref = NULL;
+	mem_free(lookup);
 
-	/* If the callback was cleared skip to the freeing part. */
-	if (!query->done)
-		goto done;
+#ifndef NO_ASYNC_LOOKUP
+	run_queued_dns_lookups();
+#endif
+}
 
-	dnsentry = find_in_dns_cache(query->name);
-	if (dnsentry) {
-		/* If the query failed, use the existing DNS cache entry even if
-		 * it is too old. */
-		if (result == DNS_ERROR) {
-			query->done(query->data, dnsentry->addr, dnsentry->addrno);
-			goto done;
-		}
+static struct dnslookup *
+init_dns_lookup(char *name)
+{
+	struct dnslookup *lookup;
+	int namelen = strlen(name);
 
-		del_dns_cache_entry(dnsentry);
-	}
+	lookup = (struct dnslookup *)mem_calloc(1, sizeof(*lookup) + namelen);
+	if (!lookup) return NULL;
 
-	if (result == DNS_SUCCESS)
-		add_to_dns_cache(query->name, query->addr, query->addrno);
+	/* calloc() sets NUL char for us. */
+	memcpy(lookup->name, name, namelen);
+	init_list(lookup->queries);
 
-	query->done(query->data, query->addr, query->addrno);
+	/* Queued lookups go after the running ones. */
+	add_to_list_end(dns_lookups, lookup);
 
-done:
-	mem_free_set(&query->addr, NULL);
-	mem_free(query);
+	return lookup;
 }
 
 static enum dns_result
-init_dns_lookup(char *name, void **queryref,
-		dns_callback_T done, void *data)
+do_lookup(struct dnslookup *lookup)
 {
-	struct dnsquery *query;
-	int namelen = strlen(name);
+	struct sockaddr_storage *addr = NULL;
+	enum dns_result result;
+	int addrno = 0;
 
-	query = (struct dnsquery *)mem_calloc(1, sizeof(*query) + namelen);
-	if (!query) {
-		done(data, NULL, 0);
-		return DNS_ERROR;
+	/* DBG("starting lookup for %s", lookup->name); */
+
+#ifndef NO_ASYNC_LOOKUP
+	/* Async lookup */
+	if (get_opt_bool("connection.async_dns", NULL)) {
+		struct dnshelper *helper = get_idle_dns_helper();
+
+		/* Queued until a helper is free. */
+		if (!helper && dns_helpers_count)
+			return DNS_ASYNC;
+
+		if (helper && start_async_dns_lookup(lookup, helper))
+			return DNS_ASYNC;
 	}
+#endif
 
-	query->done = done;
-	query->data = data;
+	/* Sync lookup */
+	result = do_real_lookup(lookup->name, &addr, &addrno, 0);
+	done_dns_lookup(lookup, result, addr, addrno);
+	mem_free_if(addr);
 
-	/* calloc() sets NUL char for us. */
-	memcpy(query->name, name, namelen);
+	return result;
+}
 
-	query->queryref = (struct dnsquery **) queryref;
-	*(query->queryref) = query;
+static struct dnslookup *
+find_dns_lookup(char *name)
+{
+	struct dnslookup *lookup;
+
+	foreach (lookup, dns_lookups)
+		if (!c_strcasecmp(lookup->name, name))
+			return lookup;
 
-	return do_queued_lookup(query);
+	return NULL;
 }
 
 
@@ -509,45 +838,138 @@ enum dns_result
 find_host(char *name, void **queryref,
 	  dns_callback_T done, void *data, int no_cache)
 {
-	struct dnsentry *dnsentry;
+	struct dnslookup *lookup;
+	struct dnsquery *query;
 
 	assert(queryref);
 	*queryref = NULL;
 
-	if (no_cache)
-		return init_dns_lookup(name, queryref, done, data);
+	dns_lookup_count++;
 
 	/* Check if the DNS name is in the cache. If the cache entry is too old
 	 * do a new lookup. However, old cache entries will be used as a
 	 * fallback if the new lookup fails. */
-	dnsentry = find_in_dns_cache(name);
-	if (dnsentry) {
-		timeval_T age, now, max_age;
+	if (!no_cache) {
+		struct dnsentry *dnsentry = find_in_dns_cache(name);
+
+		if (dnsentry && !is_dns_cache_entry_expired(dnsentry)) {
+			assert(dnsentry->addrno > 0);
+			dns_hit_count++;
+			if (dnsentry->prefetched) {
+				dns_prefetch_hit_count++;
+				dnsentry->prefetched = 0;
+			}
+			done(data, dnsentry->addr, dnsentry->addrno);
+			return DNS_SUCCESS;
+		}
+	}
 
-		assert(dnsentry && dnsentry->addrno > 0);
+	query = (struct dnsquery *)mem_calloc(1, sizeof(*query));
+	if (!query) {
+		done(data, NULL, 0);
+		return DNS_ERROR;
+	}
 
-		timeval_from_seconds(&max_age, DNS_CACHE_TIMEOUT);
-		timeval_now(&now);
-		timeval_sub(&age, &dnsentry->creation_time, &now);
+	query->done = done;
+	query->data = data;
+	query->queryref = (struct dnsquery **) queryref;
 
-		if (timeval_cmp(&age, &max_age) <= 0) {
-			done(data, dnsentry->addr, dnsentry->addrno);
-			return DNS_SUCCESS;
+	/* Wait for the lookup of the same name which is already running. */
+	lookup = find_dns_lookup(name);
+	if (lookup) {
+		dns_coalesced_count++;
+		if (lookup->prefetched) {
+			dns_prefetch_hit_count++;
+			lookup->prefetched = 0;
 		}
+		query->lookup = lookup;
+		add_to_list_end(lookup->queries, query);
+		*(query->queryref) = query;
+		return DNS_ASYNC;
 	}
 
-	return init_dns_lookup(name, queryref, done, data);
+	lookup = init_dns_lookup(name);
+	if (!lookup) {
+		mem_free(query);
+		done(data, NULL, 0);
+		return DNS_ERROR;
+	}
+
+	query->lookup = lookup;
+	add_to_list(lookup->queries, query);
+	*(query->queryref) = query;
+
+	return do_lookup(lookup);
+}
+
+void
+prefetch_host(char *name)
+{
+#ifndef NO_ASYNC_LOOKUP
+	struct dnsentry *dnsentry;
+	struct dnslookup *lookup;
+	struct dnshelper *helper;
+	int busy = 0;
+
+	if (!get_opt_bool("connection.async_dns", NULL)
+	    || get_opt_int("connection.dns_cache_ttl", NULL) <= 0)
+		return;
+
+	dnsentry = find_in_dns_cache(name);
+	if (dnsentry && !is_dns_cache_entry_expired(dnsentry))
+		return;
+
+	if (find_dns_lookup(name))
+		return;
+
+	/* Keep a helper for the lookups somebody waits for, prefetching
+	 * must not delay them. */
+	foreach (helper, dns_helpers)
+		if (helper->lookup)
+			busy++;
+
+	if (busy + 1 >= get_dns_helpers_limit())
+		return;
+
+	helper = get_idle_dns_helper();
+	if (!helper) return;
+
+	lookup = init_dns_lookup(name);
+	if (!lookup) return;
+
+	lookup->prefetched = 1;
+	dns_prefetch_count++;
+
+	if (!start_async_dns_lookup(lookup, helper))
+		done_dns_lookup(lookup, DNS_ERROR, NULL, 0);
+#endif
 }
 
 void
 kill_dns_request(void **queryref)
 {
 	struct dnsquery *query = (struct dnsquery *)*queryref;
+	struct dnslookup *lookup;
 
 	assert(query);
 
-	query->done = NULL;
-	done_dns_lookup(query, DNS_ERROR);
+	lookup = query->lookup;
+	del_from_list(query);
+	mem_free(query);
+	*queryref = NULL;
+
+	/* A finished lookup is freed by done_dns_lookup(). A running lookup
+	 * is left to finish, so the helper stays in sync
+	 * and the result gets cached. */
+	if (lookup->finished || !list_empty(lookup->queries)
+#ifndef NO_ASYNC_LOOKUP
+	    || lookup->helper
+#endif
+	    )
+		return;
+
+	del_from_list(lookup);
+	mem_free(lookup);
 }
 
 void
@@ -559,19 +981,15 @@ shrink_dns_cache(int whole)
 		foreachsafe (dnsentry, next, dns_cache)
 			del_dns_cache_entry(dnsentry);
 
-	} else {
-		timeval_T now, max_age;
-
-		timeval_from_seconds(&max_age, DNS_CACHE_TIMEOUT);
-		timeval_now(&now);
+		if (dns_cache_hash) free_hash(&dns_cache_hash);
 
-		foreachsafe (dnsentry, next, dns_cache) {
-			timeval_T age;
-
-			timeval_sub(&age, &dnsentry->creation_time, &now);
+#ifndef NO_ASYNC_LOOKUP
+		done_idle_dns_helpers();
+#endif
 
-			if (timeval_cmp(&age, &max_age) > 0)
+	} else {
+		foreachsafe (dnsentry, next, dns_cache)
+			if (is_dns_cache_entry_expired(dnsentry))
 				del_dns_cache_entry(dnsentry);
-		}
 	}
 }
@@ -36,13 +36,34 @@ do_real_lookup(char *host, struct sockaddr_storage **addr, int *addrlen,
 enum dns_result find_host(char *name, void **queryref,
 			  dns_callback_T done, void *data, int no_cache);
 
+/* Resolve @name in the background for the DNS cache, if it is not cached
+ * yet and a resolver helper is free. Nothing is done with synchronous
+ * lookups. */
+void prefetch_host(char *name);
+
 /* Stop the DNS request pointed to by the @queryref reference. */
 void kill_dns_request(void **queryref);
 
+/* The address family, AF_INET or AF_INET6, which the last connection to the
+ * cached @name used, or zero if there is no cache entry or it is not known.
+ * Connecting tries the addresses of this family first. */
+int get_dns_preferred_family(char *name);
+void set_dns_preferred_family(char *name, int family);
+
 /* Manage the cache of DNS lookups. If the boolean @whole is non-zero all DNS
- * cache entries will be removed. */
+ * cache entries will be removed and the idle resolver helpers stopped. */
 void shrink_dns_cache(int whole);
 
+/* Statistics for the resource info dialog. */
+long get_dns_lookup_count(void);
+long get_dns_hit_count(void);
+long get_dns_coalesced_count(void);
+long get_dns_prefetch_count(void);
+long get_dns_prefetch_hit_count(void);
+long get_dns_prefetch_waste_count(void);
+int get_dns_cache_entry_count(void);
+int get_dns_helpers_count(void);
+
 #ifdef __cplusplus
 }
 #endif
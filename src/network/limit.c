@@ -0,0 +1,91 @@
+/* Bandwidth limiting */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+
+#include "elinks.h"
+
+#include "network/limit.h"
+#include "util/math.h"
+#include "util/time.h"
+
+/* The burst is never smaller than this many bytes, so that slow limits do
+ * not break the traffic into tiny reads. */
+#define RATE_LIMIT_MIN_BURST	1024
+
+static double
+get_rate_limit_burst(struct rate_limit *limit)
+{
+	return (double) int_max(limit->rate / 4, RATE_LIMIT_MIN_BURST);
+}
+
+static void
+refill_rate_limit(struct rate_limit *limit, timeval_T *now)
+{
+	timeval_T elapsed;
+	double seconds;
+
+	timeval_sub(&elapsed, &limit->last_time, now);
+	timeval_copy(&limit->last_time, now);
+
+	seconds = elapsed.sec + elapsed.usec / 1000000.0;
+	if (seconds <= 0) return;
+
+	limit->tokens += limit->rate * seconds;
+	if (limit->tokens > get_rate_limit_burst(limit))
+		limit->tokens = get_rate_limit_burst(limit);
+}
+
+void
+set_rate_limit(struct rate_limit *limit, int rate)
+{
+	if (limit->rate == rate) return;
+
+	/* A new limit starts with a full bucket. */
+	if (!limit->rate) {
+		timeval_now(&limit->last_time);
+		limit->rate = rate;
+		limit->tokens = get_rate_limit_burst(limit);
+		return;
+	}
+
+	limit->rate = rate;
+	if (limit->tokens > get_rate_limit_burst(limit))
+		limit->tokens = get_rate_limit_burst(limit);
+}
+
+int
+get_rate_limit_allowance(struct rate_limit *limit, int len, timeval_T *now)
+{
+	if (!limit->rate) return len;
+
+	refill_rate_limit(limit, now);
+
+	/* Waiting for a quarter of the burst, as get_rate_limit_delay()
+	 * does, keeps a nearly empty bucket from trickling out a few bytes
+	 * per call. */
+	if (limit->tokens < 1
+	    || limit->tokens < MIN(len, get_rate_limit_burst(limit) / 4))
+		return 0;
+
+	return limit->tokens < len ? (int) limit->tokens : len;
+}
+
+void
+charge_rate_limit(struct rate_limit *limit, int len)
+{
+	if (limit->rate) limit->tokens -= len;
+}
+
+milliseconds_T
+get_rate_limit_delay(struct rate_limit *limit)
+{
+	double wanted = get_rate_limit_burst(limit) / 4 - limit->tokens;
+
+	if (!limit->rate || wanted <= 0) return 1;
+
+	return (milliseconds_T) (wanted * 1000 / limit->rate) + 1;
+}
@@ -0,0 +1,39 @@
+#ifndef EL__NETWORK_LIMIT_H
+#define EL__NETWORK_LIMIT_H
+
+#include "util/time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The most limits a socket is subject to: of the download, of the host and
+ * of all connections. */
+#define RATE_LIMITS	3
+
+/* A token bucket. The tokens are bytes which may pass, they are refilled
+ * at @rate up to a burst of a quarter of a second of traffic. */
+struct rate_limit {
+	int rate;		/* bytes/second, zero means no limit */
+	double tokens;		/* negative after an overdraft */
+	timeval_T last_time;	/* when @tokens were refilled */
+};
+
+/* Sets the @rate of @limit, which is then refilled from now on. */
+void set_rate_limit(struct rate_limit *limit, int rate);
+
+/* Returns how many bytes may pass @limit at @now, at most @len. */
+int get_rate_limit_allowance(struct rate_limit *limit, int len, timeval_T *now);
+
+/* Takes @len bytes which passed from @limit. */
+void charge_rate_limit(struct rate_limit *limit, int len);
+
+/* Returns how long to wait until enough bytes may pass @limit to be worth
+ * waking up for. */
+milliseconds_T get_rate_limit_delay(struct rate_limit *limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
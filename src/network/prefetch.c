@@ -0,0 +1,207 @@
+/* Prefetching of host names and connections */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "main/timer.h"
+#include "network/connection.h"
+#include "network/dns.h"
+#include "network/prefetch.h"
+#include "network/socket.h"
+#include "protocol/protocol.h"
+#include "protocol/proxy.h"
+#include "protocol/uri.h"
+#include "util/lists.h"
+#include "util/memory.h"
+
+/* How long a connection opened ahead of time is kept for the next
+ * connection to the server, in seconds.  Servers usually close idle
+ * connections soon. */
+#define PRECONNECT_KEEPALIVE_TIMEOUT	10
+
+/* A connection being opened ahead of time. */
+struct preconnect {
+	LIST_HEAD(struct preconnect);
+
+	struct uri *uri;
+	struct socket *socket;
+	timer_id_T timer;	/* Gives up connecting, or frees when done. */
+};
+
+static INIT_LIST_OF(struct preconnect, preconnects);
+
+/* Statistics for the resource info dialog. */
+static long preconnect_count;
+
+
+long
+get_preconnect_count(void)
+{
+	return preconnect_count;
+}
+
+static void
+done_preconnect(struct preconnect *preconnect)
+{
+	kill_timer(&preconnect->timer);
+	del_from_list(preconnect);
+	done_socket(preconnect->socket);
+	mem_free(preconnect->socket);
+	done_uri(preconnect->uri);
+	mem_free(preconnect);
+}
+
+/* Timer callback for @preconnect->timer.  As explained in install_timer(),
+ * this function must erase the expired timer ID from all variables.  */
+static void
+preconnect_timeout(void *preconnect_voidptr)
+{
+	struct preconnect *preconnect = (struct preconnect *)preconnect_voidptr;
+
+	preconnect->timer = TIMER_ID_UNDEF;
+	/* The expired timer ID has now been erased.  */
+	done_preconnect(preconnect);
+}
+
+static void
+set_preconnect_socket_state(struct socket *socket, struct connection_state state)
+{
+}
+
+static void
+set_preconnect_socket_timeout(struct socket *socket, struct connection_state state)
+{
+	struct preconnect *preconnect = (struct preconnect *)socket->conn;
+
+	kill_timer(&preconnect->timer);
+	install_timer(&preconnect->timer, (milliseconds_T)
+		      get_opt_int("connection.receive_timeout", NULL) * 1000,
+		      preconnect_timeout, preconnect);
+}
+
+/* There is no point in trying again what was only a guess. */
+static void
+done_preconnect_socket(struct socket *socket, struct connection_state state)
+{
+	done_preconnect((struct preconnect *)socket->conn);
+}
+
+static void
+preconnected(struct socket *socket)
+{
+	struct preconnect *preconnect = (struct preconnect *)socket->conn;
+
+	add_preconnected_socket(preconnect->uri, socket,
+				PRECONNECT_KEEPALIVE_TIMEOUT);
+
+	/* The socket code still uses @socket after this callback returns. */
+	kill_timer(&preconnect->timer);
+	install_timer(&preconnect->timer, 1, preconnect_timeout, preconnect);
+}
+
+static int
+is_preconnecting(struct uri *uri)
+{
+	struct preconnect *preconnect;
+
+	foreach (preconnect, preconnects)
+		if (compare_uri(preconnect->uri, uri, URI_KEEPALIVE))
+			return 1;
+
+	return 0;
+}
+
+/* Returns whether a connection to the server of @uri is being opened or is
+ * already there. */
+static int
+preconnect_uri(struct uri *uri)
+{
+	static struct socket_operations preconnect_socket_operations = {
+		set_preconnect_socket_state,
+		set_preconnect_socket_timeout,
+		done_preconnect_socket,
+		done_preconnect_socket,
+		NULL,
+	};
+	struct preconnect *preconnect;
+
+	if (is_preconnecting(uri) || is_host_connected(uri))
+		return 1;
+
+	/* Looking up the host name would block. */
+	if (!get_opt_bool("connection.async_dns", NULL))
+		return 0;
+
+	if (list_size(&preconnects) + get_preconnected_count()
+	    >= get_opt_int("connection.prefetch.connections", NULL))
+		return 0;
+
+	preconnect = (struct preconnect *)mem_calloc(1, sizeof(*preconnect));
+	if (!preconnect) return 0;
+
+	preconnect->socket = init_socket(preconnect, &preconnect_socket_operations);
+	if (!preconnect->socket) {
+		mem_free(preconnect);
+		return 0;
+	}
+
+	preconnect->uri = get_uri_reference(uri);
+	preconnect->timer = TIMER_ID_UNDEF;
+	add_to_list(preconnects, preconnect);
+	preconnect_count++;
+
+	make_connection(preconnect->socket, uri, preconnected, 0);
+	return 1;
+}
+
+void
+prefetch_uri(struct uri *uri)
+{
+	struct uri *proxy_uri;
+	char *host;
+
+	if (uri->protocol != PROTOCOL_HTTP && uri->protocol != PROTOCOL_HTTPS)
+		return;
+
+	if (!uri->host || !uri->hostlen)
+		return;
+
+	/* The proxy resolves the host names and the connection to it is
+	 * not ours to guess. */
+	proxy_uri = get_proxy_uri(uri, NULL);
+	if (!proxy_uri) return;
+	if (proxy_uri->protocol == PROTOCOL_PROXY) {
+		done_uri(proxy_uri);
+		return;
+	}
+	done_uri(proxy_uri);
+
+	/* SSL connections are never kept alive, only the plain ones can be
+	 * opened ahead of time. */
+	if (uri->protocol == PROTOCOL_HTTP
+	    && get_opt_int("connection.prefetch.connections", NULL) > 0
+	    && preconnect_uri(uri))
+		return;
+
+	if (!get_opt_bool("connection.prefetch.dns", NULL))
+		return;
+
+	host = get_uri_string(uri, URI_DNS_HOST);
+	if (!host) return;
+
+	prefetch_host(host);
+	mem_free(host);
+}
+
+void
+abort_preconnects(void)
+{
+	while (!list_empty(preconnects))
+		done_preconnect((struct preconnect *)preconnects.next);
+}
@@ -0,0 +1,27 @@
+#ifndef EL__NETWORK_PREFETCH_H
+#define EL__NETWORK_PREFETCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct uri;
+
+/* Gets ready for @uri to be loaded: resolves its host for the DNS cache
+ * and, for plain HTTP, opens a connection to its server which is then kept
+ * alive for the next connection to take, as far as the connection.prefetch
+ * options allow. */
+void prefetch_uri(struct uri *uri);
+
+/* Gives up on the connections being opened. */
+void abort_preconnects(void);
+
+/* Statistics for the resource info dialog. The connections which were used
+ * and wasted are counted by network/connection.c. */
+long get_preconnect_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,6 +18,7 @@ struct progress {
 
 	int average_speed;	/* bytes/second */
 	int current_speed;	/* bytes/second */
+	int limit;		/* bytes/second, zero if not limited */
 
 	unsigned int valid:1;
 	off_t size;
@@ -1,5 +1,9 @@
 /* Sockets-o-matic */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* splice() */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -43,8 +47,10 @@
 
 #include "config/options.h"
 #include "main/select.h"
+#include "main/timer.h"
 #include "network/connection.h"
 #include "network/dns.h"
+#include "network/limit.h"
 #include "network/socket.h"
 #include "network/ssl/socket.h"
 #include "osdep/osdep.h"
@@ -57,6 +63,17 @@
 #include "util/string.h"
 
 
+/* How many connect() calls to the addresses of one host may be in progress
+ * at the same time. */
+#define CONNECT_ATTEMPTS	4
+
+/* A connect() in progress to one of the found addresses. */
+struct connect_attempt {
+	struct socket *socket;		 /* Which the attempt is for. */
+	int fd;				 /* -1 if the slot is free. */
+	int family;			 /* AF_INET or AF_INET6 */
+};
+
 /* Holds information used during the connection establishing phase. */
 struct connect_info {
 	struct sockaddr_storage *addr;	 /* Array of found addresses. */
@@ -67,6 +84,12 @@ struct connect_info {
 	int port;			 /* Which port to bind to. */
 	int ip_family;			 /* If non-zero, force to IP version. */
 	struct uri *uri;		 /* For updating the blacklist. */
+
+	/* The first one to connect wins, the others are closed. */
+	struct connect_attempt attempts[CONNECT_ATTEMPTS];
+	int attemptno;			 /* Number of attempts in progress. */
+	/* Starts the next attempt if the last one is slow to connect. */
+	timer_id_T attempt_timer;
 };
 
 /** For detecting whether a struct socket has been deleted while a
@@ -108,6 +131,7 @@ init_connection_info(struct uri *uri, struct socket *socket,
 		     socket_connect_T connect_done)
 {
 	struct connect_info *connect_info = (struct connect_info *)mem_calloc(1, sizeof(*connect_info));
+	int i;
 
 	if (!connect_info) return NULL;
 
@@ -117,10 +141,38 @@ init_connection_info(struct uri *uri, struct socket *socket,
 	connect_info->triedno = -1;
 	connect_info->addr = NULL;
 	connect_info->uri = get_uri_reference(uri);
+	connect_info->attempt_timer = TIMER_ID_UNDEF;
+
+	for (i = 0; i < CONNECT_ATTEMPTS; i++)
+		connect_info->attempts[i].fd = -1;
 
 	return connect_info;
 }
 
+static void
+close_connect_attempt(struct connect_info *connect_info,
+		      struct connect_attempt *attempt)
+{
+	clear_handlers(attempt->fd);
+	close(attempt->fd);
+	attempt->fd = -1;
+	connect_info->attemptno--;
+}
+
+/* Gives up on all the connect() calls in progress. */
+static void
+cancel_connect_attempts(struct connect_info *connect_info)
+{
+	int i;
+
+	kill_timer(&connect_info->attempt_timer);
+
+	for (i = 0; i < CONNECT_ATTEMPTS; i++)
+		if (connect_info->attempts[i].fd != -1)
+			close_connect_attempt(connect_info,
+					      &connect_info->attempts[i]);
+}
+
 static void
 done_connection_info(struct socket *socket)
 {
@@ -129,12 +181,25 @@ done_connection_info(struct socket *socket)
 	assert(socket->connect_info);
 
 	if (connect_info->dnsquery) kill_dns_request(&connect_info->dnsquery);
+	cancel_connect_attempts(connect_info);
 
 	mem_free_if(connect_info->addr);
 	done_uri(connect_info->uri);
 	mem_free_set(&socket->connect_info, NULL);
 }
 
+#ifdef HAVE_SPLICE
+static void
+close_splice_pipe(struct socket *socket)
+{
+	if (socket->splice_pipe[0] == -1) return;
+
+	close(socket->splice_pipe[0]);
+	close(socket->splice_pipe[1]);
+	socket->splice_pipe[0] = socket->splice_pipe[1] = -1;
+}
+#endif
+
 struct socket *
 init_socket(void *conn, struct socket_operations *ops)
 {
@@ -146,6 +211,10 @@ init_socket(void *conn, struct socket_operations *ops)
 	socket->fd = -1;
 	socket->conn = conn;
 	socket->ops = ops;
+	socket->limit_timer = TIMER_ID_UNDEF;
+#ifdef HAVE_SPLICE
+	socket->splice_pipe[0] = socket->splice_pipe[1] = -1;
+#endif
 
 	return socket;
 }
@@ -155,7 +224,14 @@ done_socket(struct socket *socket)
 {
 	struct socket_weak_ref *ref;
 
+	kill_timer(&socket->limit_timer);
+	socket->read_limited = 0;
+	socket->write_limited = 0;
+
 	close_socket(socket);
+#ifdef HAVE_SPLICE
+	close_splice_pipe(socket);
+#endif
 
 	if (socket->connect_info)
 		done_connection_info(socket);
@@ -218,11 +294,54 @@ timeout_socket(struct socket *socket)
 }
 
 
+static int
+get_address_family(struct sockaddr_storage *addr)
+{
+	return ((struct sockaddr *) addr)->sa_family;
+}
+
+/* Orders the @addrno addresses in @addr so that they alternate between the
+ * address families, starting with @family or else the family of the first
+ * address, as RFC 8305 recommends.  The resolver's order is kept within each
+ * family. */
+static void
+interleave_address_families(struct sockaddr_storage *addr, int addrno,
+			    int family)
+{
+	struct sockaddr_storage *sorted;
+	int first = 0, other = 0, i = 0;
+
+	if (addrno < 2) return;
+
+	sorted = (struct sockaddr_storage *)mem_alloc(addrno * sizeof(*addr));
+	if (!sorted) return;
+
+	if (!family) family = get_address_family(&addr[0]);
+
+	while (i < addrno) {
+		while (first < addrno
+		       && get_address_family(&addr[first]) != family)
+			first++;
+		if (first < addrno)
+			sorted[i++] = addr[first++];
+
+		while (other < addrno
+		       && get_address_family(&addr[other]) == family)
+			other++;
+		if (other < addrno)
+			sorted[i++] = addr[other++];
+	}
+
+	memcpy(addr, sorted, addrno * sizeof(*addr));
+	mem_free(sorted);
+}
+
 /* DNS callback. */
 static void
 dns_found(struct socket *socket, struct sockaddr_storage *addr, int addrlen)
 {
 	struct connect_info *connect_info = socket->connect_info;
+	char *host;
 	int size;
 
 	if (!addr) {
@@ -243,6 +362,11 @@ dns_found(struct socket *socket, struct sockaddr_storage *addr, int addrlen)
 	memcpy(connect_info->addr, addr, size);
 	connect_info->addrno = addrlen;
 
+	host = get_uri_string(connect_info->uri, URI_DNS_HOST);
+	interleave_address_families(connect_info->addr, addrlen,
+				    host ? get_dns_preferred_family(host) : 0);
+	mem_free_if(host);
+
 	/* XXX: Passing non-result state here is bad but a lack of alternatives
 	 * makes it so. Well adding get_state() socket operation could maybe fix
 	 * it but the returned state would most likely be a non-result one at
@@ -497,20 +621,53 @@ complete_connect_socket(struct socket *socket, struct uri *uri,
 	done_connection_info(socket);
 }
 
-/* Select handler which is set for the socket descriptor when connect() has
- * indicated (via errno) that it is in progress. On completion this handler gets
- * called. */
+static void connect_next_address(struct socket *csocket,
+				 struct connection_state state);
+
+/* Makes @fd, which got connected to an address of @family, the descriptor of
+ * @socket and gives up on the other attempts. */
 static void
-connected(struct socket *socket)
+use_connected_fd(struct socket *socket, int fd, int family)
 {
+	struct connect_info *connect_info = socket->connect_info;
+	char *host;
+
+	cancel_connect_attempts(connect_info);
+
+	socket->fd = fd;
+#ifdef CONFIG_IPV6
+	socket->protocol_family = (family == AF_INET6 ? EL_PF_INET6 : EL_PF_INET);
+#else
+	socket->protocol_family = EL_PF_INET;
+#endif
+
+	/* The next connection to the host tries this family first. */
+	host = get_uri_string(connect_info->uri, URI_DNS_HOST);
+	if (host) {
+		set_dns_preferred_family(host, family);
+		mem_free(host);
+	}
+
+	complete_connect_socket(socket, NULL, NULL);
+}
+
+/* Select handler which is set for the descriptor of @attempt when connect()
+ * has indicated (via errno) that it is in progress. On completion this
+ * handler gets called. */
+static void
+attempt_connected(struct connect_attempt *attempt)
+{
+	struct socket *socket = attempt->socket;
+	struct connect_info *connect_info = socket->connect_info;
 	int err = 0;
 	struct connection_state state = connection_state(0);
 	socklen_t len = sizeof(err);
+	int fd = attempt->fd;
 
-	assertm(socket->connect_info != NULL, "Lost connect_info!");
+	assertm(connect_info != NULL, "Lost connect_info!");
 	if_assert_failed return;
 
-	if (getsockopt(socket->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == 0) {
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == 0) {
 		/* Why does EMX return so large values? */
 		if (err >= 10000) err -= 10000;
 		if (err != 0)
@@ -526,12 +683,81 @@ connected(struct socket *socket)
 	}
 
 	if (!is_in_state(state, 0)) {
+		close_connect_attempt(connect_info, attempt);
 		/* There are maybe still some more candidates. */
-		connect_socket(socket, state);
+		connect_next_address(socket, state);
 		return;
 	}
 
-	complete_connect_socket(socket, NULL, NULL);
+	clear_handlers(fd);
+	attempt->fd = -1;
+	connect_info->attemptno--;
+
+	use_connected_fd(socket, fd, attempt->family);
+}
+
+static void
+attempt_exception(struct connect_attempt *attempt)
+{
+	struct socket *socket = attempt->socket;
+
+	close_connect_attempt(socket->connect_info, attempt);
+	connect_next_address(socket, connection_state(S_EXCEPT));
+}
+
+/* Timer callback for @connect_info->attempt_timer.  As explained in
+ * install_timer(), this function must erase the expired timer ID from all
+ * variables.  */
+static void
+attempt_timeout(void *socket_voidptr)
+{
+	struct socket *socket = (struct socket *)socket_voidptr;
+
+	socket->connect_info->attempt_timer = TIMER_ID_UNDEF;
+	/* The expired timer ID has now been erased.  */
+
+	connect_next_address(socket, connection_state(S_CONN));
+}
+
+/* Waits for connect() of @sock to the address of @family to complete, and
+ * tries the next address too if that takes longer than
+ * connection.attempt_delay. */
+static void
+add_connect_attempt(struct socket *csocket, int sock, int family)
+{
+	struct connect_info *connect_info = csocket->connect_info;
+	struct connect_attempt *attempt = NULL;
+	milliseconds_T delay;
+	int i;
+
+	for (i = 0; i < CONNECT_ATTEMPTS; i++)
+		if (connect_info->attempts[i].fd == -1) {
+			attempt = &connect_info->attempts[i];
+			break;
+		}
+
+	assertm(attempt != NULL, "Too many connect attempts");
+	if_assert_failed {
+		close(sock);
+		return;
+	}
+
+	attempt->socket = csocket;
+	attempt->fd = sock;
+	attempt->family = family;
+	connect_info->attemptno++;
+
+	set_handlers(sock, NULL, (select_handler_T) attempt_connected,
+		     (select_handler_T) attempt_exception, attempt);
+
+	kill_timer(&connect_info->attempt_timer);
+
+	delay = get_opt_int("connection.attempt_delay", NULL);
+	if (delay > 0
+	    && connect_info->attemptno < CONNECT_ATTEMPTS
+	    && connect_info->triedno + 1 < connect_info->addrno)
+		install_timer(&connect_info->attempt_timer, delay,
+			      attempt_timeout, csocket);
 }
 
 static int to_bind;
@@ -575,6 +801,20 @@ init_bind_address(void)
 
 void
 connect_socket(struct socket *csocket, struct connection_state state)
+{
+	/* Clear handlers, the connection to the previous RR really timed
+	 * out and doesn't interest us anymore. */
+	if (csocket->fd >= 0)
+		close_socket(csocket);
+	cancel_connect_attempts(csocket->connect_info);
+
+	connect_next_address(csocket, state);
+}
+
+/* Starts connecting to the next of the found addresses, while the attempts
+ * to the previous ones go on. */
+static void
+connect_next_address(struct socket *csocket, struct connection_state state)
 {
 	static int initialized;
 	int sock = -1;
@@ -602,11 +842,6 @@ connect_socket(struct socket *csocket, struct connection_state state)
 
 	csocket->ops->set_state(csocket, state);
 
-	/* Clear handlers, the connection to the previous RR really timed
-	 * out and doesn't interest us anymore. */
-	if (csocket->fd >= 0)
-		close_socket(csocket);
-
 	for (i = connect_info->triedno + 1; i < connect_info->addrno; i++) {
 #ifdef CONFIG_IPV6
 		struct sockaddr_in6 addr = *((struct sockaddr_in6 *) &connect_info->addr[i]);
@@ -700,37 +935,27 @@ connect_socket(struct socket *csocket, struct connection_state state)
 		}
 #endif
 #endif
-		csocket->fd = sock;
-
 #ifdef CONFIG_IPV6
 		addr.sin6_port = htons(connect_info->port);
 #else
 		addr.sin_port = htons(connect_info->port);
 #endif
 
-		/* We can set csocket->protocol_family here even if the connection
-		 * will fail, as we will use it only when it will be successfully
-		 * established. At least I hope that noone else will want to do
-		 * something else ;-). --pasky */
-		/* And in fact we must set it early, because of EINPROGRESS.  */
-
 #ifdef CONFIG_IPV6
 		if (family == AF_INET6) {
-			csocket->protocol_family = EL_PF_INET6;
 			if (connect(sock, (struct sockaddr *) &addr,
 					sizeof(struct sockaddr_in6)) == 0) {
 				/* Success */
-				complete_connect_socket(csocket, NULL, NULL);
+				use_connected_fd(csocket, sock, family);
 				return;
 			}
 		} else
 #endif
 		{
-			csocket->protocol_family = EL_PF_INET;
 			if (connect(sock, (struct sockaddr *) &addr,
 					sizeof(struct sockaddr_in)) == 0) {
 				/* Success */
-				complete_connect_socket(csocket, NULL, NULL);
+				use_connected_fd(csocket, sock, family);
 				return;
 			}
 		}
@@ -741,8 +966,7 @@ connect_socket(struct socket *csocket, struct connection_state state)
 #endif
 		    || errno == EINPROGRESS) {
 			/* It will take some more time... */
-			set_handlers(sock, NULL, (select_handler_T) connected,
-				     (select_handler_T) dns_exception, csocket);
+			add_connect_attempt(csocket, sock, family);
 			csocket->ops->set_state(csocket, connection_state(S_CONN));
 			return;
 		}
@@ -754,6 +978,10 @@ connect_socket(struct socket *csocket, struct connection_state state)
 
 	assert(i >= connect_info->addrno);
 
+	/* Wait for the attempts which are still in progress. */
+	if (connect_info->attemptno)
+		return;
+
 	/* Tried everything, but it didn't help :(. */
 
 	if (only_local && !saved_errno && at_least_one_remote_ip) {
@@ -789,6 +1017,121 @@ struct write_buffer {
 	char data[1]; /* must be at end of struct */
 };
 
+/* Rate limits: */
+
+/* Returns how many of @len bytes @socket may transfer now. */
+static int
+get_socket_allowance(struct socket *socket, int len)
+{
+	struct rate_limit *limits[RATE_LIMITS];
+	timeval_T now;
+	int count, i;
+
+	if (!socket->ops->get_limits) return len;
+
+	count = socket->ops->get_limits(socket, limits);
+	if (!count) return len;
+
+	timeval_now(&now);
+	for (i = 0; i < count; i++)
+		len = get_rate_limit_allowance(limits[i], len, &now);
+
+	return len;
+}
+
+static void
+charge_socket_limits(struct socket *socket, int len)
+{
+	struct rate_limit *limits[RATE_LIMITS];
+	int count, i;
+
+	if (!socket->ops->get_limits) return;
+
+	count = socket->ops->get_limits(socket, limits);
+	for (i = 0; i < count; i++)
+		charge_rate_limit(limits[i], len);
+}
+
+static void read_select(struct socket *socket);
+static void write_select(struct socket *socket);
+
+/* Timer callback for @socket->limit_timer.  As explained in install_timer(),
+ * this function must erase the expired timer ID from all variables.  */
+static void
+limit_timeout(void *socket_voidptr)
+{
+	struct socket *socket = (struct socket *)socket_voidptr;
+	select_handler_T read_handler, write_handler;
+
+	socket->limit_timer = TIMER_ID_UNDEF;
+	/* The expired timer ID has now been erased.  */
+
+	if (socket->fd == -1) {
+		socket->read_limited = 0;
+		socket->write_limited = 0;
+		return;
+	}
+
+	read_handler  = get_handler(socket->fd, SELECT_HANDLER_READ);
+	write_handler = get_handler(socket->fd, SELECT_HANDLER_WRITE);
+
+	if (socket->read_limited && socket->read_buffer)
+		read_handler = (select_handler_T) read_select;
+	if (socket->write_limited && socket->write_buffer)
+		write_handler = (select_handler_T) write_select;
+
+	socket->read_limited = 0;
+	socket->write_limited = 0;
+
+	if (!read_handler && !write_handler) return;
+
+	set_handlers(socket->fd, read_handler, write_handler,
+		     (select_handler_T) exception, socket);
+
+#ifdef CONFIG_SSL
+	/* Data which was already decrypted does not wake select() up. */
+	if (read_handler == (select_handler_T) read_select
+	    && socket->ssl && ssl_pending(socket))
+		read_select(socket);
+#endif
+}
+
+/* Stops reading from @socket, or writing to it if @write is set, until its
+ * rate limits let more traffic through. */
+static void
+limit_socket(struct socket *socket, int write)
+{
+	struct rate_limit *limits[RATE_LIMITS];
+	select_handler_T read_handler, write_handler;
+	milliseconds_T delay = 1;
+	int count, i;
+
+	read_handler  = get_handler(socket->fd, SELECT_HANDLER_READ);
+	write_handler = get_handler(socket->fd, SELECT_HANDLER_WRITE);
+
+	if (write) {
+		socket->write_limited = 1;
+		write_handler = NULL;
+	} else {
+		socket->read_limited = 1;
+		read_handler = NULL;
+	}
+
+	if (read_handler || write_handler)
+		set_handlers(socket->fd, read_handler, write_handler,
+			     (select_handler_T) exception, socket);
+	else
+		clear_handlers(socket->fd);
+
+	if (socket->limit_timer != TIMER_ID_UNDEF) return;
+
+	count = socket->ops->get_limits(socket, limits);
+	for (i = 0; i < count; i++)
+		delay = ms_max(delay, get_rate_limit_delay(limits[i]));
+
+	install_timer(&socket->limit_timer, delay, limit_timeout, socket);
+}
+
 static int
 generic_write(struct socket *socket, char *data, int len)
 {
@@ -809,6 +1152,7 @@ static void
 write_select(struct socket *socket)
 {
 	struct write_buffer *wb = (struct write_buffer *)socket->write_buffer;
+	int len;
 	int wr;
 
 	assertm(wb != NULL, "write socket has no buffer");
@@ -828,14 +1172,26 @@ write_select(struct socket *socket)
 	printf("-\n");
 #endif
 
+#ifdef CONFIG_SSL
+	if (socket->ssl && socket->ssl_write_len)
+		len = socket->ssl_write_len;
+	else
+#endif
+		len = get_socket_allowance(socket, wb->length - wb->pos);
+	if (!len) {
+		limit_socket(socket, 1);
+		return;
+	}
+
 #ifdef CONFIG_SSL
 	if (socket->ssl) {
-		wr = ssl_write(socket, wb->data + wb->pos, wb->length - wb->pos);
+		wr = ssl_write(socket, wb->data + wb->pos, len);
+		socket->ssl_write_len = wr == SOCKET_SSL_WANT_WRITE ? len : 0;
 	} else
 #endif
 	{
-		assert(wb->length - wb->pos > 0);
-		wr = generic_write(socket, wb->data + wb->pos, wb->length - wb->pos);
+		assert(len > 0);
+		wr = generic_write(socket, wb->data + wb->pos, len);
 	}
 
 	switch (wr) {
@@ -858,6 +1214,7 @@ write_select(struct socket *socket)
 
 		/*printf("wr: %d\n", wr);*/
 		wb->pos += wr;
+		charge_socket_limits(socket, wr);
 
 		if (wb->pos == wb->length) {
 			socket_write_T done = wb->done;
@@ -941,11 +1298,101 @@ generic_read(struct socket *socket, char *data, int len)
 	return rd;
 }
 
+#ifdef HAVE_SPLICE
+/* The most a pipe holds by default. */
+#define SPLICE_SIZE 65536
+
+/* Moves at most @len bytes from @socket to @fd through @socket->splice_pipe
+ * and returns how many, or one of the errors generic_read() returns. */
+static ssize_t
+splice_read(struct socket *socket, int fd, int len)
+{
+	ssize_t rd, pos;
+
+	if (socket->splice_pipe[0] == -1 && c_pipe(socket->splice_pipe))
+		return SOCKET_SYSCALL_ERROR;
+
+	do {
+		rd = splice(socket->fd, NULL, socket->splice_pipe[1], NULL,
+			    MIN(len, SPLICE_SIZE),
+			    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	} while (rd < 0 && errno == EINTR);
+
+	if (!rd) return SOCKET_CANT_READ;
+
+	if (rd < 0) {
+#ifdef EWOULDBLOCK
+		if (errno == EWOULDBLOCK) return SOCKET_CANT_READ;
+#endif
+		return SOCKET_SYSCALL_ERROR;
+	}
+
+	/* The pipe must be empty again before the next read. */
+	for (pos = 0; pos < rd; ) {
+		ssize_t w = splice(socket->splice_pipe[0], NULL, fd, NULL,
+				   rd - pos, SPLICE_F_MOVE);
+
+		if (w <= 0) {
+			if (w < 0 && errno == EINTR) continue;
+			if (!w) errno = ENOSPC;
+
+			/* Do not leave the data in the pipe for the next
+			 * splice_from_socket(). */
+			close_splice_pipe(socket);
+			return SOCKET_SINK_ERROR;
+		}
+		pos += w;
+	}
+
+	return rd;
+}
+#endif
+
+/* Makes room for at least @len more bytes in the read buffer of @socket. */
+static struct read_buffer *
+reserve_read_buffer(struct socket *socket, int len)
+{
+	struct read_buffer *rb = socket->read_buffer;
+
+	if (rb->freespace < RD_ALLOC_GR || rb->freespace < len) {
+		int consumed = rb->data - rb->buffer;
+
+		/* Moving the unread data back is only worth it when at least as
+		 * much has been consumed, that keeps it linear. */
+		if (consumed && consumed >= rb->length) {
+			memmove(rb->buffer, rb->data, rb->length);
+			rb->data = rb->buffer;
+			rb->freespace += consumed;
+		}
+	}
+
+	if (rb->freespace < len) {
+		int consumed = rb->data - rb->buffer;
+		int size = RD_SIZE(rb, consumed + rb->length + len);
+
+		rb = (struct read_buffer *)mem_realloc(rb, size);
+		if (!rb) {
+			socket->ops->done(socket, connection_state(S_OUT_OF_MEM));
+			return NULL;
+		}
+		rb->data = rb->buffer + consumed;
+		rb->freespace = size - sizeof(*rb) - consumed - rb->length;
+		assert(rb->freespace >= len);
+		socket->read_buffer = rb;
+	}
+
+	return rb;
+}
+
 static void
 read_select(struct socket *socket)
 {
 	struct read_buffer *rb = socket->read_buffer;
 	ssize_t rd;
+	int len;
+#ifdef HAVE_SPLICE
+	int splice_fd;
+#endif
 
 	assertm(rb != NULL, "read socket has no buffer");
 	if_assert_failed {
@@ -953,6 +1400,13 @@ read_select(struct socket *socket)
 		return;
 	}
 
+#ifdef HAVE_SPLICE
+	/* Only this read goes to the file. */
+	splice_fd = rb->splice_fd;
+	rb->splice_fd = -1;
+	rb->spliced = 0;
+#endif
+
 	/* We are making some progress, therefore reset the timeout; we do this
 	 * for read_select() to avoid that the periodic calls to user handlers
 	 * has to do it. */
@@ -961,26 +1415,39 @@ read_select(struct socket *socket)
 	if (!socket->duplex)
 		clear_handlers(socket->fd);
 
-	if (!rb->freespace) {
-		int size = RD_SIZE(rb, rb->length);
+#ifdef HAVE_SPLICE
+	if (splice_fd != -1) {
+		len = get_socket_allowance(socket, rb->splice_length);
+	} else
+#endif
+	{
+		rb = reserve_read_buffer(socket, 1);
+		if (!rb) return;
 
-		rb = (struct read_buffer *)mem_realloc(rb, size);
-		if (!rb) {
-			socket->ops->done(socket, connection_state(S_OUT_OF_MEM));
-			return;
-		}
-		rb->freespace = size - sizeof(*rb) - rb->length;
-		assert(rb->freespace > 0);
-		socket->read_buffer = rb;
+		len = get_socket_allowance(socket, rb->freespace);
+	}
+
+	if (!len) {
+#ifdef HAVE_SPLICE
+		/* The read after the wait goes to the file. */
+		rb->splice_fd = splice_fd;
+#endif
+		limit_socket(socket, 0);
+		return;
 	}
 
+#ifdef HAVE_SPLICE
+	if (splice_fd != -1) {
+		rd = splice_read(socket, splice_fd, len);
+	} else
+#endif
 #ifdef CONFIG_SSL
 	if (socket->ssl) {
-		rd = ssl_read(socket, rb->data + rb->length, rb->freespace);
+		rd = ssl_read(socket, rb->data + rb->length, len);
 	} else
 #endif
 	{
-		rd = generic_read(socket, rb->data + rb->length, rb->freespace);
+		rd = generic_read(socket, rb->data + rb->length, len);
 	}
 
 	switch (rd) {
@@ -1009,12 +1476,26 @@ read_select(struct socket *socket)
 		socket->ops->done(socket, connection_state(errno));
 		break;
 
+	case SOCKET_SINK_ERROR:
+		socket->ops->done(socket, connection_state_for_errno(errno));
+		break;
+
 	default:
+#ifdef HAVE_SPLICE
+		if (splice_fd != -1) {
+			rb->spliced = rd;
+			charge_socket_limits(socket, rd);
+
+			rb->done(socket, rb);
+			break;
+		}
+#endif
 		debug_transfer_log(rb->data + rb->length, rd);
 
 		rb->length += rd;
 		rb->freespace -= rd;
 		assert(rb->freespace >= 0);
+		charge_socket_limits(socket, rd);
 
 		rb->done(socket, rb);
 	}
@@ -1031,7 +1512,11 @@ alloc_read_buffer(struct socket *socket)
 		return NULL;
 	}
 
+	rb->data = rb->buffer;
 	rb->freespace = RD_SIZE(rb, 0) - sizeof(*rb);
+#ifdef HAVE_SPLICE
+	rb->splice_fd = -1;
+#endif
 
 	return rb;
 }
@@ -1068,6 +1553,9 @@ read_from_socket(struct socket *socket, struct read_buffer *buffer,
 		mem_free(socket->read_buffer);
 	socket->read_buffer = buffer;
 
+	/* The data will be fed to us. */
+	if (socket->stream) return;
+
 	if (socket->duplex) {
 		write_handler = get_handler(socket->fd, SELECT_HANDLER_WRITE);
 	} else {
@@ -1078,6 +1566,26 @@ read_from_socket(struct socket *socket, struct read_buffer *buffer,
 		     (select_handler_T) exception, socket);
 }
 
+#ifdef HAVE_SPLICE
+void
+splice_from_socket(struct socket *socket, struct read_buffer *buffer,
+		   int fd, int len, struct connection_state state,
+		   socket_read_T done)
+{
+	assert(!socket->ssl && !socket->stream && len > 0);
+	if_assert_failed {
+		read_from_socket(socket, buffer, state, done);
+		return;
+	}
+
+	buffer->splice_fd = fd;
+	buffer->splice_length = MIN(len, SPLICE_SIZE);
+	buffer->spliced = 0;
+
+	read_from_socket(socket, buffer, state, done);
+}
+#endif
+
 static void
 read_response_from_socket(struct socket *socket)
 {
@@ -1098,14 +1606,41 @@ request_from_socket(struct socket *socket, char *data, int datalen,
 			read_response_from_socket);
 }
 
+void
+feed_socket(struct socket *socket, char *data, int len)
+{
+	struct read_buffer *rb = socket->read_buffer;
+
+	assertm(socket->stream && rb, "feeding socket which does not read");
+	if_assert_failed return;
+
+	socket->ops->set_timeout(socket, connection_state(0));
+
+	rb = reserve_read_buffer(socket, len);
+	if (!rb) return;
+
+	debug_transfer_log(data, len);
+
+	memcpy(rb->data + rb->length, data, len);
+	rb->length += len;
+	rb->freespace -= len;
+
+	rb->done(socket, rb);
+}
+
 void
 kill_buffer_data(struct read_buffer *rb, int n)
 {
 	assertm(n >= 0 && n <= rb->length, "bad number of bytes: %d", n);
-	if_assert_failed { rb->length = 0;  return; }
+	if_assert_failed { n = rb->length; }
 
-	if (!n) return; /* FIXME: We accept to kill 0 bytes... */
+	rb->data += n;
 	rb->length -= n;
-	memmove(rb->data, rb->data + n, rb->length);
-	rb->freespace += n;
+
+	/* Start from the beginning again if everything was consumed, the
+	 * remaining data is moved back only by read_select(). */
+	if (!rb->length) {
+		rb->freespace += rb->data - rb->buffer;
+		rb->data = rb->buffer;
+	}
 }
@@ -6,13 +6,16 @@
 #include <sys/socket.h> /* OS/2 needs this after sys/types.h */
 #endif
 
+#include "main/timer.h" /* timer_id_T */
 #include "network/state.h"
+#include "util/time.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct connect_info;
+struct rate_limit;
 struct read_buffer;
 struct socket;
 struct uri;
@@ -25,6 +28,8 @@ enum socket_error {
 	SOCKET_SSL_WANT_READ	= -3,	/* Try to read some more. */
 	SOCKET_CANT_READ	= -4,	/* Retry with S_CANT_READ state. */
 	SOCKET_CANT_WRITE	= -5,	/* Retry with S_CANT_WRITE state. */
+	SOCKET_SINK_ERROR	= -6,	/* Stop with connection_state_for_errno(errno). */
+	SOCKET_SSL_WANT_WRITE	= -7,	/* Write the same again when possible. */
 };
 
 enum socket_state {
@@ -55,6 +60,9 @@ struct socket_operations {
 	/* A fatal error occurred, like a memory allocation failure; advise to
 	 * abort the connection. */
 	socket_operation_T done;
+	/* Fill @limits with the rate limits of the traffic of the socket and
+	 * return how many there are, at most RATE_LIMITS. May be NULL. */
+	int (*get_limits)(struct socket *, struct rate_limit **limits);
 };
 
 struct read_buffer {
@@ -62,10 +70,22 @@ struct read_buffer {
 	 * usually many times, not only when all the data arrives. */
 	socket_read_T done;
 
+	/* The unread data. kill_buffer_data() only moves @data forward, the
+	 * consumed bytes before it are reclaimed when @freespace runs out. */
+	char *data;
 	int length;
-	int freespace;
+	int freespace; /* after the unread data */
+
+#ifdef HAVE_SPLICE
+	/* Set by splice_from_socket() for the next read only: the file to
+	 * which at most @splice_length bytes go instead of the buffer, and
+	 * how many of them did. */
+	int splice_fd;
+	int splice_length;
+	int spliced;
+#endif
 
-	char data[1]; /* must be at end of struct */
+	char buffer[1]; /* must be at end of struct */
 };
 
 struct socket {
@@ -98,12 +118,39 @@ struct socket {
 	 * lot of compilation time. --pasky */
 	void *ssl;
 
+	/* When the SSL handshake started, for the handshake statistics. */
+	timeval_T ssl_start;
+
+	/* The "host:port" under which the SSL session is cached. The socket
+	 * may outlive the connection for which it was opened. */
+	char *ssl_session_key;
+
+	/* Waits for the rate limits to let more traffic through. */
+	timer_id_T limit_timer;
+
+	/* The length of an SSL write which has to be retried. SSL wants the
+	 * retry to be of the same length, whatever the limits say. */
+	int ssl_write_len;
+
+#ifdef HAVE_SPLICE
+	/* The pipe through which splice_from_socket() moves the data. */
+	int splice_pipe[2];
+#endif
+
 	unsigned int protocol_family:1; /* EL_PF_INET, EL_PF_INET6 */
 	unsigned int need_ssl:1;	/* If the socket needs SSL support */
 	unsigned int no_tls:1;		/* Internal SSL flag. */
 	unsigned int set_no_tls:1;	/* Was the blacklist checked yet? */
 	unsigned int duplex:1;		/* Allow simultaneous reads & writes. */
 	unsigned int verify:1;		/* Whether to verify certificates */
+	unsigned int ssl_resuming:1;	/* A cached SSL session was offered. */
+	unsigned int ssl_failed:1;	/* A fatal SSL error was seen. */
+	unsigned int http2:1;		/* Offer HTTP/2 when connecting. */
+	/* The data does not come from @fd but from an HTTP/2 stream,
+	 * which passes it to feed_socket(). */
+	unsigned int stream:1;
+	unsigned int read_limited:1;	/* Reading waits for @limit_timer. */
+	unsigned int write_limited:1;	/* Writing waits for @limit_timer. */
 };
 
 #define EL_PF_INET	0
@@ -158,6 +205,15 @@ void dns_exception(struct socket *socket);
 void read_from_socket(struct socket *socket, struct read_buffer *buffer,
 		      struct connection_state state, socket_read_T done);
 
+#ifdef HAVE_SPLICE
+/* Like read_from_socket(), but the next data read from the plain @socket
+ * goes to the file @fd without passing through user space, at most @len
+ * bytes of it.  @done finds their number in @buffer->spliced. */
+void splice_from_socket(struct socket *socket, struct read_buffer *buffer,
+			int fd, int len, struct connection_state state,
+			socket_read_T done);
+#endif
+
 /* Writes @datalen bytes from @data buffer to the passed @socket. When all data
  * is written the @done callback will be called. */
 void write_to_socket(struct socket *socket,
@@ -172,6 +228,10 @@ void request_from_socket(struct socket *socket, char *data, int datalen,
 /* Initialize a read buffer. */
 struct read_buffer *alloc_read_buffer(struct socket *socket);
 
+/* Adds @len bytes of @data to the read buffer of a @socket->stream socket
+ * as if they were read, and calls the read_buffer->done() callback. */
+void feed_socket(struct socket *socket, char *data, int len);
+
 /* Remove @bytes number of bytes from @buffer. */
 void kill_buffer_data(struct read_buffer *buffer, int bytes);
 
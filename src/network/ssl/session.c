@@ -0,0 +1,303 @@
+/* SSL session cache */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef CONFIG_OPENSSL
+#include <openssl/ssl.h>
+#define USE_OPENSSL
+#elif defined(CONFIG_NSS_COMPAT_OSSL)
+#include <nss_compat_ossl/nss_compat_ossl.h>
+#define USE_OPENSSL
+#elif defined(CONFIG_GNUTLS)
+#include <gnutls/gnutls.h>
+#else
+#error "Huh?! You have SSL enabled, but not OPENSSL nor GNUTLS!! And then you want exactly *what* from me?"
+#endif
+
+#include <string.h>
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "network/connection.h"
+#include "network/socket.h"
+#include "network/ssl/session.h"
+#include "network/ssl/ssl.h"
+#include "protocol/uri.h"
+#include "util/hash.h"
+#include "util/lists.h"
+#include "util/memory.h"
+#include "util/time.h"
+
+
+/* The handshake with a server is expensive, resuming the session of the
+ * previous connection to it saves most of it. Sessions are cached per host
+ * and port, the most recently used ones are at the top of the list. */
+struct ssl_session {
+	LIST_HEAD(struct ssl_session);
+
+	struct hash_item *item;		/* In @ssl_session_hash. */
+	timeval_T creation_time;
+
+	/* A session of a connection which did not verify the certificate of
+	 * the server must not be used to skip the verification later. */
+	unsigned int verified:1;
+
+#ifdef USE_OPENSSL
+	SSL_SESSION *session;
+#elif defined(CONFIG_GNUTLS)
+	gnutls_datum_t data;
+#endif
+	char key[1];		/* "host:port"; XXX: Must be last. */
+};
+
+static INIT_LIST_OF(struct ssl_session, ssl_sessions);
+static struct hash *ssl_session_hash;
+static int ssl_session_count;
+
+static long full_handshake_count, resumed_handshake_count;
+static milliseconds_T full_handshake_time, resumed_handshake_time;
+
+
+int
+get_ssl_session_count(void)
+{
+	return ssl_session_count;
+}
+
+long
+get_ssl_full_handshake_count(void)
+{
+	return full_handshake_count;
+}
+
+long
+get_ssl_resumed_handshake_count(void)
+{
+	return resumed_handshake_count;
+}
+
+long
+get_ssl_full_handshake_time(void)
+{
+	return full_handshake_count
+	       ? (long) (full_handshake_time / full_handshake_count) : 0;
+}
+
+long
+get_ssl_resumed_handshake_time(void)
+{
+	return resumed_handshake_count
+	       ? (long) (resumed_handshake_time / resumed_handshake_count) : 0;
+}
+
+
+static char *
+get_ssl_session_key(struct socket *socket)
+{
+	struct connection *conn = (struct connection *)socket->conn;
+
+	if (!conn || !conn->proxied_uri) return NULL;
+
+	return get_uri_string(conn->proxied_uri, URI_HTTP_CONNECT);
+}
+
+static int
+is_ssl_socket_verified(struct socket *socket)
+{
+#ifdef USE_OPENSSL
+	return SSL_get_verify_mode((SSL *) socket->ssl) != SSL_VERIFY_NONE;
+#elif defined(CONFIG_GNUTLS)
+	return socket->verify && get_opt_bool("connection.ssl.cert_verify", NULL);
+#endif
+}
+
+static struct ssl_session *
+find_ssl_session(char *key)
+{
+	struct hash_item *item;
+
+	if (!ssl_session_hash) return NULL;
+
+	item = get_hash_item(ssl_session_hash, key, strlen(key));
+	return item ? (struct ssl_session *) item->value : NULL;
+}
+
+static int
+is_ssl_session_expired(struct ssl_session *session)
+{
+	timeval_T age, now, max_age;
+
+	timeval_from_seconds(&max_age,
+			     get_opt_int("connection.ssl.session_cache.lifetime", NULL));
+	timeval_now(&now);
+	timeval_sub(&age, &session->creation_time, &now);
+
+	return timeval_cmp(&age, &max_age) > 0;
+}
+
+static void
+del_ssl_session(struct ssl_session *session)
+{
+	del_hash_item(ssl_session_hash, session->item);
+	del_from_list(session);
+	ssl_session_count--;
+
+#ifdef USE_OPENSSL
+	SSL_SESSION_free(session->session);
+#elif defined(CONFIG_GNUTLS)
+	gnutls_free(session->data.data);
+#endif
+	mem_free(session);
+}
+
+static struct ssl_session *
+add_ssl_session(char *key)
+{
+	int keylen = strlen(key);
+	int size = get_opt_int("connection.ssl.session_cache.size", NULL);
+	struct ssl_session *session;
+
+	if (size <= 0) return NULL;
+
+	if (!ssl_session_hash) {
+		ssl_session_hash = init_hash8();
+		if (!ssl_session_hash) return NULL;
+	}
+
+	session = find_ssl_session(key);
+	if (session) del_ssl_session(session);
+
+	/* Make room by dropping the least recently used sessions. */
+	while (ssl_session_count >= size)
+		del_ssl_session(ssl_sessions.prev);
+
+	session = (struct ssl_session *)mem_calloc(1, sizeof(*session) + keylen);
+	if (!session) return NULL;
+
+	/* calloc() sets NUL char for us. */
+	memcpy(session->key, key, keylen);
+
+	session->item = add_hash_item(ssl_session_hash, session->key, keylen,
+				      session);
+	if (!session->item) {
+		mem_free(session);
+		return NULL;
+	}
+
+	timeval_now(&session->creation_time);
+	add_to_list(ssl_sessions, session);
+	ssl_session_count++;
+
+	return session;
+}
+
+int
+cache_ssl_session(struct socket *socket, void *data)
+{
+	struct ssl_session *session;
+
+	if (!socket->ssl_session_key) return 0;
+
+	session = add_ssl_session(socket->ssl_session_key);
+	if (!session) return 0;
+
+	session->verified = is_ssl_socket_verified(socket);
+
+#ifdef USE_OPENSSL
+	session->session = (SSL_SESSION *) data;
+#elif defined(CONFIG_GNUTLS)
+	if (gnutls_session_get_data2(*(ssl_t *) socket->ssl, &session->data) < 0) {
+		session->data.data = NULL;
+		del_ssl_session(session);
+		return 0;
+	}
+#endif
+
+	return 1;
+}
+
+void
+start_ssl_handshake(struct socket *socket)
+{
+	struct ssl_session *session;
+
+	timeval_now(&socket->ssl_start);
+	socket->ssl_resuming = 0;
+
+	/* Sessions negotiated later on the socket are cached under it too. */
+	mem_free_set(&socket->ssl_session_key, get_ssl_session_key(socket));
+
+	if (socket->no_tls || !socket->ssl_session_key) return;
+
+	session = find_ssl_session(socket->ssl_session_key);
+	if (!session) return;
+
+	if (is_ssl_session_expired(session)) {
+		del_ssl_session(session);
+		return;
+	}
+
+	if (session->verified < is_ssl_socket_verified(socket))
+		return;
+
+	move_to_top_of_list(ssl_sessions, session);
+	socket->ssl_resuming = 1;
+
+#ifdef USE_OPENSSL
+	SSL_set_session((SSL *) socket->ssl, session->session);
+#elif defined(CONFIG_GNUTLS)
+	gnutls_session_set_data(*(ssl_t *) socket->ssl, session->data.data,
+				session->data.size);
+#endif
+}
+
+void
+done_ssl_handshake(struct socket *socket, int success)
+{
+	timeval_T now, duration;
+	int resumed;
+
+	if (!success) {
+		struct ssl_session *session;
+
+		if (!socket->ssl_resuming || !socket->ssl_session_key) return;
+
+		/* Do not offer it to the server again when retrying. */
+		session = find_ssl_session(socket->ssl_session_key);
+		if (session) del_ssl_session(session);
+		return;
+	}
+
+	timeval_now(&now);
+	timeval_sub(&duration, &socket->ssl_start, &now);
+
+#ifdef USE_OPENSSL
+	resumed = SSL_session_reused((SSL *) socket->ssl);
+#elif defined(CONFIG_GNUTLS)
+	resumed = gnutls_session_is_resumed(*(ssl_t *) socket->ssl);
+
+	/* OpenSSL hands new sessions to cache_ssl_session() itself. With
+	 * TLS 1.3 the resumed session has new data too. */
+	cache_ssl_session(socket, NULL);
+#endif
+
+	if (resumed) {
+		resumed_handshake_count++;
+		resumed_handshake_time += timeval_to_milliseconds(&duration);
+	} else {
+		full_handshake_count++;
+		full_handshake_time += timeval_to_milliseconds(&duration);
+	}
+}
+
+void
+done_ssl_session_cache(void)
+{
+	while (!list_empty(ssl_sessions))
+		del_ssl_session(ssl_sessions.next);
+
+	if (ssl_session_hash) free_hash(&ssl_session_hash);
+}
@@ -0,0 +1,41 @@
+#ifndef EL__NETWORK_SSL_SESSION_H
+#define EL__NETWORK_SSL_SESSION_H
+
+#ifdef CONFIG_SSL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct socket;
+
+/* Called by ssl_connect() before the handshake. Starts the handshake timer
+ * and offers the session cached for the host and port of the connection. */
+void start_ssl_handshake(struct socket *socket);
+
+/* Called when the handshake on @socket succeeded or failed. Counts the
+ * handshake, and forgets the cached session if the handshake failed. */
+void done_ssl_handshake(struct socket *socket, int success);
+
+/* Remembers the session of @socket for its host and port. With OpenSSL
+ * @session is the new SSL_SESSION and the reference to it is kept if this
+ * returns non-zero, GnuTLS gets the session data from @socket itself. */
+int cache_ssl_session(struct socket *socket, void *session);
+
+void done_ssl_session_cache(void);
+
+/* Statistics for the document info dialog. The times are averages in
+ * milliseconds. */
+int get_ssl_session_count(void);
+long get_ssl_full_handshake_count(void);
+long get_ssl_resumed_handshake_count(void);
+long get_ssl_full_handshake_time(void);
+long get_ssl_resumed_handshake_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_SSL */
+
+#endif
@@ -5,6 +5,7 @@
 #endif
 
 #ifdef CONFIG_OPENSSL
+#include <openssl/err.h>
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
 #define USE_OPENSSL
@@ -37,6 +38,7 @@
 #include "network/connection.h"
 #include "network/socket.h"
 #include "network/ssl/match-hostname.h"
+#include "network/ssl/session.h"
 #include "network/ssl/socket.h"
 #include "network/ssl/ssl.h"
 #include "protocol/uri.h"
@@ -63,14 +65,11 @@
 #define ssl_do_connect(socket)		SSL_get_error((SSL *)socket->ssl, SSL_connect((SSL *)socket->ssl))
 #define ssl_do_write(socket, data, len)	SSL_write((SSL *)socket->ssl, data, len)
 #define ssl_do_read(socket, data, len)	SSL_read((SSL *)socket->ssl, data, len)
-#define ssl_do_close(socket)		/* Hmh? No idea.. */
 
 #elif defined(CONFIG_GNUTLS)
 
 #define ssl_do_write(socket, data, len)	gnutls_record_send(*((ssl_t *) socket->ssl), data, len)
 #define ssl_do_read(socket, data, len)	gnutls_record_recv(*((ssl_t *) socket->ssl), data, len)
-/* We probably don't handle this entirely correctly.. */
-#define ssl_do_close(socket)		gnutls_bye(*((ssl_t *) socket->ssl), GNUTLS_SHUT_RDWR);
 
 #endif
 
@@ -416,11 +415,14 @@ ssl_want_read(struct socket *socket)
 #ifdef CONFIG_GNUTLS
 			if (socket->verify && get_opt_bool("connection.ssl.cert_verify", NULL)
 			    && verify_certificates(socket)) {
+				done_ssl_handshake(socket, 0);
 				socket->ops->retry(socket, connection_state(S_SSL_ERROR));
 				return;
 			}
 #endif
 
+			done_ssl_handshake(socket, 1);
+
 			/* Report successful SSL connection setup. */
 			complete_connect_socket(socket, NULL, NULL);
 			break;
@@ -430,6 +432,7 @@ ssl_want_read(struct socket *socket)
 			break;
 
 		default:
+			done_ssl_handshake(socket, 0);
 			socket->no_tls = !socket->no_tls;
 			socket->ops->retry(socket, connection_state(S_SSL_ERROR));
 	}
@@ -542,6 +545,8 @@ ssl_connect(struct socket *socket)
 	/* TODO: Some certificates fuss. --pasky */
 #endif
 
+	start_ssl_handshake(socket);
+
 	ret = ssl_do_connect(socket);
 
 	switch (ret) {
@@ -566,10 +571,13 @@ ssl_connect(struct socket *socket)
 				/* DBG("sslerr %s", gnutls_strerror(ret)); */
 				socket->no_tls = !socket->no_tls;
 			}
+			done_ssl_handshake(socket, 0);
 			connect_socket(socket, connection_state(S_SSL_ERROR));
 			return -1;
 	}
 
+	done_ssl_handshake(socket, 1);
+
 	return 0;
 }
 
@@ -587,9 +595,11 @@ ssl_write(struct socket *socket, char *data, int len)
 #endif
 		if (err == SSL_ERROR_WANT_WRITE ||
 		    err == SSL_ERROR_WANT_WRITE2) {
-			return -1;
+			return SOCKET_SSL_WANT_WRITE;
 		}
 
+		socket->ssl_failed = 1;
+
 		if (!wr) return SOCKET_CANT_WRITE;
 
 		if (err == SSL_ERROR_SYSCALL)
@@ -617,6 +627,7 @@ ssl_read(struct socket *socket, char *data, int len)
 
 #ifdef CONFIG_GNUTLS
 		if (err == GNUTLS_E_PREMATURE_TERMINATION) {
+			socket->ssl_failed = 1;
 			return SOCKET_CANT_READ;
 		}
 
@@ -633,7 +644,17 @@ ssl_read(struct socket *socket, char *data, int len)
 			return SOCKET_SSL_WANT_READ;
 		}
 
-		if (!rd) return SOCKET_CANT_READ;
+		if (!rd) {
+#ifdef USE_OPENSSL
+			/* Only a close_notify from the server leaves the
+			 * connection fit for sending one back. */
+			if (err != SSL_ERROR_ZERO_RETURN)
+				socket->ssl_failed = 1;
+#endif
+			return SOCKET_CANT_READ;
+		}
+
+		socket->ssl_failed = 1;
 
 		if (err == SSL_ERROR_SYSCALL2)
 			return SOCKET_SYSCALL_ERROR;
@@ -645,6 +666,41 @@ ssl_read(struct socket *socket, char *data, int len)
 	return rd;
 }
 
+/* Returns whether decrypted data waits to be read, which select() does not
+ * see on the socket. */
+int
+ssl_pending(struct socket *socket)
+{
+#ifdef USE_OPENSSL
+	return SSL_pending((SSL *)socket->ssl) > 0;
+#elif defined(CONFIG_GNUTLS)
+	return gnutls_record_check_pending(*((ssl_t *) socket->ssl)) > 0;
+#endif
+}
+
+static void
+ssl_do_close(struct socket *socket)
+{
+#ifdef CONFIG_OPENSSL
+	SSL *ssl = (SSL *)socket->ssl;
+
+	/* Without close_notify OpenSSL would not let the session be resumed,
+	 * but it must not be sent before the handshake has finished or after
+	 * a fatal error. */
+	if (!socket->ssl_failed && SSL_is_init_finished(ssl))
+		SSL_shutdown(ssl);
+
+	/* Anything left on the error queue of the thread would be taken for
+	 * the error of the next SSL call on another connection. */
+	ERR_clear_error();
+
+#elif defined(CONFIG_GNUTLS)
+	/* We probably don't handle this entirely correctly.. */
+	if (!socket->ssl_failed)
+		gnutls_bye(*((ssl_t *) socket->ssl), GNUTLS_SHUT_RDWR);
+#endif
+}
+
 int
 ssl_close(struct socket *socket)
 {
@@ -32,6 +32,7 @@
 #include "main/module.h"
 #include "network/connection.h"
 #include "network/socket.h"
+#include "network/ssl/session.h"
 #include "network/ssl/ssl.h"
 #include "osdep/osdep.h"
 #include "util/conv.h"
@@ -85,6 +86,15 @@ socket_SSL_ex_data_dup(CRYPTO_EX_DATA *to, const CRYPTO_EX_DATA *from,
 		return 1;	/* allow SSL_dup() */
 }
 
+/* Called when the server gave us a session we may resume later. */
+static int
+new_session_callback(SSL *ssl, SSL_SESSION *session)
+{
+	struct socket *socket = (struct socket *)SSL_get_ex_data(ssl, socket_SSL_ex_data_idx);
+
+	return socket ? cache_ssl_session(socket, session) : 0;
+}
+
 static char opensslversion[64];
 
 #ifdef CONFIG_OS_DOS
@@ -152,6 +162,16 @@ init_openssl(struct module *module)
 	SSLeay_add_ssl_algorithms();
 	context = SSL_CTX_new(SSLv23_client_method());
 	SSL_CTX_set_options(context, SSL_OP_ALL);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	/* Most servers close the connection without close_notify, which
+	 * would make OpenSSL 3 refuse to resume the session. ELinks took
+	 * such a close for the end of the data anyway. */
+	SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	/* The sessions are cached per host, see session.c. */
+	SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT
+				       | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(context, new_session_callback);
 
 #ifdef CONFIG_OS_DOS
 	ssl_set_private_paths(context);
@@ -168,6 +188,7 @@ init_openssl(struct module *module)
 static void
 done_openssl(struct module *module)
 {
+	done_ssl_session_cache();
 	if (context) SSL_CTX_free(context);
 	/* There is no function that undoes SSL_get_ex_new_index.  */
 }
@@ -307,6 +328,7 @@ init_gnutls(struct module *module)
 static void
 done_gnutls(struct module *module)
 {
+	done_ssl_session_cache();
 	if (xcred) gnutls_certificate_free_credentials(xcred);
 	if (anon_cred) gnutls_anon_free_client_credentials(anon_cred);
 	gnutls_global_deinit();
@@ -386,6 +408,23 @@ static union option_info ssl_options[] = {
 		"ssl", OPT_SORT,
 		N_("SSL options.")),
 
+	INIT_OPT_TREE("connection.ssl", N_("Session cache"),
+		"session_cache", OPT_SORT,
+		N_("Sessions of the previous connections to servers are "
+		"remembered, so that the next connection to the same host "
+		"and port can resume the session instead of doing a full "
+		"handshake.")),
+
+	INIT_OPT_INT("connection.ssl.session_cache", N_("Size"),
+		"size", OPT_ZERO, 0, 4096, 64,
+		N_("Maximum number of remembered sessions. Zero disables "
+		"the session cache.")),
+
+	INIT_OPT_INT("connection.ssl.session_cache", N_("Lifetime"),
+		"lifetime", OPT_ZERO, 0, 86400, 3600,
+		N_("Number of seconds a session is offered to the server "
+		"again. The server may also refuse it sooner.")),
+
 	NULL_OPTION_INFO,
 };
 
@@ -408,10 +447,17 @@ struct module ssl_module = struct_module(
 	/* done: */		NULL
 );
 
+/* The protocols offered when socket.http2 is set, in the wire format of
+ * the ALPN extension (RFC 7301). */
+#define ALPN_PROTOCOLS "\x02h2\x08http/1.1"
+
 int
 init_ssl_connection(struct socket *socket,
 		    const char *server_name)
 {
+	socket->ssl_failed = 0;
+	socket->ssl_write_len = 0;
+
 #ifdef USE_OPENSSL
 	socket->ssl = SSL_new(context);
 	if (!socket->ssl) return S_SSL_ERROR;
@@ -434,6 +480,19 @@ init_ssl_connection(struct socket *socket,
 		return S_SSL_ERROR;
 	}
 
+#ifdef CONFIG_OPENSSL
+	/* Unlike the other OpenSSL functions, this one returns zero
+	 * on success. */
+	if (socket->http2
+	    && SSL_set_alpn_protos((ssl_t *)socket->ssl,
+				   (const unsigned char *) ALPN_PROTOCOLS,
+				   sizeof(ALPN_PROTOCOLS) - 1)) {
+		SSL_free((ssl_t *)socket->ssl);
+		socket->ssl = NULL;
+		return S_SSL_ERROR;
+	}
+#endif
+
 #elif defined(CONFIG_GNUTLS)
 	ssl_t *state = (ssl_t *)mem_alloc(sizeof(ssl_t));
 
@@ -500,6 +559,21 @@ init_ssl_connection(struct socket *socket,
 		return S_SSL_ERROR;
 	}
 
+	if (socket->http2) {
+		gnutls_datum_t protocols[2];
+
+		protocols[0].data = (unsigned char *) ALPN_PROTOCOLS + 1;
+		protocols[0].size = 2;
+		protocols[1].data = (unsigned char *) ALPN_PROTOCOLS + 4;
+		protocols[1].size = 8;
+
+		if (gnutls_alpn_set_protocols(*state, protocols, 2, 0)) {
+			gnutls_deinit(*state);
+			mem_free(state);
+			return S_SSL_ERROR;
+		}
+	}
+
 	socket->ssl = state;
 #endif
 
@@ -511,6 +585,8 @@ done_ssl_connection(struct socket *socket)
 {
 	ssl_t *ssl = (ssl_t *)socket->ssl;
 
+	mem_free_set(&socket->ssl_session_key, NULL);
+
 	if (!ssl) return;
 #ifdef USE_OPENSSL
 	SSL_free(ssl);
@@ -521,6 +597,33 @@ done_ssl_connection(struct socket *socket)
 	socket->ssl = NULL;
 }
 
+int
+is_ssl_http2(struct socket *socket)
+{
+	ssl_t *ssl = (ssl_t *)socket->ssl;
+
+	if (!ssl) return 0;
+
+#ifdef CONFIG_OPENSSL
+	{
+		const unsigned char *protocol;
+		unsigned int length;
+
+		SSL_get0_alpn_selected(ssl, &protocol, &length);
+		return length == 2 && !memcmp(protocol, "h2", 2);
+	}
+#elif defined(CONFIG_GNUTLS)
+	{
+		gnutls_datum_t protocol;
+
+		return !gnutls_alpn_get_selected_protocol(*ssl, &protocol)
+		       && protocol.size == 2 && !memcmp(protocol.data, "h2", 2);
+	}
+#else
+	return 0;
+#endif
+}
+
 char *
 get_ssl_connection_cipher(struct socket *socket)
 {
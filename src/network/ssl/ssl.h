@@ -31,6 +31,9 @@ int init_ssl_connection(struct socket *socket,
 /* Releases the SSL connection data */
 void done_ssl_connection(struct socket *socket);
 
+/* Returns non-zero if the server chose HTTP/2 in the ALPN extension. */
+int is_ssl_http2(struct socket *socket);
+
 char *get_ssl_connection_cipher(struct socket *socket);
 
 #if defined(CONFIG_OPENSSL) || defined(CONFIG_NSS_COMPAT_OSSL)
@@ -0,0 +1,676 @@
+/* Queue lots of downloads and check the order the connections are run in */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "cache/cache.h"
+#include "config/options.h"
+#include "document/document.h"
+#include "encoding/encoding.h"
+#include "main/object.h"
+#include "main/select.h"
+#include "main/timer.h"
+#include "network/connection.h"
+#include "network/progress.h"
+#include "network/socket.h"
+#include "network/ssl/ssl.h"
+#include "protocol/http/http2.h"
+#include "protocol/protocol.h"
+#include "protocol/proxy.h"
+#include "protocol/uri.h"
+#include "session/download.h"
+#include "util/memory.h"
+#include "util/test.h"
+#include "util/time.h"
+
+#define MAX_CONNECTIONS		10
+#define MAX_CONNECTIONS_TO_HOST	4
+
+struct entry {
+	/* The download is moved between the two when its priority
+	 * changes. */
+	struct download download[2];
+	int current;
+
+	struct uri uri;
+	char string[64];
+
+	int host;
+	int running;	/* Index in @running, or -1 */
+
+	unsigned int finishing:1;
+	unsigned int started:1;
+	unsigned int done:1;
+};
+
+static struct entry *entries;
+static int hosts_count;
+
+/* The entries with a running connection. */
+static struct entry **running;
+static int running_count;
+
+/* What the scheduler should know about the hosts. */
+static int *host_running;
+static int (*host_waiting)[PRIORITIES];
+static long *host_last_start;
+
+static long starts, suspensions, done_count;
+
+/* Whether the hosts have to take turns in the order of their last start. */
+static int check_turns;
+
+static unsigned long random_state = 42;
+
+static int
+next_random(void)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) & 0x7fff;
+}
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+struct option *config_options = NULL;
+
+#ifdef CONFIG_DEBUG
+union option_value *
+get_opt_(char *file, int line, enum option_type option_type,
+	 struct option *tree, const char *name, struct session *ses)
+#else
+union option_value *
+get_opt_(struct option *tree, const char *name, struct session *ses)
+#endif
+{
+	static union option_value value;
+
+	if (!strcmp(name, "connection.max_connections"))
+		value.number = MAX_CONNECTIONS;
+	else if (!strcmp(name, "connection.max_connections_to_host"))
+		value.number = MAX_CONNECTIONS_TO_HOST;
+	else
+		value.number = 0;
+
+	return &value;
+}
+
+/* The main loop: only check_queue() is ever registered. */
+
+static select_handler_T bottom_half;
+static void *bottom_half_data;
+
+int
+register_bottom_half_do(select_handler_T work_handler, void *data)
+{
+	bottom_half = work_handler;
+	bottom_half_data = data;
+	return 0;
+}
+
+static void
+run_bottom_halves(void)
+{
+	while (bottom_half) {
+		select_handler_T work_handler = bottom_half;
+
+		bottom_half = NULL;
+		work_handler(bottom_half_data);
+	}
+}
+
+void
+set_handlers(int fd, select_handler_T read_handler,
+	     select_handler_T write_handler, select_handler_T error_handler,
+	     void *data)
+{
+}
+
+int
+can_read(int fd)
+{
+	return 0;
+}
+
+void
+install_timer(timer_id_T *id, milliseconds_T delay, void (*func)(void *),
+	      void *data)
+{
+	*id = TIMER_ID_UNDEF;
+}
+
+void
+kill_timer(timer_id_T *id)
+{
+	*id = TIMER_ID_UNDEF;
+}
+
+/* The cache never has anything. */
+
+struct cache_entry *
+find_in_cache(struct uri *uri)
+{
+	return NULL;
+}
+
+struct cache_entry *
+get_validated_cache_entry(struct uri *uri, cache_mode_T cache_mode)
+{
+	return NULL;
+}
+
+void
+normalize_cache_entry(struct cache_entry *cached, off_t length)
+{
+}
+
+void
+free_entry_to(struct cache_entry *cached, off_t offset)
+{
+}
+
+void
+shrink_format_cache(int whole)
+{
+}
+
+void
+close_encoded(struct stream_encoded *stream)
+{
+}
+
+struct progress *
+init_progress(off_t start)
+{
+	return (struct progress *)mem_calloc(1, sizeof(struct progress));
+}
+
+void
+done_progress(struct progress *progress)
+{
+	mem_free(progress);
+}
+
+void
+update_progress(struct progress *progress, off_t loaded, off_t size, off_t pos)
+{
+}
+
+void
+start_update_progress(struct progress *progress, void (*timer_func)(void *),
+		      void *timer_func_data)
+{
+}
+
+struct socket *
+init_socket(void *conn, struct socket_operations *ops)
+{
+	struct socket *socket = (struct socket *)mem_calloc(1, sizeof(*socket));
+
+	if (!socket) return NULL;
+
+	socket->fd = -1;
+	socket->conn = conn;
+	socket->ops = ops;
+	return socket;
+}
+
+void
+done_socket(struct socket *socket)
+{
+}
+
+void
+timeout_socket(struct socket *socket)
+{
+}
+
+#ifdef CONFIG_SSL
+char *
+get_ssl_connection_cipher(struct socket *socket)
+{
+	return NULL;
+}
+#endif
+
+struct http2_session *
+get_http2_session(struct connection *conn)
+{
+	return NULL;
+}
+
+/* The test URIs are not in the URI cache and differ only in the host and the
+ * path. */
+
+void
+done_uri(struct uri *uri)
+{
+	object_unlock(uri);
+}
+
+int
+compare_uri(const struct uri *a, const struct uri *b,
+	    uri_component_T components)
+{
+	if (a == b) return 1;
+	if (!components) return 0;
+
+	return a->hostlen == b->hostlen
+	       && !memcmp(a->host, b->host, a->hostlen);
+}
+
+struct uri *
+get_proxied_uri(struct uri *uri)
+{
+	return get_uri_reference(uri);
+}
+
+struct uri *
+get_proxy_uri(struct uri *uri, struct connection_state *connection_state)
+{
+	return get_uri_reference(uri);
+}
+
+int
+get_protocol_need_slash_after_host(protocol_T protocol)
+{
+	return 1;
+}
+
+static struct entry *
+get_entry(struct connection *conn)
+{
+	return (struct entry *)((char *)conn->uri - offsetof(struct entry, uri));
+}
+
+/* Called by free_connection_data() when a connection stops running. */
+static void
+stop_entry(struct connection *conn)
+{
+	struct entry *entry = get_entry(conn);
+
+	running[entry->running] = running[--running_count];
+	running[entry->running]->running = entry->running;
+	entry->running = -1;
+	host_running[entry->host]--;
+
+	if (!entry->finishing) {
+		host_waiting[entry->host][get_connection_priority(conn)]++;
+		suspensions++;
+	}
+}
+
+static void
+check_start(struct entry *entry, connection_priority_T priority)
+{
+	int host, pri;
+
+	if (running_count >= MAX_CONNECTIONS)
+		die("%d connections running", running_count + 1);
+	if (host_running[entry->host] >= MAX_CONNECTIONS_TO_HOST)
+		die("%d connections to host %d running",
+		    host_running[entry->host] + 1, entry->host);
+
+	for (host = 0; host < hosts_count; host++) {
+		if (host_running[host] >= MAX_CONNECTIONS_TO_HOST)
+			continue;
+
+		for (pri = 0; pri < priority; pri++)
+			if (host_waiting[host][pri])
+				die("%s started with priority %d before "
+				    "a connection to host %d with priority %d",
+				    entry->string, priority, host, pri);
+
+		if (check_turns && host != entry->host
+		    && host_waiting[host][priority]
+		    && host_last_start[host] < host_last_start[entry->host])
+			die("%s started before the turn of host %d",
+			    entry->string, host);
+	}
+}
+
+static void
+test_protocol_handler(struct connection *conn)
+{
+	struct entry *entry = get_entry(conn);
+	connection_priority_T priority = get_connection_priority(conn);
+
+	check_start(entry, priority);
+
+	host_waiting[entry->host][priority]--;
+	host_running[entry->host]++;
+	host_last_start[entry->host] = starts++;
+
+	entry->started = 1;
+	entry->running = running_count;
+	running[running_count++] = entry;
+
+	conn->done = stop_entry;
+	set_connection_state(conn, connection_state(S_CONN));
+}
+
+protocol_handler_T *
+get_protocol_handler(protocol_T protocol)
+{
+	return test_protocol_handler;
+}
+
+static void
+download_callback(struct download *download, void *data)
+{
+	struct entry *entry = (struct entry *)data;
+
+	if (!is_in_result_state(download->state))
+		return;
+
+	if (entry->done)
+		die("%s finished twice", entry->string);
+	entry->done = 1;
+	done_count++;
+}
+
+static void
+queue_entry(struct entry *entry, connection_priority_T priority)
+{
+	struct download *download = &entry->download[entry->current];
+
+	download->callback = download_callback;
+	download->data = entry;
+
+	if (load_uri(&entry->uri, NULL, download, priority,
+		     CACHE_MODE_NORMAL, 0))
+		die("cannot load %s", entry->string);
+	host_waiting[entry->host][priority]++;
+}
+
+static void
+move_entry(struct entry *entry, connection_priority_T priority)
+{
+	struct download *old = &entry->download[entry->current];
+	struct download *new_ = &entry->download[!entry->current];
+	struct connection *conn = old->conn;
+	int waiting = entry->running == -1;
+
+	if (waiting)
+		host_waiting[entry->host][get_connection_priority(conn)]--;
+
+	new_->callback = download_callback;
+	new_->data = entry;
+	move_download(old, new_, priority);
+	entry->current = !entry->current;
+
+	if (waiting)
+		host_waiting[entry->host][get_connection_priority(conn)]++;
+}
+
+static void
+finish_entry(struct entry *entry)
+{
+	struct connection *conn = entry->download[entry->current].conn;
+
+	entry->finishing = 1;
+	abort_connection(conn, connection_state(S_OK));
+}
+
+static void
+cancel_entry(struct entry *entry)
+{
+	struct download *download = &entry->download[entry->current];
+
+	if (entry->running == -1)
+		host_waiting[entry->host][get_connection_priority(download->conn)]--;
+	else
+		entry->finishing = 1;
+
+	cancel_download(download, 1);
+	entry->done = 1;
+	done_count++;
+}
+
+static void
+finish_random_entries(long count)
+{
+	for (; count > 0 && running_count; count--)
+		finish_entry(running[next_random() % running_count]);
+
+	run_bottom_halves();
+}
+
+static milliseconds_T
+elapsed_ms(timeval_T *start)
+{
+	timeval_T end, duration;
+
+	timeval_now(&end);
+	timeval_sub(&duration, start, &end);
+	return timeval_to_milliseconds(&duration);
+}
+
+static void
+init_entry(int i, int host)
+{
+	struct entry *entry = &entries[i];
+
+	entry->host = host;
+	entry->running = -1;
+	snprintf(entry->string, sizeof(entry->string),
+		 "http://host%d.example/%d", host, i);
+	entry->uri.string = entry->string;
+	entry->uri.protocol = PROTOCOL_HTTP;
+	entry->uri.host = entry->string + 7;
+	entry->uri.hostlen = strchr(entry->uri.host, '/') - entry->uri.host;
+}
+
+/* Whether a connection with priority @priority to @host could be started by
+ * suspending a running one. */
+static int
+can_suspend(int host, connection_priority_T priority)
+{
+	int i;
+
+	for (i = 0; i < running_count; i++) {
+		struct connection *conn = running[i]->download[running[i]->current].conn;
+
+		if (get_connection_priority(conn) > priority
+		    && (running[i]->host == host
+			|| host_running[host] < MAX_CONNECTIONS_TO_HOST))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+check_all_done(int first, int count)
+{
+	int i;
+
+	if (running_count)
+		die("%d connections left running", running_count);
+	if (get_connections_count())
+		die("%d connections left", get_connections_count());
+
+	for (i = first; i < first + count; i++) {
+		if (!entries[i].done)
+			die("%s was not finished", entries[i].string);
+		if (entries[i].uri.object.refcount)
+			die("%s has %d references left", entries[i].string,
+			    entries[i].uri.object.refcount);
+	}
+}
+
+/* All the hosts have the same number of downloads with the same priority,
+ * queued one host after another. */
+static void
+test_turns(int count)
+{
+	timeval_T start;
+	int i;
+
+	/* As if a long list of downloads from one host was queued before any
+	 * from the next one. */
+	for (i = 0; i < count; i++)
+		init_entry(i, i / ((count + hosts_count - 1) / hosts_count));
+	check_turns = 1;
+
+	timeval_now(&start);
+	for (i = 0; i < count; i++) {
+		queue_entry(&entries[i], PRI_PRELOAD);
+		/* The hosts are in the order of their first connection. */
+		if (!i || entries[i].host != entries[i - 1].host)
+			host_last_start[entries[i].host] = -hosts_count + entries[i].host;
+	}
+	printf("queued %d downloads from %d hosts in %ld ms\n", count,
+	       hosts_count, elapsed_ms(&start));
+
+	timeval_now(&start);
+	run_bottom_halves();
+	while (running_count)
+		finish_random_entries(1 + next_random() % MAX_CONNECTIONS);
+	printf("ran them in turns in %ld ms\n", elapsed_ms(&start));
+
+	check_all_done(0, count);
+	check_turns = 0;
+}
+
+/* Background downloads with various priorities and now and then a page with
+ * its stylesheets and images, some of which get cancelled or become more
+ * urgent. */
+static void
+test_priorities(int first, int count)
+{
+	timeval_T start;
+	int page_size = 1 + 4 + 10;
+	int pages = count / 10 / page_size;
+	int background = count - pages * page_size;
+	int next_page = background;
+	int i;
+
+	for (i = first; i < first + background; i++)
+		init_entry(i, i % hosts_count);
+
+	timeval_now(&start);
+	for (i = first; i < first + background; i++)
+		queue_entry(&entries[i], next_random() % 2 ? PRI_IMG : PRI_PRELOAD);
+	printf("queued %d downloads in %ld ms\n", background, elapsed_ms(&start));
+
+	timeval_now(&start);
+	run_bottom_halves();
+	while (running_count) {
+		if (next_page < count && !(next_random() % 8)) {
+			struct entry *page = &entries[first + next_page];
+			int host = next_random() % hosts_count;
+
+			/* A page from one of the busy hosts. */
+			for (i = 0; i < page_size; i++)
+				init_entry(first + next_page + i, host);
+			queue_entry(page, PRI_MAIN);
+			for (i = 1; i < page_size; i++)
+				queue_entry(page + i, i <= 4 ? PRI_CSS : PRI_IMG);
+
+			/* Unless everything running is as urgent. */
+			if (!can_suspend(host, PRI_MAIN))
+				finish_random_entries(MAX_CONNECTIONS);
+			run_bottom_halves();
+
+			if (!page->started)
+				die("%s not started at once", page->string);
+			next_page += page_size;
+		}
+
+		if (!(next_random() % 16)) {
+			struct entry *entry = &entries[first + next_random() % background];
+
+			if (!entry->done)
+				move_entry(entry, next_random() % 2 ? PRI_NEED_IMG : PRI_PRELOAD);
+		}
+
+		if (!(next_random() % 64)) {
+			struct entry *entry = &entries[first + next_random() % background];
+
+			if (!entry->done)
+				cancel_entry(entry);
+		}
+
+		finish_random_entries(1 + next_random() % MAX_CONNECTIONS);
+	}
+	printf("ran them with %d pages and %ld suspensions in %ld ms\n",
+	       pages, suspensions, elapsed_ms(&start));
+
+	check_all_done(first, next_page);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 10000;
+	int i;
+
+	hosts_count = 50;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "downloads", &i, argc, argv, "a number")) {
+			count = atoi(arg);
+
+		} else if (get_test_opt(&arg, "hosts", &i, argc, argv, "a number")) {
+			hosts_count = atoi(arg);
+
+		} else {
+			die("usage: %s [--downloads <n>] [--hosts <n>]", argv[0]);
+		}
+	}
+
+	if (count < 1000 || hosts_count <= 0)
+		die("--downloads must be at least 1000 and --hosts positive");
+
+	entries = (struct entry *)mem_calloc(2 * count, sizeof(*entries));
+	running = (struct entry **)mem_calloc(MAX_CONNECTIONS + 1, sizeof(*running));
+	host_running = (int *)mem_calloc(hosts_count, sizeof(*host_running));
+	host_waiting = (int (*)[PRIORITIES])mem_calloc(hosts_count, sizeof(*host_waiting));
+	host_last_start = (long *)mem_calloc(hosts_count, sizeof(*host_last_start));
+	if (!entries || !running || !host_running || !host_waiting
+	    || !host_last_start)
+		die("out of memory");
+
+	test_turns(count);
+	test_priorities(count, count);
+
+	mem_free(host_last_start);
+	mem_free(host_waiting);
+	mem_free(host_running);
+	mem_free(running);
+	mem_free(entries);
+
+	return 0;
+}
@@ -14,6 +14,8 @@ enum blacklist_flags {
 	SERVER_BLACKLIST_NO_CHARSET = 2,
 	SERVER_BLACKLIST_NO_TLS = 4,
 	SERVER_BLACKLIST_NO_CERT_VERIFY = 8,
+	SERVER_BLACKLIST_NO_PIPELINE = 16,
+	SERVER_BLACKLIST_NO_HTTP2 = 32,
 };
 
 typedef unsigned char blacklist_flags_T;
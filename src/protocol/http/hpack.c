@@ -0,0 +1,499 @@
+/** HPACK header compression for HTTP/2 (RFC 7541).
+ * @file */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "elinks.h"
+
+#include "protocol/http/hpack.h"
+#include "util/memory.h"
+#include "util/string.h"
+
+
+/* RFC 7541, Appendix A. */
+static const struct {
+	const char *name;
+	const char *value;
+} hpack_static_table[] = {
+	{ ":authority",				"" },
+	{ ":method",				"GET" },
+	{ ":method",				"POST" },
+	{ ":path",				"/" },
+	{ ":path",				"/index.html" },
+	{ ":scheme",				"http" },
+	{ ":scheme",				"https" },
+	{ ":status",				"200" },
+	{ ":status",				"204" },
+	{ ":status",				"206" },
+	{ ":status",				"304" },
+	{ ":status",				"400" },
+	{ ":status",				"404" },
+	{ ":status",				"500" },
+	{ "accept-charset",			"" },
+	{ "accept-encoding",			"gzip, deflate" },
+	{ "accept-language",			"" },
+	{ "accept-ranges",			"" },
+	{ "accept",				"" },
+	{ "access-control-allow-origin",	"" },
+	{ "age",				"" },
+	{ "allow",				"" },
+	{ "authorization",			"" },
+	{ "cache-control",			"" },
+	{ "content-disposition",		"" },
+	{ "content-encoding",			"" },
+	{ "content-language",			"" },
+	{ "content-length",			"" },
+	{ "content-location",			"" },
+	{ "content-range",			"" },
+	{ "content-type",			"" },
+	{ "cookie",				"" },
+	{ "date",				"" },
+	{ "etag",				"" },
+	{ "expect",				"" },
+	{ "expires",				"" },
+	{ "from",				"" },
+	{ "host",				"" },
+	{ "if-match",				"" },
+	{ "if-modified-since",			"" },
+	{ "if-none-match",			"" },
+	{ "if-range",				"" },
+	{ "if-unmodified-since",		"" },
+	{ "last-modified",			"" },
+	{ "link",				"" },
+	{ "location",				"" },
+	{ "max-forwards",			"" },
+	{ "proxy-authenticate",			"" },
+	{ "proxy-authorization",		"" },
+	{ "range",				"" },
+	{ "referer",				"" },
+	{ "refresh",				"" },
+	{ "retry-after",			"" },
+	{ "server",				"" },
+	{ "set-cookie",				"" },
+	{ "strict-transport-security",		"" },
+	{ "transfer-encoding",			"" },
+	{ "user-agent",				"" },
+	{ "vary",				"" },
+	{ "via",				"" },
+	{ "www-authenticate",			"" },
+};
+
+#define HPACK_STATIC_TABLE_SIZE \
+	((int) (sizeof(hpack_static_table) / sizeof(*hpack_static_table)))
+
+/* RFC 7541 says each entry takes the length of its name and value plus
+ * this much. */
+#define HPACK_ENTRY_OVERHEAD 32
+
+
+/* The Huffman code of RFC 7541, Appendix B, is canonical, so the code
+ * lengths of the 256 octets and EOS are enough to rebuild it. */
+static const unsigned char huffman_lengths[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	 6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+	 5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+	13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+	 7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+	15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+	 6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+#define HUFFMAN_EOS		256
+#define HUFFMAN_MAX_LENGTH	30
+
+/* For each code length, the first code of that length, how many codes
+ * have it, and where their symbols start in @huffman_symbols. */
+static unsigned int huffman_first[HUFFMAN_MAX_LENGTH + 1];
+static unsigned int huffman_count[HUFFMAN_MAX_LENGTH + 1];
+static unsigned int huffman_offset[HUFFMAN_MAX_LENGTH + 1];
+static unsigned short huffman_symbols[257];
+static int huffman_ready;
+
+static void
+init_huffman_decoder(void)
+{
+	unsigned int code = 0, offset = 0;
+	int len, symbol;
+
+	for (symbol = 0; symbol <= HUFFMAN_EOS; symbol++)
+		huffman_count[huffman_lengths[symbol]]++;
+
+	for (len = 1; len <= HUFFMAN_MAX_LENGTH; len++) {
+		huffman_first[len] = code;
+		huffman_offset[len] = offset;
+		code = (code + huffman_count[len]) << 1;
+		offset += huffman_count[len];
+	}
+
+	/* Sorted by length and then by symbol, as the codes are. */
+	for (len = 1; len <= HUFFMAN_MAX_LENGTH; len++)
+		for (symbol = 0; symbol <= HUFFMAN_EOS; symbol++)
+			if (huffman_lengths[symbol] == len)
+				huffman_symbols[huffman_offset[len]++] = symbol;
+
+	for (len = 1; len <= HUFFMAN_MAX_LENGTH; len++)
+		huffman_offset[len] -= huffman_count[len];
+
+	huffman_ready = 1;
+}
+
+/* Returns the length of the decoded string in @out, which must have room
+ * for 8 / 5 * @length bytes, or -1 if the string is malformed. */
+static int
+decode_huffman(const unsigned char *data, int length, char *out)
+{
+	unsigned int code = 0;
+	int len = 0, outlen = 0, i, bit;
+
+	if (!huffman_ready) init_huffman_decoder();
+
+	for (i = 0; i < length; i++) {
+		for (bit = 7; bit >= 0; bit--) {
+			code = (code << 1) | ((data[i] >> bit) & 1);
+			len++;
+
+			if (code - huffman_first[len] < huffman_count[len]) {
+				int symbol = huffman_symbols[huffman_offset[len]
+							     + code - huffman_first[len]];
+
+				if (symbol == HUFFMAN_EOS) return -1;
+				out[outlen++] = symbol;
+				code = 0;
+				len = 0;
+
+			} else if (len == HUFFMAN_MAX_LENGTH) {
+				return -1;
+			}
+		}
+	}
+
+	/* The padding must be shorter than a byte and the start of EOS,
+	 * that is all ones. */
+	if (len > 7 || code != (1U << len) - 1)
+		return -1;
+
+	return outlen;
+}
+
+
+void
+init_hpack_table(struct hpack_table *table, int limit)
+{
+	memset(table, 0, sizeof(*table));
+	table->max_size = limit;
+	table->limit = limit;
+}
+
+void
+done_hpack_table(struct hpack_table *table)
+{
+	int i;
+
+	for (i = 0; i < table->count; i++)
+		mem_free(table->entries[i].name);
+	mem_free_if(table->entries);
+	init_hpack_table(table, table->limit);
+}
+
+static void
+evict_hpack_entries(struct hpack_table *table, int size)
+{
+	while (table->count && table->size + size > table->max_size) {
+		struct hpack_entry *entry = &table->entries[--table->count];
+
+		table->size -= entry->namelen + entry->valuelen
+			       + HPACK_ENTRY_OVERHEAD;
+		mem_free(entry->name);
+	}
+}
+
+static int
+add_hpack_entry(struct hpack_table *table, char *name, int namelen,
+		char *value, int valuelen)
+{
+	int size = namelen + valuelen + HPACK_ENTRY_OVERHEAD;
+	struct hpack_entry *entry;
+	char *data;
+
+	/* Copy first, @name may point into an entry about to be evicted. */
+	data = (char *)mem_alloc(namelen + valuelen + 1);
+	if (!data) return 0;
+
+	memcpy(data, name, namelen);
+	memcpy(data + namelen, value, valuelen);
+
+	evict_hpack_entries(table, size);
+
+	/* An entry larger than the table just empties it. */
+	if (size > table->max_size) {
+		mem_free(data);
+		return 1;
+	}
+
+	if (!(table->count % 16)) {
+		entry = (struct hpack_entry *)mem_realloc(table->entries,
+				(table->count + 16) * sizeof(*entry));
+		if (!entry) {
+			mem_free(data);
+			return 0;
+		}
+		table->entries = entry;
+	}
+
+	memmove(table->entries + 1, table->entries,
+		table->count * sizeof(*entry));
+	entry = &table->entries[0];
+	entry->name = data;
+	entry->namelen = namelen;
+	entry->value = data + namelen;
+	entry->valuelen = valuelen;
+
+	table->count++;
+	table->size += size;
+
+	return 1;
+}
+
+/* Looks up the entry with the 1-based @index in the static table and then
+ * in the dynamic one. */
+static int
+get_hpack_entry(struct hpack_table *table, unsigned int index,
+		char **name, int *namelen, char **value, int *valuelen)
+{
+	if (index < 1) return 0;
+
+	if (index <= HPACK_STATIC_TABLE_SIZE) {
+		*name = (char *) hpack_static_table[index - 1].name;
+		*namelen = strlen(*name);
+		*value = (char *) hpack_static_table[index - 1].value;
+		*valuelen = strlen(*value);
+		return 1;
+	}
+
+	index -= HPACK_STATIC_TABLE_SIZE + 1;
+	if (index >= (unsigned int) table->count) return 0;
+
+	*name = table->entries[index].name;
+	*namelen = table->entries[index].namelen;
+	*value = table->entries[index].value;
+	*valuelen = table->entries[index].valuelen;
+	return 1;
+}
+
+/* RFC 7541, section 5.1. */
+static int
+decode_hpack_integer(const unsigned char **pos, const unsigned char *end,
+		     int prefix, unsigned int *value)
+{
+	unsigned int max = (1U << prefix) - 1;
+	int shift = 0;
+
+	if (*pos >= end) return 0;
+
+	*value = *(*pos)++ & max;
+	if (*value < max) return 1;
+
+	while (*pos < end) {
+		unsigned char byte = *(*pos)++;
+
+		/* Nothing in a header block needs more than 28 bits. */
+		if (shift > 21) return 0;
+
+		*value += (byte & 0x7f) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80)) return 1;
+	}
+
+	return 0;
+}
+
+/* RFC 7541, section 5.2. The string is decoded into @buffer if it is Huffman
+ * encoded, else it is returned right from the block. */
+static int
+decode_hpack_string(const unsigned char **pos, const unsigned char *end,
+		    struct string *buffer, char **string, int *length)
+{
+	unsigned int len;
+	int huffman;
+
+	if (*pos >= end) return 0;
+
+	huffman = **pos & 0x80;
+	if (!decode_hpack_integer(pos, end, 7, &len)
+	    || len > (unsigned int) (end - *pos))
+		return 0;
+
+	if (!huffman) {
+		*string = (char *) *pos;
+		*length = len;
+
+	} else {
+		if (!realloc_string(buffer, len * 8 / 5 + 1))
+			return 0;
+
+		*length = decode_huffman(*pos, len, buffer->source);
+		if (*length < 0) return 0;
+		*string = buffer->source;
+	}
+
+	*pos += len;
+	return 1;
+}
+
+int
+decode_hpack_block(struct hpack_table *table,
+		   const unsigned char *block, int length,
+		   hpack_header_T header, void *data)
+{
+	const unsigned char *pos = block;
+	const unsigned char *end = block + length;
+	struct string namebuf, valuebuf;
+	int ok = 0;
+
+	if (!init_string(&namebuf)) return 0;
+	if (!init_string(&valuebuf)) {
+		done_string(&namebuf);
+		return 0;
+	}
+
+	while (pos < end) {
+		unsigned char byte = *pos;
+		unsigned int index;
+		char *name, *value;
+		int namelen, valuelen;
+
+		if (byte & 0x80) {
+			/* Indexed header field */
+			if (!decode_hpack_integer(&pos, end, 7, &index)
+			    || !get_hpack_entry(table, index, &name, &namelen,
+						&value, &valuelen))
+				goto out;
+
+			header(data, name, namelen, value, valuelen);
+			continue;
+		}
+
+		if ((byte & 0xe0) == 0x20) {
+			/* Dynamic table size update */
+			if (!decode_hpack_integer(&pos, end, 5, &index)
+			    || index > (unsigned int) table->limit)
+				goto out;
+
+			table->max_size = index;
+			evict_hpack_entries(table, 0);
+			continue;
+		}
+
+		/* Literal header field, with incremental indexing if the
+		 * 0x40 bit is set, else without indexing or never indexed. */
+		if (!decode_hpack_integer(&pos, end, (byte & 0x40) ? 6 : 4, &index))
+			goto out;
+
+		if (index) {
+			if (!get_hpack_entry(table, index, &name, &namelen,
+					     &value, &valuelen))
+				goto out;
+		} else if (!decode_hpack_string(&pos, end, &namebuf,
+						&name, &namelen)) {
+			goto out;
+		}
+
+		if (!decode_hpack_string(&pos, end, &valuebuf, &value, &valuelen))
+			goto out;
+
+		header(data, name, namelen, value, valuelen);
+
+		if ((byte & 0x40)
+		    && !add_hpack_entry(table, name, namelen, value, valuelen))
+			goto out;
+	}
+
+	ok = 1;
+
+out:
+	done_string(&namebuf);
+	done_string(&valuebuf);
+	return ok;
+}
+
+
+static void
+encode_hpack_integer(struct string *block, unsigned int value, int prefix,
+		     unsigned char flags)
+{
+	/* Not add_char_to_string(), the bytes may be zero. */
+	unsigned char bytes[8];
+	unsigned int max = (1U << prefix) - 1;
+	int length = 0;
+
+	if (value < max) {
+		bytes[length++] = flags | value;
+	} else {
+		bytes[length++] = flags | max;
+		value -= max;
+
+		while (value >= 0x80) {
+			bytes[length++] = (value & 0x7f) | 0x80;
+			value >>= 7;
+		}
+		bytes[length++] = value;
+	}
+
+	add_bytes_to_string(block, (char *) bytes, length);
+}
+
+static void
+encode_hpack_string(struct string *block, const char *string, int length)
+{
+	encode_hpack_integer(block, length, 7, 0);
+	add_bytes_to_string(block, string, length);
+}
+
+void
+encode_hpack_header(struct string *block,
+		    const char *name, int namelen,
+		    const char *value, int valuelen)
+{
+	/* Credentials should not end up in the tables of proxies either. */
+	unsigned char flags = ((namelen == 13 && !memcmp(name, "authorization", 13))
+			       || (namelen == 6 && !memcmp(name, "cookie", 6)))
+			      ? 0x10 : 0x00;
+	int name_index = 0;
+	int i;
+
+	for (i = 0; i < HPACK_STATIC_TABLE_SIZE; i++) {
+		const char *static_name = hpack_static_table[i].name;
+		const char *static_value = hpack_static_table[i].value;
+
+		if (strlen(static_name) != namelen
+		    || memcmp(static_name, name, namelen))
+			continue;
+
+		if (strlen(static_value) == valuelen
+		    && !memcmp(static_value, value, valuelen)) {
+			encode_hpack_integer(block, i + 1, 7, 0x80);
+			return;
+		}
+
+		if (!name_index) name_index = i + 1;
+	}
+
+	encode_hpack_integer(block, name_index, 4, flags);
+	if (!name_index) encode_hpack_string(block, name, namelen);
+	encode_hpack_string(block, value, valuelen);
+}
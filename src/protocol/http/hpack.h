@@ -0,0 +1,65 @@
+/** HPACK header compression for HTTP/2 (RFC 7541).
+ * @file */
+
+#ifndef EL__PROTOCOL_HTTP_HPACK_H
+#define EL__PROTOCOL_HTTP_HPACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct string;
+
+/** The default and the largest dynamic table size ELinks accepts,
+ * announced in the SETTINGS_HEADER_TABLE_SIZE setting.  */
+#define HPACK_TABLE_SIZE 4096
+
+struct hpack_entry {
+	char *name;
+	char *value;
+	int namelen;
+	int valuelen;
+};
+
+/** The dynamic table of a decoder.  The newest entry is the first one.  */
+struct hpack_table {
+	struct hpack_entry *entries;
+	int count;
+
+	/** The sum of the entry sizes as defined by RFC 7541.  */
+	int size;
+
+	/** The size the peer chose with a dynamic table size update.  */
+	int max_size;
+
+	/** The limit of @a max_size, from our SETTINGS_HEADER_TABLE_SIZE.  */
+	int limit;
+};
+
+/** Called for each decoded header field.  The name and the value are
+ * not NUL terminated.  */
+typedef void (*hpack_header_T)(void *data, char *name, int namelen,
+			       char *value, int valuelen);
+
+void init_hpack_table(struct hpack_table *table, int limit);
+void done_hpack_table(struct hpack_table *table);
+
+/** Decodes the header block @a block of @a length bytes, calling
+ * @a header for each field.  Returns zero if the block is malformed, the
+ * table cannot be used for the next blocks then.  */
+int decode_hpack_block(struct hpack_table *table,
+		       const unsigned char *block, int length,
+		       hpack_header_T header, void *data);
+
+/** Adds one header field to the header block in @a block.  The field is
+ * never added to the dynamic table of the peer, so the encoder needs no
+ * table of its own.  */
+void encode_hpack_header(struct string *block,
+			 const char *name, int namelen,
+			 const char *value, int valuelen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,9 @@
 #include <sys/socket.h> /* OS/2 needs this after sys/types.h */
 #endif
 #include <limits.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "elinks.h"
 
@@ -35,6 +38,7 @@
 #include "protocol/http/blacklist.h"
 #include "protocol/http/codes.h"
 #include "protocol/http/http.h"
+#include "protocol/http/http2.h"
 #include "protocol/uri.h"
 #include "session/session.h"
 #include "terminal/terminal.h"
@@ -65,6 +69,10 @@
 #define CHUNK_ZERO_SIZE	-2
 #define CHUNK_SIZE	-1
 
+/* How much of the body written straight to the file of a download is
+ * gathered in the read buffer first, when it cannot be spliced there. */
+#define DIRECT_WRITE_SIZE 65536
+
 static struct auth_entry proxy_auth;
 
 static char *accept_charset = NULL;
@@ -188,6 +196,34 @@ static union option_info http_options[] = {
 		"this option has no effect. To check the supported features, "
 		"see Help -> About.")),
 
+	INIT_OPT_INT("protocol.http", N_("Pipelined requests"),
+		"pipelining", OPT_ZERO, 0, 16, 0,
+		N_("How many more requests for the same server may be sent "
+		"on a keep-alive connection before the response to the first "
+		"one arrives. This saves a round trip for each of the small "
+		"objects of a page. Only plain GET requests sent directly to "
+		"the server are pipelined.\n"
+		"\n"
+		"Servers which break the responses to pipelined requests are "
+		"remembered and the requests are sent again one by one.\n"
+		"\n"
+		"Zero disables pipelining.")),
+
+	INIT_OPT_INT("protocol.http", N_("HTTP/2"),
+		"http2", OPT_ZERO, 0, 2, 0,
+		N_("Whether to use HTTP/2, which sends all the requests to "
+		"a server as streams of one connection and so needs no "
+		"pipelining nor many connections to the server. Only plain "
+		"GET requests sent directly to the server use it, others "
+		"are sent with HTTP/1.1.\n"
+		"\n"
+		"0 is never\n"
+		"1 is for HTTPS servers which choose it during the TLS "
+		"handshake\n"
+		"2 is also for HTTP servers, which are expected to speak it "
+		"right away. Those which do not are remembered and get "
+		"HTTP/1.1 requests since.")),
+
 	INIT_OPT_BOOL("protocol.http", N_("Activate HTTP TRACE debugging"),
 		"trace", OPT_ZERO, 0,
 		N_("If active, all HTTP requests are sent with TRACE as "
@@ -254,6 +290,7 @@ done_http(struct module *mod)
 	mem_free_if(proxy_auth.nonce);
 	mem_free_if(proxy_auth.opaque);
 
+	done_http2_sessions();
 	free_blacklist();
 
 	if (accept_charset)
@@ -485,6 +522,26 @@ check_http_server_bugs(struct uri *uri, struct http_connection_info *http,
 	return (*s != NULL);
 }
 
+static void
+read_pipelined_http_response(struct connection *conn)
+{
+	struct socket *socket = conn->socket;
+	struct read_buffer *rb = socket->read_buffer;
+
+	socket->state = SOCKET_END_ONCLOSE;
+
+	/* The response may have arrived with the previous one already. */
+	if (rb && rb->length > 0) {
+		http_got_header(socket, rb);
+		return;
+	}
+
+	if (!rb) rb = alloc_read_buffer(socket);
+	if (rb)
+		read_from_socket(socket, rb, connection_state(S_SENT),
+				 http_got_header);
+}
+
 static void
 http_end_request(struct connection *conn, struct connection_state state,
 		 int notrunc)
@@ -500,29 +557,46 @@ http_end_request(struct connection *conn, struct connection_state state,
 		done_http_post(&http->post);
 
 	if (http && !http->close
+	    && conn->socket->fd != -1 /* The pipelined request was not sent */
 	    && (!conn->socket->ssl) /* We won't keep alive ssl connections */
 	    && (!get_opt_bool("protocol.http.bugs.post_no_keepalive", NULL)
 		|| !conn->uri->post)) {
 		if (is_in_state(state, S_OK) && conn->cached)
 			normalize_cache_entry(conn->cached, !notrunc ? conn->from : -1);
 		set_connection_state(conn, state);
-		add_keepalive_connection(conn, HTTP_KEEPALIVE_TIMEOUT, NULL);
+		if (conn->pipelined)
+			read_pipelined_http_response(continue_pipelined_connection(conn));
+		else
+			add_keepalive_connection(conn, HTTP_KEEPALIVE_TIMEOUT, NULL);
 	} else {
+		/* The requests pipelined after ours are sent again. */
+		if (http && conn->pipelined && PRE_HTTP_1_1(http->recv_version))
+			add_blacklist_entry(conn->proxied_uri,
+					    SERVER_BLACKLIST_NO_PIPELINE);
 		abort_connection(conn, state);
 	}
 }
 
 static void http_send_header(struct socket *);
 
+static void send_http2_header(struct connection *conn,
+			      struct http2_session *session);
+
 void
 http_protocol_handler(struct connection *conn)
 {
+	struct http2_session *session = get_http2_session(conn);
+
 	/* setcstate(conn, S_CONN); */
 
-	if (!has_keepalive_connection(conn)) {
+	if (session) {
+		send_http2_header(conn, session);
+	} else if (!has_keepalive_connection(conn)) {
+		conn->socket->http2 = is_http2_allowed(conn);
 		make_connection(conn->socket, conn->uri, http_send_header,
 				conn->cache_mode >= CACHE_MODE_FORCE_RELOAD);
 	} else {
+		conn->socket->http2 = 0;
 		http_send_header(conn->socket);
 	}
 }
@@ -545,6 +619,8 @@ done_http_connection(struct connection *conn)
 {
 	struct http_connection_info *http = (struct http_connection_info *)conn->info;
 
+	if (http->stream)
+		done_http2_stream(conn, http->stream);
 	done_http_post(&http->post);
 	mem_free(http);
 	conn->info = NULL;
@@ -663,10 +739,13 @@ send_more_post_data(struct socket *socket)
 
 
 
-static void
-http_send_header(struct socket *socket)
+/* Builds the request of @conn in @request. If the request has a body, its
+ * start is returned in @post_data_ptr. Returns zero if the request could not be
+ * built, @conn has been ended then. */
+static int
+get_http_request(struct connection *conn, struct string *request,
+		 char **post_data_ptr)
 {
-	struct connection *conn = (struct connection *)socket->conn;
 	struct http_connection_info *http;
 	int trace = get_opt_bool("protocol.http.trace", NULL);
 	struct string header;
@@ -679,15 +758,15 @@ http_send_header(struct socket *socket)
 	/* Sanity check for a host */
 	if (!uri || !uri->host || !*uri->host || !uri->hostlen) {
 		http_end_request(conn, connection_state(S_BAD_URL), 0);
-		return;
+		return 0;
 	}
 
 	http = init_http_connection_info(conn, 1, 1, 0);
-	if (!http) return;
+	if (!http) return 0;
 
 	if (!init_string(&header)) {
 		http_end_request(conn, connection_state(S_OUT_OF_MEM), 0);
-		return;
+		return 0;
 	}
 
 	if (!conn->cached) conn->cached = find_in_cache(uri);
@@ -1027,7 +1106,7 @@ http_send_header(struct socket *socket)
 		if (!open_http_post(&http->post, post_data, &error)) {
 			http_end_request(conn, error, 0);
 			done_string(&header);
-			return;
+			return 0;
 		}
 		add_format_to_string(&header, "Content-Length: "
 				     "%" OFF_PRINT_FORMAT "\x0D\x0A",
@@ -1051,11 +1130,86 @@ http_send_header(struct socket *socket)
 
 	add_crlf_to_string(&header);
 
+	*request = header;
+	*post_data_ptr = post_data;
+	return 1;
+}
+
+/* Only plain GET requests can be sent again safely if the server breaks the
+ * responses to pipelined requests. */
+static int
+is_http_request_pipelinable(struct connection *conn)
+{
+	return conn->uri->protocol == PROTOCOL_HTTP && !conn->uri->post;
+}
+
+/* Adds the requests of the waiting connections for the same server to
+ * @header, so that they are sent together with the request of @conn. */
+static void
+add_pipelined_http_requests(struct connection *conn, struct string *header)
+{
+	struct http_connection_info *http = (struct http_connection_info *)conn->info;
+	int count = get_opt_int("protocol.http.pipelining", NULL);
+
+	if (count <= 0
+	    || !HTTP_1_1(http->sent_version)
+	    || (http->bl_flags & SERVER_BLACKLIST_NO_PIPELINE)
+	    || !is_http_request_pipelinable(conn)
+	    || get_opt_bool("protocol.http.trace", NULL))
+		return;
+
+	while (count-- > 0) {
+		struct connection *next = pipeline_connection(conn,
+							      is_http_request_pipelinable);
+		struct string request;
+		char *post_data = NULL;
+
+		if (!next) break;
+		if (!get_http_request(next, &request, &post_data)) continue;
+
+		((struct http_connection_info *) next->info)->pipelined = 1;
+		add_string_to_string(header, &request);
+		done_string(&request);
+	}
+}
+
+static void
+send_http2_header(struct connection *conn, struct http2_session *session)
+{
+	struct string header;
+	char *post_data = NULL;
+
+	if (!get_http_request(conn, &header, &post_data)) return;
+
+	add_http2_stream(session, conn, &header);
+	done_string(&header);
+}
+
+static void
+http_send_header(struct socket *socket)
+{
+	struct connection *conn = (struct connection *)socket->conn;
+	struct http_connection_info *http;
+	struct http2_session *session = start_http2_session(conn);
+	struct string header;
+	char *post_data = NULL;
+
+	/* The session has given @conn a socket of its own. */
+	if (session) {
+		send_http2_header(conn, session);
+		return;
+	}
+
+	if (!get_http_request(conn, &header, &post_data)) return;
+
+	http = (struct http_connection_info *)conn->info;
+
 	/* CONNECT: Any POST data is for the origin server only.
-	 * This was already checked above and post_data is NULL
-	 * in that case.  Verified with an assertion below.  */
+	 * get_http_request() already checked this and post_data is
+	 * NULL in that case.  Verified with an assertion below.  */
 	if (post_data) {
-		assert(!use_connect); /* see comment above */
+		/* see comment above */
+		assert(!connection_is_https_proxy(conn) || conn->socket->ssl);
 
 		socket->state = SOCKET_END_ONCLOSE;
 		if (!conn->http_upload_progress && http->post.file_count)
@@ -1063,28 +1217,77 @@ http_send_header(struct socket *socket)
 		write_to_socket(socket, header.source, header.length,
 				connection_state(S_TRANS),
 				send_more_post_data);
-	} else
+	} else {
+		add_pipelined_http_requests(conn, &header);
 		request_from_socket(socket, header.source, header.length,
 				    connection_state(S_SENT),
 				    SOCKET_END_ONCLOSE, http_got_header);
+	}
 	done_string(&header);
 }
 
 #undef POST_BUFFER_SIZE
 
 
+/* Decoded data goes straight to the end of the cache entry. */
+struct cache_sink {
+	struct decoded_sink sink;
+	struct connection *conn;
+	int length;
+};
+
 static char *
-decompress_data(struct connection *conn, char *data, int len,
-		int *new_len)
+get_cache_sink_room(struct decoded_sink *sink, int *size)
 {
-	*new_len = 0; /* new_len must be zero if we would ever return NULL */
+	struct cache_sink *cache_sink = (struct cache_sink *) sink;
+	struct connection *conn = cache_sink->conn;
+	ssize_t length = *size;
+	char *room;
+
+	room = get_fragment_tail(conn->cached, conn->from + cache_sink->length,
+				 &length);
+	*size = MIN(length, INT_MAX);
+
+	return room;
+}
+
+static int
+append_to_cache_sink(struct decoded_sink *sink, const char *data, int len)
+{
+	struct cache_sink *cache_sink = (struct cache_sink *) sink;
+	struct connection *conn = cache_sink->conn;
+	off_t offset = conn->from + cache_sink->length;
+	int ret = data ? add_fragment(conn->cached, offset, data, len)
+		       : commit_fragment_tail(conn->cached, offset, len);
+
+	if (ret < 0) return 0;
+	if (ret == 1) conn->tries = 0;
+
+	cache_sink->length += len;
+	return 1;
+}
+
+/* Decodes @len bytes of @data into the cache entry at conn->from. Returns
+ * the number of decoded bytes added, which is what there was before any
+ * error. */
+static int
+decompress_data(struct connection *conn, char *data, int len)
+{
+	struct cache_sink cache_sink;
 
 	if (!conn->stream) {
 		conn->stream = open_encoded(-1, conn->content_encoding);
-		if (!conn->stream) return NULL;
+		if (!conn->stream) return 0;
 	}
 
-	return decode_encoded_buffer(conn->stream, conn->content_encoding, data, len, new_len);
+	cache_sink.sink.room = get_cache_sink_room;
+	cache_sink.sink.append = append_to_cache_sink;
+	cache_sink.conn = conn;
+	cache_sink.length = 0;
+
+	decode_encoded_stream(conn->stream, data, len, &cache_sink.sink);
+
+	return cache_sink.length;
 }
 
 static int
@@ -1118,6 +1321,18 @@ read_more_http_data(struct connection *conn, struct read_buffer *rb,
 {
 	struct connection_state state = already_got_anything
 		? connection_state(S_TRANS) : conn->state;
+#ifdef HAVE_SPLICE
+	struct http_connection_info *http = (struct http_connection_info *)conn->info;
+
+	/* The rest of the body can go to the file of the download without
+	 * coming here. */
+	if (conn->direct_fd != -1 && !rb->length && http->length > 0
+	    && !conn->socket->ssl && !conn->socket->stream) {
+		splice_from_socket(conn->socket, rb, conn->direct_fd,
+				   http->length, state, read_http_data);
+		return;
+	}
+#endif
 
 	read_from_socket(conn->socket, rb, state, read_http_data);
 }
@@ -1223,12 +1438,7 @@ read_chunked_http_data(struct connection *conn, struct read_buffer *rb)
 				if (add_fragment(conn->cached, conn->from, rb->data, len) == 1)
 					conn->tries = 0;
 			} else {
-				char *data = decompress_data(conn, rb->data, len, &data_len);
-
-				if (add_fragment(conn->cached, conn->from, data, data_len) == 1)
-					conn->tries = 0;
-
-				mem_free_if(data);
+				data_len = decompress_data(conn, rb->data, len);
 				if (zero || !http->length) shutdown_connection_stream(conn);
 			}
 
@@ -1270,6 +1480,23 @@ read_chunked_http_data(struct connection *conn, struct read_buffer *rb)
 	return !!total_data_len;
 }
 
+/* Writes @len bytes of @data to @conn->direct_fd. If it cannot, the data is
+ * to go to the cache entry again, for the download to try and tell why. */
+static int
+write_direct_http_data(struct connection *conn, char *data, int len)
+{
+	ssize_t w = safe_write(conn->direct_fd, data, len);
+
+	if (w == len) return 1;
+
+	if (w > 0) lseek(conn->direct_fd, conn->from, SEEK_SET);
+	conn->direct_fd = -1;
+
+	/* The download writes the cache entry from where the file ends. */
+	conn->progress->seek = conn->from;
+	return 0;
+}
+
 /* Returns 0 if more data, 1 if done. */
 static int
 read_normal_http_data(struct connection *conn, struct read_buffer *rb)
@@ -1277,40 +1504,53 @@ read_normal_http_data(struct connection *conn, struct read_buffer *rb)
 	struct http_connection_info *http = (struct http_connection_info *)conn->info;
 	int data_len;
 	int len = rb->length;
+	int spliced = 0;
+	int direct = 0;
+
+#ifdef HAVE_SPLICE
+	/* splice_from_socket() took only what was to come. */
+	spliced = rb->spliced;
+	rb->spliced = 0;
+	if (spliced) len = spliced;
+#endif
 
 	if (http->length >= 0 && http->length < len) {
 		/* We won't read more than we have to go. */
 		len = http->length;
 	}
 
+	/* The body for the file is written in big blocks. If the server
+	 * closes the connection before sending the rest, what waits here
+	 * is lost but the download is cut short anyway. */
+	if (conn->direct_fd != -1 && !spliced
+	    && len < DIRECT_WRITE_SIZE && len < http->length)
+		return 0;
+
 	conn->received += len;
 	if (http->length > 0) http->length -= len;
 
-	if (conn->content_encoding == ENCODING_NONE) {
+	if (spliced
+	    || (conn->direct_fd != -1
+		&& write_direct_http_data(conn, rb->data, len))) {
+		data_len = len;
+		direct = 1;
+		conn->tries = 0;
+	} else if (conn->content_encoding == ENCODING_NONE) {
 		data_len = len;
 		if (add_fragment(conn->cached, conn->from, rb->data, data_len) == 1)
 			conn->tries = 0;
 	} else {
-		char *data;
-finish:
-		data = decompress_data(conn, rb->data, len, &data_len);
-
-		if (!data && !http->length && len) {
-			kill_buffer_data(rb, len);
-			len = 0;
-			goto finish;
-		}
-
-		if (add_fragment(conn->cached, conn->from, data, data_len) == 1)
-			conn->tries = 0;
-
-		mem_free_if(data);
+		data_len = decompress_data(conn, rb->data, len);
 		if (!http->length) shutdown_connection_stream(conn);
 	}
 
 	conn->from += data_len;
 
-	kill_buffer_data(rb, len);
+	/* The download takes its position in the file from here, see
+	 * write_cache_entry_to_file(). */
+	if (direct) conn->progress->seek = conn->from;
+
+	if (!spliced) kill_buffer_data(rb, len);
 
 	if (!http->length && (conn->socket->state == SOCKET_RETRY_ONCLOSE
 		|| conn->socket->state == SOCKET_CLOSED)) {
@@ -1450,6 +1690,16 @@ check_http_authentication(struct connection *conn, struct uri *uri,
 	return ret;
 }
 
+/* The response to a pipelined request did not come or was garbled, send
+ * the requests to the server one by one from now on. */
+static void
+retry_unpipelined_http_request(struct connection *conn)
+{
+	add_blacklist_entry(conn->proxied_uri, SERVER_BLACKLIST_NO_PIPELINE);
+	/* It is not the fault of the request, do not count it. */
+	conn->tries = -1;
+	retry_connection(conn, connection_state(S_CANT_READ));
+}
 
 void
 http_got_header(struct socket *socket, struct read_buffer *rb)
@@ -1469,6 +1719,11 @@ http_got_header(struct socket *socket, struct read_buffer *rb)
 	int a, h = 200;
 	int cf;
 
+	if (socket->state == SOCKET_CLOSED && http->pipelined) {
+		retry_unpipelined_http_request(conn);
+		return;
+	}
+
 	if (socket->state == SOCKET_CLOSED) {
 		if (!conn->tries && uri->host) {
 			if (http->bl_flags & SERVER_BLACKLIST_NO_CHARSET) {
@@ -1485,6 +1740,10 @@ http_got_header(struct socket *socket, struct read_buffer *rb)
 
 again:
 	a = get_header(rb);
+	if ((a == -1 || a == -2) && http->pipelined) {
+		retry_unpipelined_http_request(conn);
+		return;
+	}
 	if (a == -1) {
 		abort_connection(conn, connection_state(S_HTTP_ERROR));
 		return;
@@ -1497,8 +1756,14 @@ again:
 	 * the get_http_code call; @h and @version have already been
 	 * initialized with the right values.  */
 	if (a == -2) a = 0;
-	if ((a && get_http_code(rb, &h, &version))
-	    || h == 101) {
+	if (a && get_http_code(rb, &h, &version)) {
+		if (http->pipelined)
+			retry_unpipelined_http_request(conn);
+		else
+			abort_connection(conn, connection_state(S_HTTP_ERROR));
+		return;
+	}
+	if (h == 101) {
 		abort_connection(conn, connection_state(S_HTTP_ERROR));
 		return;
 	}
@@ -1566,11 +1831,13 @@ again:
 	}
 	if (h == 304) {
 		mem_free(head);
+		kill_buffer_data(rb, a);
 		http_end_request(conn, connection_state(S_OK), 1);
 		return;
 	}
 	if (h == 204) {
 		mem_free(head);
+		kill_buffer_data(rb, a);
 		http_end_request(conn, connection_state(S_HTTP_204), 0);
 		return;
 	}
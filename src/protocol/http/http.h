@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 struct connection;
+struct http2_stream;
 struct read_buffer;
 struct socket;
 
@@ -32,6 +33,13 @@ struct http_connection_info {
 	int chunk_remaining;
 	int code;
 
+	/* The request was sent right after the one of another connection,
+	 * see add_pipelined_http_requests(). */
+	unsigned int pipelined:1;
+
+	/* The request was sent as a stream of an HTTP/2 session. */
+	struct http2_stream *stream;
+
 	struct http_post post;
 };
 
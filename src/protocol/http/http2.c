@@ -0,0 +1,1178 @@
+/* HTTP/2 sessions */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "main/timer.h"
+#include "network/connection.h"
+#include "network/socket.h"
+#ifdef CONFIG_SSL
+#include "network/ssl/ssl.h"
+#endif
+#include "osdep/ascii.h"
+#include "protocol/http/blacklist.h"
+#include "protocol/http/hpack.h"
+#include "protocol/http/http.h"
+#include "protocol/http/http2.h"
+#include "protocol/protocol.h"
+#include "protocol/uri.h"
+#include "util/conv.h"
+#include "util/error.h"
+#include "util/lists.h"
+#include "util/math.h"
+#include "util/memory.h"
+#include "util/string.h"
+
+
+/* An HTTP/2 session multiplexes the requests of many connections to the same
+ * server over one socket. Each of those connections keeps its own struct
+ * socket, marked as socket.stream, and the session feeds the response to it
+ * translated to HTTP/1.1 so that all of the response handling of http.c is
+ * shared. Only GET requests are sent this way, there is no request body to
+ * send and no flow control of our own sending to do. */
+
+enum http2_frame_type {
+	HTTP2_DATA		= 0x0,
+	HTTP2_HEADERS		= 0x1,
+	HTTP2_PRIORITY		= 0x2,
+	HTTP2_RST_STREAM	= 0x3,
+	HTTP2_SETTINGS		= 0x4,
+	HTTP2_PUSH_PROMISE	= 0x5,
+	HTTP2_PING		= 0x6,
+	HTTP2_GOAWAY		= 0x7,
+	HTTP2_WINDOW_UPDATE	= 0x8,
+	HTTP2_CONTINUATION	= 0x9,
+};
+
+#define HTTP2_FLAG_END_STREAM	0x01
+#define HTTP2_FLAG_ACK		0x01
+#define HTTP2_FLAG_END_HEADERS	0x04
+#define HTTP2_FLAG_PADDED	0x08
+#define HTTP2_FLAG_PRIORITY	0x20
+
+#define HTTP2_SETTINGS_ENABLE_PUSH		0x2
+#define HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS	0x3
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE	0x4
+#define HTTP2_SETTINGS_MAX_FRAME_SIZE		0x5
+
+#define HTTP2_NO_ERROR		0x0
+#define HTTP2_REFUSED_STREAM	0x7
+#define HTTP2_CANCEL		0x8
+
+#define HTTP2_PREFACE		"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_FRAME_HEADER_SIZE	9
+
+/* The largest frame either side may send unless the other one allows more
+ * with SETTINGS_MAX_FRAME_SIZE. We never do. */
+#define HTTP2_MAX_FRAME_SIZE	16384
+#define HTTP2_MAX_FRAME_SIZE_LIMIT ((1 << 24) - 1)
+
+/* The receive windows of the session and of each stream. The default of
+ * 65535 bytes would limit the transfer rate to 64 KiB per round trip. The
+ * windows are opened again when half of them has been used up. */
+#define HTTP2_DEFAULT_WINDOW_SIZE 65535
+#define HTTP2_WINDOW_SIZE	(1 << 24)
+
+/* Header blocks larger than this end the session. */
+#define HTTP2_MAX_HEADER_BLOCK	(256 * 1024)
+
+struct http2_stream {
+	LIST_HEAD(struct http2_stream);
+
+	struct http2_session *session;
+	struct connection *conn;
+	unsigned int id;
+
+	/* Bytes received since the window was last opened. */
+	int unacked;
+
+	unsigned int got_headers:1;
+	/* The server ended or reset the stream. */
+	unsigned int closed:1;
+};
+
+struct http2_session {
+	LIST_HEAD(struct http2_session);
+
+	/* The socket of the connection which started the session. */
+	struct socket *socket;
+	/* The protocol, host and port of the server. */
+	struct uri *uri;
+
+	LIST_OF(struct http2_stream) streams;
+	int stream_count;
+	unsigned int next_stream_id;
+
+	/* From the SETTINGS of the server. */
+	int max_streams;
+	int max_frame_size;
+
+	/* Bytes received since the window of the session was last opened. */
+	int unacked;
+
+	struct hpack_table table;
+
+	/* Frames waiting for the previous write to finish. */
+	struct string output;
+
+	/* A header block continued in CONTINUATION frames. */
+	struct string header_block;
+	unsigned int header_stream;
+	unsigned char header_flags;
+
+	/* Closes the session when it is idle or failed. */
+	timer_id_T timer;
+	struct connection_state error;
+
+	unsigned int writing:1;
+	unsigned int got_settings:1;
+	/* No new streams may be started. */
+	unsigned int goaway:1;
+	unsigned int failed:1;
+};
+
+static INIT_LIST_OF(struct http2_session, http2_sessions);
+
+
+static inline void
+put_http2_uint32(unsigned char *data, unsigned int value)
+{
+	data[0] = (value >> 24) & 0xff;
+	data[1] = (value >> 16) & 0xff;
+	data[2] = (value >> 8) & 0xff;
+	data[3] = value & 0xff;
+}
+
+static inline unsigned int
+get_http2_uint32(const unsigned char *data)
+{
+	return ((unsigned int) data[0] << 24) | (data[1] << 16)
+	       | (data[2] << 8) | data[3];
+}
+
+int
+get_http2_session_count(void)
+{
+	return list_size(&http2_sessions);
+}
+
+int
+is_http2_allowed(struct connection *conn)
+{
+	struct uri *uri = conn->uri;
+	int http2 = get_opt_int("protocol.http.http2", NULL);
+
+	switch (uri->protocol) {
+#ifdef CONFIG_SSL
+	case PROTOCOL_HTTPS:
+		if (http2 < 1) return 0;
+		break;
+#endif
+	case PROTOCOL_HTTP:
+		if (http2 < 2) return 0;
+		break;
+	default:
+		/* Requests to proxies keep using HTTP/1.1. */
+		return 0;
+	}
+
+	if (uri->post || !uri->host
+	    || get_opt_bool("protocol.http.trace", NULL))
+		return 0;
+
+	return !(get_blacklist_flags(uri)
+		 & (SERVER_BLACKLIST_HTTP10 | SERVER_BLACKLIST_NO_HTTP2));
+}
+
+struct http2_session *
+get_http2_session(struct connection *conn)
+{
+	struct http2_session *session;
+
+	if (list_empty(http2_sessions) || !is_http2_allowed(conn))
+		return NULL;
+
+	foreach (session, http2_sessions) {
+		if (session->goaway || session->failed
+		    || session->stream_count >= session->max_streams)
+			continue;
+
+		if (compare_uri(session->uri, conn->uri,
+				URI_PROTOCOL | URI_HOST | URI_PORT))
+			return session;
+	}
+
+	return NULL;
+}
+
+static struct http2_stream *
+find_http2_stream(struct http2_session *session, unsigned int id)
+{
+	struct http2_stream *stream;
+
+	foreach (stream, session->streams)
+		if (stream->id == id)
+			return stream;
+
+	return NULL;
+}
+
+
+/* Writing frames: */
+
+static void flush_http2_session(struct http2_session *session);
+
+static void
+http2_written(struct socket *socket)
+{
+	struct http2_session *session = (struct http2_session *)socket->conn;
+
+	session->writing = 0;
+	flush_http2_session(session);
+}
+
+/* Writes the queued frames. Only one write_to_socket() can be in progress,
+ * frames queued meanwhile are written when it has finished. */
+static void
+flush_http2_session(struct http2_session *session)
+{
+	if (session->writing || session->failed || !session->output.length)
+		return;
+
+	session->writing = 1;
+	write_to_socket(session->socket, session->output.source,
+			session->output.length, connection_state(S_TRANS),
+			http2_written);
+
+	/* write_to_socket() copied the data. */
+	session->output.length = 0;
+	session->output.source[0] = '\0';
+}
+
+static void
+add_http2_frame_header(struct http2_session *session, int length,
+		       enum http2_frame_type type, unsigned char flags,
+		       unsigned int stream_id)
+{
+	unsigned char header[HTTP2_FRAME_HEADER_SIZE];
+
+	header[0] = (length >> 16) & 0xff;
+	header[1] = (length >> 8) & 0xff;
+	header[2] = length & 0xff;
+	header[3] = type;
+	header[4] = flags;
+	put_http2_uint32(header + 5, stream_id & 0x7fffffff);
+
+	add_bytes_to_string(&session->output, (char *) header, sizeof(header));
+}
+
+static void
+add_http2_frame(struct http2_session *session, enum http2_frame_type type,
+		unsigned char flags, unsigned int stream_id,
+		const unsigned char *payload, int length)
+{
+	add_http2_frame_header(session, length, type, flags, stream_id);
+	if (length)
+		add_bytes_to_string(&session->output, (const char *) payload,
+				    length);
+}
+
+static void
+add_http2_uint32_frame(struct http2_session *session,
+		       enum http2_frame_type type, unsigned int stream_id,
+		       unsigned int value)
+{
+	unsigned char payload[4];
+
+	put_http2_uint32(payload, value);
+	add_http2_frame(session, type, 0, stream_id, payload, sizeof(payload));
+}
+
+static void
+add_http2_settings(struct http2_session *session)
+{
+	static const struct {
+		unsigned short id;
+		unsigned int value;
+	} settings[] = {
+		{ HTTP2_SETTINGS_ENABLE_PUSH,		0 },
+		{ HTTP2_SETTINGS_INITIAL_WINDOW_SIZE,	HTTP2_WINDOW_SIZE },
+	};
+	unsigned char payload[sizeof(settings) / sizeof(*settings) * 6];
+	int i;
+
+	for (i = 0; i < (int) (sizeof(settings) / sizeof(*settings)); i++) {
+		payload[i * 6] = settings[i].id >> 8;
+		payload[i * 6 + 1] = settings[i].id & 0xff;
+		put_http2_uint32(payload + i * 6 + 2, settings[i].value);
+	}
+
+	add_http2_frame(session, HTTP2_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+
+/* Ending sessions and streams: */
+
+static void
+detach_http2_stream(struct http2_stream *stream)
+{
+	struct connection *conn = stream->conn;
+	struct http_connection_info *http = (struct http_connection_info *)conn->info;
+
+	if (http) http->stream = NULL;
+	conn->socket->stream = 0;
+
+	del_from_list(stream);
+	stream->session->stream_count--;
+	mem_free(stream);
+}
+
+static void
+free_http2_session(struct http2_session *session)
+{
+	while (!list_empty(session->streams))
+		detach_http2_stream(session->streams.next);
+
+	del_from_list(session);
+	kill_timer(&session->timer);
+
+	done_socket(session->socket);
+	mem_free(session->socket);
+
+	done_hpack_table(&session->table);
+	done_string(&session->output);
+	done_string(&session->header_block);
+	done_uri(session->uri);
+	mem_free(session);
+}
+
+/* Closes an idle or failed session. The connections of its streams are
+ * retried, with HTTP/1.1 if the server does not seem to speak HTTP/2. */
+static void
+end_http2_session(struct http2_session *session)
+{
+	int no_http2 = session->failed && !session->got_settings;
+
+	session->timer = TIMER_ID_UNDEF;
+
+	if (no_http2)
+		add_blacklist_entry(session->uri, SERVER_BLACKLIST_NO_HTTP2);
+
+	while (!list_empty(session->streams)) {
+		struct http2_stream *stream = session->streams.next;
+		struct connection *conn = stream->conn;
+
+		detach_http2_stream(stream);
+		/* It is not the fault of the request, do not count it. */
+		if (no_http2) conn->tries = -1;
+		retry_connection(conn, session->error);
+	}
+
+	free_http2_session(session);
+}
+
+/* The session is ended from a timer because the failure may be found deep
+ * in the callbacks of the session or of its streams. */
+static void
+abort_http2_session(struct http2_session *session,
+		    struct connection_state state)
+{
+	if (session->failed) return;
+
+	session->failed = 1;
+	session->error = state;
+
+	kill_timer(&session->timer);
+	install_timer(&session->timer, 1, (void (*)(void *)) end_http2_session,
+		      session);
+}
+
+static void
+retry_http2_socket(struct socket *socket, struct connection_state state)
+{
+	abort_http2_session((struct http2_session *)socket->conn, state);
+}
+
+static void
+set_http2_socket_state(struct socket *socket, struct connection_state state)
+{
+	/* The states and timeouts of the streams are those of their
+	 * connections. */
+}
+
+/* The streams share the socket, so only the limits of the host and of all
+ * traffic apply to it. */
+static int
+get_http2_socket_limits(struct socket *socket, struct rate_limit **limits)
+{
+	struct http2_session *session = (struct http2_session *)socket->conn;
+
+	return get_host_rate_limits(session->uri, limits);
+}
+
+static struct socket_operations http2_socket_operations = {
+	set_http2_socket_state,
+	set_http2_socket_state,
+	retry_http2_socket,
+	retry_http2_socket,
+	get_http2_socket_limits,
+};
+
+void
+done_http2_stream(struct connection *conn, struct http2_stream *stream)
+{
+	struct http2_session *session = stream->session;
+
+	if (!stream->closed && !session->failed) {
+		add_http2_uint32_frame(session, HTTP2_RST_STREAM, stream->id,
+				       HTTP2_CANCEL);
+		flush_http2_session(session);
+	}
+
+#ifdef CONFIG_SSL
+	if (session->socket->ssl && conn->cached)
+		mem_free_set(&conn->cached->ssl_info,
+			     get_ssl_connection_cipher(session->socket));
+#endif
+
+	detach_http2_stream(stream);
+
+	/* The streams time out on their own, the socket of the session does
+	 * not. A timeout may mean the connection is dead, so no new streams
+	 * are started on it and it is closed after the others. */
+	if (is_in_state(conn->state, S_TIMEOUT))
+		session->goaway = 1;
+
+	if (!session->stream_count && !session->failed) {
+		kill_timer(&session->timer);
+		install_timer(&session->timer,
+			      session->goaway ? 1 : HTTP_KEEPALIVE_TIMEOUT,
+			      (void (*)(void *)) end_http2_session, session);
+	}
+}
+
+void
+done_http2_sessions(void)
+{
+	while (!list_empty(http2_sessions))
+		free_http2_session((struct http2_session *)http2_sessions.next);
+}
+
+
+/* Reading frames: */
+
+/* Emulates the server closing the connection at the end of the response,
+ * see read_select(). */
+static void
+end_http2_stream_input(struct http2_stream *stream)
+{
+	struct socket *socket = stream->conn->socket;
+
+	stream->closed = 1;
+
+	if (socket->state == SOCKET_RETRY_ONCLOSE) {
+		socket->ops->retry(socket, connection_state(S_CANT_READ));
+		return;
+	}
+
+	socket->state = SOCKET_CLOSED;
+	socket->read_buffer->done(socket, socket->read_buffer);
+}
+
+static int
+strip_http2_padding(unsigned char flags, unsigned char **payload, int *length)
+{
+	int padding;
+
+	if (!(flags & HTTP2_FLAG_PADDED)) return 1;
+	if (*length < 1) return 0;
+
+	padding = **payload;
+	(*payload)++;
+	(*length)--;
+
+	if (padding > *length) return 0;
+	*length -= padding;
+	return 1;
+}
+
+static void
+read_http2_data(struct http2_session *session, unsigned int id,
+		unsigned char flags, unsigned char *payload, int length)
+{
+	struct http2_stream *stream = find_http2_stream(session, id);
+	int frame_length = length;
+
+	if (!id || !strip_http2_padding(flags, &payload, &length)) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	/* Padding counts too. The data of streams we have cancelled was
+	 * still sent within the window of the session. */
+	session->unacked += frame_length;
+	if (session->unacked >= HTTP2_WINDOW_SIZE / 2) {
+		add_http2_uint32_frame(session, HTTP2_WINDOW_UPDATE, 0,
+				       session->unacked);
+		session->unacked = 0;
+	}
+
+	if (!stream || stream->closed) return;
+
+	if (!stream->got_headers) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	if (flags & HTTP2_FLAG_END_STREAM) {
+		stream->closed = 1;
+	} else {
+		stream->unacked += frame_length;
+		if (stream->unacked >= HTTP2_WINDOW_SIZE / 2) {
+			add_http2_uint32_frame(session, HTTP2_WINDOW_UPDATE, id,
+					       stream->unacked);
+			stream->unacked = 0;
+		}
+	}
+
+	if (length) {
+		feed_socket(stream->conn->socket, (char *) payload, length);
+		/* The connection may have ended. */
+		stream = find_http2_stream(session, id);
+	}
+
+	if (stream && (flags & HTTP2_FLAG_END_STREAM))
+		end_http2_stream_input(stream);
+}
+
+/* The response header being translated to HTTP/1.1. */
+struct http2_header {
+	struct string fields;
+	char status[4];
+};
+
+/* Fields which would not survive the translation are dropped. */
+static int
+is_http2_field_safe(const char *string, int length, int name)
+{
+	int i;
+
+	for (i = 0; i < length; i++) {
+		unsigned char c = string[i];
+
+		if (c == ASCII_CR || c == ASCII_LF || c == '\0'
+		    || (name && (c == ':' || c == ' ')))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+add_http2_header_field(void *data, char *name, int namelen,
+		       char *value, int valuelen)
+{
+	struct http2_header *header = (struct http2_header *)data;
+
+	if (namelen == 7 && !memcmp(name, ":status", 7)) {
+		if (valuelen == 3 && isdigit((unsigned char) value[0])
+		    && isdigit((unsigned char) value[1])
+		    && isdigit((unsigned char) value[2]))
+			memcpy(header->status, value, 3);
+		return;
+	}
+
+	if (!namelen || name[0] == ':'
+	    || !is_http2_field_safe(name, namelen, 1)
+	    || !is_http2_field_safe(value, valuelen, 0))
+		return;
+
+	add_bytes_to_string(&header->fields, name, namelen);
+	add_to_string(&header->fields, ": ");
+	add_bytes_to_string(&header->fields, value, valuelen);
+	add_crlf_to_string(&header->fields);
+}
+
+static void
+read_http2_header_block(struct http2_session *session, unsigned int id,
+			unsigned char flags, unsigned char *block, int length)
+{
+	struct http2_stream *stream;
+	struct http2_header header;
+	struct string head;
+
+	memset(&header, 0, sizeof(header));
+	if (!init_string(&header.fields)) {
+		abort_http2_session(session, connection_state(S_OUT_OF_MEM));
+		return;
+	}
+
+	/* The block must be decoded even if the stream is gone, it may
+	 * change the table. */
+	if (!decode_hpack_block(&session->table, block, length,
+				add_http2_header_field, &header)) {
+		done_string(&header.fields);
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	stream = find_http2_stream(session, id);
+	if (!stream || stream->closed) {
+		done_string(&header.fields);
+		return;
+	}
+
+	/* Trailers are ignored. */
+	if (stream->got_headers) {
+		done_string(&header.fields);
+		if (flags & HTTP2_FLAG_END_STREAM)
+			end_http2_stream_input(stream);
+		return;
+	}
+
+	if (!header.status[0]) {
+		done_string(&header.fields);
+		abort_connection(stream->conn, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	/* Interim responses are of no use to us. */
+	if (header.status[0] == '1') {
+		done_string(&header.fields);
+		return;
+	}
+
+	if (!init_string(&head)) {
+		done_string(&header.fields);
+		abort_connection(stream->conn, connection_state(S_OUT_OF_MEM));
+		return;
+	}
+
+	add_to_string(&head, "HTTP/2.0 ");
+	add_to_string(&head, header.status);
+	add_crlf_to_string(&head);
+	add_string_to_string(&head, &header.fields);
+	add_crlf_to_string(&head);
+	done_string(&header.fields);
+
+	stream->got_headers = 1;
+	if (flags & HTTP2_FLAG_END_STREAM)
+		stream->closed = 1;
+
+	feed_socket(stream->conn->socket, head.source, head.length);
+	done_string(&head);
+
+	if (flags & HTTP2_FLAG_END_STREAM) {
+		stream = find_http2_stream(session, id);
+		if (stream) end_http2_stream_input(stream);
+	}
+}
+
+static void
+read_http2_headers(struct http2_session *session, unsigned int id,
+		   unsigned char flags, unsigned char *payload, int length)
+{
+	if (!id || !strip_http2_padding(flags, &payload, &length)) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	if (flags & HTTP2_FLAG_PRIORITY) {
+		if (length < 5) {
+			abort_http2_session(session, connection_state(S_HTTP_ERROR));
+			return;
+		}
+		payload += 5;
+		length -= 5;
+	}
+
+	if (flags & HTTP2_FLAG_END_HEADERS) {
+		read_http2_header_block(session, id, flags, payload, length);
+		return;
+	}
+
+	session->header_stream = id;
+	session->header_flags = flags;
+	session->header_block.length = 0;
+	add_bytes_to_string(&session->header_block, (char *) payload, length);
+}
+
+static void
+read_http2_continuation(struct http2_session *session, unsigned int id,
+			unsigned char flags, unsigned char *payload, int length)
+{
+	struct string *block = &session->header_block;
+
+	if (!session->header_stream || id != session->header_stream
+	    || block->length + length > HTTP2_MAX_HEADER_BLOCK) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	add_bytes_to_string(block, (char *) payload, length);
+	if (!(flags & HTTP2_FLAG_END_HEADERS)) return;
+
+	session->header_stream = 0;
+	read_http2_header_block(session, id, session->header_flags,
+				(unsigned char *) block->source, block->length);
+}
+
+static void
+read_http2_rst_stream(struct http2_session *session, unsigned int id,
+		      unsigned char *payload, int length)
+{
+	struct http2_stream *stream;
+	struct connection *conn;
+	unsigned int error;
+
+	if (!id || length != 4) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	stream = find_http2_stream(session, id);
+	if (!stream || stream->closed) return;
+
+	error = get_http2_uint32(payload);
+	conn = stream->conn;
+	stream->closed = 1;
+
+	if (error == HTTP2_NO_ERROR && stream->got_headers) {
+		end_http2_stream_input(stream);
+
+	} else if (error == HTTP2_REFUSED_STREAM || !stream->got_headers) {
+		/* The server did not process the request. */
+		if (error == HTTP2_REFUSED_STREAM) conn->tries = -1;
+		retry_connection(conn, connection_state(S_CANT_READ));
+
+	} else {
+		abort_connection(conn, connection_state(S_HTTP_ERROR));
+	}
+}
+
+static void
+read_http2_settings(struct http2_session *session, unsigned int id,
+		    unsigned char flags, unsigned char *payload, int length)
+{
+	int i;
+
+	if (id || (flags & HTTP2_FLAG_ACK ? length : length % 6)) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	if (flags & HTTP2_FLAG_ACK) return;
+
+	for (i = 0; i < length; i += 6) {
+		int setting = (payload[i] << 8) | payload[i + 1];
+		unsigned int value = get_http2_uint32(payload + i + 2);
+
+		switch (setting) {
+		case HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS:
+			session->max_streams = value > INT_MAX ? INT_MAX : value;
+			break;
+
+		case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+			if (value < HTTP2_MAX_FRAME_SIZE
+			    || value > HTTP2_MAX_FRAME_SIZE_LIMIT) {
+				abort_http2_session(session,
+						    connection_state(S_HTTP_ERROR));
+				return;
+			}
+			session->max_frame_size = value;
+			break;
+		}
+	}
+
+	add_http2_frame(session, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0);
+
+	if (!session->got_settings) {
+		session->got_settings = 1;
+		del_blacklist_entry(session->uri, SERVER_BLACKLIST_NO_HTTP2);
+	}
+
+	/* The connections waiting for the host may run as streams now. */
+	register_check_queue();
+}
+
+static void
+read_http2_goaway(struct http2_session *session, unsigned int id,
+		  unsigned char *payload, int length)
+{
+	struct http2_stream *stream;
+	unsigned int last_id;
+
+	if (id || length < 8) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	last_id = get_http2_uint32(payload) & 0x7fffffff;
+	session->goaway = 1;
+
+	/* The streams after @last_id were not processed and can be sent
+	 * again. Retrying ends the stream so start over each time. */
+again:
+	foreach (stream, session->streams) {
+		if (stream->id > last_id) {
+			struct connection *conn = stream->conn;
+
+			stream->closed = 1;
+			conn->tries = -1;
+			retry_connection(conn, connection_state(S_RESTART));
+			goto again;
+		}
+	}
+
+	if (!session->stream_count && !session->failed) {
+		kill_timer(&session->timer);
+		install_timer(&session->timer, 1,
+			      (void (*)(void *)) end_http2_session, session);
+	}
+}
+
+static void
+read_http2_frame(struct http2_session *session, enum http2_frame_type type,
+		 unsigned char flags, unsigned int id,
+		 unsigned char *payload, int length)
+{
+	/* Nothing may come between the frames of a header block. */
+	if (session->header_stream && type != HTTP2_CONTINUATION) {
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	switch (type) {
+	case HTTP2_DATA:
+		read_http2_data(session, id, flags, payload, length);
+		break;
+
+	case HTTP2_HEADERS:
+		read_http2_headers(session, id, flags, payload, length);
+		break;
+
+	case HTTP2_CONTINUATION:
+		read_http2_continuation(session, id, flags, payload, length);
+		break;
+
+	case HTTP2_RST_STREAM:
+		read_http2_rst_stream(session, id, payload, length);
+		break;
+
+	case HTTP2_SETTINGS:
+		read_http2_settings(session, id, flags, payload, length);
+		break;
+
+	case HTTP2_PING:
+		if (id || length != 8) {
+			abort_http2_session(session, connection_state(S_HTTP_ERROR));
+			break;
+		}
+		if (!(flags & HTTP2_FLAG_ACK))
+			add_http2_frame(session, HTTP2_PING, HTTP2_FLAG_ACK, 0,
+					payload, length);
+		break;
+
+	case HTTP2_GOAWAY:
+		read_http2_goaway(session, id, payload, length);
+		break;
+
+	case HTTP2_PUSH_PROMISE:
+		/* We have disabled server push. */
+		abort_http2_session(session, connection_state(S_HTTP_ERROR));
+		break;
+
+	default:
+		/* PRIORITY and WINDOW_UPDATE do not concern us, unknown
+		 * frames must be ignored. */
+		break;
+	}
+}
+
+static void
+read_http2_frames(struct socket *socket, struct read_buffer *rb)
+{
+	struct http2_session *session = (struct http2_session *)socket->conn;
+
+	if (session->failed) return;
+
+	if (socket->state == SOCKET_CLOSED) {
+		abort_http2_session(session, connection_state(S_CANT_READ));
+		return;
+	}
+
+	while (rb->length >= HTTP2_FRAME_HEADER_SIZE && !session->failed) {
+		unsigned char *frame = (unsigned char *) rb->data;
+		int length = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+
+		if (length > HTTP2_MAX_FRAME_SIZE) {
+			abort_http2_session(session, connection_state(S_HTTP_ERROR));
+			return;
+		}
+
+		if (rb->length < HTTP2_FRAME_HEADER_SIZE + length) break;
+
+		read_http2_frame(session, (enum http2_frame_type) frame[3],
+				 frame[4], get_http2_uint32(frame + 5) & 0x7fffffff,
+				 frame + HTTP2_FRAME_HEADER_SIZE, length);
+		kill_buffer_data(rb, HTTP2_FRAME_HEADER_SIZE + length);
+	}
+
+	flush_http2_session(session);
+}
+
+
+/* Starting sessions and streams: */
+
+struct http2_session *
+start_http2_session(struct connection *conn)
+{
+	struct socket *socket = conn->socket;
+	struct http2_session *session;
+	struct socket *stream_socket;
+	struct read_buffer *rb;
+
+	if (!socket->http2) return NULL;
+
+#ifdef CONFIG_SSL
+	if (socket->ssl) {
+		if (!is_ssl_http2(socket)) return NULL;
+	} else
+#endif
+	/* Without TLS the server is assumed to speak HTTP/2, the
+	 * blacklist remembers it if it does not. */
+	if (conn->uri->protocol != PROTOCOL_HTTP)
+		return NULL;
+
+	session = (struct http2_session *)mem_calloc(1, sizeof(*session));
+	if (!session) return NULL;
+
+	stream_socket = init_socket(conn, socket->ops);
+	if (!stream_socket
+	    || !init_string(&session->output)
+	    || !init_string(&session->header_block)) {
+		mem_free_if(stream_socket);
+		done_string(&session->output);
+		mem_free(session);
+		return NULL;
+	}
+
+	/* The session takes the socket over. */
+	conn->socket = stream_socket;
+	socket->conn = session;
+	socket->ops = &http2_socket_operations;
+	socket->duplex = 1;
+	socket->state = SOCKET_END_ONCLOSE;
+
+	session->socket = socket;
+	session->uri = get_uri_reference(conn->uri);
+	init_list(session->streams);
+	session->next_stream_id = 1;
+	session->max_streams = INT_MAX;
+	session->max_frame_size = HTTP2_MAX_FRAME_SIZE;
+	session->timer = TIMER_ID_UNDEF;
+	session->error = connection_state(S_CANT_READ);
+	init_hpack_table(&session->table, HPACK_TABLE_SIZE);
+	add_to_list(http2_sessions, session);
+
+	add_to_string(&session->output, HTTP2_PREFACE);
+	add_http2_settings(session);
+	add_http2_uint32_frame(session, HTTP2_WINDOW_UPDATE, 0,
+			       HTTP2_WINDOW_SIZE - HTTP2_DEFAULT_WINDOW_SIZE);
+	flush_http2_session(session);
+
+	rb = alloc_read_buffer(socket);
+	if (rb)
+		read_from_socket(socket, rb, connection_state(S_TRANS),
+				 read_http2_frames);
+
+	/* More connections to the server may run now. */
+	register_check_queue();
+
+	return session;
+}
+
+static void
+add_http2_header(struct string *block, const char *name,
+		 const char *value, int valuelen)
+{
+	encode_hpack_header(block, name, strlen(name), value, valuelen);
+}
+
+/* Translates the HTTP/1.1 @request to a header block. The names of the
+ * header fields in @request are converted to lowercase. */
+static int
+encode_http2_request(struct connection *conn, struct string *request,
+		     struct string *block)
+{
+	char *line = request->source;
+	char *end = strstr(line, "\r\n");
+	char *method, *path, *host = NULL;
+	int methodlen, pathlen, hostlen = 0;
+	connection_priority_T priority = get_connection_priority(conn);
+	char urgency[] = "u=0";
+	int pass;
+
+	/* "GET /path HTTP/1.1" */
+	if (!end) return 0;
+	method = line;
+	path = (char *)memchr(method, ' ', end - method);
+	if (!path) return 0;
+	methodlen = path++ - method;
+	for (pathlen = end - path; pathlen > 0 && path[pathlen - 1] != ' ';)
+		pathlen--;
+	if (pathlen-- <= 1) return 0;
+
+	/* The pseudo-header fields must come first, the :authority is in
+	 * the Host field. */
+	for (pass = 0; pass < 2; pass++) {
+		if (pass) {
+			add_http2_header(block, ":method", method, methodlen);
+			if (conn->uri->protocol == PROTOCOL_HTTPS)
+				add_http2_header(block, ":scheme", "https", 5);
+			else
+				add_http2_header(block, ":scheme", "http", 4);
+			if (host)
+				add_http2_header(block, ":authority", host, hostlen);
+			add_http2_header(block, ":path", path, pathlen);
+		}
+
+		for (line = end + 2; (end = strstr(line, "\r\n")) && end > line;
+		     line = end + 2) {
+			char *colon = (char *)memchr(line, ':', end - line);
+			char *value;
+			int namelen;
+
+			if (!colon) continue;
+
+			namelen = colon - line;
+			for (value = colon + 1; *value == ' '; value++);
+
+			if (!pass) {
+				if (namelen == 4 && !c_strncasecmp(line, "Host", 4)) {
+					host = value;
+					hostlen = end - value;
+				}
+				continue;
+			}
+
+			convert_to_lowercase_locale_indep(line, namelen);
+
+			/* Connection-specific fields are not allowed. */
+#define is_field(name) \
+	(namelen == sizeof(name) - 1 && !memcmp(line, name, namelen))
+			if (is_field("host") || is_field("connection")
+			    || is_field("keep-alive") || is_field("proxy-connection")
+			    || is_field("te") || is_field("transfer-encoding")
+			    || is_field("upgrade"))
+				continue;
+#undef is_field
+
+			encode_hpack_header(block, line, namelen, value,
+					    end - value);
+		}
+
+		end = strstr(request->source, "\r\n");
+	}
+
+	/* RFC 9218, the urgencies go from 0 to 7 just like our priorities. */
+	urgency[2] = '0' + int_min(priority, 7);
+	add_http2_header(block, "priority", urgency, 3);
+
+	return 1;
+}
+
+static void
+add_http2_headers(struct http2_session *session, struct http2_stream *stream,
+		  struct string *block)
+{
+	connection_priority_T priority = get_connection_priority(stream->conn);
+	unsigned char weight[5] = { 0, 0, 0, 0, 0 };
+	int room = session->max_frame_size - sizeof(weight);
+	int length = int_min(block->length, room);
+	unsigned char flags = HTTP2_FLAG_END_STREAM | HTTP2_FLAG_PRIORITY;
+	int pos;
+
+	/* RFC 7540 priorities, for the servers which still use them. The
+	 * stream depends on no other stream and gets a share of bandwidth
+	 * falling with the priority of its connection. */
+	weight[4] = 256 - 32 * int_min(priority, 7) - 1;
+
+	if (length == block->length) flags |= HTTP2_FLAG_END_HEADERS;
+	add_http2_frame_header(session, length + sizeof(weight), HTTP2_HEADERS,
+			       flags, stream->id);
+	add_bytes_to_string(&session->output, (char *) weight, sizeof(weight));
+	add_bytes_to_string(&session->output, block->source, length);
+
+	for (pos = length; pos < block->length; pos += length) {
+		length = int_min(block->length - pos, session->max_frame_size);
+		flags = pos + length == block->length ? HTTP2_FLAG_END_HEADERS : 0;
+		add_http2_frame(session, HTTP2_CONTINUATION, flags, stream->id,
+				(unsigned char *) block->source + pos, length);
+	}
+}
+
+void
+add_http2_stream(struct http2_session *session, struct connection *conn,
+		 struct string *request)
+{
+	struct http_connection_info *http = (struct http_connection_info *)conn->info;
+	struct http2_stream *stream;
+	struct read_buffer *rb;
+	struct string block;
+
+	if (!init_string(&block)) {
+		abort_connection(conn, connection_state(S_OUT_OF_MEM));
+		return;
+	}
+
+	if (!encode_http2_request(conn, request, &block)) {
+		done_string(&block);
+		abort_connection(conn, connection_state(S_HTTP_ERROR));
+		return;
+	}
+
+	stream = (struct http2_stream *)mem_calloc(1, sizeof(*stream));
+	if (!stream) {
+		done_string(&block);
+		abort_connection(conn, connection_state(S_OUT_OF_MEM));
+		return;
+	}
+
+	rb = alloc_read_buffer(conn->socket);
+	if (!rb) {
+		done_string(&block);
+		mem_free(stream);
+		return;
+	}
+
+	stream->session = session;
+	stream->conn = conn;
+	stream->id = session->next_stream_id;
+	session->next_stream_id += 2;
+	if (session->next_stream_id > 0x7fffffff)
+		session->goaway = 1;
+
+	add_to_list_end(session->streams, stream);
+	session->stream_count++;
+	if (!session->failed) kill_timer(&session->timer);
+
+	http->stream = stream;
+	conn->socket->stream = 1;
+
+	add_http2_headers(session, stream, &block);
+	done_string(&block);
+	flush_http2_session(session);
+
+	conn->socket->state = SOCKET_END_ONCLOSE;
+	read_from_socket(conn->socket, rb, connection_state(S_SENT),
+			 http_got_header);
+}
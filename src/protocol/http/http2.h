@@ -0,0 +1,46 @@
+/** HTTP/2 (RFC 9113) sessions carrying the requests of HTTP connections.
+ * @file */
+
+#ifndef EL__PROTOCOL_HTTP_HTTP2_H
+#define EL__PROTOCOL_HTTP_HTTP2_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct connection;
+struct http2_session;
+struct http2_stream;
+struct string;
+
+/** Returns non-zero if the request of @a conn may be sent with HTTP/2,
+ * which protocol.http.http2 and the server blacklist decide.  */
+int is_http2_allowed(struct connection *conn);
+
+/** Returns the session to the server of @a conn which can take one more
+ * stream, or NULL.  */
+struct http2_session *get_http2_session(struct connection *conn);
+
+/** Starts a session on the socket of @a conn, which has just been
+ * connected.  The session takes the socket over and @a conn gets a new
+ * one.  Returns NULL if HTTP/1.1 should be spoken on the socket.  */
+struct http2_session *start_http2_session(struct connection *conn);
+
+/** Sends the HTTP/1.1 @a request built for @a conn as a new stream of
+ * @a session.  The response is fed to the socket of @a conn looking as
+ * if it came with HTTP/1.1, so http_got_header() reads it.  */
+void add_http2_stream(struct http2_session *session, struct connection *conn,
+		      struct string *request);
+
+/** Detaches @a stream from its connection when the connection is done,
+ * the stream is cancelled if it is still open.  */
+void done_http2_stream(struct connection *conn, struct http2_stream *stream);
+
+int get_http2_session_count(void);
+void done_http2_sessions(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
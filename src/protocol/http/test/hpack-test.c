@@ -0,0 +1,235 @@
+/* Test the HPACK decoder with the examples of RFC 7541, Appendix C */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "protocol/http/hpack.h"
+#include "util/string.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle()
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+struct hpack_test_case {
+	/* Decode with a new table of this size, or 0 to continue with the
+	 * table of the previous case. */
+	int new_table;
+	const char *block;	/* In hex */
+	const char *headers;	/* "name: value\n" for each field */
+	int table_size;
+};
+
+static const struct hpack_test_case hpack_test_cases[] = {
+	/* C.3. Request Examples without Huffman Coding */
+	{ HPACK_TABLE_SIZE,
+	  "828684410f7777772e6578616d706c652e636f6d",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\n", 57 },
+	{ 0,
+	  "828684be58086e6f2d6361636865",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\ncache-control: no-cache\n", 110 },
+	{ 0,
+	  "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+	  ":method: GET\n:scheme: https\n:path: /index.html\n"
+	  ":authority: www.example.com\ncustom-key: custom-value\n", 164 },
+
+	/* C.4. Request Examples with Huffman Coding */
+	{ HPACK_TABLE_SIZE,
+	  "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\n", 57 },
+	{ 0,
+	  "828684be5886a8eb10649cbf",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\ncache-control: no-cache\n", 110 },
+	{ 0,
+	  "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+	  ":method: GET\n:scheme: https\n:path: /index.html\n"
+	  ":authority: www.example.com\ncustom-key: custom-value\n", 164 },
+
+	/* C.6. Response Examples with Huffman Coding, entries get evicted
+	 * from the 256 bytes table. */
+	{ 256,
+	  "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166"
+	  "e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+	  ":status: 302\ncache-control: private\n"
+	  "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+	  "location: https://www.example.com\n", 222 },
+	{ 0,
+	  "4883640effc1c0bf",
+	  ":status: 307\ncache-control: private\n"
+	  "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+	  "location: https://www.example.com\n", 222 },
+	{ 0,
+	  "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839b"
+	  "d9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab27"
+	  "0fb5291f9587316065c003ed4ee5b1063d5007",
+	  ":status: 200\ncache-control: private\n"
+	  "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+	  "location: https://www.example.com\ncontent-encoding: gzip\n"
+	  "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n",
+	  215 },
+
+	/* Malformed: index out of the tables, Huffman padding of zeros. */
+	{ HPACK_TABLE_SIZE, "be", NULL, 0 },
+	{ HPACK_TABLE_SIZE, "0081000100", NULL, 0 },
+
+	{ 0, NULL, NULL, 0 }
+};
+
+static void
+add_header(void *data, char *name, int namelen, char *value, int valuelen)
+{
+	struct string *headers = (struct string *)data;
+
+	add_bytes_to_string(headers, name, namelen);
+	add_to_string(headers, ": ");
+	add_bytes_to_string(headers, value, valuelen);
+	add_char_to_string(headers, '\n');
+}
+
+static int
+decode_hex(const char *hex, struct string *block)
+{
+	for (; hex[0] && hex[1]; hex += 2) {
+		unsigned int byte;
+
+		char c;
+
+		if (sscanf(hex, "%2x", &byte) != 1) return 0;
+		c = byte;
+		add_bytes_to_string(block, &c, 1);
+	}
+
+	return 1;
+}
+
+/* Headers encoded by encode_hpack_header() must decode back. */
+static int
+test_encoder(void)
+{
+	static const char *fields[][2] = {
+		{ ":method", "GET" },
+		{ ":path", "/some/where?x=1" },
+		{ "accept-encoding", "gzip, deflate" },
+		{ "cookie", "a=b" },
+		{ "x-something-long", "0123456789012345678901234567890123456789"
+				      "0123456789012345678901234567890123456789"
+				      "0123456789012345678901234567890123456789" },
+	};
+	struct hpack_table table;
+	struct string block, headers, expected;
+	int i, ok;
+
+	if (!init_string(&block) || !init_string(&headers)
+	    || !init_string(&expected))
+		return 0;
+
+	for (i = 0; i < (int) (sizeof(fields) / sizeof(*fields)); i++) {
+		encode_hpack_header(&block, fields[i][0], strlen(fields[i][0]),
+				    fields[i][1], strlen(fields[i][1]));
+		add_format_to_string(&expected, "%s: %s\n",
+				     fields[i][0], fields[i][1]);
+	}
+
+	init_hpack_table(&table, HPACK_TABLE_SIZE);
+	ok = decode_hpack_block(&table, (unsigned char *) block.source,
+				block.length, add_header, &headers)
+	     && !strcmp(headers.source, expected.source)
+	     && !table.count
+	     /* ":method: GET" is in the static table. */
+	     && (unsigned char) block.source[0] == 0x82;
+
+	if (!ok)
+		fprintf(stderr, "encode_hpack_header() test failed\n"
+			"\tDecoded: %s\n", headers.source);
+
+	done_hpack_table(&table);
+	done_string(&block);
+	done_string(&headers);
+	done_string(&expected);
+	return ok;
+}
+
+int
+main(void)
+{
+	const struct hpack_test_case *test;
+	struct hpack_table table;
+	int count_ok = 0;
+	int count_fail = 0;
+
+	init_hpack_table(&table, HPACK_TABLE_SIZE);
+
+	for (test = hpack_test_cases; test->block; test++) {
+		struct string block, headers;
+		int ok;
+
+		if (!init_string(&block) || !init_string(&headers)) {
+			fputs("Out of memory.\n", stderr);
+			return EXIT_FAILURE;
+		}
+
+		if (test->new_table) {
+			done_hpack_table(&table);
+			init_hpack_table(&table, test->new_table);
+		}
+
+		decode_hex(test->block, &block);
+		ok = decode_hpack_block(&table, (unsigned char *) block.source,
+					block.length, add_header, &headers);
+
+		if (test->headers
+		    ? ok && !strcmp(headers.source, test->headers)
+			 && table.size == test->table_size
+		    : !ok) {
+			count_ok++;
+		} else {
+			fprintf(stderr, "decode_hpack_block() test failed\n"
+				"\tBlock: %s\n"
+				"\tResult: %d\n"
+				"\tHeaders: %s\n"
+				"\tTable size: %d\n",
+				test->block, ok, headers.source, table.size);
+			count_fail++;
+		}
+
+		done_string(&block);
+		done_string(&headers);
+	}
+
+	done_hpack_table(&table);
+
+	if (test_encoder())
+		count_ok++;
+	else
+		count_fail++;
+
+	printf("Summary of HPACK tests: %d OK, %d failed.\n",
+	       count_ok, count_fail);
+
+	return count_fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
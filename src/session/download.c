@@ -616,6 +616,10 @@ download_data(struct download *download, struct file_download *file_download)
 		return;
 	}
 
+	/* Big bodies need not go through the cache at all. */
+	file_download->seek = direct_connection_to_file(download,
+							file_download->handle,
+							file_download->seek);
 	detach_connection(download, file_download->seek);
 	download_data_store(download, file_download);
 }
@@ -135,7 +135,10 @@ void *
 mem_mmap_alloc(size_t size)
 {
 	if (size) {
-		void *p = mmap(NULL, round_size(size), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+		/* Private, because mremap() can not grow shared anonymous
+		 * mappings; their backing object keeps the old size and
+		 * touching the new pages raises SIGBUS. */
+		void *p = mmap(NULL, round_size(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 
 		if (p != MAP_FAILED)
 			return p;
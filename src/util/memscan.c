@@ -0,0 +1,326 @@
+/* Scanning of long runs of text */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CONFIG_MEMSCAN_X86
+#include <immintrin.h>
+#endif
+
+#include "elinks.h"
+
+#include "util/memscan.h"
+
+
+/* The scalar scans, which also do the few bytes at the end which are too
+ * short for a vector. */
+
+static const char *
+memscan_text_scalar(const char *s, const char *end, int c1, int c2)
+{
+	for (; s < end; s++) {
+		unsigned char c = *s;
+
+		if (c <= ' ' || c == c1 || c == c2 || isspace(c))
+			break;
+	}
+
+	return s;
+}
+
+static const char *
+memscan_ascii_text_scalar(const char *s, const char *end)
+{
+	for (; s < end; s++) {
+		unsigned char c = *s;
+
+		if (c <= ' ' || c >= 0x7F)
+			break;
+	}
+
+	return s;
+}
+
+static const char *
+memscan_spaces_scalar(const char *s, const char *end)
+{
+	while (s < end && isspace((unsigned char) *s))
+		s++;
+
+	return s;
+}
+
+#ifdef CONFIG_MEMSCAN_X86
+
+/* The vector scans know only the ASCII spaces, '\t' to '\r' and ' ', so
+ * they are used only if isspace() has no others.  The bytes are compared
+ * as unsigned using that a <= b if min(a, b) == a. */
+
+/* SSE2 is there on every x86-64 CPU.  The masks have a bit set for each
+ * of the 16 bytes at @s where the scan stops. */
+
+static inline __m128i
+sse2_le(__m128i v, __m128i max)
+{
+	return _mm_cmpeq_epi8(_mm_min_epu8(v, max), v);
+}
+
+static inline unsigned int
+sse2_text_mask(const char *s, int c1, int c2)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *) s);
+	__m128i stop = sse2_le(v, _mm_set1_epi8(' '));
+
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(c1)));
+	stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_set1_epi8(c2)));
+	return _mm_movemask_epi8(stop);
+}
+
+static inline unsigned int
+sse2_ascii_text_mask(const char *s)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *) s);
+	__m128i stop = sse2_le(v, _mm_set1_epi8(' '));
+
+	stop = _mm_or_si128(stop, sse2_le(_mm_set1_epi8(0x7F), v));
+	return _mm_movemask_epi8(stop);
+}
+
+static inline unsigned int
+sse2_spaces_mask(const char *s)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *) s);
+	__m128i tab = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+	__m128i space = _mm_or_si128(sse2_le(tab, _mm_set1_epi8('\r' - '\t')),
+				     _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+
+	return ~_mm_movemask_epi8(space) & 0xFFFF;
+}
+
+static const char *
+memscan_text_sse2(const char *s, const char *end, int c1, int c2)
+{
+	for (; end - s >= 16; s += 16) {
+		unsigned int mask = sse2_text_mask(s, c1, c2);
+
+		if (mask) return s + __builtin_ctz(mask);
+	}
+
+	return memscan_text_scalar(s, end, c1, c2);
+}
+
+static const char *
+memscan_ascii_text_sse2(const char *s, const char *end)
+{
+	for (; end - s >= 16; s += 16) {
+		unsigned int mask = sse2_ascii_text_mask(s);
+
+		if (mask) return s + __builtin_ctz(mask);
+	}
+
+	return memscan_ascii_text_scalar(s, end);
+}
+
+static const char *
+memscan_spaces_sse2(const char *s, const char *end)
+{
+	for (; end - s >= 16; s += 16) {
+		unsigned int mask = sse2_spaces_mask(s);
+
+		if (mask) return s + __builtin_ctz(mask);
+	}
+
+	return memscan_spaces_scalar(s, end);
+}
+
+/* AVX2 only if the CPU has it.  Most of the runs of text are words, so
+ * the first 16 bytes are looked at with SSE2, which is quicker for them
+ * than starting with 32. */
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i
+avx2_le(__m256i v, __m256i max)
+{
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(v, max), v);
+}
+
+static inline AVX2 unsigned int
+avx2_text_mask(const char *s, int c1, int c2)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *) s);
+	__m256i stop = avx2_le(v, _mm256_set1_epi8(' '));
+
+	stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c1)));
+	stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c2)));
+	return _mm256_movemask_epi8(stop);
+}
+
+static inline AVX2 unsigned int
+avx2_ascii_text_mask(const char *s)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *) s);
+	__m256i stop = avx2_le(v, _mm256_set1_epi8(' '));
+
+	stop = _mm256_or_si256(stop, avx2_le(_mm256_set1_epi8(0x7F), v));
+	return _mm256_movemask_epi8(stop);
+}
+
+static inline AVX2 unsigned int
+avx2_spaces_mask(const char *s)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *) s);
+	__m256i tab = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+	__m256i space = _mm256_or_si256(avx2_le(tab, _mm256_set1_epi8('\r' - '\t')),
+					_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+
+	return ~(unsigned int) _mm256_movemask_epi8(space);
+}
+
+static AVX2 const char *
+memscan_text_avx2(const char *s, const char *end, int c1, int c2)
+{
+	unsigned int mask;
+
+	if (end - s < 16)
+		return memscan_text_scalar(s, end, c1, c2);
+
+	mask = sse2_text_mask(s, c1, c2);
+	if (mask) return s + __builtin_ctz(mask);
+
+	for (s += 16; end - s >= 32; s += 32) {
+		mask = avx2_text_mask(s, c1, c2);
+		if (mask) return s + __builtin_ctz(mask);
+	}
+
+	return memscan_text_sse2(s, end, c1, c2);
+}
+
+static AVX2 const char *
+memscan_ascii_text_avx2(const char *s, const char *end)
+{
+	unsigned int mask;
+
+	if (end - s < 16)
+		return memscan_ascii_text_scalar(s, end);
+
+	mask = sse2_ascii_text_mask(s);
+	if (mask) return s + __builtin_ctz(mask);
+
+	for (s += 16; end - s >= 32; s += 32) {
+		mask = avx2_ascii_text_mask(s);
+		if (mask) return s + __builtin_ctz(mask);
+	}
+
+	return memscan_ascii_text_sse2(s, end);
+}
+
+static AVX2 const char *
+memscan_spaces_avx2(const char *s, const char *end)
+{
+	unsigned int mask;
+
+	if (end - s < 16)
+		return memscan_spaces_scalar(s, end);
+
+	mask = sse2_spaces_mask(s);
+	if (mask) return s + __builtin_ctz(mask);
+
+	for (s += 16; end - s >= 32; s += 32) {
+		mask = avx2_spaces_mask(s);
+		if (mask) return s + __builtin_ctz(mask);
+	}
+
+	return memscan_spaces_sse2(s, end);
+}
+
+#undef AVX2
+
+#endif /* CONFIG_MEMSCAN_X86 */
+
+
+struct memscan_functions {
+	const char *(*text)(const char *s, const char *end, int c1, int c2);
+	const char *(*ascii_text)(const char *s, const char *end);
+	const char *(*spaces)(const char *s, const char *end);
+};
+
+static const struct memscan_functions memscan_isa_functions[] = {
+	/* MEMSCAN_SCALAR: */
+	{ memscan_text_scalar, memscan_ascii_text_scalar, memscan_spaces_scalar },
+#ifdef CONFIG_MEMSCAN_X86
+	/* MEMSCAN_SSE2: */
+	{ memscan_text_sse2, memscan_ascii_text_sse2, memscan_spaces_sse2 },
+	/* MEMSCAN_AVX2: */
+	{ memscan_text_avx2, memscan_ascii_text_avx2, memscan_spaces_avx2 },
+#endif
+};
+
+static const struct memscan_functions *memscan_functions;
+
+static int
+memscan_isa_usable(enum memscan_isa isa)
+{
+	if (isa == MEMSCAN_SCALAR)
+		return 1;
+
+#ifdef CONFIG_MEMSCAN_X86
+	int c;
+
+	/* The vector scans do not know the spaces of the locale. */
+	for (c = 0x80; c <= 0xFF; c++)
+		if (isspace(c))
+			return 0;
+
+	if (isa == MEMSCAN_AVX2) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+enum memscan_isa
+use_memscan_isa(enum memscan_isa isa)
+{
+	while (!memscan_isa_usable(isa))
+		isa = (enum memscan_isa) (isa - 1);
+
+	memscan_functions = &memscan_isa_functions[isa];
+	return isa;
+}
+
+/* The locale is set up by the time anything is scanned. */
+static inline const struct memscan_functions *
+get_memscan_functions(void)
+{
+	if (!memscan_functions)
+		use_memscan_isa(MEMSCAN_AVX2);
+
+	return memscan_functions;
+}
+
+const char *
+memscan_text(const char *s, const char *end, int c1, int c2)
+{
+	return get_memscan_functions()->text(s, end, c1, c2);
+}
+
+const char *
+memscan_ascii_text(const char *s, const char *end)
+{
+	return get_memscan_functions()->ascii_text(s, end);
+}
+
+const char *
+memscan_spaces(const char *s, const char *end)
+{
+	return get_memscan_functions()->spaces(s, end);
+}
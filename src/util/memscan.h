@@ -0,0 +1,40 @@
+#ifndef EL__UTIL_MEMSCAN_H
+#define EL__UTIL_MEMSCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Scanning of long runs of text for the bytes which end them.  The scans
+ * use the SSE2 or AVX2 instructions if the CPU has them.
+ * @file */
+
+/** Returns the first byte between @a s and @a end which is a control
+ * character, a space as isspace() has it, @a c1 or @a c2, or @a end if
+ * there is none. */
+const char *memscan_text(const char *s, const char *end, int c1, int c2);
+
+/** Like memscan_text() without @a c1 and @a c2, but also stops at the
+ * bytes from 0x7F up, which are not ASCII text. */
+const char *memscan_ascii_text(const char *s, const char *end);
+
+/** Returns the first byte between @a s and @a end which is not a space as
+ * isspace() has it, or @a end if there is none. */
+const char *memscan_spaces(const char *s, const char *end);
+
+enum memscan_isa {
+	MEMSCAN_SCALAR,
+	MEMSCAN_SSE2,
+	MEMSCAN_AVX2,
+};
+
+/** Makes the scans use the instructions of @a isa, or of the best
+ * one below it which the CPU and the current locale allow, and returns
+ * that one.  The scans choose the best one themselves otherwise. */
+enum memscan_isa use_memscan_isa(enum memscan_isa isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -388,6 +388,7 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 	    && !has_search_word(doc_view)) {
 		clear_link(term, doc_view);
 		draw_view_status(ses, doc_view, active);
+		if (active) prefetch_links(doc_view, 0);
 		return;
 	}
 	doc_view->last_x = vx;
@@ -450,6 +451,7 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 		}
 	}
 	draw_view_status(ses, doc_view, active);
+	if (active) prefetch_links(doc_view, 1);
 	if (has_search_word(doc_view))
 		doc_view->last_x = doc_view->last_y = -1;
 
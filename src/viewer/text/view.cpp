@@ -48,6 +48,7 @@
 #include "intl/charsets.h"
 #include "intl/libintl.h"
 #include "main/event.h"
+#include "network/prefetch.h"
 #include "osdep/osdep.h"
 #include "protocol/uri.h"
 #include "session/download.h"
@@ -101,6 +102,48 @@ detach_formatted(struct document_view *doc_view)
 	mem_free_set(&doc_view->name, NULL);
 }
 
+static void
+prefetch_link(struct link *link)
+{
+	struct uri *uri;
+
+	if (link->type != LINK_HYPERTEXT || !link->where)
+		return;
+
+	uri = get_uri(link->where, URI_NONE);
+	if (!uri) return;
+
+	prefetch_uri(uri);
+	done_uri(uri);
+}
+
+void
+prefetch_links(struct document_view *doc_view, int all_in_view)
+{
+	struct link *current, *link, *last;
+
+	assert(doc_view && doc_view->document);
+	if_assert_failed return;
+
+	if (!get_opt_bool("connection.prefetch.dns", NULL)
+	    && !get_opt_int("connection.prefetch.connections", NULL))
+		return;
+
+	/* The selected link is the most likely to be followed. */
+	current = get_current_link(doc_view);
+	if (current) prefetch_link(current);
+
+	if (!all_in_view) return;
+
+	link = get_first_link(doc_view);
+	last = get_last_link(doc_view);
+	if (!link || !last) return;
+
+	for (; link <= last; link++)
+		if (link != current)
+			prefetch_link(link);
+}
+
 /*! @a type == 0 -> PAGE_DOWN;
  * @a type == 1 -> DOWN */
 static void
@@ -18,6 +18,11 @@ struct terminal;
  * But doesn't free() the @a doc_view. */
 void detach_formatted(struct document_view *doc_view);
 
+/** Gets ready for the links of @a doc_view to be followed: the current
+ * link and, if @a all_in_view is set, the other links in view.
+ * See connection.prefetch options. */
+void prefetch_links(struct document_view *doc_view, int all_in_view);
+
 enum frame_event_status move_current_top(struct session *ses, struct document_view *doc_view);
 enum frame_event_status move_half_page_down(struct session *ses, struct document_view *doc_view);
 enum frame_event_status move_half_page_up(struct session *ses, struct document_view *doc_view);
@@ -0,0 +1,39 @@
+#!/usr/bin/python3
+#
+# testing server streaming a big generated body, for measuring how fast
+# elinks moves downloaded data into the cache
+#
+# run it and then for example:
+#
+#   time elinks -no-home -source 'http://127.0.0.1:9453/?size=4096' > /dev/null
+#
+# size is in megabytes (default 1024)
+#
+
+PORT = 9453
+
+import http.server
+import socketserver
+import urllib.parse
+
+CHUNK = b'0123456789abcdef' * 4096
+
+class handler(http.server.BaseHTTPRequestHandler):
+  def do_GET(self):
+    query = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+    size = int(query.get('size', ['1024'])[0]) * 1024 * 1024
+
+    self.send_response(200)
+    self.send_header('Content-Type', 'application/octet-stream')
+    self.send_header('Content-Length', str(size))
+    self.end_headers()
+
+    while size > 0:
+      data = CHUNK[:min(size, len(CHUNK))]
+      self.wfile.write(data)
+      size -= len(data)
+
+socketserver.TCPServer.allow_reuse_address = True
+with socketserver.TCPServer(('127.0.0.1', PORT), handler) as httpd:
+  print("[*] http server started at localhost:" + str(PORT))
+  httpd.serve_forever()
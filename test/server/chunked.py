@@ -0,0 +1,92 @@
+#!/usr/bin/python3
+#
+# testing server streaming a big generated body in many small HTTP chunks,
+# for measuring how fast elinks takes chunked responses apart
+#
+# run it and then for example:
+#
+#   time elinks -no-home -source 'http://127.0.0.1:9455/?size=1024&chunk=256' > /dev/null
+#
+# size is in megabytes (default 1024) and chunk is the size of the HTTP
+# chunks in bytes (default 256)
+#
+# with --bench ELINKS it instead downloads the body with ELINKS, checks that
+# all of it arrived, and prints the time and CPU time it took
+#
+
+PORT = 9455
+
+import http.server
+import os
+import socketserver
+import subprocess
+import sys
+import threading
+import time
+import urllib.parse
+
+BLOCK = 64 * 1024
+
+class handler(http.server.BaseHTTPRequestHandler):
+  protocol_version = 'HTTP/1.1'
+
+  def do_GET(self):
+    query = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+    size = int(query.get('size', ['1024'])[0]) * 1024 * 1024
+    chunk = max(1, int(query.get('chunk', ['256'])[0]))
+
+    # framing the chunks one by one would make python the bottleneck
+    data = b'0123456789abcdef' * (chunk // 16 + 1)
+    frame = b'%x\r\n' % chunk + data[:chunk] + b'\r\n'
+    frames = frame * max(1, BLOCK // len(frame))
+    per_block = len(frames) // len(frame) * chunk
+
+    self.send_response(200)
+    self.send_header('Content-Type', 'application/octet-stream')
+    self.send_header('Transfer-Encoding', 'chunked')
+    self.send_header('Connection', 'close')
+    self.end_headers()
+
+    try:
+      while size >= per_block:
+        self.wfile.write(frames)
+        size -= per_block
+      while size > 0:
+        n = min(size, chunk)
+        self.wfile.write(b'%x\r\n' % n + data[:n] + b'\r\n')
+        size -= n
+      self.wfile.write(b'0\r\n\r\n')
+    except BrokenPipeError:
+      pass
+    self.close_connection = True
+
+  def log_message(self, format, *args):
+    pass
+
+def bench(elinks, url, size):
+  start = time.time()
+  proc = subprocess.Popen([elinks, '-no-home', '-no-connect', '-source', url],
+                          stdout=subprocess.PIPE)
+  received = 0
+  while True:
+    data = proc.stdout.read(1024 * 1024)
+    if not data:
+      break
+    received += len(data)
+  pid, status, usage = os.wait4(proc.pid, 0)
+  if received != size:
+    print('got %d bytes, expected %d' % (received, size))
+  return time.time() - start, usage.ru_utime + usage.ru_stime
+
+socketserver.TCPServer.allow_reuse_address = True
+with socketserver.ThreadingTCPServer(('127.0.0.1', PORT), handler) as httpd:
+  if len(sys.argv) == 3 and sys.argv[1] == '--bench':
+    size = 1024
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+    for chunk in (16, 256, 4096):
+      url = 'http://127.0.0.1:%d/?size=%d&chunk=%d' % (PORT, size, chunk)
+      elapsed, cpu = bench(sys.argv[2], url, size * 1024 * 1024)
+      print('chunk=%d: %.2fs, %.2fs CPU' % (chunk, elapsed, cpu))
+  else:
+    print("[*] http server started at localhost:" + str(PORT))
+    httpd.serve_forever()
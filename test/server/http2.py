@@ -0,0 +1,358 @@
+#!/usr/bin/python3
+#
+# testing server for HTTP/2, serving a page with many small stylesheets and
+# answering each request only after a simulated network round trip, like
+# pipeline.py
+#
+# it speaks HTTP/1.1 too: without TLS when the client does not start with the
+# HTTP/2 connection preface, with TLS when the client does not choose h2 with
+# ALPN
+#
+# run it and then for example:
+#
+#   elinks -no-home -eval 'set protocol.http.http2 = 2' \
+#     'http://127.0.0.1:9457/?n=64&rtt=50'
+#
+# n is the number of stylesheets (default 64) and rtt the round trip time in
+# milliseconds (default 50), /big?size=N is a text of N bytes
+#
+# with --tls it serves HTTPS with the certificate of gen.sh instead, use
+# protocol.http.http2 = 1 and connection.ssl.cert_verify = 0 then
+#
+# with --bench ELINKS it instead opens the page in ELINKS running on a pty
+# with HTTP/1.1 and with HTTP/2, and prints the time until all the
+# stylesheets were served and how many connections they took
+#
+
+PORT = 9457
+CERTFILE = '/tmp/eltmp.pem'
+
+import os
+import pty
+import select
+import socket
+import socketserver
+import ssl
+import struct
+import sys
+import threading
+import time
+import urllib.parse
+
+tls = '--tls' in sys.argv
+stats = {'requests': 0, 'connections': 0, 'streams': 0}
+stats_lock = threading.Lock()
+
+# RFC 7541, Appendix A
+STATIC_TABLE = [
+  (':authority', ''), (':method', 'GET'), (':method', 'POST'), (':path', '/'),
+  (':path', '/index.html'), (':scheme', 'http'), (':scheme', 'https'),
+  (':status', '200'), (':status', '204'), (':status', '206'),
+  (':status', '304'), (':status', '400'), (':status', '404'),
+  (':status', '500'), ('accept-charset', ''),
+  ('accept-encoding', 'gzip, deflate'), ('accept-language', ''),
+  ('accept-ranges', ''), ('accept', ''), ('access-control-allow-origin', ''),
+  ('age', ''), ('allow', ''), ('authorization', ''), ('cache-control', ''),
+  ('content-disposition', ''), ('content-encoding', ''),
+  ('content-language', ''), ('content-length', ''), ('content-location', ''),
+  ('content-range', ''), ('content-type', ''), ('cookie', ''), ('date', ''),
+  ('etag', ''), ('expect', ''), ('expires', ''), ('from', ''), ('host', ''),
+  ('if-match', ''), ('if-modified-since', ''), ('if-none-match', ''),
+  ('if-range', ''), ('if-unmodified-since', ''), ('last-modified', ''),
+  ('link', ''), ('location', ''), ('max-forwards', ''),
+  ('proxy-authenticate', ''), ('proxy-authorization', ''), ('range', ''),
+  ('referer', ''), ('refresh', ''), ('retry-after', ''), ('server', ''),
+  ('set-cookie', ''), ('strict-transport-security', ''),
+  ('transfer-encoding', ''), ('user-agent', ''), ('vary', ''), ('via', ''),
+  ('www-authenticate', ''),
+]
+
+PREFACE = b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+
+def page(query):
+  n = int(query.get('n', ['64'])[0])
+  rtt = query.get('rtt', ['50'])[0]
+  links = ''.join('<link rel="stylesheet" href="/css/%d.css?rtt=%s">\n' % (i, rtt)
+                  for i in range(n))
+  return ('text/html', ('<html><head><title>http2</title>\n%s</head>'
+          '<body><p>%d stylesheets</p></body></html>\n' % (links, n)).encode())
+
+def respond(path):
+  url = urllib.parse.urlparse(path)
+  query = urllib.parse.parse_qs(url.query)
+  rtt = int(query.get('rtt', ['50'])[0]) / 1000.0
+  if url.path == '/':
+    return rtt, page(query)
+  if url.path == '/big':
+    size = int(query.get('size', ['1000000'])[0])
+    line = b'0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstu\n'
+    return 0, ('text/plain', (line * (size // len(line) + 1))[:size])
+  return rtt, ('text/css', ('/* %s */\np { margin: 0 }\n' % path).encode())
+
+# The client does not use the dynamic table nor Huffman coding.
+def decode_integer(data, pos, prefix):
+  mask = (1 << prefix) - 1
+  value = data[pos] & mask
+  pos += 1
+  if value < mask:
+    return value, pos
+  shift = 0
+  while True:
+    byte = data[pos]
+    pos += 1
+    value += (byte & 0x7f) << shift
+    shift += 7
+    if not byte & 0x80:
+      return value, pos
+
+def decode_string(data, pos):
+  if data[pos] & 0x80:
+    raise ValueError('Huffman coded string')
+  length, pos = decode_integer(data, pos, 7)
+  return data[pos:pos + length].decode(), pos + length
+
+def decode_headers(block):
+  headers = []
+  pos = 0
+  while pos < len(block):
+    byte = block[pos]
+    if byte & 0x80:
+      index, pos = decode_integer(block, pos, 7)
+      headers.append(STATIC_TABLE[index - 1])
+      continue
+    if byte & 0xe0 == 0x20:
+      _, pos = decode_integer(block, pos, 5)
+      continue
+    index, pos = decode_integer(block, pos, 6 if byte & 0x40 else 4)
+    if index:
+      name = STATIC_TABLE[index - 1][0]
+    else:
+      name, pos = decode_string(block, pos)
+    value, pos = decode_string(block, pos)
+    headers.append((name, value))
+  return headers
+
+def encode_string(string):
+  data = string.encode()
+  assert len(data) < 127
+  return bytes([len(data)]) + data
+
+def encode_headers(status, content_type, length):
+  # :status 200 is indexed, the others are literals with an indexed name.
+  return ((b'\x88' if status == 200 else b'\x08' + encode_string(str(status)))
+          + b'\x0f\x10' + encode_string(content_type)
+          + b'\x0f\x0d' + encode_string(str(length)))
+
+def frame(type, flags, stream, payload=b''):
+  return struct.pack('>I', len(payload))[1:] + bytes([type, flags]) \
+         + struct.pack('>I', stream) + payload
+
+class http2_connection:
+  def __init__(self, request):
+    self.request = request
+    self.lock = threading.Condition()
+    self.window = 65535
+    self.initial_window = 65535
+    self.streams = {}
+
+  def send(self, data):
+    with self.lock:
+      self.request.sendall(data)
+
+  def recv(self, length):
+    data = b''
+    while len(data) < length:
+      got = self.request.recv(length - len(data))
+      if not got:
+        raise EOFError
+      data += got
+    return data
+
+  def answer(self, stream, path, received):
+    delay, (content_type, body) = respond(path)
+    delay = received + delay - time.time()
+    if delay > 0:
+      time.sleep(delay)
+    with stats_lock:
+      stats['requests'] += 1
+    self.send(frame(1, 4, stream, encode_headers(200, content_type, len(body))))
+    pos = 0
+    while True:
+      with self.lock:
+        while self.streams.get(stream, 0) <= 0 or self.window <= 0:
+          if stream not in self.streams:
+            return
+          self.lock.wait()
+        length = min(16384, len(body) - pos, self.window, self.streams[stream])
+        self.window -= length
+        self.streams[stream] -= length
+        end = pos + length == len(body)
+        self.request.sendall(frame(0, 1 if end else 0, stream, body[pos:pos + length]))
+        pos += length
+        if end:
+          del self.streams[stream]
+          return
+
+  def run(self):
+    self.send(frame(4, 0, 0, struct.pack('>HI', 3, 100)))
+    block = b''
+    while True:
+      try:
+        header = self.recv(9)
+        length = struct.unpack('>I', b'\0' + header[:3])[0]
+        type, flags = header[3], header[4]
+        stream = struct.unpack('>I', header[5:])[0] & 0x7fffffff
+        payload = self.recv(length)
+      except (EOFError, OSError):
+        with self.lock:
+          self.streams.clear()
+          self.lock.notify_all()
+        return
+      if type == 4 and not flags & 1:
+        for i in range(0, len(payload), 6):
+          id, value = struct.unpack('>HI', payload[i:i + 6])
+          if id == 4:
+            with self.lock:
+              for s in self.streams:
+                self.streams[s] += value - self.initial_window
+              self.initial_window = value
+              self.lock.notify_all()
+        self.send(frame(4, 1, 0))
+      elif type == 8:
+        increment = struct.unpack('>I', payload)[0] & 0x7fffffff
+        with self.lock:
+          if stream:
+            if stream in self.streams:
+              self.streams[stream] += increment
+          else:
+            self.window += increment
+          self.lock.notify_all()
+      elif type == 3:
+        with self.lock:
+          self.streams.pop(stream, None)
+          self.lock.notify_all()
+      elif type == 6 and not flags & 1:
+        self.send(frame(6, 1, 0, payload))
+      elif type in (1, 9):
+        if type == 1:
+          if flags & 0x20:
+            payload = payload[5:]
+          block = b''
+        block += payload
+        if flags & 4:
+          headers = dict(decode_headers(block))
+          with stats_lock:
+            stats['streams'] += 1
+          with self.lock:
+            self.streams[stream] = self.initial_window
+          threading.Thread(target=self.answer, daemon=True,
+                           args=(stream, headers[':path'], time.time())).start()
+
+class handler(socketserver.BaseRequestHandler):
+  def http1(self, data):
+    while True:
+      while b'\r\n\r\n' not in data:
+        got = self.request.recv(65536)
+        if not got:
+          return
+        data += got
+      head, data = data.split(b'\r\n\r\n', 1)
+      path = head.split(b'\r\n', 1)[0].split(b' ')[1].decode()
+      received = time.time()
+      delay, (content_type, body) = respond(path)
+      delay = received + delay - time.time()
+      if delay > 0:
+        time.sleep(delay)
+      with stats_lock:
+        stats['requests'] += 1
+      self.request.sendall(b'HTTP/1.1 200 OK\r\n'
+                           b'Content-Type: %s\r\n'
+                           b'Content-Length: %d\r\n'
+                           b'\r\n' % (content_type.encode(), len(body)) + body)
+
+  def handle(self):
+    with stats_lock:
+      stats['connections'] += 1
+    try:
+      if tls:
+        if self.request.selected_alpn_protocol() == 'h2':
+          data = b''
+          while len(data) < len(PREFACE):
+            data += self.request.recv(len(PREFACE) - len(data))
+          http2_connection(self.request).run()
+        else:
+          self.http1(b'')
+        return
+      data = b''
+      while len(data) < len(PREFACE) and PREFACE.startswith(data):
+        got = self.request.recv(len(PREFACE) - len(data))
+        if not got:
+          return
+        data += got
+      if data == PREFACE:
+        http2_connection(self.request).run()
+      else:
+        self.http1(data)
+    except OSError:
+      return
+
+def bench(elinks, url, requests, settings):
+  with stats_lock:
+    stats['requests'] = stats['connections'] = stats['streams'] = 0
+  start = time.time()
+  pid, fd = pty.fork()
+  if pid == 0:
+    os.environ['TERM'] = 'vt100'
+    args = [elinks, '-no-home', '-no-connect']
+    for setting in settings:
+      args += ['-eval', 'set ' + setting]
+    os.execv(elinks, args + [url])
+  while True:
+    with stats_lock:
+      if stats['requests'] >= requests:
+        break
+    if time.time() - start > 60:
+      print('timed out')
+      break
+    readable, _, _ = select.select([fd], [], [], 0.01)
+    if readable:
+      try:
+        os.read(fd, 65536)
+      except OSError:
+        break
+  elapsed = time.time() - start
+  os.kill(pid, 9)
+  os.waitpid(pid, 0)
+  os.close(fd)
+  with stats_lock:
+    return elapsed, stats['requests'], stats['connections'], stats['streams']
+
+class server(socketserver.ThreadingTCPServer):
+  allow_reuse_address = True
+  daemon_threads = True
+
+  def get_request(self):
+    sock, address = super().get_request()
+    if tls:
+      sock = self.context.wrap_socket(sock, server_side=True)
+    return sock, address
+
+with server(('127.0.0.1', PORT), handler) as httpd:
+  if tls:
+    httpd.context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    httpd.context.load_cert_chain(CERTFILE)
+    httpd.context.set_alpn_protocols(['h2', 'http/1.1'])
+  if len(sys.argv) >= 3 and sys.argv[1] == '--bench':
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+    n = 64
+    url = '%s://127.0.0.1:%d/?n=%d&rtt=50' % ('https' if tls else 'http', PORT, n)
+    common = ['connection.ssl.cert_verify = 0']
+    for name, settings in (('HTTP/1.1', ['protocol.http.http2 = 0']),
+                           ('HTTP/2', ['protocol.http.http2 = 2'])):
+      elapsed, requests, connections, streams = bench(sys.argv[2], url, n + 1,
+                                                      common + settings)
+      print('%s: %.2fs, %d requests on %d connections, %d streams'
+            % (name, elapsed, requests, connections, streams))
+  else:
+    print("[*] http2 server started at localhost:" + str(PORT))
+    httpd.serve_forever()
@@ -0,0 +1,146 @@
+#!/usr/bin/python3
+#
+# testing server for HTTP/1.1 request pipelining, serving a page with many
+# small stylesheets and answering each request only after a simulated
+# network round trip
+#
+# run it and then for example:
+#
+#   elinks -no-home -eval 'set protocol.http.pipelining = 8' \
+#     'http://127.0.0.1:9456/?n=64&rtt=50'
+#
+# n is the number of stylesheets (default 64) and rtt the round trip time in
+# milliseconds (default 50)
+#
+# with --bench ELINKS it instead opens the page in ELINKS running on a pty
+# (-dump does not load stylesheets) with pipelining disabled and enabled, and
+# prints the time until all the stylesheets were served and how many
+# connections they took
+#
+# with --broken the server answers only the first request of those which
+# arrive together and closes the connection, like some broken servers do
+#
+
+PORT = 9456
+
+import os
+import pty
+import queue
+import select
+import socket
+import socketserver
+import sys
+import threading
+import time
+import urllib.parse
+
+broken = '--broken' in sys.argv
+stats = {'requests': 0, 'connections': 0}
+stats_lock = threading.Lock()
+
+def page(query):
+  n = int(query.get('n', ['64'])[0])
+  rtt = query.get('rtt', ['50'])[0]
+  links = ''.join('<link rel="stylesheet" href="/css/%d.css?rtt=%s">\n' % (i, rtt)
+                  for i in range(n))
+  return ('text/html', ('<html><head><title>pipelining</title>\n%s</head>'
+          '<body><p>%d stylesheets</p></body></html>\n' % (links, n)).encode())
+
+def stylesheet(path):
+  return ('text/css', ('/* %s */\np { margin: 0 }\n' % path).encode())
+
+class handler(socketserver.BaseRequestHandler):
+  def reader(self, requests):
+    data = b''
+    while True:
+      try:
+        got = self.request.recv(65536)
+      except OSError:
+        got = b''
+      if not got:
+        requests.put(None)
+        return
+      now = time.time()
+      data += got
+      batch = 0
+      while b'\r\n\r\n' in data:
+        head, data = data.split(b'\r\n\r\n', 1)
+        path = head.split(b'\r\n', 1)[0].split(b' ')[1].decode()
+        requests.put((now, path, batch))
+        batch += 1
+
+  def handle(self):
+    with stats_lock:
+      stats['connections'] += 1
+    requests = queue.Queue()
+    threading.Thread(target=self.reader, args=(requests,), daemon=True).start()
+    while True:
+      request = requests.get()
+      if request is None:
+        return
+      received, path, batch = request
+      if broken and batch > 0:
+        return
+      url = urllib.parse.urlparse(path)
+      query = urllib.parse.parse_qs(url.query)
+      rtt = int(query.get('rtt', ['50'])[0]) / 1000.0
+      content_type, body = page(query) if url.path == '/' else stylesheet(path)
+
+      # the response leaves a round trip after the request did
+      delay = received + rtt - time.time()
+      if delay > 0:
+        time.sleep(delay)
+
+      with stats_lock:
+        stats['requests'] += 1
+      try:
+        self.request.sendall(b'HTTP/1.1 200 OK\r\n'
+                             b'Content-Type: %s\r\n'
+                             b'Content-Length: %d\r\n'
+                             b'\r\n' % (content_type.encode(), len(body)) + body)
+      except OSError:
+        return
+
+def bench(elinks, url, requests, pipelining):
+  with stats_lock:
+    stats['requests'] = stats['connections'] = 0
+  start = time.time()
+  pid, fd = pty.fork()
+  if pid == 0:
+    os.environ['TERM'] = 'vt100'
+    os.execv(elinks, [elinks, '-no-home', '-no-connect', '-eval',
+                      'set protocol.http.pipelining = %d' % pipelining, url])
+  while True:
+    with stats_lock:
+      if stats['requests'] >= requests:
+        break
+    if time.time() - start > 60:
+      print('timed out')
+      break
+    readable, _, _ = select.select([fd], [], [], 0.01)
+    if readable:
+      try:
+        os.read(fd, 65536)
+      except OSError:
+        break
+  elapsed = time.time() - start
+  os.kill(pid, 9)
+  os.waitpid(pid, 0)
+  os.close(fd)
+  with stats_lock:
+    return elapsed, stats['requests'], stats['connections']
+
+socketserver.TCPServer.allow_reuse_address = True
+with socketserver.ThreadingTCPServer(('127.0.0.1', PORT), handler) as httpd:
+  httpd.daemon_threads = True
+  if len(sys.argv) >= 3 and sys.argv[1] == '--bench':
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+    n = 64
+    url = 'http://127.0.0.1:%d/?n=%d&rtt=50' % (PORT, n)
+    for pipelining in (0, 4, 16):
+      elapsed, requests, connections = bench(sys.argv[2], url, n + 1, pipelining)
+      print('pipelining=%d: %.2fs, %d requests on %d connections'
+            % (pipelining, elapsed, requests, connections))
+  else:
+    print("[*] http server started at localhost:" + str(PORT))
+    httpd.serve_forever()
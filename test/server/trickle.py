@@ -0,0 +1,107 @@
+#!/usr/bin/python3
+#
+# testing server sending a big text document in small pieces, for measuring
+# how much time elinks spends rerendering documents while they are loading
+#
+# run it and then open for example
+#
+#   http://127.0.0.1:9454/?size=8&chunk=4096&delay=5
+#
+# size is in megabytes (default 8), chunk in bytes (default 4096) and delay
+# in milliseconds between chunks (default 5); with html=1 the document is
+# an HTML one
+#
+# with --bench ELINKS it instead loads the documents in ELINKS running on
+# a pseudo terminal, once with document.plain.incremental or
+# document.html.incremental off and once on, and prints the CPU time each
+# run used
+#
+
+PORT = 9454
+
+import fcntl
+import http.server
+import os
+import pty
+import select
+import signal
+import socketserver
+import struct
+import sys
+import termios
+import threading
+import time
+import urllib.parse
+
+sent = threading.Event()
+
+LINE = b'The quick brown fox jumps over the lazy dog; http://elinks.cz/ %08d\n'
+HTML_LINE = b'<p>The quick brown fox jumps over the <a href="http://elinks.cz/">lazy dog</a> %08d</p>\n'
+
+class handler(http.server.BaseHTTPRequestHandler):
+  def do_GET(self):
+    query = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+    size = int(float(query.get('size', ['8'])[0]) * 1024 * 1024)
+    chunk = int(query.get('chunk', ['4096'])[0])
+    delay = int(query.get('delay', ['5'])[0]) / 1000.0
+    html = query.get('html', ['0'])[0] == '1'
+    line = HTML_LINE if html else LINE
+
+    body = b''.join(line % n for n in range(size // len(line % 0) + 1))[:size]
+
+    self.send_response(200)
+    self.send_header('Content-Type', 'text/html' if html else 'text/plain')
+    self.send_header('Content-Length', str(size))
+    self.end_headers()
+    try:
+      for i in range(0, size, chunk):
+        self.wfile.write(body[i:i + chunk])
+        self.wfile.flush()
+        time.sleep(delay)
+    except BrokenPipeError:
+      pass
+    sent.set()
+
+  def log_message(self, format, *args):
+    pass
+
+def bench(elinks, option, incremental, url):
+  sent.clear()
+  pid, fd = pty.fork()
+  if pid == 0:
+    os.environ['TERM'] = 'vt100'
+    os.execv(elinks, [elinks, '-no-home', '-no-connect',
+                      '-eval', 'set %s = %d' % (option, incremental),
+                      url])
+
+  fcntl.ioctl(fd, termios.TIOCSWINSZ, struct.pack('HHHH', 25, 80, 0, 0))
+
+  # let it load the whole document, then quit
+  end = None
+  while not end or time.time() < end:
+    if not end and sent.is_set():
+      end = time.time() + 1
+    r, w, e = select.select([fd], [], [], 0.1)
+    if r:
+      try:
+        os.read(fd, 65536)
+      except OSError:
+        break
+  os.kill(pid, signal.SIGTERM)
+  pid, status, usage = os.wait4(pid, 0)
+  os.close(fd)
+  return usage.ru_utime + usage.ru_stime
+
+socketserver.TCPServer.allow_reuse_address = True
+with socketserver.ThreadingTCPServer(('127.0.0.1', PORT), handler) as httpd:
+  if len(sys.argv) == 3 and sys.argv[1] == '--bench':
+    size, chunk, delay = 8, 4096, 5
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+    for html, option in ((0, 'document.plain.incremental'),
+                         (1, 'document.html.incremental')):
+      url = 'http://127.0.0.1:%d/?size=%d&chunk=%d&delay=%d&html=%d' % (PORT, size, chunk, delay, html)
+      for incremental in (0, 1):
+        print('%s=%d: %.2fs CPU' % (option, incremental, bench(sys.argv[2], option, incremental, url)))
+  else:
+    print("[*] http server started at localhost:" + str(PORT))
+    httpd.serve_forever()